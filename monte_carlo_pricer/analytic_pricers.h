@@ -0,0 +1,203 @@
+#pragma once
+#if !defined(_ANALYTIC_PRICERS_H_)
+#define _ANALYTIC_PRICERS_H_
+
+#include"mc_utilities.h"
+#include<cmath>
+#include<complex>
+#include<vector>
+#include<algorithm>
+#include<limits>
+
+namespace analytic_pricers {
+
+	inline double normalPdf(double x) {
+		return (std::exp(-0.5 * x * x) / std::sqrt(2.0 * PI));
+	}
+
+	inline double normalCdf(double x) {
+		return (0.5 * std::erfc(-x / std::sqrt(2.0)));
+	}
+
+	// Black-Scholes price of european option on underlying with continuous yield
+	inline double blackScholesPrice(double spot, double strike, double maturity,
+		double rate, double dividend, double volatility, bool isCall) {
+		double const dfRate = std::exp(-rate * maturity);
+		double const dfDividend = std::exp(-dividend * maturity);
+		if (maturity <= 0.0 || volatility <= 0.0) {
+			double const forward = spot * dfDividend / dfRate;
+			return dfRate * std::max(0.0, isCall ? (forward - strike) : (strike - forward));
+		}
+		double const stdev = volatility * std::sqrt(maturity);
+		double const d1 = (std::log(spot / strike) + (rate - dividend + 0.5 * volatility * volatility) * maturity) / stdev;
+		double const d2 = d1 - stdev;
+		if (isCall)
+			return (spot * dfDividend * normalCdf(d1) - strike * dfRate * normalCdf(d2));
+		return (strike * dfRate * normalCdf(-d2) - spot * dfDividend * normalCdf(-d1));
+	}
+
+	// Continuously monitored down-and-out call, barrier <= strike (Reiner-Rubinstein)
+	inline double downAndOutCallPrice(double spot, double strike, double barrier, double maturity,
+		double rate, double dividend, double volatility) {
+		if (spot <= barrier)
+			return 0.0;
+		double const stdev = volatility * std::sqrt(maturity);
+		double const lambda = (rate - dividend + 0.5 * volatility * volatility) / (volatility * volatility);
+		double const y = std::log(barrier * barrier / (spot * strike)) / stdev + lambda * stdev;
+		double const ratio = barrier / spot;
+		double const downAndIn = spot * std::exp(-dividend * maturity) * std::pow(ratio, 2.0 * lambda) * normalCdf(y) -
+			strike * std::exp(-rate * maturity) * std::pow(ratio, 2.0 * lambda - 2.0) * normalCdf(y - stdev);
+		return (blackScholesPrice(spot, strike, maturity, rate, dividend, volatility, true) - downAndIn);
+	}
+
+	inline double blackScholesVega(double spot, double strike, double maturity,
+		double rate, double dividend, double volatility) {
+		double const stdev = volatility * std::sqrt(maturity);
+		double const d1 = (std::log(spot / strike) + (rate - dividend + 0.5 * volatility * volatility) * maturity) / stdev;
+		return (spot * std::exp(-dividend * maturity) * normalPdf(d1) * std::sqrt(maturity));
+	}
+
+	// Black-Scholes implied volatility (safeguarded Newton), returns NaN if price
+	// lies outside of no-arbitrage bounds
+	inline double impliedVolatility(double price, double spot, double strike, double maturity,
+		double rate, double dividend, bool isCall,
+		double tolerance = 1.0e-10, std::size_t maxIterations = 100) {
+		double const lower = blackScholesPrice(spot, strike, maturity, rate, dividend, 0.0, isCall);
+		double const upper = isCall ? spot * std::exp(-dividend * maturity) : strike * std::exp(-rate * maturity);
+		if (price < lower || price >= upper || maturity <= 0.0)
+			return std::numeric_limits<double>::quiet_NaN();
+		double low{ 1.0e-8 };
+		double high{ 10.0 };
+		double vol{ 0.2 };
+		for (std::size_t i = 0; i < maxIterations; ++i) {
+			double const diff = blackScholesPrice(spot, strike, maturity, rate, dividend, vol, isCall) - price;
+			if (std::abs(diff) < tolerance)
+				break;
+			if (diff > 0.0)
+				high = vol;
+			else
+				low = vol;
+			double const vega = blackScholesVega(spot, strike, maturity, rate, dividend, vol);
+			double next = vol - diff / vega;
+			if (!(vega > 0.0) || next <= low || next >= high)
+				next = 0.5 * (low + high);
+			vol = next;
+		}
+		return vol;
+	}
+
+	// Bachelier price for arithmetic brownian motion dS = mu dt + sigma dW
+	inline double bachelierPrice(double spot, double strike, double maturity,
+		double rate, double mu, double sigma, bool isCall) {
+		double const df = std::exp(-rate * maturity);
+		double const forward = spot + mu * maturity;
+		double const stdev = sigma * std::sqrt(maturity);
+		if (stdev <= 0.0)
+			return df * std::max(0.0, isCall ? (forward - strike) : (strike - forward));
+		double const d = (forward - strike) / stdev;
+		if (isCall)
+			return df * ((forward - strike) * normalCdf(d) + stdev * normalPdf(d));
+		return df * ((strike - forward) * normalCdf(-d) + stdev * normalPdf(d));
+	}
+
+
+	// Gauss-Legendre nodes and weights on [-1,1]
+	class GaussLegendre {
+	private:
+		std::vector<double> nodes_;
+		std::vector<double> weights_;
+
+	public:
+		explicit GaussLegendre(std::size_t order) :nodes_(order), weights_(order) {
+			for (std::size_t i = 0; i < order; ++i) {
+				double x = std::cos(PI * (i + 0.75) / (order + 0.5));
+				double dp{};
+				for (std::size_t it = 0; it < 100; ++it) {
+					double p0{ 1.0 };
+					double p1{ x };
+					for (std::size_t k = 2; k <= order; ++k) {
+						double const p2 = ((2.0 * k - 1.0) * x * p1 - (k - 1.0) * p0) / static_cast<double>(k);
+						p0 = p1;
+						p1 = p2;
+					}
+					dp = order * (x * p1 - p0) / (x * x - 1.0);
+					double const dx = p1 / dp;
+					x -= dx;
+					if (std::abs(dx) < 1.0e-15)
+						break;
+				}
+				nodes_[i] = x;
+				weights_[i] = 2.0 / ((1.0 - x * x) * dp * dp);
+			}
+		}
+
+		inline std::vector<double> const &nodes()const { return nodes_; }
+		inline std::vector<double> const &weights()const { return weights_; }
+	};
+
+
+	// Semi-analytic Heston price in the standard parametrisation
+	// dS = (r-q) S dt + sqrt(v) S dW1, dv = kappa (theta - v) dt + eta sqrt(v) dW2
+	// using the "little Heston trap" form of the characteristic function.
+	class HestonPricer {
+	private:
+		double upperLimit_;
+		std::size_t panels_;
+		GaussLegendre quadrature_;
+
+		static std::complex<double> logCharacteristic(std::complex<double> u, double logSpot, double maturity,
+			double rate, double dividend, double v0, double kappa, double theta, double eta, double rho) {
+			std::complex<double> const i{ 0.0,1.0 };
+			std::complex<double> const beta = kappa - rho * eta * i * u;
+			std::complex<double> const d = std::sqrt(beta * beta + eta * eta * (i * u + u * u));
+			std::complex<double> const g = (beta - d) / (beta + d);
+			std::complex<double> const edt = std::exp(-d * maturity);
+			std::complex<double> const C = (rate - dividend) * i * u * maturity +
+				(kappa * theta / (eta * eta)) * ((beta - d) * maturity - 2.0 * std::log((1.0 - g * edt) / (1.0 - g)));
+			std::complex<double> const D = ((beta - d) / (eta * eta)) * ((1.0 - edt) / (1.0 - g * edt));
+			return (C + D * v0 + i * u * logSpot);
+		}
+
+	public:
+		explicit HestonPricer(double upperLimit = 200.0, std::size_t panels = 8, std::size_t order = 32)
+			:upperLimit_{ upperLimit }, panels_{ panels }, quadrature_{ order } {}
+
+		double price(double spot, double strike, double maturity, double rate, double dividend,
+			double v0, double kappa, double theta, double eta, double rho, bool isCall)const {
+			std::complex<double> const i{ 0.0,1.0 };
+			double const logSpot = std::log(spot);
+			double const logStrike = std::log(strike);
+			// log of E[S_T] = phi(-i):
+			double const logForward = logSpot + (rate - dividend) * maturity;
+			double p1{};
+			double p2{};
+			double const width = upperLimit_ / static_cast<double>(panels_);
+			for (std::size_t p = 0; p < panels_; ++p) {
+				double const a = p * width;
+				for (std::size_t k = 0; k < quadrature_.nodes().size(); ++k) {
+					double const u = a + 0.5 * width * (quadrature_.nodes()[k] + 1.0);
+					double const w = 0.5 * width * quadrature_.weights()[k];
+					std::complex<double> const phase = std::exp(-i * u * logStrike) / (i * u);
+					std::complex<double> const phi2 = std::exp(logCharacteristic(u, logSpot, maturity,
+						rate, dividend, v0, kappa, theta, eta, rho));
+					std::complex<double> const phi1 = std::exp(logCharacteristic(u - i, logSpot, maturity,
+						rate, dividend, v0, kappa, theta, eta, rho) - logForward);
+					p1 += w * std::real(phase * phi1);
+					p2 += w * std::real(phase * phi2);
+				}
+			}
+			p1 = 0.5 + p1 / PI;
+			p2 = 0.5 + p2 / PI;
+			double const call = spot * std::exp(-dividend * maturity) * p1 - strike * std::exp(-rate * maturity) * p2;
+			if (isCall)
+				return std::max(0.0, call);
+			// put-call parity:
+			return std::max(0.0, call - spot * std::exp(-dividend * maturity) + strike * std::exp(-rate * maturity));
+		}
+	};
+
+}
+
+
+
+#endif ///_ANALYTIC_PRICERS_H_
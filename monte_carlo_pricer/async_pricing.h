@@ -0,0 +1,246 @@
+#pragma once
+#if !defined(_ASYNC_PRICING_H_)
+#define _ASYNC_PRICING_H_
+
+#include"mc_types.h"
+#include"payoff_strategy.h"
+#include"path_buffer.h"
+#include"mixed_precision.h"
+#include"fdm.h"
+#include"reduction.h"
+#include<functional>
+#include<memory>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<atomic>
+#include<chrono>
+#include<exception>
+#include<algorithm>
+#include<cmath>
+#include<type_traits>
+
+namespace async_pricing {
+
+	using mc_types::FDMScheme;
+	using payoff::PayoffStrategy;
+	using path_buffer::PathSpan;
+	using path_buffer::PathArena;
+	using mixed_precision::CompensatedMoments;
+	using reduction::StreamingTree;
+	using finite_difference_method::Fdm;
+
+	enum class RunStatus {
+		Running,
+		Completed,	// all paths priced
+		Converged,	// stopped early at the target standard error
+		Cancelled,
+		Failed,
+	};
+
+	// Snapshot of a run, estimate and standard error are discounted
+	struct PricingProgress {
+		std::size_t pathsDone{ 0 };
+		std::size_t pathCount{ 0 };
+		double estimate{ 0.0 };
+		double standardError{ 0.0 };
+		double elapsedSeconds{ 0.0 };
+		RunStatus status{ RunStatus::Running };
+
+		inline double fraction()const {
+			return (pathCount == 0 ? 1.0 : static_cast<double>(pathsDone) / static_cast<double>(pathCount));
+		}
+		inline bool isDone()const { return (status != RunStatus::Running); }
+	};
+
+	struct AsyncOptions {
+		std::size_t blockSize{ 4096 };		// paths between progress updates and cancellation checks
+		double discountFactor{ 1.0 };
+		double targetError{ 0.0 };			// stop once the standard error is at most this (0: price all paths)
+		std::size_t minimumPaths{ 1000 };	// paths before targetError is looked at
+		FDMScheme scheme{ FDMScheme::EulerScheme };
+		std::function<void(PricingProgress const &)> onProgress;	// after every block, on the run's thread
+		std::function<void(PricingProgress const &)> onComplete;	// once at the end, on the run's thread, before wait() returns
+	};
+
+
+	namespace detail {
+
+		struct RunState {
+			std::mutex mutex;
+			std::condition_variable finished;
+			PricingProgress progress;
+			std::exception_ptr error;
+			std::atomic<bool> cancelled{ false };
+		};
+
+		// Owns the run's thread: the last handle to go cancels and joins it
+		struct RunControl {
+			std::shared_ptr<RunState> state;
+			std::thread worker;
+
+			~RunControl() {
+				state->cancelled = true;
+				if (!worker.joinable())
+					return;
+				if (worker.get_id() == std::this_thread::get_id())
+					worker.detach();	// last handle dropped inside a callback
+				else
+					worker.join();
+			}
+		};
+	}
+
+
+	// Handle of a run started by submit(), copies refer to the same run.
+	// Destroying the last copy cancels the run and waits for it.
+	class PricingHandle {
+	private:
+		std::shared_ptr<detail::RunControl> control_;
+
+	public:
+		PricingHandle() = default;
+		explicit PricingHandle(std::shared_ptr<detail::RunControl> const &control) :control_{ control } {}
+
+		inline bool valid()const { return (control_ != nullptr); }
+
+		PricingProgress progress()const {
+			std::lock_guard<std::mutex> lock(control_->state->mutex);
+			return control_->state->progress;
+		}
+
+		inline bool isDone()const { return progress().isDone(); }
+
+		// Workers stop after the block in hand, the estimate so far is kept
+		inline void cancel() { control_->state->cancelled = true; }
+
+		void wait()const {
+			auto &state = *(control_->state);
+			std::unique_lock<std::mutex> lock(state.mutex);
+			state.finished.wait(lock, [&state]() {return state.progress.isDone(); });
+		}
+
+		template<typename Rep, typename Period>
+		bool waitFor(std::chrono::duration<Rep, Period> const &timeout)const {
+			auto &state = *(control_->state);
+			std::unique_lock<std::mutex> lock(state.mutex);
+			return state.finished.wait_for(lock, timeout, [&state]() {return state.progress.isDone(); });
+		}
+
+		// Waits for the run, rethrows the exception of a failed run
+		PricingProgress result()const {
+			wait();
+			std::lock_guard<std::mutex> lock(control_->state->mutex);
+			if (control_->state->error)
+				std::rethrow_exception(control_->state->error);
+			return control_->state->progress;
+		}
+	};
+
+
+	// Starts pricing pathCount paths of fdm on a thread of its own and returns at
+	// once. Paths are simulated block by block into an arena (in parallel on the
+	// engine's thread pool if it has one) and payoff(path) is accumulated in
+	// double with compensated sums, reduced by the tree of reduction.h over
+	// fixed blocks. A seeded engine gives the same paths as a blocking run, so a
+	// run cut off at n paths gives the bits of a reduction of n paths.
+	// fdm and payoff must outlive the run and fdm must not be used meanwhile.
+	template<std::size_t FactorCount, typename T, typename Payoff,
+		typename = typename std::enable_if<!std::is_base_of<PayoffStrategy<T>, Payoff>::value>::type>
+	PricingHandle submit(Fdm<FactorCount, T> &fdm, std::size_t pathCount, Payoff payoff,
+		AsyncOptions options = AsyncOptions{}) {
+		options.blockSize = std::max<std::size_t>(1, options.blockSize);
+		auto control = std::make_shared<detail::RunControl>();
+		control->state = std::make_shared<detail::RunState>();
+		control->state->progress.pathCount = pathCount;
+		auto const state = control->state;
+
+		control->worker = std::thread([state, &fdm, pathCount, payoff, options]() {
+			auto const start = std::chrono::steady_clock::now();
+			std::size_t const firstPath = fdm.firstPath();
+			PathArena<T> arena;
+			// full reduction blocks go into the tree, the open one is added on reading
+			StreamingTree<CompensatedMoments, decltype(&mixed_precision::mergeMoments)> tree{ mixed_precision::mergeMoments };
+			CompensatedMoments open;
+			RunStatus status = RunStatus::Completed;
+			PricingProgress snapshot;
+			try {
+				std::size_t done{ 0 };
+				while (done < pathCount) {
+					if (state->cancelled) {
+						status = RunStatus::Cancelled;
+						break;
+					}
+					std::size_t const size = std::min(options.blockSize, pathCount - done);
+					fdm.setFirstPath(firstPath + done);
+					fdm.simulateInto(arena, size, options.scheme);
+					for (std::size_t i = 0; i < size; ++i) {
+						open.add(static_cast<double>(payoff(arena.path(i))));
+						if (open.count == reduction::reductionBlockSize) {
+							tree.add(open);
+							open = CompensatedMoments{};
+						}
+					}
+					done += size;
+
+					auto const block = (open.count == 0 ? tree.value() : tree.valueWith(open)).moments();
+					{
+						std::lock_guard<std::mutex> lock(state->mutex);
+						state->progress.pathsDone = done;
+						state->progress.estimate = options.discountFactor * block.mean();
+						state->progress.standardError = (done > 1 ? options.discountFactor * block.standardError() : 0.0);
+						state->progress.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+						snapshot = state->progress;
+					}
+					if (options.onProgress)
+						options.onProgress(snapshot);
+					if (options.targetError > 0.0 && done >= options.minimumPaths && done < pathCount &&
+						snapshot.standardError <= options.targetError) {
+						status = RunStatus::Converged;
+						break;
+					}
+				}
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->error = std::current_exception();
+				status = RunStatus::Failed;
+			}
+			fdm.setFirstPath(firstPath);
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				snapshot = state->progress;
+			}
+			snapshot.status = status;
+			snapshot.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			// the run counts as done only after the callback, so that wait() and
+			// result() imply it has run (and must not be called from it)
+			if (options.onComplete) {
+				try {
+					options.onComplete(snapshot);
+				}
+				catch (...) {}
+			}
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->progress = snapshot;
+			}
+			state->finished.notify_all();
+		});
+		return PricingHandle{ control };
+	}
+
+	// Terminal payoff strategy, the strategy must outlive the run
+	template<std::size_t FactorCount, typename T>
+	PricingHandle submit(Fdm<FactorCount, T> &fdm, std::size_t pathCount, PayoffStrategy<T> const &strategy,
+		AsyncOptions options = AsyncOptions{}) {
+		PayoffStrategy<T> const *payoff = &strategy;
+		return submit(fdm, pathCount, [payoff](PathSpan<T> const &path) {
+			return payoff->payoff(path.back()); }, std::move(options));
+	}
+
+}
+
+
+
+#endif ///_ASYNC_PRICING_H_
@@ -0,0 +1,110 @@
+#pragma once
+#if !defined(_BARRIER_STRATEGY_H_)
+#define _BARRIER_STRATEGY_H_
+
+#include"mc_types.h"
+#include"payoff_strategy.h"
+#include"sde.h"
+#include<memory>
+#include<cmath>
+#include<stdexcept>
+
+namespace payoff {
+
+	using mc_types::TimePointsType;
+	using mc_types::BarrierType;
+	using mc_types::BridgeCorrection;
+	using sde::Sde;
+
+
+	// Knock-in/knock-out barrier on a vanilla payoff of the terminal value.
+	// Between consecutive grid points the path is bridged with diffusion frozen
+	// at the left point and the path is weighted by its survival probability
+	// prod(1 - p_i), where
+	// Arithmetic: p_i = exp(-2 (B - x0)(B - x1) / (b^2 dt))
+	// Logarithmic: p_i = exp(-2 ln(B/x0) ln(B/x1) / ((b/x0)^2 dt))
+	// b = diffusion(t0,x0) of the model. Paths from EulerScheme and MilsteinScheme
+	// are treated alike, path[i] is taken at timePoints[i].
+	template<typename T = double>
+	class BarrierStrategy :public PayoffStrategy<PathValuesType<T>> {
+	private:
+		std::shared_ptr<PayoffStrategy<T>> vanilla_;
+		T barrier_;
+		BarrierType type_;
+		std::shared_ptr<Sde<T, T, T>> model_;
+		TimePointsType<T> timePoints_;
+		BridgeCorrection correction_;
+
+		inline bool isUp()const {
+			return (type_ == BarrierType::UpAndOut || type_ == BarrierType::UpAndIn);
+		}
+
+		inline bool isOut()const {
+			return (type_ == BarrierType::UpAndOut || type_ == BarrierType::DownAndOut);
+		}
+
+		inline bool isBreached(T value)const {
+			return (isUp() ? (value >= barrier_) : (value <= barrier_));
+		}
+
+		double crossingProbability(std::size_t i, T x0, T x1)const {
+			T const dt = timePoints_[i] - timePoints_[i - 1];
+			T const b = model_->diffusion(timePoints_[i - 1], x0);
+			T variance = b * b * dt;
+			T distance{};
+			if (correction_ == BridgeCorrection::Logarithmic) {
+				variance /= (x0 * x0);
+				distance = std::log(barrier_ / x0) * std::log(barrier_ / x1);
+			}
+			else {
+				distance = (barrier_ - x0) * (barrier_ - x1);
+			}
+			if (variance <= static_cast<T>(0.0))
+				return 0.0;
+			return static_cast<double>(std::exp(static_cast<T>(-2.0) * distance / variance));
+		}
+
+	public:
+		BarrierStrategy(std::shared_ptr<PayoffStrategy<T>> const &vanilla, T barrier, BarrierType type,
+			std::shared_ptr<Sde<T, T, T>> const &model, TimePointsType<T> const &timePoints,
+			BridgeCorrection correction = BridgeCorrection::Logarithmic)
+			:vanilla_{ vanilla }, barrier_{ barrier }, type_{ type }, model_{ model },
+			timePoints_{ timePoints }, correction_{ correction } {
+			if (correction_ != BridgeCorrection::None && !model_)
+				throw std::invalid_argument("Bridge correction needs the model diffusion.");
+		}
+
+		inline T barrier()const { return barrier_; }
+		inline BarrierType type()const { return type_; }
+		inline BridgeCorrection correction()const { return correction_; }
+
+		// Probability that the path did not touch the barrier
+		double survivalProbability(PathValuesType<T> const &path)const {
+			if (path.size() > timePoints_.size())
+				throw std::out_of_range("Path is longer than the time points of the barrier.");
+			if (path.empty() || isBreached(path.front()))
+				return 0.0;
+			double survival{ 1.0 };
+			for (std::size_t i = 1; i < path.size(); ++i) {
+				if (isBreached(path[i]))
+					return 0.0;
+				if (correction_ != BridgeCorrection::None)
+					survival *= (1.0 - crossingProbability(i, path[i - 1], path[i]));
+			}
+			return survival;
+		}
+
+		double payoff(PathValuesType<T> const &underlying)const override {
+			double const vanilla = vanilla_->payoff(underlying.back());
+			if (vanilla == 0.0)
+				return 0.0;
+			double const survival = survivalProbability(underlying);
+			return (isOut() ? survival : (1.0 - survival)) * vanilla;
+		}
+	};
+
+}
+
+
+
+#endif ///_BARRIER_STRATEGY_H_
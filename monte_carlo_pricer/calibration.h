@@ -0,0 +1,495 @@
+#pragma once
+#if !defined(_CALIBRATION_H_)
+#define _CALIBRATION_H_
+
+#include"mc_types.h"
+#include"mc_utilities.h"
+#include"analytic_pricers.h"
+#include"sde_builder.h"
+#include"fdm.h"
+#include"pipeline.h"
+#include"reduction.h"
+#include<map>
+#include<chrono>
+#include<future>
+#include<thread>
+#include<numeric>
+#include<stdexcept>
+
+namespace calibration {
+
+	using mc_types::CalibrationObjective;
+	using mc_types::FDMScheme;
+	using mc_types::TimePointsType;
+	using sde_builder::HestonModel;
+	using sde_builder::GeometricBrownianMotion;
+	using sde_builder::ArithmeticBrownianMotion;
+	using sde_builder::ConstantElasticityVariance;
+	using finite_difference_method::Fdm;
+	using thread_pool::ThreadPool;
+	using path_buffer::PathArena;
+	using analytic_pricers::blackScholesPrice;
+	using analytic_pricers::blackScholesVega;
+	using analytic_pricers::impliedVolatility;
+	using analytic_pricers::bachelierPrice;
+	using analytic_pricers::HestonPricer;
+
+	// Market quote of european vanilla option. Holds price or Black-Scholes
+	// implied volatility depending on the objective of the calibrator.
+	struct VanillaQuote {
+		double strike;
+		double maturity;
+		double value;
+		bool isCall;
+		double weight;
+	};
+
+	struct MarketData {
+		double spot;
+		double rate;
+		double dividend;
+	};
+
+	struct LevenbergMarquardtSettings {
+		std::size_t maxIterations{ 100 };
+		double tolerance{ 1.0e-10 };
+		double initialDamping{ 1.0e-3 };
+		double relativeBump{ 1.0e-5 };
+	};
+
+	struct CalibrationResult {
+		std::vector<double> parameters;
+		std::vector<double> residuals;
+		std::size_t iterations;
+		std::size_t objectiveEvaluations;
+		double wallTime;	// in seconds
+		double rootMeanSquaredError;
+		bool converged;
+	};
+
+
+	// Levenberg-Marquardt calibration of model Builder to vanilla quotes.
+	// Derived calibrators map the parameter vector to the model and price
+	// the quotes; model prices are evaluated in parallel over maturities
+	// and (for pricers that do not share a simulation) over quotes.
+	template<typename Builder>
+	class Calibrator {
+	protected:
+		MarketData market_;
+		std::vector<VanillaQuote> quotes_;
+		CalibrationObjective objective_;
+		LevenbergMarquardtSettings settings_;
+		std::vector<double> lower_;
+		std::vector<double> upper_;
+		std::vector<double> marketPrices_;
+		std::vector<double> marketVegas_;
+		std::map<double, std::vector<std::size_t>> maturities_;
+
+		virtual Builder model(std::vector<double> const &parameters)const = 0;
+
+		// model prices of quotes[indices], all having the given maturity
+		virtual std::vector<double> prices(Builder const &model, double maturity,
+			std::vector<std::size_t> const &indices)const = 0;
+
+		// true if all quotes of one maturity must be priced together
+		// (e.g. from one Monte Carlo simulation)
+		virtual bool pricesByMaturity()const { return false; }
+
+		std::vector<double> clamp(std::vector<double> parameters)const {
+			for (std::size_t j = 0; j < parameters.size(); ++j)
+				parameters[j] = std::min(upper_[j], std::max(lower_[j], parameters[j]));
+			return parameters;
+		}
+
+		std::vector<std::vector<std::size_t>> tasks()const {
+			std::vector<std::vector<std::size_t>> tasks;
+			std::size_t const workers = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+			std::size_t const chunk = std::max<std::size_t>(1, (quotes_.size() + workers - 1) / workers);
+			for (auto const &maturity : maturities_) {
+				if (pricesByMaturity()) {
+					tasks.emplace_back(maturity.second);
+					continue;
+				}
+				for (std::size_t first = 0; first < maturity.second.size(); first += chunk) {
+					auto last = std::min(first + chunk, maturity.second.size());
+					tasks.emplace_back(maturity.second.begin() + first, maturity.second.begin() + last);
+				}
+			}
+			return tasks;
+		}
+
+		std::vector<double> residuals(std::vector<double> const &parameters)const {
+			auto const builder = model(parameters);
+			auto const work = tasks();
+			std::vector<std::future<std::vector<double>>> futures;
+			futures.reserve(work.size());
+			for (auto const &indices : work) {
+				double const maturity = quotes_[indices.front()].maturity;
+				futures.emplace_back(std::async(std::launch::async, [this, &builder, maturity, &indices]() {
+					return prices(builder, maturity, indices);
+				}));
+			}
+			std::vector<double> result(quotes_.size());
+			for (std::size_t t = 0; t < work.size(); ++t) {
+				auto const modelPrices = futures[t].get();
+				for (std::size_t k = 0; k < work[t].size(); ++k) {
+					auto const q = work[t][k];
+					result[q] = quotes_[q].weight * error(q, modelPrices[k]);
+				}
+			}
+			return result;
+		}
+
+		double error(std::size_t q, double modelPrice)const {
+			if (objective_ == CalibrationObjective::Price)
+				return (modelPrice - marketPrices_[q]);
+			auto const &quote = quotes_[q];
+			double const vol = impliedVolatility(modelPrice, market_.spot, quote.strike, quote.maturity,
+				market_.rate, market_.dividend, quote.isCall);
+			if (std::isfinite(vol))
+				return (vol - quote.value);
+			// model price outside of no-arbitrage bounds: first order vol error
+			return (modelPrice - marketPrices_[q]) / std::max(marketVegas_[q], 1.0e-8);
+		}
+
+		static double squaredNorm(std::vector<double> const &v) {
+			return std::inner_product(v.begin(), v.end(), v.begin(), 0.0);
+		}
+
+	public:
+		Calibrator(MarketData const &market, std::vector<VanillaQuote> const &quotes,
+			std::vector<double> const &lower, std::vector<double> const &upper,
+			CalibrationObjective objective = CalibrationObjective::Price)
+			:market_{ market }, quotes_{ quotes }, objective_{ objective }, lower_{ lower }, upper_{ upper },
+			marketPrices_(quotes.size()), marketVegas_(quotes.size()) {
+			if (quotes_.empty())
+				throw std::invalid_argument("Calibration needs at least one quote.");
+			assert(lower_.size() == upper_.size());
+			for (std::size_t q = 0; q < quotes_.size(); ++q) {
+				auto const &quote = quotes_[q];
+				maturities_[quote.maturity].emplace_back(q);
+				if (objective_ == CalibrationObjective::Price) {
+					marketPrices_[q] = quote.value;
+				}
+				else {
+					marketPrices_[q] = blackScholesPrice(market_.spot, quote.strike, quote.maturity,
+						market_.rate, market_.dividend, quote.value, quote.isCall);
+					marketVegas_[q] = blackScholesVega(market_.spot, quote.strike, quote.maturity,
+						market_.rate, market_.dividend, quote.value);
+				}
+			}
+		}
+
+		virtual ~Calibrator() {}
+
+		inline void setSettings(LevenbergMarquardtSettings const &settings) { settings_ = settings; }
+		inline LevenbergMarquardtSettings const &settings()const { return settings_; }
+		inline void setBounds(std::vector<double> const &lower, std::vector<double> const &upper) {
+			lower_ = lower;
+			upper_ = upper;
+		}
+
+		CalibrationResult calibrate(std::vector<double> const &initialParameters)const {
+			assert(initialParameters.size() == lower_.size());
+			auto const start = std::chrono::steady_clock::now();
+			std::size_t const n = initialParameters.size();
+			std::size_t const m = quotes_.size();
+
+			CalibrationResult result{};
+			auto x = clamp(initialParameters);
+			auto r = residuals(x);
+			double cost = squaredNorm(r);
+			result.objectiveEvaluations = 1;
+			double damping = settings_.initialDamping;
+
+			std::vector<double> jacobian(m * n);
+			std::vector<double> A(n * n);
+			std::vector<double> g(n);
+			std::vector<double> dx;
+			for (result.iterations = 0; result.iterations < settings_.maxIterations; ++result.iterations) {
+				// forward difference jacobian, bumped inwards at the upper bound:
+				for (std::size_t j = 0; j < n; ++j) {
+					auto bumped = x;
+					double h = settings_.relativeBump * std::max(std::abs(x[j]), 1.0e-2);
+					if (bumped[j] + h > upper_[j])
+						h = -h;
+					bumped[j] += h;
+					auto const rb = residuals(bumped);
+					++result.objectiveEvaluations;
+					for (std::size_t i = 0; i < m; ++i)
+						jacobian[i*n + j] = (rb[i] - r[i]) / h;
+				}
+				for (std::size_t a = 0; a < n; ++a) {
+					g[a] = 0.0;
+					for (std::size_t i = 0; i < m; ++i)
+						g[a] += jacobian[i*n + a] * r[i];
+					for (std::size_t b = 0; b < n; ++b) {
+						A[a*n + b] = 0.0;
+						for (std::size_t i = 0; i < m; ++i)
+							A[a*n + b] += jacobian[i*n + a] * jacobian[i*n + b];
+					}
+				}
+
+				bool improved{ false };
+				bool converged{ false };
+				while (damping < 1.0e12) {
+					auto M = A;
+					std::vector<double> rhs(n);
+					for (std::size_t a = 0; a < n; ++a) {
+						M[a*n + a] += damping * std::max(A[a*n + a], 1.0e-12);
+						rhs[a] = -g[a];
+					}
+					if (!mc_utilities::solveLinearSystem(M, rhs, dx)) {
+						damping *= 10.0;
+						continue;
+					}
+					std::vector<double> trial(n);
+					for (std::size_t a = 0; a < n; ++a)
+						trial[a] = x[a] + dx[a];
+					trial = clamp(trial);
+					auto const rt = residuals(trial);
+					++result.objectiveEvaluations;
+					double const trialCost = squaredNorm(rt);
+					if (trialCost < cost) {
+						double step{ 0.0 };
+						for (std::size_t a = 0; a < n; ++a)
+							step = std::max(step, std::abs(trial[a] - x[a]) / std::max(std::abs(x[a]), 1.0e-8));
+						converged = ((cost - trialCost) <= settings_.tolerance * cost) ||
+							(step <= settings_.tolerance);
+						x = trial;
+						r = rt;
+						cost = trialCost;
+						damping = std::max(damping / 10.0, 1.0e-12);
+						improved = true;
+						break;
+					}
+					damping *= 10.0;
+				}
+				if (!improved || converged) {
+					result.converged = true;
+					++result.iterations;
+					break;
+				}
+			}
+
+			result.parameters = x;
+			result.residuals = r;
+			result.rootMeanSquaredError = std::sqrt(cost / static_cast<double>(m));
+			result.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			return result;
+		}
+
+		Builder calibratedModel(CalibrationResult const &result)const {
+			return model(result.parameters);
+		}
+	};
+
+
+	// Calibrates (init2,kappa,theta,etha,rho) of HestonModel with the
+	// semi-analytic pricer. mu = rate - dividend and sigma stays as given.
+	template<typename T = double>
+	class HestonCalibrator :public Calibrator<HestonModel<T>> {
+	private:
+		T sigma_;
+		HestonPricer pricer_;
+
+	protected:
+		HestonModel<T> model(std::vector<double> const &parameters)const override {
+			return HestonModel<T>{ static_cast<T>(this->market_.rate - this->market_.dividend), sigma_,
+				static_cast<T>(parameters[1]), static_cast<T>(parameters[2]), static_cast<T>(parameters[3]),
+				static_cast<T>(this->market_.spot), static_cast<T>(parameters[0]), static_cast<T>(parameters[4]) };
+		}
+
+		std::vector<double> prices(HestonModel<T> const &model, double maturity,
+			std::vector<std::size_t> const &indices)const override {
+			// sigma*sqrt(v) is the volatility of the underlying, hence the
+			// standard parametrisation has variance sigma^2*v:
+			double const scale = static_cast<double>(model.sigma()) * static_cast<double>(model.sigma());
+			std::vector<double> result;
+			result.reserve(indices.size());
+			for (auto const q : indices) {
+				auto const &quote = this->quotes_[q];
+				result.emplace_back(pricer_.price(this->market_.spot, quote.strike, maturity,
+					this->market_.rate, this->market_.dividend,
+					scale * model.init2(), model.kappa(), scale * model.theta(),
+					static_cast<double>(model.sigma()) * model.etha(), model.rho(), quote.isCall));
+			}
+			return result;
+		}
+
+	public:
+		HestonCalibrator(MarketData const &market, std::vector<VanillaQuote> const &quotes,
+			CalibrationObjective objective = CalibrationObjective::Price, T sigma = 1.0)
+			:Calibrator<HestonModel<T>>{ market,quotes,
+			{ 1.0e-6, 1.0e-4, 1.0e-6, 1.0e-4, -0.999 },
+			{ 4.0, 20.0, 4.0, 5.0, 0.999 },objective },
+			sigma_{ sigma } {}
+
+		CalibrationResult calibrate(HestonModel<T> const &initial)const {
+			return Calibrator<HestonModel<T>>::calibrate({ static_cast<double>(initial.init2()),
+				static_cast<double>(initial.kappa()), static_cast<double>(initial.theta()),
+				static_cast<double>(initial.etha()), static_cast<double>(initial.rho()) });
+		}
+	};
+
+
+	// Calibrates sigma of GeometricBrownianMotion (Black-Scholes pricer)
+	template<typename T = double>
+	class GeometricBrownianMotionCalibrator :public Calibrator<GeometricBrownianMotion<T>> {
+	protected:
+		GeometricBrownianMotion<T> model(std::vector<double> const &parameters)const override {
+			return GeometricBrownianMotion<T>{ static_cast<T>(this->market_.rate - this->market_.dividend),
+				static_cast<T>(parameters[0]), static_cast<T>(this->market_.spot) };
+		}
+
+		std::vector<double> prices(GeometricBrownianMotion<T> const &model, double maturity,
+			std::vector<std::size_t> const &indices)const override {
+			std::vector<double> result;
+			result.reserve(indices.size());
+			for (auto const q : indices) {
+				auto const &quote = this->quotes_[q];
+				result.emplace_back(blackScholesPrice(this->market_.spot, quote.strike, maturity,
+					this->market_.rate, this->market_.dividend, model.sigma(), quote.isCall));
+			}
+			return result;
+		}
+
+	public:
+		GeometricBrownianMotionCalibrator(MarketData const &market, std::vector<VanillaQuote> const &quotes,
+			CalibrationObjective objective = CalibrationObjective::Price)
+			:Calibrator<GeometricBrownianMotion<T>>{ market,quotes,{ 1.0e-6 },{ 5.0 },objective } {}
+
+		CalibrationResult calibrate(GeometricBrownianMotion<T> const &initial)const {
+			return Calibrator<GeometricBrownianMotion<T>>::calibrate({ static_cast<double>(initial.sigma()) });
+		}
+	};
+
+
+	// Calibrates sigma of ArithmeticBrownianMotion (Bachelier pricer), mu stays as given
+	template<typename T = double>
+	class ArithmeticBrownianMotionCalibrator :public Calibrator<ArithmeticBrownianMotion<T>> {
+	private:
+		T mu_;
+
+	protected:
+		ArithmeticBrownianMotion<T> model(std::vector<double> const &parameters)const override {
+			return ArithmeticBrownianMotion<T>{ mu_, static_cast<T>(parameters[0]), static_cast<T>(this->market_.spot) };
+		}
+
+		std::vector<double> prices(ArithmeticBrownianMotion<T> const &model, double maturity,
+			std::vector<std::size_t> const &indices)const override {
+			std::vector<double> result;
+			result.reserve(indices.size());
+			for (auto const q : indices) {
+				auto const &quote = this->quotes_[q];
+				result.emplace_back(bachelierPrice(this->market_.spot, quote.strike, maturity,
+					this->market_.rate, model.mu(), model.sigma(), quote.isCall));
+			}
+			return result;
+		}
+
+	public:
+		ArithmeticBrownianMotionCalibrator(MarketData const &market, std::vector<VanillaQuote> const &quotes,
+			CalibrationObjective objective = CalibrationObjective::Price, T mu = 0.0)
+			:Calibrator<ArithmeticBrownianMotion<T>>{ market,quotes,{ 1.0e-8 },{ 1.0e6 },objective },
+			mu_{ mu } {}
+
+		CalibrationResult calibrate(ArithmeticBrownianMotion<T> const &initial)const {
+			return Calibrator<ArithmeticBrownianMotion<T>>::calibrate({ static_cast<double>(initial.sigma()) });
+		}
+	};
+
+
+	// Calibrates (sigma,beta) of ConstantElasticityVariance by Monte Carlo, or
+	// sigma alone once fixBeta() is called: quotes that do not span a wide
+	// smile cannot tell sigma from beta. Every objective evaluation reuses the same seed (common random numbers),
+	// so the objective is a smooth function of the parameters. Paths of all
+	// maturities are simulated in a pipeline on one shared thread pool.
+	template<typename T = double>
+	class ConstantElasticityVarianceCalibrator :public Calibrator<ConstantElasticityVariance<T>> {
+	private:
+		std::size_t iterations_;
+		std::size_t numberSteps_;
+		std::uint64_t seed_;
+		FDMScheme scheme_;
+		std::shared_ptr<ThreadPool> pool_;
+		bool betaFixed_{ false };
+		T beta_{ 1.0 };
+
+	protected:
+		ConstantElasticityVariance<T> model(std::vector<double> const &parameters)const override {
+			return ConstantElasticityVariance<T>{ static_cast<T>(this->market_.rate - this->market_.dividend),
+				static_cast<T>(parameters[0]), (betaFixed_ ? beta_ : static_cast<T>(parameters[1])),
+				static_cast<T>(this->market_.spot) };
+		}
+
+		bool pricesByMaturity()const override { return true; }
+
+		std::vector<double> prices(ConstantElasticityVariance<T> const &model, double maturity,
+			std::vector<std::size_t> const &indices)const override {
+			TimePointsType<T> timePoints(numberSteps_ + 1);
+			for (std::size_t i = 0; i < timePoints.size(); ++i)
+				timePoints[i] = static_cast<T>(maturity * i / static_cast<double>(numberSteps_));
+			Fdm<1, T> fdm{ model.model(),timePoints };
+			fdm.setSeed(seed_);
+			fdm.setThreadPool(pool_);
+
+			// payoff sums of every block, added in block order:
+			pipeline::PipelineOptions options;
+			options.scheme = scheme_;
+			auto const blocks = fdm.template simulatePipelined<std::vector<double>>(iterations_,
+				reduction::reductionBlockSize, pipeline::chunkPaths(fdm, options),
+				[&](std::vector<double> &sums, std::size_t, PathArena<T> const &chunk) {
+				sums.resize(indices.size(), 0.0);
+				for (std::size_t i = 0; i < chunk.pathCount(); ++i) {
+					double const terminal = static_cast<double>(chunk.path(i).back());
+					for (std::size_t k = 0; k < indices.size(); ++k) {
+						auto const &quote = this->quotes_[indices[k]];
+						sums[k] += std::max(0.0, quote.isCall ? (terminal - quote.strike) : (quote.strike - terminal));
+					}
+				}
+			}, scheme_);
+
+			double const df = std::exp(-this->market_.rate * maturity);
+			std::vector<double> result(indices.size(), 0.0);
+			for (auto const &sums : blocks)
+				for (std::size_t k = 0; k < sums.size(); ++k)
+					result[k] += sums[k];
+			for (auto &price : result)
+				price *= (df / static_cast<double>(iterations_));
+			return result;
+		}
+
+	public:
+		ConstantElasticityVarianceCalibrator(MarketData const &market, std::vector<VanillaQuote> const &quotes,
+			std::size_t iterations, std::size_t numberSteps, std::uint64_t seed,
+			CalibrationObjective objective = CalibrationObjective::Price,
+			FDMScheme scheme = FDMScheme::EulerScheme)
+			:Calibrator<ConstantElasticityVariance<T>>{ market,quotes,{ 1.0e-6, 0.0 },{ 50.0, 1.5 },objective },
+			iterations_{ iterations }, numberSteps_{ numberSteps }, seed_{ seed }, scheme_{ scheme },
+			pool_{ std::make_shared<ThreadPool>() } {}
+
+		// pool the paths of every objective evaluation are simulated on
+		inline void setThreadPool(std::shared_ptr<ThreadPool> const &pool) { pool_ = pool; }
+		inline std::shared_ptr<ThreadPool> const &threadPool()const { return pool_; }
+
+		// beta stays as given, only sigma is calibrated
+		void fixBeta(T beta) {
+			betaFixed_ = true;
+			beta_ = beta;
+			this->setBounds({ 1.0e-6 }, { 50.0 });
+		}
+
+		CalibrationResult calibrate(ConstantElasticityVariance<T> const &initial)const {
+			if (betaFixed_)
+				return Calibrator<ConstantElasticityVariance<T>>::calibrate({ static_cast<double>(initial.sigma()) });
+			return Calibrator<ConstantElasticityVariance<T>>::calibrate({ static_cast<double>(initial.sigma()),
+				static_cast<double>(initial.beta()) });
+		}
+	};
+
+}
+
+
+
+#endif ///_CALIBRATION_H_
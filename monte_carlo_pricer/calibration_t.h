@@ -0,0 +1,84 @@
+#pragma once
+#if !defined(_CALIBRATION_T_H_)
+#define _CALIBRATION_T_H_
+
+#include"calibration.h"
+#include<iostream>
+
+using namespace calibration;
+
+
+void hestonCalibration() {
+
+	MarketData market{ 100.0,0.02,0.01 };
+	// "market" generated by known parameters:
+	double v0{ 0.04 };
+	double kappa{ 1.5 };
+	double theta{ 0.06 };
+	double etha{ 0.5 };
+	double rho{ -0.6 };
+
+	HestonPricer pricer;
+	std::vector<VanillaQuote> quotes;
+	for (double maturity : { 0.25,0.5,1.0,2.0 }) {
+		for (double strike : { 80.0,90.0,100.0,110.0,120.0 }) {
+			bool isCall = (strike >= market.spot);
+			double price = pricer.price(market.spot, strike, maturity, market.rate, market.dividend,
+				v0, kappa, theta, etha, rho, isCall);
+			double vol = impliedVolatility(price, market.spot, strike, maturity, market.rate, market.dividend, isCall);
+			quotes.emplace_back(VanillaQuote{ strike,maturity,vol,isCall,1.0 });
+		}
+	}
+
+	HestonCalibrator<> calibrator{ market,quotes,CalibrationObjective::ImpliedVolatility };
+	HestonModel<> guess{ 0.0,1.0,1.0,0.04,0.3,market.spot,0.02,-0.2 };
+	auto result = calibrator.calibrate(guess);
+	auto heston = calibrator.calibratedModel(result);
+
+	std::cout << "Heston calibration took: " << result.wallTime << " seconds\n";
+	std::cout << "iterations: " << result.iterations << ", evaluations: " << result.objectiveEvaluations << "\n";
+	std::cout << "vol RMSE: " << result.rootMeanSquaredError << "\n";
+	std::cout << "v0: " << heston.init2() << " (" << v0 << ")\n";
+	std::cout << "kappa: " << heston.kappa() << " (" << kappa << ")\n";
+	std::cout << "theta: " << heston.theta() << " (" << theta << ")\n";
+	std::cout << "etha: " << heston.etha() << " (" << etha << ")\n";
+	std::cout << "rho: " << heston.rho() << " (" << rho << ")\n";
+}
+
+
+void cevCalibration() {
+
+	MarketData market{ 100.0,0.01,0.0 };
+	// flat 20% Black-Scholes smile, reproduced by CEV with beta = 1:
+	double vol{ 0.2 };
+	std::vector<VanillaQuote> quotes;
+	for (double maturity : { 0.5,1.0 }) {
+		for (double strike : { 80.0,90.0,100.0,110.0,120.0 }) {
+			double price = blackScholesPrice(market.spot, strike, maturity, market.rate, market.dividend, vol, true);
+			quotes.emplace_back(VanillaQuote{ strike,maturity,price,true,1.0 });
+		}
+	}
+
+	// strikes from 80 to 120 and a few thousand paths cannot tell sigma from
+	// beta (only the local vol at the spot), so beta is fixed and sigma calibrated:
+	std::size_t simuls{ 2'000 };
+	std::size_t numberSteps{ 50 };
+	std::uint64_t seed{ 12345 };
+	double tolerance{ 0.01 };
+	ConstantElasticityVarianceCalibrator<> calibrator{ market,quotes,simuls,numberSteps,seed };
+	calibrator.fixBeta(1.0);
+	ConstantElasticityVariance<> guess{ market.rate,0.5,1.0,market.spot };
+	auto result = calibrator.calibrate(guess);
+	auto cev = calibrator.calibratedModel(result);
+
+	std::cout << "CEV calibration took: " << result.wallTime << " seconds\n";
+	std::cout << "iterations: " << result.iterations << ", evaluations: " << result.objectiveEvaluations << "\n";
+	std::cout << "price RMSE: " << result.rootMeanSquaredError << "\n";
+	std::cout << "sigma: " << cev.sigma() << " (" << vol << ")"
+		<< (std::abs(cev.sigma() - vol) <= tolerance ? " within " : " OUTSIDE ") << tolerance << "\n";
+	std::cout << "beta: " << cev.beta() << " (fixed)\n";
+}
+
+
+
+#endif ///_CALIBRATION_T_H_
@@ -0,0 +1,235 @@
+#pragma once
+#if !defined(_CHECKPOINT_H_)
+#define _CHECKPOINT_H_
+
+#include"mc_types.h"
+#include"payoff_strategy.h"
+#include"path_cache.h"
+#include<string>
+#include<vector>
+#include<fstream>
+#include<algorithm>
+#include<atomic>
+#include<chrono>
+#include<cstdio>
+#include<cstdint>
+#include<stdexcept>
+
+namespace checkpoint {
+
+	using mc_types::PathValuesType;
+	using mc_types::FDMScheme;
+	using payoff::PayoffMoments;
+
+	// File layout (little endian, as written by the host):
+	// CheckpointHeader | accumulatorCount x (sum, sumOfSquares, count)
+	static constexpr std::uint64_t checkpointMagic = 0x3154504B4843434DULL; // "MCCHKPT1"
+	static constexpr std::uint64_t checkpointVersion = 2;
+
+	struct CheckpointHeader {
+		std::uint64_t magic;
+		std::uint64_t version;
+		std::uint64_t configuration;	// hash of run configuration
+		std::uint64_t pathCount;
+		std::uint64_t blockSize;
+		std::uint64_t completedPaths;	// next path index, i.e. the RNG counter
+		std::uint64_t accumulatorCount;
+		std::uint64_t checksum;			// of the accumulators
+	};
+
+	// Progress of a resumable run
+	struct CheckpointState {
+		std::uint64_t configuration{ 0 };
+		std::size_t pathCount{ 0 };
+		std::size_t blockSize{ 0 };
+		std::size_t completedPaths{ 0 };
+		std::vector<PayoffMoments> accumulators;
+
+		inline bool complete()const { return (completedPaths == pathCount); }
+	};
+
+	namespace detail {
+
+		inline std::uint64_t checksum(std::vector<PayoffMoments> const &accumulators) {
+			std::uint64_t h = 0xcbf29ce484222325ULL;
+			auto const mix = [&h](void const *data, std::size_t size) {
+				auto const bytes = static_cast<unsigned char const *>(data);
+				for (std::size_t i = 0; i < size; ++i) {
+					h ^= bytes[i];
+					h *= 0x100000001b3ULL;
+				}
+			};
+			for (auto const &a : accumulators) {
+				double const values[] = { a.sum,a.sumOfSquares };
+				std::uint64_t const count = a.count;
+				mix(values, sizeof(values));
+				mix(&count, sizeof(count));
+			}
+			return h;
+		}
+
+		// Hash of a run: the full model state by SdeBuilder::fingerprint(), the
+		// engine's correlation, grid, seed and first path, and the split of the run
+		template<typename Builder, typename Engine>
+		std::uint64_t configuration(Builder const &builder, Engine const &fdm, std::size_t pathCount,
+			FDMScheme scheme, std::size_t blockSize, std::size_t accumulatorCount) {
+			mc_utilities::Fingerprint hash;
+			hash.mix(builder.name());
+			hash.mix(builder.fingerprint());
+			hash.mix(path_cache::detail::engineSettings(fdm, 0));
+			hash.mix(fdm.timeResolution());
+			std::uint64_t const fields[] = { static_cast<std::uint64_t>(scheme),fdm.seed(),fdm.firstPath(),
+				pathCount,blockSize,accumulatorCount };
+			hash.mix(fields, sizeof(fields));
+			return hash.value();
+		}
+	}
+
+	// Writes the state into a temporary file which then replaces fileName,
+	// so that an interruption never leaves a torn checkpoint behind
+	inline void save(std::string const &fileName, CheckpointState const &state) {
+		std::string const temporary = fileName + ".tmp";
+		{
+			std::ofstream file{ temporary, std::ios::binary | std::ios::trunc };
+			if (!file)
+				throw std::runtime_error("Cannot open checkpoint file " + temporary + ".");
+			CheckpointHeader header;
+			header.magic = checkpointMagic;
+			header.version = checkpointVersion;
+			header.configuration = state.configuration;
+			header.pathCount = state.pathCount;
+			header.blockSize = state.blockSize;
+			header.completedPaths = state.completedPaths;
+			header.accumulatorCount = state.accumulators.size();
+			header.checksum = detail::checksum(state.accumulators);
+			file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+			for (auto const &a : state.accumulators) {
+				std::uint64_t const count = a.count;
+				file.write(reinterpret_cast<char const *>(&a.sum), sizeof(double));
+				file.write(reinterpret_cast<char const *>(&a.sumOfSquares), sizeof(double));
+				file.write(reinterpret_cast<char const *>(&count), sizeof(count));
+			}
+			file.flush();
+			if (!file)
+				throw std::runtime_error("Writing checkpoint file " + temporary + " failed.");
+		}
+#if defined(_WIN32)
+		std::remove(fileName.c_str());
+#endif
+		if (std::rename(temporary.c_str(), fileName.c_str()) != 0)
+			throw std::runtime_error("Cannot replace checkpoint file " + fileName + ".");
+	}
+
+	// Reads a checkpoint, returns false when there is none
+	inline bool load(std::string const &fileName, CheckpointState &state) {
+		std::ifstream file{ fileName, std::ios::binary };
+		if (!file)
+			return false;
+		CheckpointHeader header;
+		if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || header.magic != checkpointMagic)
+			throw std::runtime_error("File " + fileName + " is not a checkpoint.");
+		if (header.version != checkpointVersion)
+			throw std::runtime_error("Checkpoint " + fileName + " has unsupported version.");
+		state.configuration = header.configuration;
+		state.pathCount = static_cast<std::size_t>(header.pathCount);
+		state.blockSize = static_cast<std::size_t>(header.blockSize);
+		state.completedPaths = static_cast<std::size_t>(header.completedPaths);
+		state.accumulators.assign(static_cast<std::size_t>(header.accumulatorCount), PayoffMoments{});
+		for (auto &a : state.accumulators) {
+			std::uint64_t count{ 0 };
+			file.read(reinterpret_cast<char *>(&a.sum), sizeof(double));
+			file.read(reinterpret_cast<char *>(&a.sumOfSquares), sizeof(double));
+			file.read(reinterpret_cast<char *>(&count), sizeof(count));
+			a.count = static_cast<std::size_t>(count);
+		}
+		if (!file || detail::checksum(state.accumulators) != header.checksum)
+			throw std::runtime_error("Checkpoint " + fileName + " is corrupted.");
+		return true;
+	}
+
+
+	// Runs a seeded simulation of pathCount paths block by block, feeds each block
+	// to a streaming estimator and checkpoints the accumulators periodically.
+	// The estimator fills one PayoffMoments per accumulator for the block:
+	//		estimator(paths, blockMoments)
+	// Block boundaries are fixed by the block size and block moments are merged
+	// in block order, path i is always generated from pathSeed(seed,firstPath+i),
+	// so a resumed run gives exactly the result of an uninterrupted one.
+	// A checkpoint of a different configuration (model state, correlation, grid,
+	// scheme, seed, path count, block size or number of accumulators) is rejected.
+	// Checkpoints of version 1 hashed the scalar parameters only and are refused.
+	class ResumableRun {
+	private:
+		std::string fileName_;
+		std::size_t blockSize_;
+		double interval_;	// seconds between checkpoints
+		std::atomic<bool> stop_{ false };
+
+	public:
+		explicit ResumableRun(std::string const &fileName, std::size_t blockSize = 5000,
+			double checkpointInterval = 60.0)
+			:fileName_{ fileName }, blockSize_{ std::max<std::size_t>(1, blockSize) },
+			interval_{ checkpointInterval } {}
+
+		ResumableRun(ResumableRun const &) = delete;
+		ResumableRun &operator=(ResumableRun const &) = delete;
+
+		inline std::string const &fileName()const { return fileName_; }
+		inline std::size_t blockSize()const { return blockSize_; }
+
+		// May be called from another thread (e.g. a signal watcher): the run
+		// stops after the current block and leaves a checkpoint behind
+		inline void requestStop() { stop_ = true; }
+
+		template<typename Builder, typename Engine, typename Estimator>
+		CheckpointState run(Builder const &builder, Engine &fdm, std::size_t pathCount,
+			std::size_t accumulatorCount, Estimator &&estimator, FDMScheme scheme = FDMScheme::EulerScheme) {
+			if (!fdm.isSeeded())
+				throw std::invalid_argument("Resumable runs need a seeded engine.");
+			std::uint64_t const configuration = detail::configuration(builder, fdm, pathCount, scheme,
+				blockSize_, accumulatorCount);
+
+			CheckpointState state;
+			if (load(fileName_, state)) {
+				if (state.configuration != configuration || state.pathCount != pathCount ||
+					state.blockSize != blockSize_ || state.accumulators.size() != accumulatorCount)
+					throw std::invalid_argument("Checkpoint " + fileName_ + " belongs to a different run.");
+			}
+			else {
+				state.configuration = configuration;
+				state.pathCount = pathCount;
+				state.blockSize = blockSize_;
+				state.accumulators.assign(accumulatorCount, PayoffMoments{});
+			}
+
+			stop_ = false;
+			std::size_t const firstPath = fdm.firstPath();
+			std::vector<PayoffMoments> blockMoments(accumulatorCount);
+			auto lastSave = std::chrono::steady_clock::now();
+			while (!state.complete() && !stop_) {
+				std::size_t const size = std::min(blockSize_, pathCount - state.completedPaths);
+				fdm.setFirstPath(firstPath + state.completedPaths);
+				auto const paths = fdm(size, scheme);
+				std::fill(blockMoments.begin(), blockMoments.end(), PayoffMoments{});
+				estimator(paths, blockMoments);
+				for (std::size_t k = 0; k < accumulatorCount; ++k)
+					state.accumulators[k].merge(blockMoments[k]);
+				state.completedPaths += size;
+
+				auto const now = std::chrono::steady_clock::now();
+				if (std::chrono::duration<double>(now - lastSave).count() >= interval_) {
+					save(fileName_, state);
+					lastSave = now;
+				}
+			}
+			fdm.setFirstPath(firstPath);
+			save(fileName_, state);
+			return state;
+		}
+	};
+
+}
+
+
+
+#endif ///_CHECKPOINT_H_
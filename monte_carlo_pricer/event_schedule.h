@@ -0,0 +1,248 @@
+#pragma once
+#if !defined(_EVENT_SCHEDULE_H_)
+#define _EVENT_SCHEDULE_H_
+
+#include"mc_types.h"
+#include"mc_utilities.h"
+#include"payoff_strategy.h"
+#include"fdm_scheme.h"
+#include"sde.h"
+#include"time_grid.h"
+#include<memory>
+#include<random>
+#include<cmath>
+#include<algorithm>
+#include<stdexcept>
+
+namespace event_schedule {
+
+	using mc_types::PathValuesType;
+	using mc_types::TimePointsType;
+	using mc_types::FDMScheme;
+	using payoff::PayoffMoments;
+	using finite_difference_method::JumpSampler;
+	using finite_difference_method::JumpScheduleType;
+	using finite_difference_method::SchemeBuilder;
+	using sde::Sde;
+	using time_grid::TimeGrid;
+
+
+	// State of one path seen by the event handlers
+	struct EventState {
+		double discountFactor{ 1.0 };	// discount factor at the current event
+		double cashFlow{ 0.0 };			// discounted cash flows paid so far
+		double memory{ 0.0 };			// product specific (e.g. unpaid coupons)
+		bool knockedIn{ false };
+		bool terminated{ false };
+
+		inline void pay(double amount) { cashFlow += discountFactor * amount; }
+		inline void terminate() { terminated = true; }
+	};
+
+	template<typename T>
+	using EventHandler = std::function<void(T value, EventState &state)>;
+
+
+	// Observation events of a product. Event times are compiled against
+	// the time grid of the engine (nearest grid point), a monitoring handler
+	// is called at every grid point in between.
+	template<typename T = double>
+	class EventSchedule {
+	private:
+		std::vector<std::pair<T, EventHandler<T>>> events_;
+		EventHandler<T> monitor_;
+
+	public:
+		EventSchedule() {}
+
+		void addEvent(T time, EventHandler<T> const &handler) {
+			events_.emplace_back(time, handler);
+		}
+
+		void setMonitor(EventHandler<T> const &handler) { monitor_ = handler; }
+
+		inline bool hasMonitor()const { return static_cast<bool>(monitor_); }
+		inline EventHandler<T> const &monitor()const { return monitor_; }
+		inline std::size_t size()const { return events_.size(); }
+
+		// (grid index, handler) sorted by index, events at equal index keep their order
+		std::vector<std::pair<std::size_t, EventHandler<T>>> compile(TimePointsType<T> const &timePoints)const {
+			if (events_.empty())
+				throw std::invalid_argument("Event schedule is empty.");
+			std::vector<std::pair<std::size_t, EventHandler<T>>> compiled;
+			compiled.reserve(events_.size());
+			for (auto const &event : events_) {
+				auto const it = std::lower_bound(timePoints.begin(), timePoints.end(), event.first);
+				std::size_t index = static_cast<std::size_t>(it - timePoints.begin());
+				if (index == timePoints.size() ||
+					(index > 0 && (event.first - timePoints[index - 1]) < (timePoints[index] - event.first)))
+					--index;
+				compiled.emplace_back(std::max<std::size_t>(1, index), event.second);
+			}
+			std::stable_sort(compiled.begin(), compiled.end(),
+				[](std::pair<std::size_t, EventHandler<T>> const &a, std::pair<std::size_t, EventHandler<T>> const &b) {
+				return (a.first < b.first);
+			});
+			return compiled;
+		}
+	};
+
+
+	// Discounted price of an event-driven product
+	struct EventPricing {
+		double price;
+		double standardError;
+		double averageSteps;	// grid steps simulated per path
+	};
+
+
+	// Steps one-factor paths on a time grid and calls the event handlers between
+	// steps. Paths stop as soon as they terminate and are never simulated beyond
+	// the last event. Every step is the step of the Euler or Milstein scheme of
+	// fdm_scheme.h (exact transitions, step tables of time-dependent models and
+	// the model's math accuracy included); jumps are applied as in the schemes.
+	template<typename T = double>
+	class EventEngine {
+	private:
+		std::shared_ptr<Sde<T, T, T>> model_;
+		std::shared_ptr<TimeGrid<T> const> grid_;
+		T rate_;
+		std::size_t blockSize_{ 1024 };
+		bool seeded_{ false };
+		std::uint64_t seed_{ 0 };
+
+		// returns (discounted cash flow, steps simulated)
+		std::pair<double, std::size_t> simulatePath(std::uint32_t seed, SchemeBuilder<1, T, T, T> const &fdmScheme,
+			std::vector<std::pair<std::size_t, EventHandler<T>>> const &events,
+			EventHandler<T> const &monitor, std::vector<double> const &discounts)const {
+			std::mt19937 mt(seed);
+			std::normal_distribution<T> normal;
+			std::size_t const horizon = events.back().first;
+			JumpScheduleType<T> jumps;
+			std::size_t nextJump{ 0 };
+			if (model_->hasJumps()) {
+				TimePointsType<T> const grid(grid_->times().begin(), grid_->times().begin() + horizon + 1);
+				jumps = JumpSampler<T>{}.sample(*(model_->jumps()), mt, grid);
+			}
+			EventState state;
+			T spot = model_->initCondition();
+			std::size_t nextEvent{ 0 };
+			std::size_t i{ 1 };
+			for (; i <= horizon && !state.terminated; ++i) {
+				T const z = normal(mt);
+				spot = fdmScheme.stepFrom(i, spot, z, mt);
+				spot = JumpSampler<T>::apply(spot, i, jumps, nextJump);
+
+				if (monitor)
+					monitor(spot, state);
+				state.discountFactor = discounts[i];
+				for (; nextEvent < events.size() && events[nextEvent].first == i && !state.terminated; ++nextEvent)
+					events[nextEvent].second(spot, state);
+			}
+			return std::make_pair(state.cashFlow, i - 1);
+		}
+
+	public:
+		EventEngine(std::shared_ptr<Sde<T, T, T>> const &model, std::shared_ptr<TimeGrid<T> const> const &grid, T rate)
+			:model_{ model }, grid_{ grid }, rate_{ rate } {}
+
+		EventEngine(std::shared_ptr<Sde<T, T, T>> const &model, TimePointsType<T> const &timePoints, T rate)
+			:EventEngine{ model,TimeGrid<T>::fromPoints(timePoints),rate } {}
+
+		inline std::shared_ptr<TimeGrid<T> const> const &timeGrid()const { return grid_; }
+
+		inline void setSeed(std::uint64_t seed) { seeded_ = true; seed_ = seed; }
+		inline void resetSeed() { seeded_ = false; }
+
+		inline void setBlockSize(std::size_t blockSize) { blockSize_ = std::max<std::size_t>(1, blockSize); }
+		inline std::size_t blockSize()const { return blockSize_; }
+
+		EventPricing price(EventSchedule<T> const &schedule, std::size_t iterations,
+			FDMScheme scheme = FDMScheme::EulerScheme)const {
+			auto const &timePoints = grid_->times();
+			auto const events = schedule.compile(timePoints);
+			auto const fdmScheme = finite_difference_method::makeScheme<T>(model_, grid_, scheme);
+			std::vector<double> discounts(timePoints.size());
+			for (std::size_t i = 0; i < discounts.size(); ++i)
+				discounts[i] = std::exp(-static_cast<double>(rate_) * static_cast<double>(timePoints[i]));
+			std::uint64_t baseSeed = seed_;
+			if (!seeded_) {
+				std::random_device rd;
+				baseSeed = (static_cast<std::uint64_t>(rd()) << 32) | rd();
+			}
+
+			struct BlockResult {
+				PayoffMoments moments;
+				std::size_t steps{ 0 };
+			};
+			auto const blocks = mc_utilities::parallelBlocks<BlockResult>(iterations, blockSize_,
+				[&](std::size_t first, std::size_t size) {
+				BlockResult result;
+				for (std::size_t p = first; p < first + size; ++p) {
+					auto const path = simulatePath(mc_utilities::pathSeed(baseSeed, p), *fdmScheme,
+						events, schedule.monitor(), discounts);
+					result.moments.sum += path.first;
+					result.moments.sumOfSquares += path.first * path.first;
+					result.steps += path.second;
+				}
+				result.moments.count = size;
+				return result;
+			});
+			PayoffMoments total;
+			std::size_t steps{ 0 };
+			for (auto const &block : blocks) {
+				total.merge(block.moments);
+				steps += block.steps;
+			}
+			return EventPricing{ total.mean(),total.standardError(),
+				static_cast<double>(steps) / static_cast<double>(std::max<std::size_t>(1, iterations)) };
+		}
+	};
+
+
+	// Autocallable note on performance S/initial:
+	// at every observation date the note redeems at notional plus coupon if
+	// performance >= autocallLevel, else pays the coupon if performance >= couponLevel
+	// (with unpaid coupons when memory is on). Performance below knockInLevel at any
+	// grid point knocks in; at maturity a knocked-in note redeems notional*performance
+	// if performance < 1, otherwise the notional.
+	template<typename T = double>
+	EventSchedule<T> autocallableSchedule(TimePointsType<T> const &observationTimes, T initial,
+		T autocallLevel, T couponLevel, T coupon, T knockInLevel, T notional = 1.0, bool memory = true) {
+		if (observationTimes.empty())
+			throw std::invalid_argument("Autocallable needs observation dates.");
+		EventSchedule<T> schedule;
+		schedule.setMonitor([=](T value, EventState &state) {
+			if (value < knockInLevel * initial)
+				state.knockedIn = true;
+		});
+		for (std::size_t d = 0; d < observationTimes.size(); ++d) {
+			bool const isLast = (d + 1 == observationTimes.size());
+			schedule.addEvent(observationTimes[d], [=](T value, EventState &state) {
+				T const performance = value / initial;
+				if (performance >= couponLevel) {
+					state.pay(notional * (coupon + (memory ? state.memory : 0.0)));
+					state.memory = 0.0;
+				}
+				else {
+					state.memory += coupon;
+				}
+				if (performance >= autocallLevel) {
+					state.pay(notional);
+					state.terminate();
+					return;
+				}
+				if (isLast) {
+					state.pay((state.knockedIn && performance < 1.0) ? notional * performance : notional);
+					state.terminate();
+				}
+			});
+		}
+		return schedule;
+	}
+
+}
+
+
+
+#endif ///_EVENT_SCHEDULE_H_
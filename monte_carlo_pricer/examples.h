@@ -4,13 +4,48 @@
 
 #include<iostream>
 #include<string>
+#include<iomanip>
 #include"payoff.h"
 #include"payoff_strategy.h"
 #include"fdm.h"
 #include"sde_builder.h"
+#include"portfolio.h"
+#include"barrier_strategy.h"
+#include"longstaff_schwartz.h"
+#include"price_surface.h"
+#include"event_schedule.h"
+#include"path_store.h"
+#include"path_cache.h"
+#include"checkpoint.h"
+#include"shard.h"
+#include"pricing_service.h"
+#include"mixed_precision.h"
+#include"path_buffer.h"
+#include"time_grid.h"
+#include"async_pricing.h"
+#include"numa.h"
+#include"pipeline.h"
+#include"reduction.h"
 
 using namespace finite_difference_method;
 using namespace sde_builder;
+using namespace portfolio;
+using namespace longstaff_schwartz;
+using namespace price_surface;
+using namespace event_schedule;
+using namespace path_store;
+using namespace path_cache;
+using namespace checkpoint;
+using namespace shard;
+using namespace pricing_service;
+using namespace mixed_precision;
+using namespace path_buffer;
+using namespace time_grid;
+using namespace async_pricing;
+using namespace numa;
+using namespace thread_pool;
+using namespace pipeline;
+using namespace reduction;
 
 // Pricing european options 
 // using paths from geometric brownian motion  
@@ -47,25 +82,17 @@ void europeanOptionsGBMEuler() {
 	// Construct call payoff of the option:
 	double call_strike{ 100.0 };
 	PlainCallStrategy<> call_strategy{ call_strike };
-	auto call_payoff = std::bind(&PlainCallStrategy<>::payoff, &call_strategy, std::placeholders::_1);
 	// Construct put payoff of the option:
 	double put_strike{ 100.0 };
 	PlainPutStrategy<> put_strategy{ put_strike };
-	auto put_payoff = std::bind(&PlainPutStrategy<>::payoff, &put_strategy, std::placeholders::_1);
 
-	double lastPrice{0.0};
-	double call_sum{0.0};
-	double put_sum{0.0};
-	for (auto const &path : paths_euler) {
-		lastPrice = path.back();
-		call_sum += call_payoff(lastPrice);
-		put_sum += put_payoff(lastPrice);
-	}
-	auto call_avg = (call_sum / static_cast<double>(paths_euler.size()));
-	auto put_avg = (put_sum / static_cast<double>(paths_euler.size()));
+	// Evaluate payoffs over blocks of terminal values in parallel:
+	auto call_moments = batchTerminalPayoff(call_strategy, paths_euler);
+	auto put_moments = batchTerminalPayoff(put_strategy, paths_euler);
+	double df = std::exp(-1.0*rate*maturityInYears);
 
-	std::cout << "Call price: " << ((std::exp(-1.0*rate*maturityInYears))*call_avg) << "\n";
-	std::cout << "Put price: " << ((std::exp(-1.0*rate*maturityInYears))*put_avg) << "\n";
+	std::cout << "Call price: " << (df*call_moments.mean()) << " (" << (df*call_moments.standardError()) << ")\n";
+	std::cout << "Put price: " << (df*put_moments.mean()) << " (" << (df*put_moments.standardError()) << ")\n";
 	std::cout << "=========================================================\n";
 }
 
@@ -255,23 +282,17 @@ void asianOptionsGBMEuler() {
 	// Construct call payoff of the option:
 	double call_strike{ 100.0 };
 	AsianAvgCallStrategy<> call_strategy{ call_strike };
-	auto call_payoff = std::bind(&AsianAvgCallStrategy<>::payoff, &call_strategy, std::placeholders::_1);
 	// Construct put payoff of the option:
 	double put_strike{ 100.0 };
 	AsianAvgPutStrategy<> put_strategy{ put_strike };
-	auto put_payoff = std::bind(&AsianAvgPutStrategy<>::payoff, &put_strategy, std::placeholders::_1);
 
-	double call_sum{ 0.0 };
-	double put_sum{ 0.0 };
-	for (auto const &path : paths_euler) {
-		call_sum += call_payoff(path);
-		put_sum += put_payoff(path);
-	}
-	auto call_avg = (call_sum / static_cast<double>(paths_euler.size()));
-	auto put_avg = (put_sum / static_cast<double>(paths_euler.size()));
+	// Evaluate payoffs over blocks of paths in parallel:
+	auto call_moments = batchPayoff(call_strategy, paths_euler);
+	auto put_moments = batchPayoff(put_strategy, paths_euler);
+	double df = std::exp(-1.0*rate*maturityInYears);
 
-	std::cout << "Asian call price: " << ((std::exp(-1.0*rate*maturityInYears))*call_avg) << "\n";
-	std::cout << "Asian put price: " << ((std::exp(-1.0*rate*maturityInYears))*put_avg) << "\n";
+	std::cout << "Asian call price: " << (df*call_moments.mean()) << " (" << (df*call_moments.standardError()) << ")\n";
+	std::cout << "Asian put price: " << (df*put_moments.mean()) << " (" << (df*put_moments.standardError()) << ")\n";
 	std::cout << "=========================================================\n";
 }
 
@@ -428,5 +449,788 @@ void asianOptionsHestonMilstein() {
 	std::cout << "=========================================================\n";
 }
 
+// Pricing european options on equity with stochastic short rate
+// (Hull-White stepped exactly) using pathwise discount factors
+void europeanOptionsHullWhiteEquityEuler() {
+
+	// First construct the short rate model:
+	double kappa{ 0.1 };
+	double theta{ 0.002 }; // long-run rate theta/kappa = 2%
+	double sigma_r{ 0.01 };
+	double r_init{ 0.02 };
+	HullWhiteModel<> hullWhite{ kappa,theta,sigma_r,r_init };
+	std::cout << "Short rate model: " << hullWhite.name() << "\n";
+
+	// Equity driven by the short rate:
+	double sigma{ 0.2 };
+	double s_init{ 100.0 };
+	double correlation{ 0.3 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 50 }; // exact rate transition needs no fine grid
+	std::size_t simuls{ 50000 };
+	EquityShortRateModel<> hybrid{ sigma,s_init,hullWhite };
+	std::cout << "Model: " << hybrid.name() << "\n";
+	// Construct the engine: 
+	Fdm<EquityShortRateModel<>::FactorCount, double> fdm_hybrid{ hybrid.model(),maturityInYears,correlation,numberSteps };
+	auto start = std::chrono::system_clock::now();
+	auto discounted = fdm_hybrid.discountedPaths(simuls, FDMScheme::EulerScheme);
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Euler scheme for Equity-Hull-White<2> took: " << end << " seconds.\n";
+
+	// Construct call payoff of the option:
+	double call_strike{ 100.0 };
+	PlainCallStrategy<> call_strategy{ call_strike };
+	auto call_payoff = std::bind(&PlainCallStrategy<>::payoff, &call_strategy, std::placeholders::_1);
+
+	double call_sum{ 0.0 };
+	double bond_sum{ 0.0 };
+	for (std::size_t i = 0; i < discounted.paths.size(); ++i) {
+		call_sum += discounted.discountFactors[i] * call_payoff(discounted.paths[i].back());
+		bond_sum += discounted.discountFactors[i];
+	}
+	std::cout << "Zero coupon bond: " << (bond_sum / static_cast<double>(discounted.paths.size())) << "\n";
+	std::cout << "Call price: " << (call_sum / static_cast<double>(discounted.paths.size())) << "\n";
+	std::cout << "=========================================================\n";
+}
+
+
+// Pricing european and asian options together
+// from one simulation of geometric brownian motion
+void portfolioGBMEuler() {
+
+	// First generate paths using GBM 
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 50000 };
+
+	// Construct the model:
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+
+	// Construct the trades:
+	Portfolio<> book;
+	book.add("call 100", std::make_shared<PlainCallStrategy<>>(100.0));
+	book.add("put 100", std::make_shared<PlainPutStrategy<>>(100.0));
+	book.add("asian call 100", std::make_shared<AsianAvgCallStrategy<>>(100.0));
+	book.add("asian put 100", std::make_shared<AsianAvgPutStrategy<>>(100.0));
+
+	// Construct the pricer, simulation is shared by all trades:
+	PortfolioPricer<GeometricBrownianMotion<>::FactorCount> pricer{ gbm.model(),maturityInYears,numberSteps };
+	auto start = std::chrono::system_clock::now();
+	auto prices = pricer.price(book, simuls, std::exp(-1.0*rate*maturityInYears), FDMScheme::EulerScheme);
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Portfolio of " << book.size() << " trades took: " << end << " seconds.\n";
+
+	for (auto const &price : prices) {
+		std::cout << price.name << ": " << price.price << " (" << price.standardError << ")\n";
+	}
+	std::cout << "=========================================================\n";
+}
+
+
+// Pricing down-and-out call on coarse grid
+// with Brownian-bridge crossing correction
+void barrierOptionsGBMEuler() {
+
+	// First generate paths using GBM 
+	double rate{ 0.05 };
+	double sigma{ 0.2 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 25 }; // bridge correction needs no fine grid
+	std::size_t simuls{ 20000 };
+
+	// Construct the model:
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	// Construct the engine: 
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	auto start = std::chrono::system_clock::now();
+	auto paths_euler = fdm_gbm(simuls, FDMScheme::EulerScheme);
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Euler scheme for GBM<1> took: " << end << " seconds.\n";
+
+	// Construct barrier payoffs of the option:
+	double strike{ 100.0 };
+	double barrier{ 90.0 };
+	auto call = std::make_shared<PlainCallStrategy<>>(strike);
+	BarrierStrategy<> discrete_strategy{ call,barrier,BarrierType::DownAndOut,gbm.model(),
+		fdm_gbm.timeResolution(),BridgeCorrection::None };
+	BarrierStrategy<> bridge_strategy{ call,barrier,BarrierType::DownAndOut,gbm.model(),
+		fdm_gbm.timeResolution(),BridgeCorrection::Logarithmic };
+
+	auto discrete_moments = batchPayoff<PathValuesType<double>>(discrete_strategy, paths_euler);
+	auto bridge_moments = batchPayoff<PathValuesType<double>>(bridge_strategy, paths_euler);
+	double df = std::exp(-1.0*rate*maturityInYears);
+
+	std::cout << "Down-and-out call (grid monitoring): " << (df*discrete_moments.mean()) << "\n";
+	std::cout << "Down-and-out call (bridge corrected): " << (df*bridge_moments.mean()) << " (" << (df*bridge_moments.standardError()) << ")\n";
+	std::cout << "=========================================================\n";
+}
+
+
+// Pricing american put by least-squares Monte Carlo
+// using independent paths for training and pricing
+void americanOptionsGBMEuler() {
+
+	// First generate paths using GBM 
+	double rate{ 0.06 };
+	double sigma{ 0.2 };
+	double s{ 36.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 50 };
+	std::size_t simuls{ 20000 };
+
+	// Construct the model:
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	// Construct the engine: 
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	auto start = std::chrono::system_clock::now();
+	auto training_paths = fdm_gbm(simuls, FDMScheme::EulerScheme);
+	auto pricing_paths = fdm_gbm(simuls, FDMScheme::EulerScheme);
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Euler scheme for GBM<1> took: " << end << " seconds.\n";
+
+	// Exercise allowed at every step of the grid:
+	std::vector<std::size_t> exercise_indices;
+	for (std::size_t i = 1; i < training_paths.front().size(); ++i)
+		exercise_indices.emplace_back(i);
+
+	double put_strike{ 40.0 };
+	LongstaffSchwartz<> lsm{ std::make_shared<PlainPutStrategy<>>(put_strike),
+		fdm_gbm.timeResolution(),exercise_indices,rate };
+	lsm.setBasis(RegressionBasis::Laguerre, 3);
+	start = std::chrono::system_clock::now();
+	auto result = lsm.price(training_paths, pricing_paths);
+	end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Longstaff-Schwartz took: " << end << " seconds.\n";
+
+	std::cout << "American put (in-sample): " << result.inSamplePrice << "\n";
+	std::cout << "American put (lower bound): " << result.lowerBound << " (" << result.standardError << ")\n";
+	std::cout << "=========================================================\n";
+}
+
+
+// Pricing strike x maturity surface of european options
+// from one simulation of geometric brownian motion
+void surfaceGBMEuler() {
+
+	// First generate paths using GBM 
+	double rate{ 0.03 };
+	double sigma{ 0.25 };
+	double s{ 100.0 };
+	double maturityInYears{ 2.0 };
+	std::size_t numberSteps{ 720 };
+	std::size_t simuls{ 20000 };
+
+	// Construct the model:
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	// Construct the engine: 
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	auto start = std::chrono::system_clock::now();
+	auto paths_euler = fdm_gbm(simuls, FDMScheme::EulerScheme);
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Euler scheme for GBM<1> took: " << end << " seconds.\n";
+
+	// 20 strikes x 15 maturities:
+	std::vector<double> strikes;
+	for (std::size_t k = 0; k < 20; ++k)
+		strikes.emplace_back(60.0 + 5.0 * k);
+	std::vector<std::size_t> maturity_indices;
+	for (std::size_t m = 1; m <= 15; ++m)
+		maturity_indices.emplace_back(m * (paths_euler.front().size() - 1) / 15);
+
+	SurfacePricer<> pricer{ fdm_gbm.timeResolution(),rate };
+	start = std::chrono::system_clock::now();
+	auto surface = pricer.price(paths_euler, maturity_indices, strikes, s, 0.0);
+	end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Surface of " << strikes.size() * maturity_indices.size() << " options took: " << end << " seconds.\n";
+
+	std::size_t last = surface.maturities.size() - 1;
+	for (std::size_t k = 0; k < strikes.size(); k += 4) {
+		std::cout << "T = " << surface.maturities[last] << ", K = " << strikes[k] << ": call "
+			<< surface.calls[last][k] << ", put " << surface.puts[last][k]
+			<< ", implied vol " << surface.impliedVolatilities[last][k] << "\n";
+	}
+	std::cout << "=========================================================\n";
+}
+
+
+// Pricing autocallable note with event schedule:
+// paths stop simulating as soon as the note redeems
+void autocallableGBMEuler() {
+
+	double rate{ 0.03 };
+	double sigma{ 0.25 };
+	double s{ 100.0 };
+	double maturityInYears{ 3.0 };
+	std::size_t numberSteps{ 756 }; // daily knock-in monitoring
+	std::size_t simuls{ 50000 };
+
+	// Construct the model:
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+
+	// Semi-annual observations, 100% autocall, 80% coupon barrier with memory, 60% knock-in:
+	auto note = autocallableSchedule<double>({ 0.5,1.0,1.5,2.0,2.5,3.0 }, s, 1.0, 0.8, 0.04, 0.6, 100.0);
+
+	TimePointsType<double> grid(numberSteps + 1);
+	for (std::size_t i = 0; i < grid.size(); ++i)
+		grid[i] = maturityInYears * static_cast<double>(i) / static_cast<double>(numberSteps);
+	EventEngine<> engine{ gbm.model(),grid,rate };
+	auto start = std::chrono::system_clock::now();
+	auto result = engine.price(note, simuls, FDMScheme::EulerScheme);
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Event engine took: " << end << " seconds.\n";
+	std::cout << "Steps per path: " << result.averageSteps << " of " << numberSteps << "\n";
+	std::cout << "Autocallable price: " << result.price << " (" << result.standardError << ")\n";
+	std::cout << "=========================================================\n";
+}
+
+
+// Storing paths of geometric brownian motion in a path file
+// and pricing against the mapped file
+void pathStoreGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 50000 };
+
+	// Construct the model:
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	// Construct the engine: 
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	fdm_gbm.setSeed(20200101);
+
+	// Stream the simulation into the file in blocks of 5000 paths:
+	std::string file_name{ "gbm_paths.bin" };
+	auto start = std::chrono::system_clock::now();
+	PathStoreWriter<> writer{ file_name,describe(gbm,fdm_gbm,simuls,PathLayout::StepMajor) };
+	writer.simulate(fdm_gbm, 5000, FDMScheme::EulerScheme);
+	writer.close();
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Writing " << simuls << " paths took: " << end << " seconds.\n";
+
+	// Any other process can now map the same file:
+	PathStoreReader<> reader{ file_name };
+	std::cout << "Stored model: " << reader.info().modelName << ", paths: " << reader.pathCount()
+		<< ", path length: " << reader.pathLength() << "\n";
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	auto call_moments = batchTerminalPayoff(call_strategy, reader);
+	double df = std::exp(-1.0*rate*maturityInYears);
+	std::cout << "Call price: " << (df*call_moments.mean()) << " (" << (df*call_moments.standardError()) << ")\n";
+	// Path dependent payoffs read the mapped paths in place:
+	auto asian_moments = batchPayoff([](PathView<double> const &path) {
+		double sum{ 0.0 };
+		for (std::size_t i = 0; i < path.size(); ++i)
+			sum += path[i];
+		return std::max(0.0, sum / static_cast<double>(path.size()) - 100.0);
+	}, reader);
+	std::cout << "Asian call price: " << (df*asian_moments.mean()) << " (" << (df*asian_moments.standardError()) << ")\n";
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Pricing call and put from one cached simulation
+// of geometric brownian motion
+void pathCacheGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 50000 };
+
+	// Construct the model:
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	// Construct the engine, only seeded runs are cached:
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	fdm_gbm.setSeed(20200101);
+
+	// Cache with 256MB budget:
+	PathCache<> cache{ 256 * 1024 * 1024 };
+	double df = std::exp(-1.0*rate*maturityInYears);
+
+	auto start = std::chrono::system_clock::now();
+	auto terminal = cache.terminalValues(gbm, fdm_gbm, simuls, FDMScheme::EulerScheme);
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	auto call_moments = batchPayoff(call_strategy, *terminal);
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Call price: " << (df*call_moments.mean()) << " took: " << end << " seconds.\n";
+
+	// Same model, grid, scheme and seed: served from the cache
+	start = std::chrono::system_clock::now();
+	terminal = cache.terminalValues(gbm, fdm_gbm, simuls, FDMScheme::EulerScheme);
+	PlainPutStrategy<> put_strategy{ 100.0 };
+	auto put_moments = batchPayoff(put_strategy, *terminal);
+	end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Put price: " << (df*put_moments.mean()) << " took: " << end << " seconds.\n";
+
+	auto statistics = cache.statistics();
+	std::cout << "Cache hits: " << statistics.hits << ", misses: " << statistics.misses
+		<< ", bytes: " << statistics.bytes << "\n";
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Pricing call and put in a resumable run:
+// interrupted after a few blocks and resumed from the checkpoint
+void checkpointGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 50000 };
+
+	// Construct the model:
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	// Construct the engine, resumable runs must be seeded:
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	fdm_gbm.setSeed(20200101);
+
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	PlainPutStrategy<> put_strategy{ 100.0 };
+	auto estimator = [&](PathValuesType<PathValuesType<double>> const &paths, std::vector<PayoffMoments> &moments) {
+		moments[0] = batchTerminalPayoff(call_strategy, paths);
+		moments[1] = batchTerminalPayoff(put_strategy, paths);
+	};
+
+	// Blocks of 5000 paths, checkpoint every 10 seconds:
+	std::string file_name{ "gbm_run.ckpt" };
+	std::remove(file_name.c_str());
+	{
+		ResumableRun run{ file_name,5000,10.0 };
+		std::size_t blocks{ 0 };
+		auto state = run.run(gbm, fdm_gbm, simuls, 2,
+			[&](PathValuesType<PathValuesType<double>> const &paths, std::vector<PayoffMoments> &moments) {
+			estimator(paths, moments);
+			if (++blocks == 3)
+				run.requestStop(); // e.g. on shutdown
+		});
+		std::cout << "Interrupted after " << state.completedPaths << " of " << state.pathCount << " paths.\n";
+	}
+
+	// Restarting with the same configuration resumes from the checkpoint:
+	ResumableRun run{ file_name,5000,10.0 };
+	auto state = run.run(gbm, fdm_gbm, simuls, 2, estimator);
+	double df = std::exp(-1.0*rate*maturityInYears);
+	std::cout << "Call price: " << (df*state.accumulators[0].mean()) << " (" << (df*state.accumulators[0].standardError()) << ")\n";
+	std::cout << "Put price: " << (df*state.accumulators[1].mean()) << " (" << (df*state.accumulators[1].standardError()) << ")\n";
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Pricing call and put in four worker processes,
+// result equals the single-process run bit for bit
+void shardedGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 40000 };
+
+	// Construct the model:
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	// Construct the engine, sharded runs must be seeded:
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	fdm_gbm.setSeed(20200101);
+
+	// Two payoff accumulators and Welford moments of the terminal value:
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	PlainPutStrategy<> put_strategy{ 100.0 };
+	EstimatorState prototype;
+	prototype.moments.resize(2);
+	prototype.welford.resize(1);
+	auto estimator = [&](PathValuesType<PathValuesType<double>> const &paths, EstimatorState &state) {
+		state.moments[0] = batchTerminalPayoff(call_strategy, paths);
+		state.moments[1] = batchTerminalPayoff(put_strategy, paths);
+		for (auto const &path : paths)
+			state.welford[0].add(path.back());
+	};
+
+	ShardedRun sharded{ 4,5000 };
+	auto start = std::chrono::system_clock::now();
+	auto state = sharded.run(fdm_gbm, simuls, prototype, estimator);
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	double df = std::exp(-1.0*rate*maturityInYears);
+	std::cout << "Call price: " << (df*state.moments[0].mean()) << " (" << (df*state.moments[0].standardError()) << ")\n";
+	std::cout << "Put price: " << (df*state.moments[1].mean()) << " (" << (df*state.moments[1].standardError()) << ")\n";
+	std::cout << "Terminal mean: " << state.welford[0].mean << ", variance: " << state.welford[0].variance() << "\n";
+	std::cout << "Sharded run took: " << end << " seconds.\n";
+
+	auto single = sharded.runInProcess(fdm_gbm, simuls, prototype, estimator);
+	std::cout << "Equal to single process: " << std::boolalpha << (single.moments[0].sum == state.moments[0].sum) << "\n";
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Burst of small requests batched by the pricing service:
+// trades on the same model, grid, scheme and seed share one simulation
+// (UnixSocketServer serves the same service to other processes)
+void pricingServiceGBMEuler() {
+
+	auto pool = std::make_shared<ThreadPool>();
+	PricingService<> service{ pool,std::chrono::microseconds{ 2000 } };
+
+	std::vector<std::future<PricingResponse>> responses;
+	for (std::size_t k = 0; k < 10; ++k) {
+		std::string const line = std::to_string(k) +
+			" model=gbm params=0.001,0.005,100 maturity=1 steps=720 scheme=euler seed=20200101 paths=20000" +
+			" payoff=" + (k % 2 == 0 ? "call" : "put") + " args=" + std::to_string(98 + k / 2) + " rate=0.001";
+		responses.emplace_back(service.submit(parseRequest(line)));
+	}
+	for (auto &response : responses)
+		std::cout << formatResponse(response.get());
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Where the time of a simulation goes: stage timers, path-step and
+// allocation counts and thread busy/idle time (needs MC_INSTRUMENTATION)
+void instrumentedGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 20000 };
+
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+
+	instrumentation::reset();
+	instrumentation::enable();
+	auto paths = fdm_gbm(simuls);
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	batchTerminalPayoff(call_strategy, paths);
+
+	// the same on a warm thread pool:
+	fdm_gbm.setThreadPool(std::make_shared<ThreadPool>());
+	paths = fdm_gbm(simuls);
+	batchTerminalPayoff(call_strategy, paths);
+	instrumentation::enable(false);
+
+	std::cout << instrumentation::statistics().json() << "\n";
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Heston paths simulated in float, payoffs evaluated in double and accumulated
+// with compensated sums, validated against all-double paths on the same normals:
+void mixedPrecisionHestonEuler() {
+
+	std::cout << "\n\n==== Mixed precision Heston (float paths, compensated accumulation) ====\n";
+
+	float const maturityInYears = 1.0f;
+	float const correlation = 0.0f;
+	std::size_t const numberSteps = 2 * 360;
+	std::size_t const simuls = 3000;
+	double const rate = 0.001;
+	double const strike = 100.0;
+
+	HestonModel<float> hestonFloat{ 0.001f,0.005f,0.14f,0.0155f,0.012f,100.0f,0.025f };
+	HestonModel<double> hestonDouble{ 0.001,0.005,0.14,0.0155,0.012,100.0,0.025 };
+
+	Fdm<HestonModel<float>::FactorCount, float> mixed{ hestonFloat.model(),maturityInYears,correlation,numberSteps };
+	Fdm<HestonModel<double>::FactorCount, double> reference{ hestonDouble.model(),maturityInYears,correlation,numberSteps };
+	mixed.setSeed(2024);
+	reference.setSeed(2024);
+
+	PlainCallStrategy<float> callFloat{ static_cast<float>(strike) };
+	PlainCallStrategy<double> callDouble{ strike };
+
+	auto const report = validate(mixed, reference, callFloat, callDouble, simuls, std::exp(-rate * maturityInYears));
+	std::cout << "float paths:  " << report.mixedPrice << " (se " << report.mixedStandardError << ")\n";
+	std::cout << "double paths: " << report.referencePrice << " (se " << report.referenceStandardError << ")\n";
+	std::cout << "difference:   " << report.difference << " (se " << report.differenceStandardError
+		<< "), bound " << report.errorBound
+		<< (report.withinBound ? " (within bound)" : " (OUTSIDE bound)") << "\n";
+}
+
+
+
+
+// Repeated runs of one engine into a reusable, huge-page backed path arena:
+void pathArenaGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 50000 };
+
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	fdm_gbm.setThreadPool(std::make_shared<ThreadPool>());
+
+	// Arena is allocated on the first run and reused by the next ones:
+	PathArena<double> arena{ PageBacking::TransparentHugePages };
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	double df = std::exp(-1.0*rate*maturityInYears);
+
+	for (std::size_t run = 0; run < 3; ++run) {
+		auto start = std::chrono::system_clock::now();
+		fdm_gbm.simulateInto(arena, simuls, FDMScheme::EulerScheme);
+		double sum{ 0.0 };
+		for (std::size_t i = 0; i < arena.pathCount(); ++i)
+			sum += call_strategy.payoff(arena.path(i).back());
+		auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+		std::cout << "Run " << run << ": call price: " << (df*sum / static_cast<double>(arena.pathCount()))
+			<< " took: " << end << " seconds.\n";
+	}
+	std::cout << "Arena allocations: " << arena.allocations() << ", bytes: " << arena.capacityBytes()
+		<< ", huge pages: " << (arena.backing() != PageBacking::Standard ? "yes" : "no") << "\n";
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Monthly observations simulated on a daily grid shared by all paths:
+void timeGridGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	std::size_t simuls{ 20000 };
+
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+
+	TimePointsType<double> months(13);
+	for (std::size_t m = 0; m < months.size(); ++m)
+		months[m] = static_cast<double>(m) / 12.0;
+	auto grid = TimeGrid<double>::refined(months, 1.0 / 365.0);
+	std::cout << "Grid points: " << grid->size() << ", observations: " << grid->observationCount() << "\n";
+
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),grid };
+	auto start = std::chrono::system_clock::now();
+	auto paths = fdm_gbm(simuls, FDMScheme::EulerScheme);
+
+	// Asian call on the monthly observations only:
+	AsianAvgCallStrategy<> asian_strategy{ 100.0 };
+	double sum{ 0.0 };
+	for (auto const &path : paths)
+		sum += asian_strategy.payoff(grid->observe(path));
+	auto end = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+	std::cout << "Monthly Asian call price: " << (std::exp(-rate * grid->terminationTime()) * sum / simuls)
+		<< " took: " << end << " seconds.\n";
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Non-blocking pricing: progress is polled while the run goes on and the run
+// stops by itself once the standard error is small enough:
+void asyncPricingGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 500000 };
+
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	fdm_gbm.setSeed(20200101);
+	fdm_gbm.setThreadPool(std::make_shared<ThreadPool>());
+
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	AsyncOptions options;
+	options.discountFactor = std::exp(-1.0*rate*maturityInYears);
+	options.targetError = 0.002;
+	options.onComplete = [](PricingProgress const &progress) {
+		std::cout << "Finished after " << progress.pathsDone << " paths.\n";
+	};
+
+	auto handle = submit(fdm_gbm, simuls, call_strategy, options);
+	while (!handle.waitFor(std::chrono::milliseconds(250))) {
+		auto const progress = handle.progress();
+		std::cout << "  " << static_cast<int>(100.0 * progress.fraction()) << "%: "
+			<< progress.estimate << " +- " << progress.standardError << "\n";
+	}
+	auto const result = handle.result();
+	std::cout << "Call price: " << result.estimate << " +- " << result.standardError
+		<< (result.status == RunStatus::Converged ? " (converged)" : "") << " took: "
+		<< result.elapsedSeconds << " seconds.\n";
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// NUMA aware pricing: the pool pins its workers node by node, every node's
+// workers write their own share of the arena and the payoff moments are merged
+// per node before across nodes. Scaling over the nodes is measured at the end:
+void numaGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 100000 };
+
+	auto const topology = NumaTopology::detect();
+	std::cout << "NUMA nodes: " << topology.nodeCount() << ", CPUs: " << topology.cpuCount() << "\n";
+
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	fdm_gbm.setSeed(20200101);
+	auto const pool = std::make_shared<ThreadPool>(topology);
+	fdm_gbm.setThreadPool(pool);
+
+	PathArena<double> arena;
+	auto start = std::chrono::system_clock::now();
+	fdm_gbm.simulateInto(arena, simuls);
+	auto end = std::chrono::system_clock::now();
+	std::cout << "Simulation of " << simuls << " paths took: "
+		<< std::chrono::duration<double>(end - start).count() << " seconds.\n";
+
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	auto const moments = pool->parallelReduce<CompensatedMoments>(simuls, reductionBlockSize,
+		[&](std::size_t first, std::size_t size) {
+		CompensatedMoments block;
+		for (std::size_t i = first; i < first + size; ++i)
+			block.add(call_strategy.payoff(arena.path(i).back()));
+		return block;
+	}, mergeMoments).moments();
+	std::cout << "Call price: " << std::exp(-1.0*rate*maturityInYears) * moments.mean()
+		<< " +- " << std::exp(-1.0*rate*maturityInYears) * moments.standardError() << "\n";
+
+	auto const points = measureScaling(topology, [&](ThreadPool &workers) {
+		Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm{ gbm.model(),maturityInYears,numberSteps };
+		fdm.setSeed(20200101);
+		fdm.setThreadPool(std::shared_ptr<ThreadPool>(&workers, [](ThreadPool *) {}));
+		PathArena<double> local;
+		fdm.simulateInto(local, simuls / 4);
+	});
+	for (auto const &point : points) {
+		std::cout << "  " << point.nodes << " node(s), " << point.threads << " thread(s): "
+			<< point.seconds << " seconds, speedup " << point.speedup
+			<< ", efficiency " << point.efficiency << "\n";
+	}
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Pipelined pricing: paths are generated, stepped and priced chunk by chunk
+// in cache sized pieces, no buffer of the whole run is written:
+void pipelinedGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 100000 };
+
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	fdm_gbm.setSeed(20200101);
+	fdm_gbm.setThreadPool(std::make_shared<ThreadPool>());
+
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	PipelineOptions options;
+	std::cout << "Paths per chunk: " << chunkPaths(fdm_gbm, options) << "\n";
+
+	auto start = std::chrono::system_clock::now();
+	auto const pipelined = pipelinedPayoff(fdm_gbm, simuls, call_strategy, options);
+	auto end = std::chrono::system_clock::now();
+	std::cout << "Pipelined call price: " << std::exp(-1.0*rate*maturityInYears) * pipelined.mean()
+		<< " took: " << std::chrono::duration<double>(end - start).count() << " seconds.\n";
+
+	start = std::chrono::system_clock::now();
+	PathArena<double> arena;
+	fdm_gbm.simulateInto(arena, simuls);
+	auto const stored = compensatedTerminalPayoff(call_strategy, arena.paths());
+	end = std::chrono::system_clock::now();
+	std::cout << "Stored paths call price: " << std::exp(-1.0*rate*maturityInYears) * stored.mean()
+		<< " took: " << std::chrono::duration<double>(end - start).count() << " seconds.\n";
+	std::cout << "=========================================================\n";
+}
+
+
+
+
+// Deterministic reduction: the payoff sum of a seeded run is reduced over fixed
+// path blocks by a fixed tree and comes out bit for bit the same whatever the
+// number of threads:
+void deterministicReductionGBMEuler() {
+
+	double rate{ 0.001 };
+	double sigma{ 0.005 };
+	double s{ 100.0 };
+	double maturityInYears{ 1.0 };
+	std::size_t numberSteps{ 720 }; // two times a day
+	std::size_t simuls{ 50000 };
+
+	GeometricBrownianMotion<> gbm{ rate,sigma,s };
+	std::cout << "Model: " << gbm.name() << "\n";
+	Fdm<GeometricBrownianMotion<>::FactorCount, double> fdm_gbm{ gbm.model(),maturityInYears,numberSteps };
+	fdm_gbm.setSeed(20200101);
+
+	PathArena<double> arena;
+	fdm_gbm.simulateInto(arena, simuls);
+	PlainCallStrategy<> call_strategy{ 100.0 };
+	auto const block = [&](std::size_t first, std::size_t size) {
+		CompensatedMoments moments;
+		for (std::size_t i = first; i < first + size; ++i)
+			moments.add(call_strategy.payoff(arena.path(i).back()));
+		return moments;
+	};
+
+	auto const reference = reduceBlocks<CompensatedMoments>(simuls, reductionBlockSize, block, mergeMoments).moments();
+	std::cout << std::setprecision(17) << "Payoff sum on hardware threads: " << reference.sum << "\n";
+	for (std::size_t threads : { 1, 2, 5, 16 }) {
+		ThreadPool pool(threads);
+		auto const moments = pool.parallelReduce<CompensatedMoments>(simuls, reductionBlockSize, block, mergeMoments).moments();
+		std::cout << "Payoff sum on " << threads << " thread(s): " << moments.sum
+			<< (moments.sum == reference.sum ? " (identical)" : " (differs)") << "\n";
+	}
+	std::cout << std::setprecision(6) << "Call price: " << std::exp(-1.0*rate*maturityInYears) * reference.mean() << "\n";
+	std::cout << "=========================================================\n";
+}
+
+
 
 #endif ///_EXAMPLES_H_
\ No newline at end of file
@@ -0,0 +1,318 @@
+#pragma once
+#if !defined(_FAST_MATH_H_)
+#define _FAST_MATH_H_
+
+#include"mc_types.h"
+#include<cmath>
+#include<algorithm>
+#include<array>
+#include<cstdint>
+#include<cstring>
+#include<limits>
+#include<type_traits>
+
+namespace fast_math {
+
+	using mc_types::MathAccuracy;
+
+	// Branch-free exp/log/pow kernels for float and double.
+	// Table-driven range reduction plus short fixed-degree polynomial, so that
+	// loops over blocks of paths are vectorised by the compiler.
+	// Inputs are expected finite (subnormal log arguments are normalised),
+	// results of exp and pow below the normal range are flushed to zero.
+	// Precise log carries its rounding error in a second term (hi + lo) into
+	// pow, so that pow stays accurate for large |y log x|. Products are split
+	// exactly without fma, which would be a library call on targets without it.
+
+	template<typename T>
+	struct FloatTraits {};
+
+	template<>
+	struct FloatTraits<double> {
+		using BitsType = std::uint64_t;
+		static constexpr int mantissaBits = 52;
+		static constexpr int exponentBias = 1023;
+		static constexpr BitsType exponentMask = 0x7FF;
+		static constexpr BitsType mantissaMask = 0x000FFFFFFFFFFFFFULL;
+		// ln2 = ln2Hi + ln2Lo, ln2Hi has trailing zero bits so that k*ln2Hi is exact
+		static constexpr double ln2Hi = 6.93147180369123816490e-01;
+		static constexpr double ln2Lo = 1.90821492927058770002e-10;
+		// 1.5*2^52: adding it rounds to integer, which lands in the low mantissa bits
+		static constexpr double roundingShifter = 6755399441055744.0;
+		static constexpr double expMin = -708.0;
+		static constexpr double expMax = 709.0;
+		// 2^27 + 1 splits a value into two halves of 26 bits (Veltkamp)
+		static constexpr double splitter = 134217729.0;
+		// 2^54 moves subnormals into the normal range
+		static constexpr double normalizer = 18014398509481984.0;
+		static constexpr double normalizerExponent = 54.0;
+	};
+
+	template<>
+	struct FloatTraits<float> {
+		using BitsType = std::uint32_t;
+		static constexpr int mantissaBits = 23;
+		static constexpr int exponentBias = 127;
+		static constexpr BitsType exponentMask = 0xFF;
+		static constexpr BitsType mantissaMask = 0x007FFFFF;
+		static constexpr float ln2Hi = 6.93359375e-01f;
+		static constexpr float ln2Lo = -2.12194440e-04f;
+		static constexpr float roundingShifter = 12582912.0f;
+		static constexpr float expMin = -87.0f;
+		static constexpr float expMax = 88.0f;
+		static constexpr float splitter = 4097.0f;
+		static constexpr float normalizer = 33554432.0f;
+		static constexpr float normalizerExponent = 25.0f;
+	};
+
+	// Polynomial degrees per accuracy:
+	// exp: Taylor polynomial on |r| <= ln2/128 (table of 2^(j/64))
+	// log: terms of atanh series in s = (m-1)/(m+1), |s| <= 0.1716
+	template<typename T, MathAccuracy Accuracy>
+	struct KernelDegree {
+		static constexpr std::size_t exp = 5;
+		static constexpr std::size_t log = 10;
+	};
+
+	template<>
+	struct KernelDegree<double, MathAccuracy::Fast> {
+		static constexpr std::size_t exp = 3;
+		static constexpr std::size_t log = 6;
+	};
+
+	template<>
+	struct KernelDegree<float, MathAccuracy::Precise> {
+		static constexpr std::size_t exp = 3;
+		static constexpr std::size_t log = 6;
+	};
+
+	template<>
+	struct KernelDegree<float, MathAccuracy::Fast> {
+		static constexpr std::size_t exp = 2;
+		static constexpr std::size_t log = 3;
+	};
+
+	namespace detail {
+
+		static constexpr std::size_t tableBits = 6;
+		static constexpr std::size_t tableSize = (1 << tableBits);
+
+		template<typename T>
+		inline typename FloatTraits<T>::BitsType toBits(T x) {
+			typename FloatTraits<T>::BitsType bits;
+			std::memcpy(&bits, &x, sizeof(T));
+			return bits;
+		}
+
+		template<typename T>
+		inline T fromBits(typename FloatTraits<T>::BitsType bits) {
+			T x;
+			std::memcpy(&x, &bits, sizeof(T));
+			return x;
+		}
+
+		// 2^(j/64), j = 0,...,63
+		template<typename T>
+		struct ExpTable {
+			static const std::array<T, tableSize> values;
+		};
+
+		template<typename T>
+		const std::array<T, tableSize> ExpTable<T>::values = []() {
+			std::array<T, tableSize> table;
+			for (std::size_t j = 0; j < tableSize; ++j)
+				table[j] = static_cast<T>(std::exp2(static_cast<double>(j) / tableSize));
+			return table;
+		}();
+
+		// Horner form of sum_{n=N-1}^{Degree} r^(n-N+1) (N-1)!/n! = 1 + r/N (1 + r/(N+1) (1 + ...)),
+		// unrolled at compile time so that all coefficients are constants
+		template<typename T, std::size_t N, std::size_t Degree>
+		struct ExpPolynomial {
+			static inline T evaluate(T r) {
+				return static_cast<T>(1.0) + r * static_cast<T>(1.0 / N) * ExpPolynomial<T, N + 1, Degree>::evaluate(r);
+			}
+		};
+
+		template<typename T, std::size_t Degree>
+		struct ExpPolynomial<T, Degree + 1, Degree> {
+			static inline T evaluate(T) { return static_cast<T>(1.0); }
+		};
+
+		// Horner form of sum_{k=K}^{Terms-1} z^(k-K)/(2k+1)
+		template<typename T, std::size_t K, std::size_t Terms>
+		struct AtanhPolynomial {
+			static inline T evaluate(T z) {
+				return static_cast<T>(1.0 / (2 * K + 1)) + z * AtanhPolynomial<T, K + 1, Terms>::evaluate(z);
+			}
+		};
+
+		template<typename T, std::size_t Terms>
+		struct AtanhPolynomial<T, Terms, Terms> {
+			static inline T evaluate(T) { return static_cast<T>(0.0); }
+		};
+
+		// Rounding error of product = a*b, exact (Dekker)
+		template<typename T>
+		inline T productError(T a, T b, T product) {
+			T const splitter = FloatTraits<T>::splitter;
+			T const as = a * splitter;
+			T const aHi = as - (as - a);
+			T const aLo = a - aHi;
+			T const bs = b * splitter;
+			T const bHi = bs - (bs - b);
+			T const bLo = b - bHi;
+			return (((aHi * bHi - product) + aHi * bLo + aLo * bHi) + aLo * bLo);
+		}
+
+		// exp(x + lo) for |lo| small against the reduced argument
+		template<MathAccuracy Accuracy, typename T>
+		inline T exp(T x, T lo) {
+			using Traits = FloatTraits<T>;
+			using BitsType = typename Traits::BitsType;
+			T const lower = Traits::expMin;
+			T const upper = Traits::expMax;
+			T const clamped = std::min(std::max(x, lower), upper);
+			// x = (k/64) ln2 + r, k rounded to nearest through the shifter so that
+			// no float-to-integer conversion is needed:
+			T const shifted = clamped * static_cast<T>(1.44269504088896340736 * tableSize) + Traits::roundingShifter;
+			T const k = shifted - Traits::roundingShifter;
+			T const r = ((clamped - k * static_cast<T>(Traits::ln2Hi / tableSize)) -
+				k * static_cast<T>(Traits::ln2Lo / tableSize)) + lo;
+			// k = 64 m + j, exp(x) = 2^m 2^(j/64) exp(r):
+			BitsType const kBits = toBits(shifted) - toBits(Traits::roundingShifter);
+			BitsType const j = kBits & static_cast<BitsType>(tableSize - 1);
+			BitsType const scale = ((kBits - j) << (Traits::mantissaBits - tableBits)) +
+				(static_cast<BitsType>(Traits::exponentBias) << Traits::mantissaBits);
+			// exp(r) = 1 + q, added last so that only the table value and the sum round:
+			T const q = r * ExpPolynomial<T, 2, KernelDegree<T, Accuracy>::exp>::evaluate(r);
+			T const t = ExpTable<T>::values[j];
+			T const result = (t + t * q) * fromBits<T>(scale);
+			return (x < lower) ? static_cast<T>(0.0) :
+				((x > upper) ? std::numeric_limits<T>::infinity() : result);
+		}
+
+		// log(x) = result + lo for finite x > 0, lo = 0 for Fast
+		template<MathAccuracy Accuracy, typename T>
+		inline T log(T x, T &lo) {
+			using Traits = FloatTraits<T>;
+			using BitsType = typename Traits::BitsType;
+			bool const subnormal = (x < std::numeric_limits<T>::min());
+			BitsType const bits = toBits(subnormal ? x * Traits::normalizer : x);
+			// x = 2^e m, m in [1,2), then moved into [sqrt(1/2),sqrt(2)).
+			// The exponent field is turned into floating point through the shifter bits:
+			T const shifter = Traits::roundingShifter;
+			T e = fromBits<T>(toBits(shifter) + ((bits >> Traits::mantissaBits) & Traits::exponentMask)) -
+				shifter - static_cast<T>(Traits::exponentBias);
+			e = subnormal ? e - static_cast<T>(Traits::normalizerExponent) : e;
+			T m = fromBits<T>((bits & Traits::mantissaMask) |
+				(static_cast<BitsType>(Traits::exponentBias) << Traits::mantissaBits));
+			bool const shift = (m > static_cast<T>(1.41421356237309504880));
+			m = shift ? static_cast<T>(0.5) * m : m;
+			e = shift ? e + static_cast<T>(1.0) : e;
+			// log(m) = 2 atanh(s) = 2s + 2s^3/3 + ..., s = f/(2+f), f = m-1 exact:
+			T const f = m - static_cast<T>(1.0);
+			T const u = static_cast<T>(2.0) + f;
+			T const s = f / u;
+			T const s2 = s * s;
+			T const tail = static_cast<T>(2.0) * s * s2 *
+				AtanhPolynomial<T, 1, KernelDegree<T, Accuracy>::log>::evaluate(s2);
+			if (Accuracy == MathAccuracy::Fast) {
+				lo = static_cast<T>(0.0);
+				return (e * Traits::ln2Hi + (e * Traits::ln2Lo + (static_cast<T>(2.0) * s + tail)));
+			}
+			// s + sLo = f/(2+f) to twice the precision, 2+f = u + uLo exactly:
+			T const uLo = f - (u - static_cast<T>(2.0));
+			T const su = s * u;
+			T const sLo = (((f - su) - productError(s, u, su)) - s * uLo) / u;
+			// e ln2Hi + 2s summed exactly (two-sum), the small terms added to the error:
+			T const a = e * Traits::ln2Hi;
+			T const b = static_cast<T>(2.0) * s;
+			T const sum = a + b;
+			T const bVirtual = sum - a;
+			T const sumError = (a - (sum - bVirtual)) + (b - bVirtual);
+			T const error = sumError + (e * Traits::ln2Lo + (static_cast<T>(2.0) * sLo + tail));
+			T const result = sum + error;
+			lo = error - (result - sum);
+			return result;
+		}
+	}
+
+	template<MathAccuracy Accuracy = MathAccuracy::Precise, typename T,
+		typename = typename std::enable_if<std::is_floating_point<T>::value>::type>
+	inline T exp(T x) {
+		if (Accuracy == MathAccuracy::Libm)
+			return std::exp(x);
+		return detail::exp<Accuracy>(x, static_cast<T>(0.0));
+	}
+
+	template<MathAccuracy Accuracy = MathAccuracy::Precise, typename T,
+		typename = typename std::enable_if<std::is_floating_point<T>::value>::type>
+	inline T log(T x) {
+		if (Accuracy == MathAccuracy::Libm)
+			return std::log(x);
+		T lo;
+		T const result = detail::log<Accuracy>(x, lo);
+		return (x > static_cast<T>(0.0)) ? result :
+			((x == static_cast<T>(0.0)) ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::quiet_NaN());
+	}
+
+	// x^y = exp(y log x) for x >= 0. Precise carries the error terms of log
+	// and of the product y log x into exp; Fast error grows with |y log x|.
+	template<MathAccuracy Accuracy = MathAccuracy::Precise, typename T,
+		typename = typename std::enable_if<std::is_floating_point<T>::value>::type>
+	inline T pow(T x, T y) {
+		if (Accuracy == MathAccuracy::Libm)
+			return std::pow(x, y);
+		T lo;
+		T const logX = detail::log<Accuracy>(x, lo);
+		T const product = y * logX;
+		T const productLo = (Accuracy == MathAccuracy::Fast) ? static_cast<T>(0.0) :
+			detail::productError(y, logX, product) + y * lo;
+		T const result = detail::exp<Accuracy>(product, productLo);
+		T const atZero = (y > static_cast<T>(0.0)) ? static_cast<T>(0.0) :
+			((y == static_cast<T>(0.0)) ? static_cast<T>(1.0) : std::numeric_limits<T>::infinity());
+		return (x == static_cast<T>(0.0)) ? atZero :
+			((x < static_cast<T>(0.0)) ? std::numeric_limits<T>::quiet_NaN() : result);
+	}
+
+	// square root is a single correctly rounded instruction already,
+	// kept here so that model code goes through one math layer
+	template<MathAccuracy Accuracy = MathAccuracy::Precise, typename T,
+		typename = typename std::enable_if<std::is_floating_point<T>::value>::type>
+	inline T sqrt(T x) {
+		return std::sqrt(x);
+	}
+
+	// Array versions over blocks of paths, written as plain loops
+	// over the inline kernels so that the compiler vectorises them:
+
+	template<MathAccuracy Accuracy = MathAccuracy::Precise, typename T>
+	inline void exp(T const *x, T *result, std::size_t size) {
+		for (std::size_t i = 0; i < size; ++i)
+			result[i] = fast_math::exp<Accuracy>(x[i]);
+	}
+
+	template<MathAccuracy Accuracy = MathAccuracy::Precise, typename T>
+	inline void log(T const *x, T *result, std::size_t size) {
+		for (std::size_t i = 0; i < size; ++i)
+			result[i] = fast_math::log<Accuracy>(x[i]);
+	}
+
+	template<MathAccuracy Accuracy = MathAccuracy::Precise, typename T>
+	inline void pow(T const *x, T y, T *result, std::size_t size) {
+		for (std::size_t i = 0; i < size; ++i)
+			result[i] = fast_math::pow<Accuracy>(x[i], y);
+	}
+
+	template<MathAccuracy Accuracy = MathAccuracy::Precise, typename T>
+	inline void sqrt(T const *x, T *result, std::size_t size) {
+		for (std::size_t i = 0; i < size; ++i)
+			result[i] = fast_math::sqrt<Accuracy>(x[i]);
+	}
+
+}
+
+
+
+#endif ///_FAST_MATH_H_
@@ -0,0 +1,78 @@
+#pragma once
+#if !defined(_FAST_MATH_T_H_)
+#define _FAST_MATH_T_H_
+
+#include"fast_math.h"
+#include<iostream>
+#include<random>
+#include<string>
+#include<cmath>
+#include<limits>
+
+using namespace fast_math;
+
+
+// Error of value against the long double reference in ulp of the result type
+template<typename T>
+double ulpError(T value, long double reference) {
+	T const rounded = static_cast<T>(reference);
+	if (!std::isfinite(rounded) || rounded == static_cast<T>(0.0))
+		return (value == rounded ? 0.0 : std::numeric_limits<double>::infinity());
+	long double const ulp = std::abs(static_cast<long double>(std::nextafter(rounded,
+		std::numeric_limits<T>::infinity())) - static_cast<long double>(rounded));
+	return static_cast<double>(std::abs(static_cast<long double>(value) - reference) / ulp);
+}
+
+// Largest ulp error of exp, log and pow over the whole domain: exp over
+// [expMin,expMax] (outside it results are flushed), log over all positive
+// finite values (subnormals included) and pow over all bases with y log x
+// within [expMin,expMax].
+template<typename T, MathAccuracy Accuracy>
+void fastMathUlp(std::string const &name) {
+	using Traits = FloatTraits<T>;
+	std::mt19937_64 engine{ 20240101 };
+	std::uniform_real_distribution<double> mantissa(1.0, 2.0);
+	std::uniform_int_distribution<int> exponent(std::numeric_limits<T>::min_exponent - std::numeric_limits<T>::digits,
+		std::numeric_limits<T>::max_exponent - 1);
+	std::uniform_real_distribution<double> argument(Traits::expMin, Traits::expMax);
+	std::uniform_real_distribution<double> power(-4.0, 4.0);
+	std::size_t const samples{ 2000000 };
+
+	double expError{ 0.0 };
+	double logError{ 0.0 };
+	double powError{ 0.0 };
+	for (std::size_t i = 0; i < samples; ++i) {
+		T const e = static_cast<T>(argument(engine));
+		expError = std::max(expError, ulpError(fast_math::exp<Accuracy>(e), std::exp(static_cast<long double>(e))));
+
+		T const x = static_cast<T>(std::ldexp(mantissa(engine), exponent(engine)));
+		if (x > static_cast<T>(0.0) && std::isfinite(x))
+			logError = std::max(logError, ulpError(fast_math::log<Accuracy>(x), std::log(static_cast<long double>(x))));
+
+		T const y = static_cast<T>(power(engine));
+		long double const exact = std::pow(static_cast<long double>(x), static_cast<long double>(y));
+		if (x > static_cast<T>(0.0) && std::isfinite(x) &&
+			exact >= std::exp(static_cast<long double>(Traits::expMin)) &&
+			exact < static_cast<long double>(std::exp(static_cast<long double>(Traits::expMax))))
+			powError = std::max(powError, ulpError(fast_math::pow<Accuracy>(x, y), exact));
+	}
+	std::cout << name << ": exp " << expError << " ulp, log " << logError << " ulp, pow " << powError << " ulp\n";
+}
+
+void fastMathAccuracy() {
+	fastMathUlp<double, MathAccuracy::Precise>("double Precise");
+	fastMathUlp<double, MathAccuracy::Fast>("double Fast");
+	fastMathUlp<float, MathAccuracy::Precise>("float Precise");
+	fastMathUlp<float, MathAccuracy::Fast>("float Fast");
+
+	// cases of large |y log x| and subnormal arguments:
+	std::cout << "pow(1e200,1.5): " << ulpError(fast_math::pow(1.0e200, 1.5),
+		std::pow(static_cast<long double>(1.0e200), 1.5L)) << " ulp\n";
+	double const subnormal = std::numeric_limits<double>::denorm_min() * 1.0e5;
+	std::cout << "log(" << subnormal << "): " << fast_math::log(subnormal)
+		<< " (std::log " << std::log(subnormal) << ")\n";
+}
+
+
+
+#endif ///_FAST_MATH_T_H_
@@ -5,8 +5,15 @@
 #include"mc_types.h"
 #include"fdm_scheme.h"
 #include"sde.h"
+#include"thread_pool.h"
+#include"path_buffer.h"
+#include"time_grid.h"
+#include"instrumentation.h"
 #include<thread>
 #include<future>
+#include<memory>
+#include<cstdint>
+#include<cmath>
 
 namespace finite_difference_method {
 
@@ -15,6 +22,61 @@ namespace finite_difference_method {
 	using mc_types::TimePointsType;
 	using mc_types::FDMScheme;
 	using sde::Sde;
+	using term_structure::StepCoefficientTable;
+	using thread_pool::ThreadPool;
+	using path_buffer::PathArena;
+	using mc_types::PageBacking;
+	using time_grid::TimeGrid;
+	using instrumentation::Stage;
+	using instrumentation::StageTimer;
+
+
+	// Simulated paths together with pathwise discount factors
+	// exp(-integral of the short rate over the whole path)
+	template<typename T>
+	struct DiscountedPaths {
+		PathValuesType<PathValuesType<T>> paths;
+		PathValuesType<T> discountFactors;
+	};
+
+
+	namespace detail {
+
+		// Buffers of one block of a pipelined run, reused chunk after chunk so
+		// that every chunk is generated and stepped in the same warm cache lines
+		template<typename T>
+		struct PipelineBuffers {
+			PathArena<T> paths{ PageBacking::Standard };
+			PathArena<T> normals{ PageBacking::Standard };
+			std::vector<JumpScheduleType<T>> jumps;
+			StepWorkspace<T> workspace;
+		};
+
+		// Simulates size paths of the given seeds into buffers stage by stage:
+		// all normals of the chunk first, then the stepping of the whole chunk.
+		// Unstaged schemes simulate path by path.
+		template<typename T, typename Scheme>
+		PathArena<T> const &simulateChunk(Scheme &scheme, std::random_device::result_type const *seeds,
+			std::size_t size, PipelineBuffers<T> &buffers) {
+			auto &paths = buffers.paths;
+			paths.reset(size, scheme.storedLength());
+			if (!scheme.isStaged()) {
+				for (std::size_t i = 0; i < size; ++i)
+					instrumentation::timedFill(paths.pathLength(), [&]() {
+						scheme.simulateInto(seeds[i], paths.path(i)); });
+				return paths;
+			}
+			auto &normals = buffers.normals;
+			normals.reset(size, scheme.normalsPerPath());
+			if (buffers.jumps.size() < size)
+				buffers.jumps.resize(size);
+			for (std::size_t i = 0; i < size; ++i)
+				scheme.drawNormals(seeds[i], normals.path(i), buffers.jumps[i]);
+			instrumentation::timedFill(paths.pathLength(), [&]() {
+				scheme.stepChunk(normals, buffers.jumps, paths, buffers.workspace); }, size);
+			return paths;
+		}
+	}
 
 
 	template<std::size_t FactorCount,typename T,typename ...Ts>
@@ -27,40 +89,54 @@ namespace finite_difference_method {
 	template<typename T,typename ...Ts>
 	class FdmBuilder<1,T,Ts...> {
 	protected:
-		bool timePointsOn_{ false };
-		T terminationTime_;
-		TimePointsType<T> timePoints_;
-		std::size_t numberSteps_;
 		std::shared_ptr<Sde<T,Ts...>> model_;
+		std::shared_ptr<TimeGrid<T> const> grid_;
+		bool seeded_{ false };
+		std::uint64_t seed_{ 0 };
+		std::size_t firstPath_{ 0 };
+		std::shared_ptr<ThreadPool> pool_;
 
 	public:
 		FdmBuilder(std::shared_ptr<Sde<T,Ts...>> const &model,T const &terminationTime,
 			std::size_t numberSteps = 360)
-			:model_{ model },terminationTime_ {terminationTime},numberSteps_{numberSteps}{}
+			:model_{ model },grid_{ TimeGrid<T>::uniform(terminationTime,numberSteps) }{}
 
 		FdmBuilder(ISde<T,Ts...> const &isde,T const &init, T const &terminationTime,
 			std::size_t numberSteps = 360)
-			:model_{ new Sde<T,Ts...>{isde,init} }, terminationTime_{ terminationTime },
-			numberSteps_{ numberSteps } {}
+			:model_{ new Sde<T,Ts...>{isde,init} }, grid_{ TimeGrid<T>::uniform(terminationTime,numberSteps) } {}
 
 		FdmBuilder(std::shared_ptr<Sde<T, Ts...>> const &model, TimePointsType<T> const &timePoints)
-			:model_{ model }, timePoints_{ timePoints }, timePointsOn_{ true } {}
+			:model_{ model }, grid_{ TimeGrid<T>::fromPoints(timePoints) } {}
 
 		FdmBuilder(ISde<T, Ts...> const &isde, T const &init, TimePointsType<T> const &timePoints)
-			:model_{ new Sde<T,Ts...>{ isde,init } }, timePoints_{ timePoints }, timePointsOn_{true} {}
-
-		inline TimePointsType<T> timeResolution()const {
-			if (timePointsOn_ == false) {
-				TimePointsType<T> points(numberSteps_ + 1);
-				auto delta = (terminationTime_ / static_cast<T>(numberSteps_));
-				std::size_t i = 0;
-				std::generate(points.begin(), points.end(), [&i, &delta]() {return delta * i++; });
-				return points;
-			}
-			else {
-				return timePoints_;
-			}
-		}
+			:model_{ new Sde<T,Ts...>{ isde,init } }, grid_{ TimeGrid<T>::fromPoints(timePoints) } {}
+
+		FdmBuilder(std::shared_ptr<Sde<T, Ts...>> const &model, std::shared_ptr<TimeGrid<T> const> const &grid)
+			:model_{ model }, grid_{ grid } {}
+
+		// Fixes the seed of the run: path i is then always generated from
+		// mc_utilities::pathSeed(seed,i), which gives common random numbers
+		// across repeated runs (e.g. calibration). Unseeded runs draw the
+		// path seeds from std::random_device.
+		inline void setSeed(std::uint64_t seed) { seeded_ = true; seed_ = seed; }
+		inline void resetSeed() { seeded_ = false; }
+		inline bool isSeeded()const { return seeded_; }
+		inline std::uint64_t seed()const { return seed_; }
+
+		// Index of the first path of the next run: a seeded run of n paths then
+		// generates paths [firstPath,firstPath+n) of the whole seeded sequence,
+		// so that a simulation can be produced block by block.
+		inline void setFirstPath(std::size_t firstPath) { firstPath_ = firstPath; }
+		inline std::size_t firstPath()const { return firstPath_; }
+
+		// Paths run on the warm threads of pool instead of one new thread
+		// per path; paths and their seeds are the same either way.
+		inline void setThreadPool(std::shared_ptr<ThreadPool> const &pool) { pool_ = pool; }
+		inline std::shared_ptr<ThreadPool> const &threadPool()const { return pool_; }
+
+		// Grid shared by all runs of this engine, path[i] is taken at time i of it
+		inline std::shared_ptr<TimeGrid<T> const> const &timeGrid()const { return grid_; }
+		inline TimePointsType<T> const &timeResolution()const { return grid_->times(); }
 
 		virtual PathValuesType<PathValuesType<T>> operator()(std::size_t iterations,FDMScheme scheme = FDMScheme::EulerScheme)=0;
 
@@ -72,67 +148,84 @@ namespace finite_difference_method {
 	template<typename T,typename ...Ts>
 	class FdmBuilder<2, T, Ts...> {
 	protected:
-		bool timePointsOn_{ false };
-		T terminationTime_;
-		TimePointsType<T> timePoints_;
 		T correlation_;
-		std::size_t numberSteps_;
 		std::shared_ptr<Sde<T,Ts...>> factor1_;
 		std::shared_ptr<Sde<T,Ts...>> factor2_;
+		std::shared_ptr<TimeGrid<T> const> grid_;
+		bool seeded_{ false };
+		std::uint64_t seed_{ 0 };
+		std::size_t firstPath_{ 0 };
+		std::shared_ptr<ThreadPool> pool_;
 
 	public:
 		FdmBuilder(std::tuple<std::shared_ptr<Sde<T,Ts...>>, std::shared_ptr<Sde<T, Ts...>>> const &model,
 			T const &terminationTime,T correlation = 0.0,std::size_t numberSteps = 360)
 			:factor1_{ std::get<0>(model) },factor2_{std::get<1>(model)},
-			terminationTime_{ terminationTime }, correlation_{ correlation },
-			numberSteps_ {numberSteps} {}
+			correlation_{ correlation }, grid_{ TimeGrid<T>::uniform(terminationTime,numberSteps) } {}
 
 		FdmBuilder(std::shared_ptr<Sde<T, Ts...>> const &factor1,
 			std::shared_ptr<Sde<T, Ts...>> const &factor2,
 			T const &terminationTime, T correlation = 0.0, std::size_t numberSteps = 360)
 			:factor1_{factor1 }, factor2_{ factor2 },
-			terminationTime_{ terminationTime },correlation_{correlation},
-			numberSteps_{ numberSteps } {}
+			correlation_{correlation}, grid_{ TimeGrid<T>::uniform(terminationTime,numberSteps) } {}
 
 		FdmBuilder(ISde<T,Ts...> const &isde1, T const &init1,
 			ISde<T, Ts...> const &isde2, T const &init2,
 			T const &terminationTime,T correlation=0.0,std::size_t numberSteps = 360)
 			:factor1_{ new Sde<T,Ts...>{ isde1,init1 } },
 			factor2_{ new Sde<T,Ts...>{ isde2,init2 } },
-			terminationTime_{ terminationTime },
 			correlation_{correlation},
-			numberSteps_{ numberSteps } {}
+			grid_{ TimeGrid<T>::uniform(terminationTime,numberSteps) } {}
 
 		FdmBuilder(std::tuple<std::shared_ptr<Sde<T, Ts...>>, std::shared_ptr<Sde<T, Ts...>>> const &model,
 				TimePointsType<T> const &timePoints, T correlation = 0.0)
-			:factor1_{ std::get<0>(model) }, factor2_{ std::get<1>(model) }, timePoints_{ timePoints },
-			correlation_{ correlation }, timePointsOn_{true} {}
+			:factor1_{ std::get<0>(model) }, factor2_{ std::get<1>(model) },
+			correlation_{ correlation }, grid_{ TimeGrid<T>::fromPoints(timePoints) } {}
 
 		FdmBuilder(std::shared_ptr<Sde<T, Ts...>> const &factor1,
 			std::shared_ptr<Sde<T, Ts...>> const &factor2,
 			TimePointsType<T> const &timePoints, T correlation = 0.0)
-			:factor1_{ factor1 }, factor2_{ factor2 }, timePoints_{ timePoints },
-			correlation_{ correlation }, timePointsOn_{ true } {}
+			:factor1_{ factor1 }, factor2_{ factor2 },
+			correlation_{ correlation }, grid_{ TimeGrid<T>::fromPoints(timePoints) } {}
 
 		FdmBuilder(ISde<T, Ts...> const &isde1, T const &init1,
 			ISde<T, Ts...> const &isde2, T const &init2,
 			TimePointsType<T> const &timePoints, T correlation = 0.0)
 			:factor1_{ new Sde<T,Ts...>{ isde1,init1 } },
 			factor2_{ new Sde<T,Ts...>{ isde2,init2 } },
-			timePoints_{ timePoints },correlation_{ correlation }, timePointsOn_{true} {}
-
-		TimePointsType<T> timeResolution()const {
-			if (timePointsOn_ == false) {
-				TimePointsType<T> points(numberSteps_ + 1);
-				auto delta = (terminationTime_ / static_cast<T>(numberSteps_));
-				std::size_t i = 0;
-				std::generate(points.begin(), points.end(), [&i, &delta]() {return delta * i++; });
-				return points;
-			}
-			else {
-				return timePoints_;
-			}
-		}
+			correlation_{ correlation }, grid_{ TimeGrid<T>::fromPoints(timePoints) } {}
+
+		FdmBuilder(std::tuple<std::shared_ptr<Sde<T, Ts...>>, std::shared_ptr<Sde<T, Ts...>>> const &model,
+			std::shared_ptr<TimeGrid<T> const> const &grid, T correlation = 0.0)
+			:factor1_{ std::get<0>(model) }, factor2_{ std::get<1>(model) },
+			correlation_{ correlation }, grid_{ grid } {}
+
+		// Fixes the seed of the run: path i is then always generated from
+		// mc_utilities::pathSeed(seed,i), which gives common random numbers
+		// across repeated runs (e.g. calibration). Unseeded runs draw the
+		// path seeds from std::random_device.
+		inline void setSeed(std::uint64_t seed) { seeded_ = true; seed_ = seed; }
+		inline void resetSeed() { seeded_ = false; }
+		inline bool isSeeded()const { return seeded_; }
+		inline std::uint64_t seed()const { return seed_; }
+
+		// correlation of the Brownian motions driving the two factors
+		inline T const &correlation()const { return correlation_; }
+
+		// Index of the first path of the next run: a seeded run of n paths then
+		// generates paths [firstPath,firstPath+n) of the whole seeded sequence,
+		// so that a simulation can be produced block by block.
+		inline void setFirstPath(std::size_t firstPath) { firstPath_ = firstPath; }
+		inline std::size_t firstPath()const { return firstPath_; }
+
+		// Paths run on the warm threads of pool instead of one new thread
+		// per path; paths and their seeds are the same either way.
+		inline void setThreadPool(std::shared_ptr<ThreadPool> const &pool) { pool_ = pool; }
+		inline std::shared_ptr<ThreadPool> const &threadPool()const { return pool_; }
+
+		// Grid shared by all runs of this engine, path[i] is taken at time i of it
+		inline std::shared_ptr<TimeGrid<T> const> const &timeGrid()const { return grid_; }
+		inline TimePointsType<T> const &timeResolution()const { return grid_->times(); }
 
 		virtual PathValuesType<PathValuesType<T>> operator()(std::size_t iterations,FDMScheme scheme = FDMScheme::EulerScheme) = 0;
 	};
@@ -150,7 +243,29 @@ namespace finite_difference_method {
 	class Fdm<1, T> :public FdmBuilder<1, T, T,T> {
 	private:
 		std::random_device rd_;
+
+		// seeds of the paths of one run, owned by that run
+		inline std::vector<std::random_device::result_type> drawSeeds(std::size_t iterations) {
+			std::vector<std::random_device::result_type> seeds(iterations);
+			for (std::size_t i = 0; i < iterations; ++i)
+				seeds[i] = pathSeed(i);
+			return seeds;
+		}
+
 	public:
+		// Seed of path index of the next run (firstPath() counted in),
+		// a draw of std::random_device when the engine is unseeded
+		inline std::random_device::result_type pathSeed(std::size_t index) {
+			if (this->seeded_)
+				return static_cast<std::random_device::result_type>(mc_utilities::pathSeed(this->seed_, this->firstPath_ + index));
+			return rd_();
+		}
+
+		// Scheme of the runs of this engine, for callers stepping paths themselves
+		inline std::shared_ptr<SchemeBuilder<1, T, T, T>> makeScheme(FDMScheme scheme) {
+			return finite_difference_method::makeScheme<T>(this->model_, this->grid_, scheme);
+		}
+
 		Fdm(std::shared_ptr<Sde<T, T, T>> const &model, T const &terminationTime,
 			std::size_t numberSteps = 360)
 			:FdmBuilder<1,T,T,T>{model,terminationTime,numberSteps}{}
@@ -165,61 +280,50 @@ namespace finite_difference_method {
 		Fdm(ISde<T, T, T> const &isde, T const &init, TimePointsType<T> const &timePoints)
 			:FdmBuilder<1, T, T, T>{ isde,init,timePoints } {}
 
+		Fdm(std::shared_ptr<Sde<T, T, T>> const &model, std::shared_ptr<TimeGrid<T> const> const &grid)
+			:FdmBuilder<1, T, T, T>{ model,grid } {}
+
 		PathValuesType<PathValuesType<T>> operator()(std::size_t iterations,
 													FDMScheme scheme = FDMScheme::EulerScheme)override{
 
-			asyncKernel<T,std::random_device::result_type> asyncGenerator = nullptr;
-			asyncKernel<T,std::random_device::result_type, TimePointsType<T>&> asyncGeneratorTP = nullptr;
-			T delta = (this->terminationTime_ / static_cast<T>(this->numberSteps_));
-
-			switch (scheme) { 
-			case FDMScheme::EulerScheme:
-			{
-				if (this->timePointsOn_ == false) {
-					EulerScheme<1, T> euler(this->model_, delta, this->numberSteps_);
-					asyncGenerator = std::bind(&EulerScheme<1,T>::simulate,
-						&euler,std::placeholders::_1);
-				}
-				else if (this->timePointsOn_ == true) {
-					EulerScheme<1, T> euler(this->model_);
-					asyncGeneratorTP = std::bind(&EulerScheme<1, T>::simulateWithTimePoints, 
-						&euler, std::placeholders::_1,std::placeholders::_2);
-				}				
-			}
-			break;
-			case FDMScheme::MilsteinScheme:
-			{
-				if (this->timePointsOn_ == false) {
-					MilsteinScheme<1, T> milstein(this->model_, delta, this->numberSteps_);
-					asyncGenerator = std::bind(&MilsteinScheme<1,T>::simulate,
-						&milstein,std::placeholders::_1);
-				}
-				else if (this->timePointsOn_ == true) {
-					MilsteinScheme<1, T> milstein(this->model_);
-					asyncGeneratorTP = std::bind(&MilsteinScheme<1,T>::simulateWithTimePoints,
-						&milstein,std::placeholders::_1,std::placeholders::_2);
-				}
-			}
-			break;
+			StageTimer setup{ Stage::Setup };
+			auto const fdmScheme = makeScheme(scheme);
+			asyncKernel<T, std::random_device::result_type> asyncGenerator =
+				std::bind(&SchemeBuilder<1, T, T, T>::simulate, fdmScheme, std::placeholders::_1);
+
+			setup.stop();
+			auto const generate = [&](std::random_device::result_type seed) {
+				return instrumentation::timedPath(asyncGenerator, seed);
+			};
+
+			if (this->pool_) {
+				StageTimer launch{ Stage::Launch };
+				auto const seeds = drawSeeds(iterations);
+				PathValuesType<PathValuesType<T>> paths(iterations);
+				instrumentation::recordAllocation(iterations * sizeof(PathValuesType<T>));
+				launch.stop();
+				StageTimer join{ Stage::Join };
+				this->pool_->parallelFor(iterations, [&](std::size_t i) {
+					paths[i] = generate(seeds[i]);
+				});
+				return paths;
 			}
 
+			StageTimer launch{ Stage::Launch };
 			PathValuesType<std::future<PathValuesType<T>>> futures;
 			futures.reserve(iterations);
+			instrumentation::recordAllocation(iterations * sizeof(std::future<PathValuesType<T>>));
 
-			if (this->timePointsOn_ == false) {
-				for (std::size_t i = 0; i < iterations; ++i) {
-					futures.emplace_back(std::async(std::launch::async, asyncGenerator, rd_()));
-				}
-			}
-			else if (this->timePointsOn_ == true) {
-				for (std::size_t i = 0; i < iterations; ++i) {
-					futures.emplace_back(std::async(std::launch::async, asyncGeneratorTP, rd_(), std::ref(this->timePoints_)));
-				}
+			for (std::size_t i = 0; i < iterations; ++i) {
+				futures.emplace_back(std::async(std::launch::async, generate, pathSeed(i)));
 			}
+			launch.stop();
 			
 
+			StageTimer join{ Stage::Join };
 			PathValuesType<PathValuesType<T>> paths;
 			paths.reserve(iterations);
+			instrumentation::recordAllocation(iterations * sizeof(PathValuesType<T>));
 
 			for (auto &path : futures) {
 				paths.emplace_back(std::move(path.get()));
@@ -228,6 +332,79 @@ namespace finite_difference_method {
 			return paths;
 		}
 
+		// Same paths as operator() written into arena, path i at arena.path(i).
+		// Once the arena is large enough repeated runs allocate nothing per path.
+		// With a NUMA thread pool each node's share of the paths is written, and
+		// so placed, by that node's workers.
+		void simulateInto(PathArena<T> &arena, std::size_t iterations,
+			FDMScheme scheme = FDMScheme::EulerScheme) {
+			StageTimer setup{ Stage::Setup };
+			auto const fdmScheme = makeScheme(scheme);
+			arena.reset(iterations, fdmScheme->storedLength());
+			auto const seeds = drawSeeds(iterations);
+			setup.stop();
+
+			StageTimer join{ Stage::Join };
+			auto const fill = [&](std::size_t i) {
+				instrumentation::timedFill(arena.pathLength(), [&]() {
+					fdmScheme->simulateInto(seeds[i], arena.path(i)); });
+			};
+			if (this->pool_)
+				this->pool_->parallelFor(iterations, fill);
+			else
+				mc_utilities::parallelFor(iterations, fill);
+		}
+
+		// Pipelined run of iterations paths in blocks of blockSize paths: a worker
+		// takes a block and goes through it in chunks of chunkSize paths, drawing
+		// the normals of all paths of a chunk, stepping them and handing the chunk
+		// to consume(blockResult, firstPath, chunk) while it is still in cache, so
+		// no run-sized buffer is ever written. chunk.path(i) is path firstPath+i
+		// of simulateInto(); block results come back in block order and do not
+		// depend on chunkSize when consume folds paths in order.
+		// Every block owns the buffers its chunks are simulated into.
+		template<typename Result, typename Consume>
+		std::vector<Result> simulatePipelined(std::size_t iterations, std::size_t blockSize, std::size_t chunkSize,
+			Consume &&consume, FDMScheme scheme = FDMScheme::EulerScheme) {
+			StageTimer setup{ Stage::Setup };
+			auto const fdmScheme = makeScheme(scheme);
+			auto const seeds = drawSeeds(iterations);
+			setup.stop();
+
+			StageTimer join{ Stage::Join };
+			chunkSize = std::max<std::size_t>(1, chunkSize);
+			auto const block = [&](std::size_t first, std::size_t size) {
+				Result result{};
+				detail::PipelineBuffers<T> buffers;
+				for (std::size_t c = first; c < first + size; c += chunkSize) {
+					std::size_t const chunk = std::min(chunkSize, first + size - c);
+					consume(result, c, detail::simulateChunk<T>(*fdmScheme, seeds.data() + c, chunk, buffers));
+				}
+				return result;
+			};
+			if (this->pool_)
+				return this->pool_->template parallelBlocks<Result>(iterations, blockSize, block);
+			return mc_utilities::parallelBlocks<Result>(iterations, blockSize, block);
+		}
+
+		// Model is taken as short rate: every path is integrated by the trapezoid
+		// rule over timeResolution() to give its discount factor.
+		DiscountedPaths<T> discountedPaths(std::size_t iterations,
+			FDMScheme scheme = FDMScheme::EulerScheme) {
+			DiscountedPaths<T> result;
+			result.paths = (*this)(iterations, scheme);
+			auto const &grid = *(this->grid_);
+			result.discountFactors.reserve(result.paths.size());
+			for (auto const &path : result.paths) {
+				T integral{};
+				for (std::size_t i = 1; i < path.size(); ++i) {
+					integral += 0.5 * (path[i - 1] + path[i]) * grid.dt(i);
+				}
+				result.discountFactors.emplace_back(std::exp(-integral));
+			}
+			return result;
+		}
+
 	};
 
 	template<typename T>
@@ -235,7 +412,89 @@ namespace finite_difference_method {
 	private:
 		std::random_device rd_;
 
+		// seeds of the paths of one run, owned by that run
+		inline std::vector<std::random_device::result_type> drawSeeds(std::size_t iterations) {
+			std::vector<std::random_device::result_type> seeds(iterations);
+			for (std::size_t i = 0; i < iterations; ++i)
+				seeds[i] = pathSeed(i);
+			return seeds;
+		}
+
+		PathValuesType<PathValuesType<T>> simulate(std::size_t iterations, FDMScheme scheme,
+			bool accumulateDiscount) {
+
+			StageTimer setup{ Stage::Setup };
+			auto const fdmScheme = makeScheme(scheme, accumulateDiscount);
+			asyncKernel<T, std::random_device::result_type> asyncGenerator =
+				std::bind(&SchemeBuilder<2, T, T, T, T>::simulate, fdmScheme, std::placeholders::_1);
+
+			setup.stop();
+			auto const generate = [&](std::random_device::result_type seed) {
+				return instrumentation::timedPath(asyncGenerator, seed);
+			};
+
+			if (this->pool_) {
+				StageTimer launch{ Stage::Launch };
+				auto const seeds = drawSeeds(iterations);
+				PathValuesType<PathValuesType<T>> paths(iterations);
+				instrumentation::recordAllocation(iterations * sizeof(PathValuesType<T>));
+				launch.stop();
+				StageTimer join{ Stage::Join };
+				this->pool_->parallelFor(iterations, [&](std::size_t i) {
+					paths[i] = generate(seeds[i]);
+				});
+				return paths;
+			}
+
+			StageTimer launch{ Stage::Launch };
+			PathValuesType<std::future<PathValuesType<T>>> futures;
+			futures.reserve(iterations);
+			instrumentation::recordAllocation(iterations * sizeof(std::future<PathValuesType<T>>));
+
+			for (std::size_t i = 0; i < iterations; ++i) {
+				futures.emplace_back(std::async(std::launch::async, generate, pathSeed(i)));
+			}
+			launch.stop();
+
+
+			StageTimer join{ Stage::Join };
+			PathValuesType<PathValuesType<T>> paths;
+			paths.reserve(iterations);
+			instrumentation::recordAllocation(iterations * sizeof(PathValuesType<T>));
+
+			for (auto &path : futures) {
+				paths.emplace_back(std::move(path.get()));
+			}
+
+			return paths;
+		}
+
 	public:
+		// Seed of path index of the next run (firstPath() counted in),
+		// a draw of std::random_device when the engine is unseeded
+		inline std::random_device::result_type pathSeed(std::size_t index) {
+			if (this->seeded_)
+				return static_cast<std::random_device::result_type>(mc_utilities::pathSeed(this->seed_, this->firstPath_ + index));
+			return rd_();
+		}
+
+		// Scheme of the runs of this engine, for callers stepping paths themselves
+		std::shared_ptr<SchemeBuilder<2, T, T, T, T>> makeScheme(FDMScheme scheme, bool accumulateDiscount = false) {
+			auto const model = std::make_tuple(this->factor1_, this->factor2_);
+
+			std::shared_ptr<SchemeBuilder<2, T, T, T, T>> result = nullptr;
+			switch (scheme) {
+			case FDMScheme::EulerScheme:
+				result = std::make_shared<EulerScheme<2, T>>(model, this->correlation_, this->grid_);
+				break;
+			case FDMScheme::MilsteinScheme:
+				result = std::make_shared<MilsteinScheme<2, T>>(model, this->correlation_, this->grid_);
+				break;
+			}
+			result->setDiscountAccumulation(accumulateDiscount);
+			return result;
+		}
+
 		Fdm(std::tuple<std::shared_ptr<Sde<T, T,T,T>>, std::shared_ptr<Sde<T, T,T,T>>> const &model,
 			T const &terminationTime,T correlation = 0.0, std::size_t numberSteps = 360)
 			:FdmBuilder<2, T, T,T,T>{ model,terminationTime,correlation,numberSteps } {}
@@ -267,74 +526,85 @@ namespace finite_difference_method {
 			:FdmBuilder<2, T, T, T, T>{ isde1,init1,isde2,init2,timePoints,
 			correlation} {}
 
+		Fdm(std::tuple<std::shared_ptr<Sde<T, T, T, T>>, std::shared_ptr<Sde<T, T, T, T>>> const &model,
+			std::shared_ptr<TimeGrid<T> const> const &grid, T correlation = 0.0)
+			:FdmBuilder<2, T, T, T, T>{ model,grid,correlation } {}
 
 		PathValuesType<PathValuesType<T>> operator()(std::size_t iterations,
 			FDMScheme scheme = FDMScheme::EulerScheme)override {
+			return simulate(iterations, scheme, false);
+		}
 
-			asyncKernel<T, std::random_device::result_type> asyncGenerator = nullptr;
-			asyncKernel<T, std::random_device::result_type, TimePointsType<T>&> asyncGeneratorTP = nullptr;
-			T delta = (this->terminationTime_ / static_cast<T>(this->numberSteps_));
-
-			switch (scheme) {
-			case FDMScheme::EulerScheme:
-			{
-				if (this->timePointsOn_ == false) {
-					EulerScheme<2, T> euler(std::make_tuple(this->factor1_,this->factor2_),
-						this->correlation_,delta, this->numberSteps_);
-					asyncGenerator = std::bind(&EulerScheme<2, T>::simulate,
-						&euler, std::placeholders::_1);
-				}
-				else if (this->timePointsOn_ == true) {
-					EulerScheme<2, T> euler(std::make_tuple(this->factor1_,this->factor2_),
-						this->correlation_);
-					asyncGeneratorTP = std::bind(&EulerScheme<2, T>::simulateWithTimePoints,
-						&euler, std::placeholders::_1, std::placeholders::_2);
-				}
-			}
-			break;
-			case FDMScheme::MilsteinScheme:
-			{
-				if (this->timePointsOn_ == false) {
-					MilsteinScheme<2, T> milstein(std::make_tuple(this->factor1_, this->factor2_),
-						this->correlation_, delta, this->numberSteps_);
-					asyncGenerator = std::bind(&MilsteinScheme<2, T>::simulate,
-						&milstein, std::placeholders::_1);
-				}
-				else if (this->timePointsOn_ == true) {
-					MilsteinScheme<2, T> milstein(std::make_tuple(this->factor1_, this->factor2_),
-						this->correlation_);
-					asyncGeneratorTP = std::bind(&MilsteinScheme<2, T>::simulateWithTimePoints,
-						&milstein, std::placeholders::_1,std::placeholders::_2);
-				}
-			}
-			break;
-			}
-
-			PathValuesType<std::future<PathValuesType<T>>> futures;
-			futures.reserve(iterations);
+		// Same paths as operator() written into arena, path i at arena.path(i).
+		// Once the arena is large enough repeated runs allocate nothing per path.
+		// With a NUMA thread pool each node's share of the paths is written, and
+		// so placed, by that node's workers.
+		void simulateInto(PathArena<T> &arena, std::size_t iterations,
+			FDMScheme scheme = FDMScheme::EulerScheme) {
+			StageTimer setup{ Stage::Setup };
+			auto const fdmScheme = makeScheme(scheme, false);
+			arena.reset(iterations, fdmScheme->storedLength());
+			auto const seeds = drawSeeds(iterations);
+			setup.stop();
+
+			StageTimer join{ Stage::Join };
+			auto const fill = [&](std::size_t i) {
+				instrumentation::timedFill(arena.pathLength(), [&]() {
+					fdmScheme->simulateInto(seeds[i], arena.path(i)); });
+			};
+			if (this->pool_)
+				this->pool_->parallelFor(iterations, fill);
+			else
+				mc_utilities::parallelFor(iterations, fill);
+		}
 
-			if (this->timePointsOn_ == false) {
-				for (std::size_t i = 0; i < iterations; ++i) {
-					futures.emplace_back(std::async(std::launch::async, asyncGenerator, rd_()));
+		// Pipelined run of iterations paths in blocks of blockSize paths: a worker
+		// takes a block and goes through it in chunks of chunkSize paths, drawing
+		// the normals of all paths of a chunk, stepping them and handing the chunk
+		// to consume(blockResult, firstPath, chunk) while it is still in cache, so
+		// no run-sized buffer is ever written. chunk.path(i) is path firstPath+i
+		// of simulateInto(); block results come back in block order and do not
+		// depend on chunkSize when consume folds paths in order.
+		// Every block owns the buffers its chunks are simulated into.
+		template<typename Result, typename Consume>
+		std::vector<Result> simulatePipelined(std::size_t iterations, std::size_t blockSize, std::size_t chunkSize,
+			Consume &&consume, FDMScheme scheme = FDMScheme::EulerScheme) {
+			StageTimer setup{ Stage::Setup };
+			auto const fdmScheme = makeScheme(scheme, false);
+			auto const seeds = drawSeeds(iterations);
+			setup.stop();
+
+			StageTimer join{ Stage::Join };
+			chunkSize = std::max<std::size_t>(1, chunkSize);
+			auto const block = [&](std::size_t first, std::size_t size) {
+				Result result{};
+				detail::PipelineBuffers<T> buffers;
+				for (std::size_t c = first; c < first + size; c += chunkSize) {
+					std::size_t const chunk = std::min(chunkSize, first + size - c);
+					consume(result, c, detail::simulateChunk<T>(*fdmScheme, seeds.data() + c, chunk, buffers));
 				}
-			}
-			else if (this->timePointsOn_ == true) {
-				for (std::size_t i = 0; i < iterations; ++i) {
-					futures.emplace_back(std::async(std::launch::async, asyncGeneratorTP, rd_(), std::ref(this->timePoints_)));
-				}
-			}
-
-
-			PathValuesType<PathValuesType<T>> paths;
-			paths.reserve(iterations);
+				return result;
+			};
+			if (this->pool_)
+				return this->pool_->template parallelBlocks<Result>(iterations, blockSize, block);
+			return mc_utilities::parallelBlocks<Result>(iterations, blockSize, block);
+		}
 
-			for (auto &path : futures) {
-				paths.emplace_back(std::move(path.get()));
+		// Second factor is taken as short rate: each path carries its discount
+		// factor from the scheme, which is split off here.
+		DiscountedPaths<T> discountedPaths(std::size_t iterations,
+			FDMScheme scheme = FDMScheme::EulerScheme) {
+			DiscountedPaths<T> result;
+			result.paths = simulate(iterations, scheme, true);
+			result.discountFactors.reserve(result.paths.size());
+			for (auto &path : result.paths) {
+				result.discountFactors.emplace_back(path.back());
+				path.pop_back();
 			}
-
-			return paths;
+			return result;
 		}
 
+
 	};
 
 
@@ -4,20 +4,148 @@
 
 #include"mc_types.h"
 #include"mc_utilities.h"
+#include"sde.h"
+#include"path_buffer.h"
+#include"time_grid.h"
+#include"instrumentation.h"
 #include<random>
 #include<cassert>
+#include<algorithm>
 
 namespace finite_difference_method {
 
 
 	using mc_types::TimePointsType;
+	using mc_types::PathValuesType;
+	using mc_types::FDMScheme;
+	using sde::Sde;
+	using sde::JumpProcess;
+	using term_structure::StepCoefficientTable;
+	using term_structure::SeparableCoefficients;
 	using mc_utilities::PartialCentralDifference;
 	using mc_utilities::withRespectTo;
+	using path_buffer::PathSpan;
+	using path_buffer::PathArena;
+	using time_grid::TimeGrid;
+	using instrumentation::Stage;
+	using instrumentation::StageTimer;
 
 
 	template<typename T,typename ...Ts>
 	using asyncKernel = std::function<PathValuesType<T>(Ts...)>;
 
+	// (step index, aggregated log-jump of that step), sorted by step index
+	template<typename T>
+	using JumpScheduleType = std::vector<std::pair<std::size_t, T>>;
+
+	// Scratch of chunk stepping, kept by the worker and reused chunk after
+	// chunk: state, diffusion value and next jump of every path of a chunk
+	template<typename T>
+	struct StepWorkspace {
+		std::vector<T> states;
+		std::vector<T> diffusions;
+		std::vector<std::size_t> nextJumps;
+
+		void reset(std::size_t size, T initCondition) {
+			states.assign(size, initCondition);
+			diffusions.resize(size);
+			nextJumps.assign(size, 0);
+		}
+	};
+
+	// Pre-samples all jumps of one path in bulk: the number of jumps over the
+	// whole horizon is drawn once, jump times are mapped onto the time grid and
+	// jump sizes falling into the same step are aggregated. Steps without a jump
+	// never touch the jump component and stay on the diffusion-only route.
+	template<typename T>
+	class JumpSampler {
+	private:
+		void aggregate(JumpScheduleType<T> &schedule)const {
+			std::sort(schedule.begin(), schedule.end(),
+				[](std::pair<std::size_t, T> const &a, std::pair<std::size_t, T> const &b) {
+				return (a.first < b.first);
+			});
+			std::size_t last{ 0 };
+			for (std::size_t j = 1; j < schedule.size(); ++j) {
+				if (schedule[j].first == schedule[last].first) {
+					schedule[last].second += schedule[j].second;
+				}
+				else {
+					schedule[++last] = schedule[j];
+				}
+			}
+			schedule.resize(last + 1);
+		}
+
+	public:
+		// uniform grid with given delta, path of pathSize points
+		template<typename Engine>
+		JumpScheduleType<T> sample(JumpProcess<T> const &jumps, Engine &engine,
+			T const &delta, std::size_t pathSize)const {
+			JumpScheduleType<T> schedule;
+			if (pathSize < 2 || jumps.intensity() <= 0.0)
+				return schedule;
+			T const horizon = delta * static_cast<T>(pathSize - 1);
+			std::poisson_distribution<std::size_t> poisson(static_cast<double>(jumps.intensity() * horizon));
+			std::size_t const count = poisson(engine);
+			if (count == 0)
+				return schedule;
+			std::normal_distribution<T> normal;
+			std::uniform_real_distribution<T> uniform;
+			schedule.reserve(count);
+			for (std::size_t j = 0; j < count; ++j) {
+				auto step = static_cast<std::size_t>(horizon * uniform(engine) / delta) + 1;
+				schedule.emplace_back(std::min(step, pathSize - 1),
+					jumps.jumpMean() + jumps.jumpStdev() * normal(engine));
+			}
+			aggregate(schedule);
+			return schedule;
+		}
+
+		// arbitrary time points, path of timePoints.size() points
+		template<typename Engine>
+		JumpScheduleType<T> sample(JumpProcess<T> const &jumps, Engine &engine,
+			TimePointsType<T> const &timePoints)const {
+			JumpScheduleType<T> schedule;
+			if (timePoints.size() < 2 || jumps.intensity() <= 0.0)
+				return schedule;
+			T const horizon = timePoints.back() - timePoints.front();
+			std::poisson_distribution<std::size_t> poisson(static_cast<double>(jumps.intensity() * horizon));
+			std::size_t const count = poisson(engine);
+			if (count == 0)
+				return schedule;
+			std::normal_distribution<T> normal;
+			std::uniform_real_distribution<T> uniform;
+			schedule.reserve(count);
+			for (std::size_t j = 0; j < count; ++j) {
+				auto const time = timePoints.front() + horizon * uniform(engine);
+				auto step = static_cast<std::size_t>(std::distance(timePoints.begin(),
+					std::upper_bound(timePoints.begin(), timePoints.end(), time)));
+				schedule.emplace_back(std::max<std::size_t>(1, std::min(step, timePoints.size() - 1)),
+					jumps.jumpMean() + jumps.jumpStdev() * normal(engine));
+			}
+			aggregate(schedule);
+			return schedule;
+		}
+
+		// whole time grid, path of grid.size() points
+		template<typename Engine>
+		JumpScheduleType<T> sample(JumpProcess<T> const &jumps, Engine &engine,
+			TimeGrid<T> const &grid)const {
+			return (grid.isUniform() ?
+				sample(jumps, engine, grid.delta(), grid.size()) :
+				sample(jumps, engine, grid.times()));
+		}
+
+		// applies the jump of step i (if any) to the freshly stepped factor
+		static inline T apply(T spot, std::size_t i, JumpScheduleType<T> const &schedule, std::size_t &next) {
+			if (next < schedule.size() && schedule[next].first == i) {
+				return spot * std::exp(schedule[next++].second);
+			}
+			return spot;
+		}
+	};
+
 	template<std::size_t FactorCount,typename T,typename ...Ts>
 	class SchemeBuilder {
 	public:
@@ -28,46 +156,200 @@ namespace finite_difference_method {
 	template<typename T,typename ...Ts>
 	class SchemeBuilder<1,T,Ts...> {
 	protected:
-		std::size_t numberSteps_;
-		T delta_;
 		std::shared_ptr<Sde<T, Ts...>> model_;
+		std::shared_ptr<TimeGrid<T> const> grid_;
+		JumpSampler<T> jumpSampler_;
+		std::shared_ptr<StepCoefficientTable<T> const> stepCoefficients_;
 
 	public:
 		SchemeBuilder(std::shared_ptr<Sde<T, Ts...>> const &model,
-					T const &delta,std::size_t numberSteps)
-					:model_{model},delta_ {delta}, 
-					numberSteps_{ numberSteps } {}
-		SchemeBuilder(std::shared_ptr<Sde<T,Ts...>> const &model):
-					model_{model}{}
+					std::shared_ptr<TimeGrid<T> const> const &grid)
+					:model_{ model }, grid_{ grid } {}
+
+		// per-step integrated coefficients of time-dependent models,
+		// must be built on the same time grid the scheme is stepping on
+		inline void setStepCoefficients(std::shared_ptr<StepCoefficientTable<T> const> const &table) {
+			stepCoefficients_ = table;
+		}
+
+	protected:
+		// steps the factor by its exact transition law
+		void simulateWithTransition(std::mt19937 &mt, std::normal_distribution<T> &normal,
+			PathSpan<T> path, JumpScheduleType<T> const &jumps) {
+			auto const &transition = *(this->model_->transition());
+			auto const &grid = *(this->grid_);
+			auto spot = path[0];
+			std::size_t nextJump{ 0 };
+			for (std::size_t i = 1; i < path.size(); ++i) {
+				spot = transition.sample(grid.time(i - 1), grid.dt(i), spot, normal(mt), mt);
+				spot = JumpSampler<T>::apply(spot, i, jumps, nextJump);
+				path[i] = spot;
+			}
+		}
+
+		// step i of the scheme from spot with normal z, jumps not applied
+		virtual T advance(std::size_t i, T spot, T z)const = 0;
+
+	public:
+		inline std::shared_ptr<TimeGrid<T> const> const &timeGrid()const { return grid_; }
+
+		// values stored for one path
+		inline std::size_t storedLength()const { return grid_->size(); }
+
+		// Single step i of simulateInto() from spot at time(i-1) with normal z
+		// (exact transitions draw any further variates from mt), jumps not
+		// applied, for callers acting between steps such as event handlers
+		T stepFrom(std::size_t i, T spot, T z, std::mt19937 &mt)const {
+			if (model_->hasExactTransition())
+				return model_->transition()->sample(grid_->time(i - 1), grid_->dt(i), spot, z, mt);
+			return advance(i, spot, z);
+		}
 
+		// Writes one path of storedLength() values into storage owned by the caller
+		// (e.g. a PathArena), path[i] taken at grid time i
+		virtual void simulateInto(std::random_device::result_type seed, PathSpan<T> path) = 0;
 
-		virtual PathValuesType<T> simulate(std::random_device::result_type seed) = 0;
-		virtual PathValuesType<T> simulateWithTimePoints(std::random_device::result_type seed,
-			TimePointsType<T> &timePoints) = 0;
+		PathValuesType<T> simulate(std::random_device::result_type seed) {
+			PathValuesType<T> path(storedLength());
+			simulateInto(seed, PathSpan<T>{ path });
+			return path;
+		}
+
+		// Staged stepping: drawNormals() does all the random number work of a path
+		// (its jump schedule included) and stepInto() only the arithmetic, together
+		// giving the path of simulateInto() for the same seed. Exact transitions
+		// draw from the engine while stepping, so such models are not staged.
+		inline bool isStaged()const { return !model_->hasExactTransition(); }
+		inline std::size_t normalsPerPath()const { return grid_->steps(); }
+
+		void drawNormals(std::random_device::result_type seed, PathSpan<T> normals, JumpScheduleType<T> &jumps) {
+			StageTimer rng{ Stage::RandomNumbers };
+			assert(normals.size() >= normalsPerPath());
+			std::mt19937 mt(seed);
+			std::normal_distribution<T> normal;
+			jumps.clear();
+			if (model_->hasJumps())
+				jumps = jumpSampler_.sample(*(model_->jumps()), mt, *grid_);
+			for (std::size_t k = 0; k < normalsPerPath(); ++k)
+				normals[k] = normal(mt);
+		}
+
+		virtual void stepInto(PathSpan<T> normals, JumpScheduleType<T> const &jumps, PathSpan<T> path) = 0;
+
+		// Steps all paths of a chunk, normals.path(i) and jumps[i] drawn by
+		// drawNormals() for paths.path(i), giving the paths of stepInto()
+		virtual void stepChunkInto(PathArena<T> const &normals, std::vector<JumpScheduleType<T>> const &jumps,
+			PathArena<T> &paths, StepWorkspace<T> &) {
+			for (std::size_t i = 0; i < paths.pathCount(); ++i)
+				stepInto(normals.path(i), jumps[i], paths.path(i));
+		}
+
+		// stepChunkInto() recorded as the stepping stage
+		void stepChunk(PathArena<T> const &normals, std::vector<JumpScheduleType<T>> const &jumps,
+			PathArena<T> &paths, StepWorkspace<T> &workspace) {
+			StageTimer stepping{ Stage::Stepping };
+			stepChunkInto(normals, jumps, paths, workspace);
+		}
+
+	protected:
+		// While instrumentation records, simulateInto() of a staged scheme goes
+		// through drawNormals() and stepInto(), giving the same path, so that
+		// random numbers and stepping are timed apart; false otherwise
+		bool simulateRecorded(std::random_device::result_type seed, PathSpan<T> path) {
+			if (!instrumentation::isEnabled() || !isStaged())
+				return false;
+			PathValuesType<T> normals(normalsPerPath());
+			JumpScheduleType<T> jumps;
+			drawNormals(seed, PathSpan<T>{ normals }, jumps);
+			StageTimer stepping{ Stage::Stepping };
+			stepInto(PathSpan<T>{ normals }, jumps, path);
+			return true;
+		}
 	};
 
 	// Scheme builder for two-factor models:
 	template<typename T, typename ...Ts>
 	class SchemeBuilder<2, T, Ts...> {
 	protected:
-		std::size_t numberSteps_;
-		T delta_;
 		T correlation_;
 		std::tuple<std::shared_ptr<Sde<T, Ts...>>, std::shared_ptr<Sde<T, Ts...>>> model_;
+		std::shared_ptr<TimeGrid<T> const> grid_;
+		JumpSampler<T> jumpSampler_;
+		bool accumulateDiscount_{ false };
 
 	public:
 		SchemeBuilder(std::tuple<std::shared_ptr<Sde<T, Ts...>>, std::shared_ptr<Sde<T, Ts...>>> const &model,
-			T correlation,T const &delta, std::size_t numberSteps)
-			:model_{ model }, delta_{ delta }, correlation_{ correlation },
-			numberSteps_ {numberSteps} {}
+			T correlation, std::shared_ptr<TimeGrid<T> const> const &grid)
+			:model_{ model }, correlation_{ correlation }, grid_{ grid } {}
 
-		SchemeBuilder(std::tuple<std::shared_ptr<Sde<T, Ts...>>, std::shared_ptr<Sde<T, Ts...>>> const &model,
-			T correlation)
-			:model_{ model }, correlation_{ correlation } {}
+		// Second factor taken as short rate: exp(-integral of it over the path)
+		// (trapezoid rule on the scheme grid) is appended as the last path element.
+		inline void setDiscountAccumulation(bool on) { accumulateDiscount_ = on; }
+		inline bool isDiscountAccumulated()const { return accumulateDiscount_; }
+
+		inline std::shared_ptr<TimeGrid<T> const> const &timeGrid()const { return grid_; }
+
+		// values stored for one path (discount factor included)
+		inline std::size_t storedLength()const { return grid_->size() + (accumulateDiscount_ ? 1 : 0); }
+
+		// Writes one path of storedLength() values into storage owned by the caller
+		// (e.g. a PathArena), path[i] taken at grid time i
+		virtual void simulateInto(std::random_device::result_type seed, PathSpan<T> path) = 0;
+
+		PathValuesType<T> simulate(std::random_device::result_type seed) {
+			PathValuesType<T> path(storedLength());
+			simulateInto(seed, PathSpan<T>{ path });
+			return path;
+		}
+
+		// Staged stepping as for one factor, normals of step i at 2(i-1) (first
+		// factor) and 2(i-1)+1 (second factor, before correlation)
+		inline bool isStaged()const { return !std::get<1>(model_)->hasExactTransition(); }
+		inline std::size_t normalsPerPath()const { return 2 * grid_->steps(); }
+
+		void drawNormals(std::random_device::result_type seed, PathSpan<T> normals, JumpScheduleType<T> &jumps) {
+			StageTimer rng{ Stage::RandomNumbers };
+			assert(normals.size() >= normalsPerPath());
+			std::mt19937 mt(seed);
+			std::normal_distribution<T> normal1;
+			std::normal_distribution<T> normal2;
+			jumps.clear();
+			if (std::get<0>(model_)->hasJumps())
+				jumps = jumpSampler_.sample(*(std::get<0>(model_)->jumps()), mt, *grid_);
+			for (std::size_t k = 0; k < normalsPerPath(); k += 2) {
+				normals[k] = normal1(mt);
+				normals[k + 1] = normal2(mt);
+			}
+		}
 
-		virtual PathValuesType<T> simulate(std::random_device::result_type seed) = 0;
-		virtual PathValuesType<T> simulateWithTimePoints(std::random_device::result_type seed,
-			TimePointsType<T> &timePoints) = 0;
+		virtual void stepInto(PathSpan<T> normals, JumpScheduleType<T> const &jumps, PathSpan<T> path) = 0;
+
+		// Steps all paths of a chunk as for one factor
+		virtual void stepChunkInto(PathArena<T> const &normals, std::vector<JumpScheduleType<T>> const &jumps,
+			PathArena<T> &paths, StepWorkspace<T> &) {
+			for (std::size_t i = 0; i < paths.pathCount(); ++i)
+				stepInto(normals.path(i), jumps[i], paths.path(i));
+		}
+
+		// stepChunkInto() recorded as the stepping stage
+		void stepChunk(PathArena<T> const &normals, std::vector<JumpScheduleType<T>> const &jumps,
+			PathArena<T> &paths, StepWorkspace<T> &workspace) {
+			StageTimer stepping{ Stage::Stepping };
+			stepChunkInto(normals, jumps, paths, workspace);
+		}
+
+	protected:
+		// Recorded staged simulation as for one factor
+		bool simulateRecorded(std::random_device::result_type seed, PathSpan<T> path) {
+			if (!instrumentation::isEnabled() || !isStaged())
+				return false;
+			PathValuesType<T> normals(normalsPerPath());
+			JumpScheduleType<T> jumps;
+			drawNormals(seed, PathSpan<T>{ normals }, jumps);
+			StageTimer stepping{ Stage::Stepping };
+			stepInto(PathSpan<T>{ normals }, jumps, path);
+			return true;
+		}
 
 	};
 
@@ -82,52 +364,124 @@ namespace finite_difference_method {
 	template<typename T>
 	class EulerScheme<1, T> :public SchemeBuilder<1, T, T, T> {
 	private:
-		std::normal_distribution<T> normal_;
-		std::mt19937 mt_;
-
-	public:
-		EulerScheme(std::shared_ptr<Sde<T,T,T>> const &model,
-			T const &delta, std::size_t numberSteps)
-			:SchemeBuilder<1,T,T,T>{model,delta,numberSteps}{
+		// step i by the per-step table. The increments of every update here and
+		// in the other schemes are summed before the spot is added, as spot+drift
+		// alone rounds the same way step after step in float.
+		static inline T tableStep(SeparableCoefficients<T> const &coefficients,
+			StepCoefficientTable<T> const &table, std::size_t i, T spot, T z) {
+			return spot + (
+				coefficients.driftState(spot) * table.drift(i) +
+				coefficients.diffusionState(spot) * table.volatility(i) * z);
 		}
 
-		EulerScheme(std::shared_ptr<Sde<T,T,T>> const &model):
-			SchemeBuilder<1, T, T, T>{model}{}
+		// step i by drift and diffusion at the start of the step
+		static inline T gridStep(Sde<T, T, T> const &model, TimeGrid<T> const &grid, std::size_t i, T spot, T z) {
+			return spot + (
+				model.drift(grid.time(i - 1), spot) * grid.dt(i) +
+				model.diffusion(grid.time(i - 1), spot) * grid.sqrtDt(i) * z);
+		}
 
+		template<typename Draw>
+		void stepWithTable(Draw &&draw, PathSpan<T> path, JumpScheduleType<T> const &jumps) {
+			auto const &coefficients = *(this->model_->coefficients());
+			auto const &table = *(this->stepCoefficients_);
+			assert(table.size() >= path.size());
+			auto spot = path[0];
+			std::size_t nextJump{ 0 };
+			for (std::size_t i = 1; i < path.size(); ++i) {
+				spot = tableStep(coefficients, table, i, spot, draw());
+				spot = JumpSampler<T>::apply(spot, i, jumps, nextJump);
+				path[i] = spot;
+			}
+		}
 
-		PathValuesType<T> simulate(std::random_device::result_type seed) override {
-			this->mt_.seed(seed );
-			PathValuesType<T> path(this->numberSteps_);
-			path[0] = this->model_->initCondition();
-			auto spot = this->model_->initCondition();
+		// steps path from path[0], draw() giving the normal of each step in turn
+		template<typename Draw>
+		void step(Draw &&draw, PathSpan<T> path, JumpScheduleType<T> const &jumps) {
+			if (this->stepCoefficients_ != nullptr) {
+				stepWithTable(draw, path, jumps);
+				return;
+			}
+			auto const &model = *(this->model_);
+			auto const &grid = *(this->grid_);
+			auto spot = path[0];
 			T spotNew{};
+			std::size_t nextJump{ 0 };
 			for (std::size_t i = 1; i < path.size(); ++i) {
-				spotNew = spot +
-					this->model_->drift((i - 1)*(this->delta_), spot)*(this->delta_) +
-					this->model_->diffusion((i - 1)*(this->delta_), spot) *
-					std::sqrt((this->delta_)) * normal_(mt_);
+				spotNew = gridStep(model, grid, i, spot, draw());
+				spotNew = JumpSampler<T>::apply(spotNew, i, jumps, nextJump);
 				path[i] = spotNew;
 				spot = spotNew;
 			}
-			return path;
 		}
 
-		PathValuesType<T> simulateWithTimePoints(std::random_device::result_type seed,TimePointsType<T> &timePoints)override {
-			this->mt_.seed(seed);
-			assert(!timePoints.empty());
-			PathValuesType<T> path(timePoints.size());
+	protected:
+		T advance(std::size_t i, T spot, T z)const override {
+			if (this->stepCoefficients_ != nullptr)
+				return tableStep(*(this->model_->coefficients()), *(this->stepCoefficients_), i, spot, z);
+			return gridStep(*(this->model_), *(this->grid_), i, spot, z);
+		}
+
+	public:
+		EulerScheme(std::shared_ptr<Sde<T,T,T>> const &model,
+			std::shared_ptr<TimeGrid<T> const> const &grid)
+			:SchemeBuilder<1,T,T,T>{model,grid}{}
+
+		void simulateInto(std::random_device::result_type seed, PathSpan<T> path) override {
+			if (this->simulateRecorded(seed, path))
+				return;
+			auto const &grid = *(this->grid_);
+			assert(path.size() == grid.size());
+			std::mt19937 mt(seed);
+			std::normal_distribution<T> normal;
 			path[0] = this->model_->initCondition();
-			auto spot = this->model_->initCondition();
-			T spotNew{};
-			for (std::size_t i = 1; i < path.size(); ++i) {
-				spotNew = spot +
-					this->model_->drift(timePoints[i - 1], spot)*(timePoints[i] - timePoints[i - 1]) +
-					this->model_->diffusion(timePoints[i - 1], spot) *
-					std::sqrt((timePoints[i] - timePoints[i - 1])) * normal_(mt_);
-				path[i] = spotNew;
-				spot = spotNew;
+			JumpScheduleType<T> jumps;
+			if (this->model_->hasJumps())
+				jumps = this->jumpSampler_.sample(*(this->model_->jumps()), mt, grid);
+			if (this->model_->hasExactTransition()) {
+				this->simulateWithTransition(mt, normal, path, jumps);
+				return;
+			}
+			step([&]() {return normal(mt); }, path, jumps);
+		}
+
+		void stepInto(PathSpan<T> normals, JumpScheduleType<T> const &jumps, PathSpan<T> path) override {
+			assert(this->isStaged() && path.size() == this->grid_->size());
+			path[0] = this->model_->initCondition();
+			T const *z = normals.data();
+			step([&z]() {return *z++; }, path, jumps);
+		}
+
+		// With a step table the chunk is stepped one time step at a time over
+		// all its paths, g(x) evaluated for the whole chunk at once by the
+		// block function of the model; the update is that of stepWithTable().
+		void stepChunkInto(PathArena<T> const &normals, std::vector<JumpScheduleType<T>> const &jumps,
+			PathArena<T> &paths, StepWorkspace<T> &workspace) override {
+			if (this->stepCoefficients_ == nullptr) {
+				SchemeBuilder<1, T, T, T>::stepChunkInto(normals, jumps, paths, workspace);
+				return;
+			}
+			assert(this->isStaged() && paths.pathLength() == this->grid_->size());
+			auto const &coefficients = *(this->model_->coefficients());
+			auto const &table = *(this->stepCoefficients_);
+			assert(table.size() >= paths.pathLength());
+			std::size_t const size = paths.pathCount();
+			workspace.reset(size, this->model_->initCondition());
+			T *spot = workspace.states.data();
+			T *diff = workspace.diffusions.data();
+			for (std::size_t p = 0; p < size; ++p)
+				paths.path(p)[0] = spot[p];
+			for (std::size_t i = 1; i < paths.pathLength(); ++i) {
+				coefficients.diffusionStates(spot, diff, size);
+				for (std::size_t p = 0; p < size; ++p) {
+					T value = spot[p] + (
+						coefficients.driftState(spot[p]) * table.drift(i) +
+						diff[p] * table.volatility(i) * normals.path(p)[i - 1]);
+					value = JumpSampler<T>::apply(value, i, jumps[p], workspace.nextJumps[p]);
+					paths.path(p)[i] = value;
+					spot[p] = value;
+				}
 			}
-			return path;
 		}
 
 	};
@@ -135,24 +489,16 @@ namespace finite_difference_method {
 	template<typename T>
 	class EulerScheme<2, T> :public SchemeBuilder<2, T, T, T, T> {
 	private:
-		std::normal_distribution<T> normal1_;
-		std::normal_distribution<T> normal2_;
-		std::mt19937 mt_;
-
-	public:
-		EulerScheme(std::tuple<std::shared_ptr<Sde<T, T, T, T>>, std::shared_ptr<Sde<T, T,T,T>>> const &model,
-			T correlation, T const &delta, std::size_t numberSteps)
-			:SchemeBuilder<2,T,T,T,T>{model,correlation,delta,numberSteps}{}
-
-		EulerScheme(std::tuple<std::shared_ptr<Sde<T,T,T,T>>,std::shared_ptr<Sde<T,T,T,T>>> const &model,
-			T correlation):
-			SchemeBuilder<2,T,T,T,T>{model,correlation}{}
-
-		PathValuesType<T> simulate(std::random_device::result_type seed)override {
-			this->mt_.seed(seed);
+		// steps path from the initial conditions, draw(z1,z2) giving the normals
+		// of each step in turn; mt is only used by an exact second factor transition
+		template<typename Draw>
+		void step(Draw &&draw, std::mt19937 *mt, PathSpan<T> path, JumpScheduleType<T> const &jumps) {
+			auto const &grid = *(this->grid_);
+			std::size_t const length = path.size() - (this->accumulateDiscount_ ? 1 : 0);
+			assert(length == grid.size());
 			T z1{};
 			T z2{};
-			PathValuesType<T> path(this->numberSteps_);
+			auto const complement = std::sqrt(1.0 - (this->correlation_ * this->correlation_));
 			auto firstModel = std::get<0>(this->model_);
 			auto secondModel = std::get<1>(this->model_);
 			path[0] = firstModel->initCondition();
@@ -160,57 +506,62 @@ namespace finite_difference_method {
 			T firstSpotNew{};
 			auto secondSpot = secondModel->initCondition();
 			T secondSpotNew{};
-
-			for (std::size_t i = 1; i < path.size(); ++i) {
-				z1 = normal1_(mt_);
-				z2 = normal2_(mt_);
-				firstSpotNew = firstSpot +
-					firstModel->drift((i - 1)*(this->delta_), firstSpot,secondSpot)*(this->delta_) +
-					firstModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot) *
-					std::sqrt((this->delta_)) * z1;
-				secondSpotNew = secondSpot +
-					secondModel->drift((i - 1)*(this->delta_), firstSpot, secondSpot)*(this->delta_) +
-					secondModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot) *
-					std::sqrt((this->delta_)) * 
-					(this->correlation_ * z1 + std::sqrt(1.0 - (this->correlation_ * this->correlation_)) * z2);
+			T discountIntegral{};
+			std::size_t nextJump{ 0 };
+
+			for (std::size_t i = 1; i < length; ++i) {
+				T const t = grid.time(i - 1);
+				T const dt = grid.dt(i);
+				draw(z1, z2);
+				auto const w = this->correlation_ * z1 + complement * z2;
+				firstSpotNew = firstSpot + (
+					firstModel->drift(t, firstSpot, secondSpot) * dt +
+					firstModel->diffusion(t, firstSpot, secondSpot) * grid.sqrtDt(i) * z1);
+				if (secondModel->hasExactTransition()) {
+					secondSpotNew = secondModel->transition()->sample(t, dt, secondSpot, w, *mt);
+				}
+				else {
+					secondSpotNew = secondSpot + (
+						secondModel->drift(t, firstSpot, secondSpot) * dt +
+						secondModel->diffusion(t, firstSpot, secondSpot) * grid.sqrtDt(i) * w);
+				}
+				firstSpotNew = JumpSampler<T>::apply(firstSpotNew, i, jumps, nextJump);
 				path[i] = firstSpotNew;
 				firstSpot = firstSpotNew;
+				discountIntegral += 0.5 * (secondSpot + secondSpotNew) * dt;
 				secondSpot = secondSpotNew;
 			}
-			return path;
+			if (this->accumulateDiscount_)
+				path[length] = std::exp(-discountIntegral);
 		}
 
-		PathValuesType<T> simulateWithTimePoints(std::random_device::result_type seed, TimePointsType<T> &timePoints)override {
-			this->mt_.seed(seed);
-			T z1{};
-			T z2{};
-			assert(!timePoints.empty());
-			PathValuesType<T> path(timePoints.size());
-			auto firstModel = std::get<0>(this->model_);
-			auto secondModel = std::get<1>(this->model_);
-			path[0] = firstModel->initCondition();
-			auto firstSpot = firstModel->initCondition();
-			T firstSpotNew{};
-			auto secondSpot = secondModel->initCondition();
-			T secondSpotNew{};
+	public:
+		EulerScheme(std::tuple<std::shared_ptr<Sde<T, T, T, T>>, std::shared_ptr<Sde<T, T,T,T>>> const &model,
+			T correlation, std::shared_ptr<TimeGrid<T> const> const &grid)
+			:SchemeBuilder<2,T,T,T,T>{model,correlation,grid}{}
+
+		void simulateInto(std::random_device::result_type seed, PathSpan<T> path) override {
+			if (this->simulateRecorded(seed, path))
+				return;
+			std::mt19937 mt(seed);
+			std::normal_distribution<T> normal1;
+			std::normal_distribution<T> normal2;
+			JumpScheduleType<T> jumps;
+			if (std::get<0>(this->model_)->hasJumps())
+				jumps = this->jumpSampler_.sample(*(std::get<0>(this->model_)->jumps()), mt, *(this->grid_));
+			step([&](T &z1, T &z2) {
+				z1 = normal1(mt);
+				z2 = normal2(mt);
+			}, &mt, path, jumps);
+		}
 
-			for (std::size_t i = 1; i < path.size(); ++i) {
-				z1 = normal1_(mt_);
-				z2 = normal2_(mt_);
-				firstSpotNew = firstSpot +
-					firstModel->drift(timePoints[i - 1], firstSpot, secondSpot)*(timePoints[i] - timePoints[i - 1]) +
-					firstModel->diffusion(timePoints[i - 1], firstSpot, secondSpot) *
-					std::sqrt(timePoints[i] - timePoints[i - 1]) * z1;
-				secondSpotNew = secondSpot +
-					secondModel->drift(timePoints[i - 1], firstSpot, secondSpot)*(timePoints[i] - timePoints[i - 1]) +
-					secondModel->diffusion(timePoints[i - 1], firstSpot, secondSpot) *
-					std::sqrt(timePoints[i] - timePoints[i - 1]) *
-					(this->correlation_ * z1 + std::sqrt(1.0 - (this->correlation_*this->correlation_)) * z2);
-				path[i] = firstSpotNew;
-				firstSpot = firstSpotNew;
-				secondSpot = secondSpotNew;
-			}
-			return path;
+		void stepInto(PathSpan<T> normals, JumpScheduleType<T> const &jumps, PathSpan<T> path) override {
+			assert(this->isStaged());
+			T const *z = normals.data();
+			step([&z](T &z1, T &z2) {
+				z1 = *z++;
+				z2 = *z++;
+			}, nullptr, path, jumps);
 		}
 
 	};
@@ -226,17 +577,81 @@ namespace finite_difference_method {
 	template<typename T>
 	class MilsteinScheme<1, T> :public SchemeBuilder<1, T, T, T> {
 	private:
-		std::normal_distribution<T> normal_;
-		std::mt19937 mt_;
 		T step_ = 10e-6;
 
+		// step i by the per-step table
+		inline T tableStep(SeparableCoefficients<T> const &coefficients,
+			StepCoefficientTable<T> const &table, std::size_t i, T spot, T z)const {
+			T const diff = coefficients.diffusionState(spot);
+			T const diffPrime = coefficients.hasDiffusionStateDerivative() ?
+				coefficients.diffusionStateDerivative(spot, diff) :
+				(coefficients.diffusionState(spot + 0.5*(this->step_)) -
+					coefficients.diffusionState(spot - 0.5*(this->step_))) / (this->step_);
+			return spot + (
+				coefficients.driftState(spot) * table.drift(i) +
+				diff * table.volatility(i) * z +
+				0.5 * diff * diffPrime * table.variance(i) * (z * z - 1.0));
+		}
+
+		// step i by drift and diffusion at the start of the step
+		inline T gridStep(Sde<T, T, T> const &model, TimeGrid<T> const &grid, std::size_t i, T spot, T z)const {
+			T const t = grid.time(i - 1);
+			T const dt = grid.dt(i);
+			T const diff = model.diffusion(t, spot);
+			return spot + (
+				model.drift(t, spot) * dt +
+				diff * grid.sqrtDt(i) * z +
+				0.5 * diff *
+				((model.diffusion(t, spot + 0.5*(this->step_)) -
+					model.diffusion(t, spot - 0.5*(this->step_))) / (this->step_)) *
+				((grid.sqrtDt(i) * z) * (grid.sqrtDt(i) * z) - dt));
+		}
+
+		template<typename Draw>
+		void stepWithTable(Draw &&draw, PathSpan<T> path, JumpScheduleType<T> const &jumps) {
+			auto const &coefficients = *(this->model_->coefficients());
+			auto const &table = *(this->stepCoefficients_);
+			assert(table.size() >= path.size());
+			auto spot = path[0];
+			std::size_t nextJump{ 0 };
+			for (std::size_t i = 1; i < path.size(); ++i) {
+				spot = tableStep(coefficients, table, i, spot, draw());
+				spot = JumpSampler<T>::apply(spot, i, jumps, nextJump);
+				path[i] = spot;
+			}
+		}
+
+		// steps path from path[0], draw() giving the normal of each step in turn
+		template<typename Draw>
+		void step(Draw &&draw, PathSpan<T> path, JumpScheduleType<T> const &jumps) {
+			if (this->stepCoefficients_ != nullptr) {
+				stepWithTable(draw, path, jumps);
+				return;
+			}
+			auto const &model = *(this->model_);
+			auto const &grid = *(this->grid_);
+			auto spot = path[0];
+			T spotNew{};
+			std::size_t nextJump{ 0 };
+			for (std::size_t i = 1; i < path.size(); ++i) {
+				spotNew = gridStep(model, grid, i, spot, draw());
+				spotNew = JumpSampler<T>::apply(spotNew, i, jumps, nextJump);
+				path[i] = spotNew;
+				spot = spotNew;
+			}
+		}
+
+	protected:
+		T advance(std::size_t i, T spot, T z)const override {
+			if (this->stepCoefficients_ != nullptr)
+				return tableStep(*(this->model_->coefficients()), *(this->stepCoefficients_), i, spot, z);
+			return gridStep(*(this->model_), *(this->grid_), i, spot, z);
+		}
+
 	public:
 		MilsteinScheme(std::shared_ptr<Sde<T, T, T>> const &model,
-			T const &delta, std::size_t numberSteps)
-			:SchemeBuilder<1, T, T, T>{model,delta,numberSteps}{}
-
-		MilsteinScheme(std::shared_ptr<Sde<T, T, T>> const &model) :
-			SchemeBuilder<1, T, T, T>{ model } {};
+			std::shared_ptr<TimeGrid<T> const> const &grid)
+			:SchemeBuilder<1, T, T, T>{model,grid}{}
 
 		inline T diffusionPrime(T time,T price) {
 			auto fun = pcd_(std::bind(&Sde<T, T, T>::diffusion, *(this->model_), std::placeholders::_1, std::placeholders::_2),
@@ -244,52 +659,65 @@ namespace finite_difference_method {
 			return fun(time, price);
 		}
 
-		PathValuesType<T> simulate(std::random_device::result_type seed) override {
-			this->mt_.seed(seed);
-			PathValuesType<T> path(this->numberSteps_);
+		void simulateInto(std::random_device::result_type seed, PathSpan<T> path) override {
+			if (this->simulateRecorded(seed, path))
+				return;
+			auto const &grid = *(this->grid_);
+			assert(path.size() == grid.size());
+			std::mt19937 mt(seed);
+			std::normal_distribution<T> normal;
 			path[0] = this->model_->initCondition();
-			auto spot = this->model_->initCondition();
-			T spotNew{};
-			T z{};
-			for (std::size_t i = 1; i < path.size(); ++i) {
-				z = normal_(mt_);
-				spotNew = spot +
-					this->model_->drift((i - 1)*(this->delta_), spot)*(this->delta_) +
-					this->model_->diffusion((i - 1)*(this->delta_), spot) *
-					std::sqrt((this->delta_)) * z +
-					0.5*this->model_->diffusion((i - 1) * (this->delta_), spot) *
-					((this->model_->diffusion((i - 1) * (this->delta_), spot + 0.5*(this->step_)) - 
-						this->model_->diffusion((i - 1) * (this->delta_), spot - 0.5*(this->step_)))/(this->step_))*
-					((std::sqrt(this->delta_)*z)*(std::sqrt(this->delta_)*z) - (this->delta_));
-				path[i] = spotNew;
-				spot = spotNew;
+			JumpScheduleType<T> jumps;
+			if (this->model_->hasJumps())
+				jumps = this->jumpSampler_.sample(*(this->model_->jumps()), mt, grid);
+			if (this->model_->hasExactTransition()) {
+				this->simulateWithTransition(mt, normal, path, jumps);
+				return;
 			}
-			return path;
+			step([&]() {return normal(mt); }, path, jumps);
 		}
 
-		PathValuesType<T> simulateWithTimePoints(std::random_device::result_type seed,TimePointsType<T> &timePoints)override {
-			this->mt_.seed(seed);
-			assert(!timePoints.empty());
-			PathValuesType<T> path(timePoints.size());
+		void stepInto(PathSpan<T> normals, JumpScheduleType<T> const &jumps, PathSpan<T> path) override {
+			assert(this->isStaged() && path.size() == this->grid_->size());
 			path[0] = this->model_->initCondition();
-			auto spot = this->model_->initCondition();
-			T spotNew{};
-			T z{};
-			for (std::size_t i = 0; i < path.size(); ++i) {
-				z = normal_(mt_);
-				spotNew = spot +
-					this->model_->drift(timePoints[i - 1], spot)*(timePoints[i] - timePoints[i - 1]) +
-					this->model_->diffusion(timePoints[i - 1], spot) *
-					std::sqrt(timePoints[i] - timePoints[i - 1]) * z +
-					0.5*this->model_->diffusion(timePoints[i - 1], spot)*
-					((this->model_->diffusion(timePoints[i - 1], spot + 0.5*(this->step_)) -
-						this->model_->diffusion(timePoints[i - 1], spot - 0.5*(this->step_))) / (this->step_))*
-						((std::sqrt(timePoints[i] - timePoints[i - 1])*z)*(std::sqrt(timePoints[i] - timePoints[i - 1])*z) - 
-					(timePoints[i] - timePoints[i - 1]));
-				path[i] = spotNew;
-				spot = spotNew;
+			T const *z = normals.data();
+			step([&z]() {return *z++; }, path, jumps);
+		}
+
+		// Chunk stepping as for Euler, the update is that of stepWithTable()
+		void stepChunkInto(PathArena<T> const &normals, std::vector<JumpScheduleType<T>> const &jumps,
+			PathArena<T> &paths, StepWorkspace<T> &workspace) override {
+			if (this->stepCoefficients_ == nullptr) {
+				SchemeBuilder<1, T, T, T>::stepChunkInto(normals, jumps, paths, workspace);
+				return;
+			}
+			assert(this->isStaged() && paths.pathLength() == this->grid_->size());
+			auto const &coefficients = *(this->model_->coefficients());
+			auto const &table = *(this->stepCoefficients_);
+			assert(table.size() >= paths.pathLength());
+			std::size_t const size = paths.pathCount();
+			workspace.reset(size, this->model_->initCondition());
+			T *spot = workspace.states.data();
+			T *diff = workspace.diffusions.data();
+			for (std::size_t p = 0; p < size; ++p)
+				paths.path(p)[0] = spot[p];
+			for (std::size_t i = 1; i < paths.pathLength(); ++i) {
+				coefficients.diffusionStates(spot, diff, size);
+				for (std::size_t p = 0; p < size; ++p) {
+					T const z = normals.path(p)[i - 1];
+					T const diffPrime = coefficients.hasDiffusionStateDerivative() ?
+						coefficients.diffusionStateDerivative(spot[p], diff[p]) :
+						(coefficients.diffusionState(spot[p] + 0.5*(this->step_)) -
+							coefficients.diffusionState(spot[p] - 0.5*(this->step_))) / (this->step_);
+					T value = spot[p] + (
+						coefficients.driftState(spot[p]) * table.drift(i) +
+						diff[p] * table.volatility(i) * z +
+						0.5 * diff[p] * diffPrime * table.variance(i) * (z * z - 1.0));
+					value = JumpSampler<T>::apply(value, i, jumps[p], workspace.nextJumps[p]);
+					paths.path(p)[i] = value;
+					spot[p] = value;
+				}
 			}
-			return path;
 		}
 	};
 
@@ -297,27 +725,21 @@ namespace finite_difference_method {
 	template<typename T>
 	class MilsteinScheme<2, T> :public SchemeBuilder<2, T, T, T, T> {
 	private:
-		std::normal_distribution<T> normal1_;
-		std::normal_distribution<T> normal2_;
-		std::mt19937 mt_;
 		T step_ = 10e-6;
 
-	public:
-		MilsteinScheme(std::tuple<std::shared_ptr<Sde<T, T,T,T>>, std::shared_ptr<Sde<T, T,T,T>>> const &model,
-			T correlation, T const &delta, std::size_t numberSteps):
-			SchemeBuilder<2,T,T,T,T>{model,correlation,delta,numberSteps}{
-		}
-
-		MilsteinScheme(std::tuple<std::shared_ptr<Sde<T,T,T,T>>,std::shared_ptr<Sde<T,T,T,T>>> const &model,
-			T correlation):
-			SchemeBuilder<2,T,T,T,T>{model,correlation}{}
-
-		PathValuesType<T> simulate(std::random_device::result_type seed) override {
-			mt_.seed(seed);
+		// steps path from the initial conditions, draw(z1,z2) giving the normals
+		// of each step in turn; mt is only used by an exact second factor transition
+		template<typename Draw>
+		void step(Draw &&draw, std::mt19937 *mt, PathSpan<T> path, JumpScheduleType<T> const &jumps) {
+			auto const &grid = *(this->grid_);
+			std::size_t const length = path.size() - (this->accumulateDiscount_ ? 1 : 0);
+			assert(length == grid.size());
 			T z1{};
 			T z2{};
+			auto const rho = this->correlation_;
+			auto const complement = std::sqrt(1.0 - rho * rho);
+			auto const halfStep = 0.5 * (this->step_);
 
-			PathValuesType<T> path(this->numberSteps_);
 			auto firstModel = std::get<0>(this->model_);
 			auto secondModel = std::get<1>(this->model_);
 			path[0] = firstModel->initCondition();
@@ -325,125 +747,115 @@ namespace finite_difference_method {
 			T firstSpotNew{};
 			auto secondSpot = secondModel->initCondition();
 			T secondSpotNew{};
-
-			for (std::size_t i = 1; i < path.size(); ++i) {
-				z1 = normal1_(mt_);
-				z2 = normal2_(mt_);
-
-				firstSpotNew = firstSpot +
-					firstModel->drift((i - 1)*(this->delta_), firstSpot, secondSpot)*(this->delta_) +
-					firstModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot) *
-					std::sqrt((this->delta_)) * z1 +
-					0.5*firstModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot) *
-					((firstModel->diffusion((i - 1)*(this->delta_), firstSpot + 0.5*(this->step_), secondSpot) -
-						firstModel->diffusion((i - 1)*(this->delta_), firstSpot - 0.5*(this->step_), secondSpot)) / (this->step_))*
-						(this->delta_)*((z1)*(z1)-1.0) +
-					0.5*(this->correlation_)*secondModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot) *
-					((firstModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot + 0.5*(this->step_)) -
-						firstModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot - 0.5*(this->step_))) / (this->step_)) *
-						(this->delta_)*((z1)*(z1)-1.0) +
-					std::sqrt(1.0 - (this->correlation_)*(this->correlation_))*
-					secondModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot)*
-					((firstModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot + 0.5*(this->step_)) -
-						firstModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot - 0.5*(this->step_))) / (this->step_)) *
-					(this->delta_)*z1*z2;
-
-				secondSpotNew = secondSpot +
-					secondModel->drift((i - 1)*(this->delta_), firstSpot, secondSpot)*(this->delta_) +
-					secondModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot) *
-					std::sqrt((this->delta_)) *
-					(this->correlation_ * z1 + std::sqrt(1.0 - (this->correlation_ * this->correlation_)) * z2) +
-					0.5*(this->correlation_)*firstModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot)*
-					((secondModel->diffusion((i - 1)*(this->delta_), firstSpot + 0.5*(this->step_), secondSpot) -
-						secondModel->diffusion((i - 1)*(this->delta_), firstSpot - 0.5*(this->step_), secondSpot)) / (this->step_))*
-						(this->delta_) * ((z1)*(z1)-1.0) +
-					0.5 * secondModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot)*
-					((secondModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot + 0.5*(this->step_)) -
-						secondModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot - 0.5*(this->step_))) / (this->step_))*
-						(this->delta_) * (((this->correlation_)*z1 + std::sqrt(1.0 - (this->correlation_)*(this->correlation_))*z2)*
-					((this->correlation_)*z1 + std::sqrt(1.0 - (this->correlation_)*(this->correlation_))*z2) - 1.0) +
-					std::sqrt(1.0 - (this->correlation_)*(this->correlation_))*
-					firstModel->diffusion((i - 1)*(this->delta_), firstSpot, secondSpot)*
-					((secondModel->diffusion((i - 1)*(this->delta_), firstSpot + 0.5*(this->step_), secondSpot) -
-						secondModel->diffusion((i - 1)*(this->delta_), firstSpot - 0.5*(this->step_), secondSpot)) / (this->step_)) *
-					(this->delta_)*z1*z2;
-
+			T discountIntegral{};
+
+			std::size_t nextJump{ 0 };
+
+			for (std::size_t i = 1; i < length; ++i) {
+				T const t = grid.time(i - 1);
+				T const dt = grid.dt(i);
+				draw(z1, z2);
+				auto const w = rho * z1 + complement * z2;
+
+				// diffusions and their central differences at the start of the step
+				T const diff1 = firstModel->diffusion(t, firstSpot, secondSpot);
+				T const diff2 = secondModel->diffusion(t, firstSpot, secondSpot);
+				T const diff1First = (firstModel->diffusion(t, firstSpot + halfStep, secondSpot) -
+					firstModel->diffusion(t, firstSpot - halfStep, secondSpot)) / (this->step_);
+				T const diff1Second = (firstModel->diffusion(t, firstSpot, secondSpot + halfStep) -
+					firstModel->diffusion(t, firstSpot, secondSpot - halfStep)) / (this->step_);
+
+				firstSpotNew = firstSpot + (
+					firstModel->drift(t, firstSpot, secondSpot) * dt +
+					diff1 * grid.sqrtDt(i) * z1 +
+					0.5 * diff1 * diff1First * dt * ((z1)*(z1)-1.0) +
+					0.5 * rho * diff2 * diff1Second * dt * ((z1)*(z1)-1.0) +
+					complement * diff2 * diff1Second * dt * z1 * z2);
+
+				if (secondModel->hasExactTransition()) {
+					secondSpotNew = secondModel->transition()->sample(t, dt, secondSpot, w, *mt);
+				}
+				else {
+					T const diff2First = (secondModel->diffusion(t, firstSpot + halfStep, secondSpot) -
+						secondModel->diffusion(t, firstSpot - halfStep, secondSpot)) / (this->step_);
+					T const diff2Second = (secondModel->diffusion(t, firstSpot, secondSpot + halfStep) -
+						secondModel->diffusion(t, firstSpot, secondSpot - halfStep)) / (this->step_);
+					secondSpotNew = secondSpot + (
+						secondModel->drift(t, firstSpot, secondSpot) * dt +
+						diff2 * grid.sqrtDt(i) * w +
+						0.5 * rho * diff1 * diff2First * dt * ((z1)*(z1)-1.0) +
+						0.5 * diff2 * diff2Second * dt * (w * w - 1.0) +
+						complement * diff1 * diff2First * dt * z1 * z2);
+				}
+
+				firstSpotNew = JumpSampler<T>::apply(firstSpotNew, i, jumps, nextJump);
 				path[i] = firstSpotNew;
 				firstSpot = firstSpotNew;
+				discountIntegral += 0.5 * (secondSpot + secondSpotNew) * dt;
 				secondSpot = secondSpotNew;
 			}
-			return path;
+			if (this->accumulateDiscount_)
+				path[length] = std::exp(-discountIntegral);
 		}
 
-		PathValuesType<T> simulateWithTimePoints(std::random_device::result_type seed,TimePointsType<T> &timePoints)override{
-			this->mt_.seed(seed);
-			T z1{};
-			T z2{};
-			assert(!timePoints.empty());
-			PathValuesType<T> path(timePoints.size());
-			auto firstModel = std::get<0>(this->model_);
-			auto secondModel = std::get<1>(this->model_);
-			path[0] = firstModel->initCondition();
-			auto firstSpot = firstModel->initCondition();
-			T firstSpotNew{};
-			auto secondSpot = secondModel->initCondition();
-			T secondSpotNew{};
-
-			for (std::size_t i = 1; i < path.size(); ++i) {
-				z1 = normal1_(mt_);
-				z2 = normal2_(mt_);
-
-				firstSpotNew = firstSpot +
-					firstModel->drift(timePoints[i - 1], firstSpot, secondSpot)*(timePoints[i] - timePoints[i - 1]) +
-					firstModel->diffusion(timePoints[i - 1], firstSpot, secondSpot) *
-					std::sqrt(timePoints[i] - timePoints[i - 1]) * z1 +
-					0.5*firstModel->diffusion(timePoints[i - 1], firstSpot, secondSpot) *
-					((firstModel->diffusion(timePoints[i - 1], firstSpot + 0.5*(this->step_), secondSpot) -
-						firstModel->diffusion(timePoints[i - 1], firstSpot - 0.5*(this->step_), secondSpot)) / (this->step_))*
-						(timePoints[i] - timePoints[i - 1])*((z1)*(z1)-1.0) +
-					0.5*(this->correlation_)*secondModel->diffusion(timePoints[i - 1], firstSpot, secondSpot) *
-					((firstModel->diffusion(timePoints[i - 1], firstSpot, secondSpot + 0.5*(this->step_)) -
-						firstModel->diffusion(timePoints[i - 1], firstSpot, secondSpot - 0.5*(this->step_))) / (this->step_)) *
-						(timePoints[i] -timePoints[i - 1])*((z1)*(z1)-1.0) +
-					std::sqrt(1.0 - (this->correlation_)*(this->correlation_))*
-					secondModel->diffusion(timePoints[i - 1], firstSpot, secondSpot)*
-					((firstModel->diffusion(timePoints[i - 1], firstSpot, secondSpot + 0.5*(this->step_)) -
-						firstModel->diffusion(timePoints[i - 1], firstSpot, secondSpot - 0.5*(this->step_))) / (this->step_)) *
-						(timePoints[i] -timePoints[i - 1])*z1*z2;
-
-				secondSpotNew = secondSpot +
-					secondModel->drift(timePoints[i - 1], firstSpot, secondSpot)*(timePoints[i] - timePoints[i - 1]) +
-					secondModel->diffusion(timePoints[i - 1], firstSpot, secondSpot) *
-					std::sqrt((timePoints[i] - timePoints[i - 1])) *
-					(this->correlation_ * z1 + std::sqrt(1.0 - (this->correlation_ * this->correlation_)) * z2) +
-					0.5*(this->correlation_)*firstModel->diffusion(timePoints[i - 1], firstSpot, secondSpot)*
-					((secondModel->diffusion(timePoints[i - 1], firstSpot + 0.5*(this->step_), secondSpot) -
-						secondModel->diffusion(timePoints[i - 1], firstSpot - 0.5*(this->step_), secondSpot)) / (this->step_))*
-						(timePoints[i] -timePoints[i - 1]) * ((z1)*(z1)-1.0) +
-					0.5 * secondModel->diffusion(timePoints[i - 1], firstSpot, secondSpot)*
-					((secondModel->diffusion(timePoints[i - 1], firstSpot, secondSpot + 0.5*(this->step_)) -
-						secondModel->diffusion(timePoints[i - 1], firstSpot, secondSpot - 0.5*(this->step_))) / (this->step_))*
-						(timePoints[i] -timePoints[i - 1]) * (((this->correlation_)*z1 + std::sqrt(1.0 - (this->correlation_)*(this->correlation_))*z2)*
-					((this->correlation_)*z1 + std::sqrt(1.0 - (this->correlation_)*(this->correlation_))*z2) - 1.0) +
-					std::sqrt(1.0 - (this->correlation_)*(this->correlation_))*
-					firstModel->diffusion(timePoints[i - 1], firstSpot, secondSpot)*
-					((secondModel->diffusion(timePoints[i - 1], firstSpot + 0.5*(this->step_), secondSpot) -
-						secondModel->diffusion(timePoints[i - 1], firstSpot - 0.5*(this->step_), secondSpot)) / (this->step_)) *
-						(timePoints[i] -timePoints[i - 1])*z1*z2;
+	public:
+		MilsteinScheme(std::tuple<std::shared_ptr<Sde<T, T,T,T>>, std::shared_ptr<Sde<T, T,T,T>>> const &model,
+			T correlation, std::shared_ptr<TimeGrid<T> const> const &grid):
+			SchemeBuilder<2,T,T,T,T>{model,correlation,grid}{}
+
+		void simulateInto(std::random_device::result_type seed, PathSpan<T> path) override {
+			if (this->simulateRecorded(seed, path))
+				return;
+			std::mt19937 mt(seed);
+			std::normal_distribution<T> normal1;
+			std::normal_distribution<T> normal2;
+			JumpScheduleType<T> jumps;
+			if (std::get<0>(this->model_)->hasJumps())
+				jumps = this->jumpSampler_.sample(*(std::get<0>(this->model_)->jumps()), mt, *(this->grid_));
+			step([&](T &z1, T &z2) {
+				z1 = normal1(mt);
+				z2 = normal2(mt);
+			}, &mt, path, jumps);
+		}
 
-				path[i] = firstSpotNew;
-				firstSpot = firstSpotNew;
-				secondSpot = secondSpotNew;
-			}
-			return path;
+		void stepInto(PathSpan<T> normals, JumpScheduleType<T> const &jumps, PathSpan<T> path) override {
+			assert(this->isStaged());
+			T const *z = normals.data();
+			step([&z](T &z1, T &z2) {
+				z1 = *z++;
+				z2 = *z++;
+			}, nullptr, path, jumps);
 		}
 
+	};
 
 
-	};
+	// One-factor scheme stepping model on grid; time-dependent coefficients
+	// are integrated once for the whole grid and shared by all paths
+	template<typename T>
+	std::shared_ptr<SchemeBuilder<1, T, T, T>> makeScheme(std::shared_ptr<Sde<T, T, T>> const &model,
+		std::shared_ptr<TimeGrid<T> const> const &grid, FDMScheme scheme) {
+		std::shared_ptr<StepCoefficientTable<T> const> table = nullptr;
+		if (model->hasStepCoefficients())
+			table = model->coefficients()->table(grid->times());
+
+		std::shared_ptr<SchemeBuilder<1, T, T, T>> result = nullptr;
+		switch (scheme) {
+		case FDMScheme::EulerScheme:
+			result = std::make_shared<EulerScheme<1, T>>(model, grid);
+			break;
+		case FDMScheme::MilsteinScheme:
+			result = std::make_shared<MilsteinScheme<1, T>>(model, grid);
+			break;
+		}
+		result->setStepCoefficients(table);
+		return result;
+	}
 
 }
 
 
 
-#endif ///_FDM_SCHEME_H_
\ No newline at end of file
+
+
+#endif ///_FDM_SCHEME_H_
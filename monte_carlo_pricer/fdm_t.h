@@ -4,6 +4,7 @@
 
 #include"sde_builder.h"
 #include"fdm.h"
+#include"path_cache.h"
 #include<iostream>
 #include<chrono>
 
@@ -107,6 +108,68 @@ void fdm_heston() {
 	//}
 }
 
+void fdm_cache_keys() {
+
+	// Models that differ only outside of their scalar parameters must not
+	// share cached paths:
+	path_cache::PathCache<> cache{ 64 * 1024 * 1024 };
+
+	HestonModel<> hest{ 0.04,0.01,0.12,0.015,0.012,100.0,0.025 };
+	Fdm<HestonModel<>::FactorCount, double> weak{ hest.model(),1.0,0.1,100 };
+	Fdm<HestonModel<>::FactorCount, double> strong{ hest.model(),1.0,0.9,100 };
+	weak.setSeed(7);
+	strong.setSeed(7);
+	auto weak_paths = cache.paths(hest, weak, 1000);
+	auto strong_paths = cache.paths(hest, strong, 1000);
+	std::cout << "correlation 0.1 vs 0.9 share paths: " << std::boolalpha
+		<< (weak_paths == strong_paths) << "\n";
+
+	ConstantElasticityVariance<> libm{ 0.05,0.2,0.8,100.0 };
+	ConstantElasticityVariance<> fast{ libm };
+	fast.setMathAccuracy(MathAccuracy::Fast);
+	Fdm<1, double> libm_fdm{ libm.model(),1.0,100 };
+	Fdm<1, double> fast_fdm{ fast.model(),1.0,100 };
+	libm_fdm.setSeed(7);
+	fast_fdm.setSeed(7);
+	auto libm_paths = cache.paths(libm, libm_fdm, 1000);
+	auto fast_paths = cache.paths(fast, fast_fdm, 1000);
+	std::cout << "Libm vs Fast accuracy share paths: " << (libm_paths == fast_paths) << "\n";
+
+	HullWhiteModel<> flat{ 0.1,ParameterCurve<double>(0.002),0.01,0.02 };
+	HullWhiteModel<> steep{ 0.1,ParameterCurve<double>({ 0.0,0.5 },{ 0.002,0.004 }),0.01,0.02 };
+	std::cout << "flat vs steep theta fingerprints equal: " << (flat.fingerprint() == steep.fingerprint()) << "\n";
+
+	// while the same run is served from the cache:
+	auto again = cache.paths(hest, weak, 1000);
+	std::cout << "same run served from cache: " << (again == weak_paths) << "\n";
+}
+
+void fdm_cev_chunks() {
+
+	// Pipelined runs step whole chunks with the fast_math array kernels and
+	// must give the paths of simulateInto() bit for bit:
+	for (auto accuracy : { MathAccuracy::Libm,MathAccuracy::Precise,MathAccuracy::Fast }) {
+		ConstantElasticityVariance<> cev{ 0.02,0.3,0.7,100.0 };
+		cev.setMathAccuracy(accuracy);
+		for (auto scheme : { FDMScheme::EulerScheme,FDMScheme::MilsteinScheme }) {
+			Fdm<1, double> fdm{ cev.model(),1.0,100 };
+			fdm.setSeed(5);
+			path_buffer::PathArena<double> arena;
+			fdm.simulateInto(arena, 1000, scheme);
+			auto same = fdm.template simulatePipelined<int>(1000, 100, 37,
+				[&](int &equal, std::size_t first, path_buffer::PathArena<double> const &chunk) {
+				for (std::size_t i = 0; i < chunk.pathCount(); ++i)
+					equal += std::equal(chunk.path(i).begin(), chunk.path(i).end(), arena.path(first + i).begin());
+			}, scheme);
+			int equal{ 0 };
+			for (auto s : same)
+				equal += s;
+			std::cout << "accuracy " << static_cast<int>(accuracy) << ", scheme " << static_cast<int>(scheme)
+				<< ": " << equal << " of 1000 chunked paths equal\n";
+		}
+	}
+}
+
 
 
 
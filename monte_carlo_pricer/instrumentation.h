@@ -0,0 +1,358 @@
+#pragma once
+#if !defined(_INSTRUMENTATION_H_)
+#define _INSTRUMENTATION_H_
+
+#include<string>
+#include<vector>
+#include<array>
+#include<deque>
+#include<atomic>
+#include<mutex>
+#include<chrono>
+#include<sstream>
+#include<cstdint>
+#include<utility>
+
+// Engine instrumentation is compiled in only when MC_INSTRUMENTATION is defined
+// (e.g. /D MC_INSTRUMENTATION) and then records only while enabled at run time.
+// Without the define every hook below is an empty inline function.
+
+namespace instrumentation {
+
+	// Stages of Fdm::operator() and of the batch payoff functions
+	enum class Stage {
+		Setup,		// scheme construction and coefficient tables
+		Launch,		// starting path tasks (std::async or thread pool)
+		Simulation,	// path generation, summed over worker threads
+		RandomNumbers,	// normals and jump schedules of staged schemes, summed over worker threads
+		Stepping,	// drift/diffusion evaluation and path updates of staged schemes, ditto
+		Join,		// waiting for and collecting the paths
+		Payoff,		// batch payoff evaluation
+	};
+
+	static constexpr std::size_t stageCount = 7;
+
+	inline char const *stageName(Stage stage) {
+		switch (stage) {
+		case Stage::Setup: return "setup";
+		case Stage::Launch: return "launch";
+		case Stage::Simulation: return "simulation";
+		case Stage::RandomNumbers: return "rng";
+		case Stage::Stepping: return "stepping";
+		case Stage::Join: return "join";
+		case Stage::Payoff: return "payoff";
+		}
+		return "unknown";
+	}
+
+	struct StageStatistics {
+		std::uint64_t calls{ 0 };
+		double seconds{ 0.0 };
+	};
+
+	// Pool workers are reported one by one, all other threads (std::async
+	// path threads and callers of parallelFor) together as "other"
+	struct ThreadStatistics {
+		std::string name;
+		double busySeconds{ 0.0 };
+		double idleSeconds{ 0.0 };
+		std::uint64_t tasks{ 0 };
+	};
+
+	struct Statistics {
+		bool compiledIn{ false };
+		bool enabled{ false };
+		std::array<StageStatistics, stageCount> stages;
+		std::uint64_t paths{ 0 };
+		std::uint64_t pathSteps{ 0 };
+		std::uint64_t allocations{ 0 };		// engine buffers (paths and their containers)
+		std::uint64_t allocatedBytes{ 0 };
+		std::vector<ThreadStatistics> threads;
+
+		std::string json()const {
+			std::ostringstream out;
+			out.precision(9);
+			out << "{\"compiledIn\":" << (compiledIn ? "true" : "false")
+				<< ",\"enabled\":" << (enabled ? "true" : "false") << ",\"stages\":{";
+			for (std::size_t s = 0; s < stageCount; ++s) {
+				out << (s == 0 ? "" : ",") << '"' << stageName(static_cast<Stage>(s)) << "\":{\"calls\":"
+					<< stages[s].calls << ",\"seconds\":" << stages[s].seconds << '}';
+			}
+			out << "},\"paths\":" << paths << ",\"pathSteps\":" << pathSteps
+				<< ",\"allocations\":" << allocations << ",\"allocatedBytes\":" << allocatedBytes << ",\"threads\":[";
+			for (std::size_t t = 0; t < threads.size(); ++t) {
+				out << (t == 0 ? "" : ",") << "{\"name\":\"" << threads[t].name << "\",\"busySeconds\":"
+					<< threads[t].busySeconds << ",\"idleSeconds\":" << threads[t].idleSeconds
+					<< ",\"tasks\":" << threads[t].tasks << '}';
+			}
+			out << "]}";
+			return out.str();
+		}
+	};
+
+
+#if defined(MC_INSTRUMENTATION)
+
+	namespace detail {
+
+		typedef std::chrono::steady_clock Clock;
+
+		struct ThreadRecord {
+			std::string name;
+			std::atomic<std::uint64_t> busy{ 0 };	// nanoseconds
+			std::atomic<std::uint64_t> idle{ 0 };
+			std::atomic<std::uint64_t> tasks{ 0 };
+			bool pooled{ false };
+
+			ThreadRecord(std::string const &name, bool pooled) :name{ name }, pooled{ pooled } {}
+		};
+
+		struct Registry {
+			std::atomic<bool> enabled{ false };
+			std::array<std::atomic<std::uint64_t>, stageCount> calls;
+			std::array<std::atomic<std::uint64_t>, stageCount> nanoseconds;
+			std::atomic<std::uint64_t> paths{ 0 };
+			std::atomic<std::uint64_t> pathSteps{ 0 };
+			std::atomic<std::uint64_t> allocations{ 0 };
+			std::atomic<std::uint64_t> allocatedBytes{ 0 };
+			std::mutex mutex;
+			std::deque<ThreadRecord> threads;	// stable addresses
+			std::size_t poolWorkers{ 0 };
+
+			Registry() {
+				for (std::size_t s = 0; s < stageCount; ++s) {
+					calls[s] = 0;
+					nanoseconds[s] = 0;
+				}
+				threads.emplace_back("other", false);
+			}
+		};
+
+		inline Registry &registry() {
+			static Registry instance;
+			return instance;
+		}
+
+		inline ThreadRecord *&currentThread() {
+			thread_local ThreadRecord *record = nullptr;
+			return record;
+		}
+
+		inline ThreadRecord &thread() {
+			auto &record = currentThread();
+			if (record == nullptr)
+				record = &registry().threads.front();
+			return *record;
+		}
+
+		inline std::uint64_t since(Clock::time_point start) {
+			return static_cast<std::uint64_t>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+		}
+
+		inline void recordStage(Stage stage, std::uint64_t nanoseconds) {
+			auto &r = registry();
+			r.calls[static_cast<std::size_t>(stage)].fetch_add(1, std::memory_order_relaxed);
+			r.nanoseconds[static_cast<std::size_t>(stage)].fetch_add(nanoseconds, std::memory_order_relaxed);
+		}
+	}
+
+	inline void enable(bool on = true) { detail::registry().enabled = on; }
+	inline bool isEnabled() { return detail::registry().enabled.load(std::memory_order_relaxed); }
+
+	inline void reset() {
+		auto &r = detail::registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (std::size_t s = 0; s < stageCount; ++s) {
+			r.calls[s] = 0;
+			r.nanoseconds[s] = 0;
+		}
+		r.paths = 0;
+		r.pathSteps = 0;
+		r.allocations = 0;
+		r.allocatedBytes = 0;
+		for (auto &t : r.threads) {
+			t.busy = 0;
+			t.idle = 0;
+			t.tasks = 0;
+		}
+	}
+
+	inline Statistics statistics() {
+		auto &r = detail::registry();
+		Statistics result;
+		result.compiledIn = true;
+		result.enabled = isEnabled();
+		for (std::size_t s = 0; s < stageCount; ++s) {
+			result.stages[s].calls = r.calls[s];
+			result.stages[s].seconds = static_cast<double>(r.nanoseconds[s]) * 1.0e-9;
+		}
+		result.paths = r.paths;
+		result.pathSteps = r.pathSteps;
+		result.allocations = r.allocations;
+		result.allocatedBytes = r.allocatedBytes;
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (auto const &t : r.threads) {
+			result.threads.emplace_back(ThreadStatistics{ t.name,static_cast<double>(t.busy) * 1.0e-9,
+				static_cast<double>(t.idle) * 1.0e-9,t.tasks });
+		}
+		return result;
+	}
+
+	inline void recordAllocation(std::size_t bytes) {
+		if (!isEnabled())
+			return;
+		auto &r = detail::registry();
+		r.allocations.fetch_add(1, std::memory_order_relaxed);
+		r.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	// Times a stage from construction until stop() or destruction
+	class StageTimer {
+	private:
+		Stage stage_;
+		bool running_;
+		detail::Clock::time_point start_;
+
+	public:
+		explicit StageTimer(Stage stage)
+			:stage_{ stage }, running_{ isEnabled() } {
+			if (running_)
+				start_ = detail::Clock::now();
+		}
+
+		~StageTimer() { stop(); }
+
+		StageTimer(StageTimer const &) = delete;
+		StageTimer &operator=(StageTimer const &) = delete;
+
+		void stop() {
+			if (!running_)
+				return;
+			running_ = false;
+			detail::recordStage(stage_, detail::since(start_));
+		}
+	};
+
+	// Calls generator(args...) for one path and records its time, steps,
+	// buffer and (off the pool) the busy time of the calling thread
+	template<typename Generator, typename ...Args>
+	auto timedPath(Generator const &generator, Args &&...args) -> decltype(generator(std::forward<Args>(args)...)) {
+		if (!isEnabled())
+			return generator(std::forward<Args>(args)...);
+		auto const start = detail::Clock::now();
+		auto path = generator(std::forward<Args>(args)...);
+		auto const elapsed = detail::since(start);
+		auto &r = detail::registry();
+		detail::recordStage(Stage::Simulation, elapsed);
+		r.paths.fetch_add(1, std::memory_order_relaxed);
+		r.pathSteps.fetch_add(path.empty() ? 0 : path.size() - 1, std::memory_order_relaxed);
+		recordAllocation(path.capacity() * sizeof(typename decltype(path)::value_type));
+		auto &thread = detail::thread();
+		if (!thread.pooled) {
+			thread.busy.fetch_add(elapsed, std::memory_order_relaxed);
+			thread.tasks.fetch_add(1, std::memory_order_relaxed);
+		}
+		return path;
+	}
+
+	// Calls fill() writing pathCount paths of pathLength values into existing
+	// storage and records them like timedPath, without a buffer allocation
+	template<typename Fill>
+	void timedFill(std::size_t pathLength, Fill const &fill, std::size_t pathCount = 1) {
+		if (!isEnabled()) {
+			fill();
+			return;
+		}
+		auto const start = detail::Clock::now();
+		fill();
+		auto const elapsed = detail::since(start);
+		auto &r = detail::registry();
+		detail::recordStage(Stage::Simulation, elapsed);
+		r.paths.fetch_add(pathCount, std::memory_order_relaxed);
+		r.pathSteps.fetch_add(pathLength == 0 ? 0 : pathCount * (pathLength - 1), std::memory_order_relaxed);
+		auto &thread = detail::thread();
+		if (!thread.pooled) {
+			thread.busy.fetch_add(elapsed, std::memory_order_relaxed);
+			thread.tasks.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Names the calling thread pool-<n>, called once by every pool worker
+	inline void registerPoolWorker() {
+		auto &r = detail::registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.threads.emplace_back("pool-" + std::to_string(r.poolWorkers++), true);
+		detail::currentThread() = &r.threads.back();
+	}
+
+	// Times the calling thread as busy (running a task) or idle (waiting for one)
+	class ThreadTimer {
+	private:
+		bool busy_;
+		bool running_;
+		detail::Clock::time_point start_;
+
+	public:
+		explicit ThreadTimer(bool busy)
+			:busy_{ busy }, running_{ isEnabled() } {
+			if (running_)
+				start_ = detail::Clock::now();
+		}
+
+		~ThreadTimer() {
+			if (!running_)
+				return;
+			auto &thread = detail::thread();
+			auto const elapsed = detail::since(start_);
+			if (busy_) {
+				thread.busy.fetch_add(elapsed, std::memory_order_relaxed);
+				thread.tasks.fetch_add(1, std::memory_order_relaxed);
+			}
+			else {
+				thread.idle.fetch_add(elapsed, std::memory_order_relaxed);
+			}
+		}
+
+		ThreadTimer(ThreadTimer const &) = delete;
+		ThreadTimer &operator=(ThreadTimer const &) = delete;
+	};
+
+#else
+
+	inline void enable(bool = true) {}
+	inline bool isEnabled() { return false; }
+	inline void reset() {}
+	inline Statistics statistics() { return Statistics{}; }
+	inline void recordAllocation(std::size_t) {}
+
+	class StageTimer {
+	public:
+		explicit StageTimer(Stage) {}
+		inline void stop() {}
+	};
+
+	template<typename Generator, typename ...Args>
+	inline auto timedPath(Generator const &generator, Args &&...args) -> decltype(generator(std::forward<Args>(args)...)) {
+		return generator(std::forward<Args>(args)...);
+	}
+
+	template<typename Fill>
+	inline void timedFill(std::size_t, Fill const &fill, std::size_t = 1) {
+		fill();
+	}
+
+	inline void registerPoolWorker() {}
+
+	class ThreadTimer {
+	public:
+		explicit ThreadTimer(bool) {}
+	};
+
+#endif
+
+}
+
+
+
+#endif ///_INSTRUMENTATION_H_
@@ -0,0 +1,266 @@
+#pragma once
+#if !defined(_LONGSTAFF_SCHWARTZ_H_)
+#define _LONGSTAFF_SCHWARTZ_H_
+
+#include"mc_types.h"
+#include"mc_utilities.h"
+#include"payoff_strategy.h"
+#include<memory>
+#include<array>
+#include<algorithm>
+#include<cmath>
+#include<limits>
+#include<stdexcept>
+
+namespace longstaff_schwartz {
+
+	using mc_types::PathValuesType;
+	using mc_types::TimePointsType;
+	using mc_types::RegressionBasis;
+	using payoff::PayoffStrategy;
+	using payoff::PayoffMoments;
+
+
+	// In-sample price is biased high (exercise rule fitted on the same paths),
+	// lower bound comes from an independent set of paths
+	struct LsmResult {
+		double inSamplePrice;
+		double lowerBound;
+		double standardError;
+	};
+
+	static constexpr std::size_t maxBasisDegree = 8;
+
+	// Basis functions 0,...,degree evaluated at x into out
+	inline void basisFunctions(RegressionBasis basis, std::size_t degree, double x, double *out) {
+		out[0] = 1.0;
+		if (degree == 0)
+			return;
+		if (basis == RegressionBasis::Monomial) {
+			for (std::size_t k = 1; k <= degree; ++k)
+				out[k] = out[k - 1] * x;
+			return;
+		}
+		// Laguerre: (n+1) L_{n+1} = (2n+1-x) L_n - n L_{n-1}
+		out[1] = 1.0 - x;
+		for (std::size_t n = 1; n < degree; ++n) {
+			out[n + 1] = ((2.0 * n + 1.0 - x) * out[n] - n * out[n - 1]) / (n + 1.0);
+		}
+	}
+
+
+	// Least-squares Monte Carlo (Longstaff-Schwartz) for Bermudan exercise.
+	// Paths are those produced by Fdm (for two-factor models the first factor),
+	// path[i] is taken at timePoints[i] and exercise is allowed at exerciseIndices.
+	// Continuation values are regressed on the state scaled by its initial value,
+	// using in-the-money paths only, with constant rate discounting.
+	template<typename T = double>
+	class LongstaffSchwartz {
+	private:
+		std::shared_ptr<PayoffStrategy<T>> exercise_;
+		TimePointsType<T> timePoints_;
+		std::vector<std::size_t> exerciseIndices_;
+		T rate_;
+		RegressionBasis basis_{ RegressionBasis::Laguerre };
+		std::size_t degree_{ 3 };
+		std::size_t blockSize_{ 4096 };
+		double scale_{ 1.0 };
+		std::vector<std::vector<double>> coefficients_;
+
+		struct NormalEquations {
+			std::vector<double> xtx;
+			std::vector<double> xty;
+		};
+
+		// Coefficients of targets regressed on the basis of states,
+		// X'X and X'y are formed over blocks of paths in parallel.
+		// Empty result means no regression (too few paths or singular system).
+		std::vector<double> regress(std::vector<double> const &states, std::vector<double> const &targets)const {
+			std::size_t const n = degree_ + 1;
+			if (states.size() < n)
+				return std::vector<double>{};
+			auto const blocks = mc_utilities::parallelBlocks<NormalEquations>(states.size(), blockSize_,
+				[&](std::size_t first, std::size_t size) {
+				NormalEquations eq{ std::vector<double>(n * n, 0.0),std::vector<double>(n, 0.0) };
+				std::array<double, maxBasisDegree + 1> f;
+				for (std::size_t i = first; i < first + size; ++i) {
+					basisFunctions(basis_, degree_, states[i] / scale_, f.data());
+					for (std::size_t r = 0; r < n; ++r) {
+						eq.xty[r] += f[r] * targets[i];
+						for (std::size_t c = 0; c <= r; ++c)
+							eq.xtx[r * n + c] += f[r] * f[c];
+					}
+				}
+				return eq;
+			});
+			NormalEquations total{ std::vector<double>(n * n, 0.0),std::vector<double>(n, 0.0) };
+			for (auto const &eq : blocks) {
+				for (std::size_t k = 0; k < n * n; ++k)
+					total.xtx[k] += eq.xtx[k];
+				for (std::size_t k = 0; k < n; ++k)
+					total.xty[k] += eq.xty[k];
+			}
+			for (std::size_t r = 0; r < n; ++r) {
+				for (std::size_t c = r + 1; c < n; ++c)
+					total.xtx[r * n + c] = total.xtx[c * n + r];
+			}
+			std::vector<double> beta;
+			if (!mc_utilities::solveLinearSystem(total.xtx, total.xty, beta))
+				return std::vector<double>{};
+			return beta;
+		}
+
+		double continuation(std::size_t date, T state)const {
+			auto const &beta = coefficients_[date];
+			if (beta.empty())
+				return std::numeric_limits<double>::infinity();
+			std::array<double, maxBasisDegree + 1> f;
+			basisFunctions(basis_, degree_, static_cast<double>(state) / scale_, f.data());
+			double value{ 0.0 };
+			for (std::size_t k = 0; k < beta.size(); ++k)
+				value += beta[k] * f[k];
+			return value;
+		}
+
+		void checkPaths(PathValuesType<PathValuesType<T>> const &paths)const {
+			if (paths.empty())
+				throw std::invalid_argument("No paths given.");
+			if (exerciseIndices_.back() >= paths.front().size())
+				throw std::out_of_range("Exercise index lies beyond the end of the paths.");
+		}
+
+	public:
+		LongstaffSchwartz(std::shared_ptr<PayoffStrategy<T>> const &exercise,
+			TimePointsType<T> const &timePoints, std::vector<std::size_t> const &exerciseIndices, T rate)
+			:exercise_{ exercise }, timePoints_{ timePoints }, exerciseIndices_{ exerciseIndices },
+			rate_{ rate } {
+			if (exerciseIndices_.empty())
+				throw std::invalid_argument("At least one exercise date is needed.");
+			std::sort(exerciseIndices_.begin(), exerciseIndices_.end());
+			exerciseIndices_.erase(std::unique(exerciseIndices_.begin(), exerciseIndices_.end()), exerciseIndices_.end());
+			if (exerciseIndices_.back() >= timePoints_.size())
+				throw std::out_of_range("Exercise index lies beyond the time points.");
+		}
+
+		// Indices of time points nearest to the exercise times
+		static std::vector<std::size_t> exerciseIndices(TimePointsType<T> const &timePoints,
+			TimePointsType<T> const &exerciseTimes) {
+			std::vector<std::size_t> indices;
+			indices.reserve(exerciseTimes.size());
+			for (auto const &time : exerciseTimes) {
+				auto const it = std::lower_bound(timePoints.begin(), timePoints.end(), time);
+				std::size_t index = static_cast<std::size_t>(it - timePoints.begin());
+				if (index == timePoints.size() || (index > 0 && (time - timePoints[index - 1]) < (timePoints[index] - time)))
+					--index;
+				indices.emplace_back(index);
+			}
+			return indices;
+		}
+
+		void setBasis(RegressionBasis basis, std::size_t degree) {
+			if (degree > maxBasisDegree)
+				throw std::invalid_argument("Degree of regression basis is too high.");
+			basis_ = basis;
+			degree_ = degree;
+		}
+		inline RegressionBasis basis()const { return basis_; }
+		inline std::size_t degree()const { return degree_; }
+
+		inline void setBlockSize(std::size_t blockSize) { blockSize_ = std::max<std::size_t>(1, blockSize); }
+		inline std::size_t blockSize()const { return blockSize_; }
+
+		inline std::vector<std::size_t> const &exerciseIndices()const { return exerciseIndices_; }
+		inline std::vector<std::vector<double>> const &coefficients()const { return coefficients_; }
+
+		// Backward induction: fits the exercise rule and returns the in-sample price
+		double fit(PathValuesType<PathValuesType<T>> const &paths) {
+			checkPaths(paths);
+			std::size_t const dates = exerciseIndices_.size();
+			std::size_t const size = paths.size();
+			scale_ = (paths.front().front() != T{}) ? std::abs(static_cast<double>(paths.front().front())) : 1.0;
+			coefficients_.assign(dates, std::vector<double>{});
+
+			std::vector<double> cash(size);
+			std::size_t index = exerciseIndices_.back();
+			for (std::size_t p = 0; p < size; ++p)
+				cash[p] = exercise_->payoff(paths[p][index]);
+
+			std::vector<std::size_t> itm;
+			std::vector<double> states;
+			std::vector<double> targets;
+			std::vector<double> values;
+			for (std::size_t d = dates - 1; d-- > 0;) {
+				std::size_t const next = index;
+				index = exerciseIndices_[d];
+				double const df = std::exp(-static_cast<double>(rate_) *
+					static_cast<double>(timePoints_[next] - timePoints_[index]));
+				itm.clear();
+				states.clear();
+				targets.clear();
+				values.clear();
+				for (std::size_t p = 0; p < size; ++p) {
+					cash[p] *= df;
+					double const value = exercise_->payoff(paths[p][index]);
+					if (value > 0.0) {
+						itm.emplace_back(p);
+						states.emplace_back(static_cast<double>(paths[p][index]));
+						targets.emplace_back(cash[p]);
+						values.emplace_back(value);
+					}
+				}
+				coefficients_[d] = regress(states, targets);
+				for (std::size_t k = 0; k < itm.size(); ++k) {
+					if (values[k] >= continuation(d, static_cast<T>(states[k])))
+						cash[itm[k]] = values[k];
+				}
+			}
+			double const df = std::exp(-static_cast<double>(rate_) * static_cast<double>(timePoints_[index]));
+			double sum{ 0.0 };
+			for (auto const &c : cash)
+				sum += c;
+			return (df * sum / static_cast<double>(size));
+		}
+
+		// Discounted cash flows of the fitted exercise rule on (independent) paths
+		PayoffMoments exercise(PathValuesType<PathValuesType<T>> const &paths)const {
+			if (coefficients_.size() != exerciseIndices_.size())
+				throw std::logic_error("Exercise rule has not been fitted.");
+			checkPaths(paths);
+			std::vector<double> discounts(exerciseIndices_.size());
+			for (std::size_t d = 0; d < discounts.size(); ++d)
+				discounts[d] = std::exp(-static_cast<double>(rate_) * static_cast<double>(timePoints_[exerciseIndices_[d]]));
+			return payoff::detail::parallelBlockMoments(paths.size(), blockSize_,
+				[&](std::size_t first, std::size_t size) {
+				PayoffMoments moments;
+				for (std::size_t p = first; p < first + size; ++p) {
+					double cashFlow{ 0.0 };
+					for (std::size_t d = 0; d < exerciseIndices_.size(); ++d) {
+						T const state = paths[p][exerciseIndices_[d]];
+						double const value = exercise_->payoff(state);
+						if (value > 0.0 && (d + 1 == exerciseIndices_.size() || value >= continuation(d, state))) {
+							cashFlow = discounts[d] * value;
+							break;
+						}
+					}
+					moments.sum += cashFlow;
+					moments.sumOfSquares += cashFlow * cashFlow;
+				}
+				moments.count = size;
+				return moments;
+			});
+		}
+
+		// Fits on the training paths and prices on the independent pricing paths
+		LsmResult price(PathValuesType<PathValuesType<T>> const &trainingPaths,
+			PathValuesType<PathValuesType<T>> const &pricingPaths) {
+			double const inSample = fit(trainingPaths);
+			auto const moments = exercise(pricingPaths);
+			return LsmResult{ inSample,moments.mean(),moments.standardError() };
+		}
+	};
+
+}
+
+
+
+#endif ///_LONGSTAFF_SCHWARTZ_H_
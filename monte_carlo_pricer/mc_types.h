@@ -30,6 +30,40 @@ namespace mc_types {
 
 	enum class FDMScheme { EulerScheme, MilsteinScheme};
 
+	enum class CurveInterpolation { PiecewiseConstant, PiecewiseLinear };
+
+	enum class CalibrationObjective { Price, ImpliedVolatility };
+
+	enum class BarrierType { UpAndOut, UpAndIn, DownAndOut, DownAndIn };
+
+	// Crossing probability between grid points:
+	// None: barrier monitored at grid points only
+	// Arithmetic: Brownian bridge on the state
+	// Logarithmic: Brownian bridge on the log of the state (GBM-like models)
+	enum class BridgeCorrection { None, Arithmetic, Logarithmic };
+
+	// Regression functions of the continuation value (least-squares Monte Carlo)
+	enum class RegressionBasis { Monomial, Laguerre };
+
+	// Order of path values in contiguous storage:
+	// PathMajor: all values of path 0, then path 1, ...
+	// StepMajor: values of all paths at step 0, then step 1, ...
+	enum class PathLayout { PathMajor, StepMajor };
+
+	// Libm: std:: functions
+	// Precise: fast_math kernels, largest errors measured over the whole domain
+	// (fast_math_t.h): exp and pow 1.3 ulp, log 0.7 ulp (double), 1.1 and 0.6 ulp (float)
+	// Fast: fast_math kernels, exp and log relative error below 1e-10 (double),
+	// 1e-5 (float), pow error growing with |y log x| up to 2e-10 (double), 3e-5 (float)
+	enum class MathAccuracy { Libm, Precise, Fast };
+
+	// Backing of large path buffers:
+	// Standard: ordinary aligned heap memory
+	// TransparentHugePages: heap memory advised for transparent huge pages (Linux)
+	// HugePages: explicit huge/large pages, falls back to TransparentHugePages
+	// when none are available (no reserved hugetlbfs pages, no SeLockMemoryPrivilege)
+	enum class PageBacking { Standard, TransparentHugePages, HugePages };
+
 }
 
 
@@ -4,6 +4,14 @@
 
 #include<cassert>
 #include<functional>
+#include<cstdint>
+#include<vector>
+#include<string>
+#include<cmath>
+#include<utility>
+#include<algorithm>
+#include<future>
+#include<thread>
 #include<amp.h>
 #include<amp_math.h>
 
@@ -11,6 +19,138 @@ namespace mc_utilities {
 
 	#define PI 3.14159265358979323846
 
+	// Deterministic seed of path number index derived from a base seed (splitmix64).
+	// Neighbouring indices give uncorrelated seeds, so a run with fixed base seed
+	// reproduces the same paths independently of how they are scheduled.
+	inline std::uint32_t pathSeed(std::uint64_t baseSeed, std::uint64_t index) {
+		std::uint64_t z = baseSeed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z = z ^ (z >> 31);
+		return static_cast<std::uint32_t>(z ^ (z >> 32));
+	}
+
+	// FNV-1a hash over canonical bytes of the values mixed in: sizes precede
+	// strings and vectors, -0.0 mixes as 0.0
+	class Fingerprint {
+	private:
+		std::uint64_t hash_;
+
+	public:
+		explicit Fingerprint(std::uint64_t seed = 0xcbf29ce484222325ULL) :hash_{ seed } {}
+
+		void mix(void const *data, std::size_t size) {
+			auto const bytes = static_cast<unsigned char const *>(data);
+			for (std::size_t i = 0; i < size; ++i) {
+				hash_ ^= bytes[i];
+				hash_ *= 0x100000001b3ULL;
+			}
+		}
+
+		inline void mix(std::uint64_t value) { mix(&value, sizeof(value)); }
+
+		inline void mix(double value) {
+			value = (value == 0.0) ? 0.0 : value;
+			mix(&value, sizeof(value));
+		}
+
+		inline void mix(std::string const &value) {
+			mix(static_cast<std::uint64_t>(value.size()));
+			mix(value.data(), value.size());
+		}
+
+		template<typename T>
+		void mix(std::vector<T> const &values) {
+			mix(static_cast<std::uint64_t>(values.size()));
+			for (auto const &value : values)
+				mix(static_cast<double>(value));
+		}
+
+		inline std::uint64_t value()const { return hash_; }
+	};
+
+	// Solves dense system A x = b (A stored row-major, n x n) by Gaussian
+	// elimination with partial pivoting. Returns false for singular A.
+	inline bool solveLinearSystem(std::vector<double> A, std::vector<double> b,
+		std::vector<double> &x) {
+		std::size_t const n = b.size();
+		assert(A.size() == n * n);
+		for (std::size_t c = 0; c < n; ++c) {
+			std::size_t pivot = c;
+			for (std::size_t r = c + 1; r < n; ++r) {
+				if (std::abs(A[r*n + c]) > std::abs(A[pivot*n + c]))
+					pivot = r;
+			}
+			if (A[pivot*n + c] == 0.0)
+				return false;
+			if (pivot != c) {
+				for (std::size_t k = 0; k < n; ++k)
+					std::swap(A[c*n + k], A[pivot*n + k]);
+				std::swap(b[c], b[pivot]);
+			}
+			for (std::size_t r = c + 1; r < n; ++r) {
+				double const f = A[r*n + c] / A[c*n + c];
+				for (std::size_t k = c; k < n; ++k)
+					A[r*n + k] -= f * A[c*n + k];
+				b[r] -= f * b[c];
+			}
+		}
+		x.assign(n, 0.0);
+		for (std::size_t r = n; r-- > 0;) {
+			double sum = b[r];
+			for (std::size_t k = r + 1; k < n; ++k)
+				sum -= A[r*n + k] * x[k];
+			x[r] = sum / A[r*n + r];
+		}
+		return true;
+	}
+
+	// Evaluates blockFun(first,size) over consecutive blocks of count items,
+	// blocks are spread over hardware threads. Results are returned in block order,
+	// so reductions over them do not depend on the number of threads.
+	template<typename Result, typename BlockFun>
+	std::vector<Result> parallelBlocks(std::size_t count, std::size_t blockSize, BlockFun &&blockFun) {
+		blockSize = std::max<std::size_t>(1, blockSize);
+		std::size_t const blocks = (count + blockSize - 1) / blockSize;
+		std::size_t const workers = std::min<std::size_t>(blocks,
+			std::max<std::size_t>(1, std::thread::hardware_concurrency()));
+		std::vector<Result> results(blocks);
+		auto const task = [&](std::size_t worker) {
+			for (std::size_t b = worker; b < blocks; b += workers) {
+				std::size_t const first = b * blockSize;
+				results[b] = blockFun(first, std::min(blockSize, count - first));
+			}
+		};
+		std::vector<std::future<void>> futures;
+		for (std::size_t w = 1; w < workers; ++w)
+			futures.emplace_back(std::async(std::launch::async, task, w));
+		if (workers > 0)
+			task(0);
+		for (auto &f : futures)
+			f.get();
+		return results;
+	}
+
+	// Calls fun(i) for i in [0,count) on hardware threads, each thread taking
+	// one contiguous range of indices
+	template<typename Fun>
+	void parallelFor(std::size_t count, Fun &&fun) {
+		std::size_t const workers = std::min<std::size_t>(count,
+			std::max<std::size_t>(1, std::thread::hardware_concurrency()));
+		auto const task = [&](std::size_t worker) {
+			std::size_t const last = (count * (worker + 1)) / workers;
+			for (std::size_t i = (count * worker) / workers; i < last; ++i)
+				fun(i);
+		};
+		std::vector<std::future<void>> futures;
+		for (std::size_t w = 1; w < workers; ++w)
+			futures.emplace_back(std::async(std::launch::async, task, w));
+		if (workers > 0)
+			task(0);
+		for (auto &f : futures)
+			f.get();
+	}
+
 	enum class withRespectTo {
 		firstArg,
 		secondArg,
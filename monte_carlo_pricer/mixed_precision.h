@@ -0,0 +1,211 @@
+#pragma once
+#if !defined(_MIXED_PRECISION_H_)
+#define _MIXED_PRECISION_H_
+
+#include"mc_types.h"
+#include"mc_utilities.h"
+#include"payoff_strategy.h"
+#include"fdm.h"
+#include"reduction.h"
+#include<vector>
+#include<cmath>
+#include<random>
+#include<algorithm>
+#include<stdexcept>
+
+namespace mixed_precision {
+
+	using mc_types::PathValuesType;
+	using mc_types::FDMScheme;
+	using payoff::PayoffStrategy;
+	using payoff::PayoffMoments;
+	using finite_difference_method::Fdm;
+	using finite_difference_method::JumpScheduleType;
+	using path_buffer::PathSpan;
+
+
+	// Neumaier (improved Kahan) summation: the rounding error of every
+	// addition is carried in a separate compensation term
+	struct CompensatedSum {
+		double sum{ 0.0 };
+		double compensation{ 0.0 };
+
+		inline void add(double x) {
+			double const t = sum + x;
+			if (std::abs(sum) >= std::abs(x))
+				compensation += (sum - t) + x;
+			else
+				compensation += (x - t) + sum;
+			sum = t;
+		}
+
+		inline void merge(CompensatedSum const &other) {
+			add(other.sum);
+			compensation += other.compensation;
+		}
+
+		inline double value()const { return (sum + compensation); }
+	};
+
+	// Payoff moments accumulated with compensated sums
+	struct CompensatedMoments {
+		CompensatedSum sum;
+		CompensatedSum sumOfSquares;
+		std::size_t count{ 0 };
+
+		inline void add(double x) {
+			sum.add(x);
+			sumOfSquares.add(x * x);
+			++count;
+		}
+
+		inline void merge(CompensatedMoments const &other) {
+			sum.merge(other.sum);
+			sumOfSquares.merge(other.sumOfSquares);
+			count += other.count;
+		}
+
+		inline PayoffMoments moments()const {
+			PayoffMoments result;
+			result.sum = sum.value();
+			result.sumOfSquares = sumOfSquares.value();
+			result.count = count;
+			return result;
+		}
+	};
+
+
+	inline void mergeMoments(CompensatedMoments &into, CompensatedMoments const &from) { into.merge(from); }
+
+	// Payoff moments of a strategy over all underlyings: payoffs are evaluated in
+	// double whatever the precision of the paths and accumulated with compensated
+	// sums, blocks run in parallel and are reduced by the fixed tree of
+	// reduction.h, so the result does not depend on the number of threads
+	template<typename UnderlyingType>
+	PayoffMoments compensatedPayoff(PayoffStrategy<UnderlyingType> const &strategy,
+		std::vector<UnderlyingType> const &underlyings, std::size_t blockSize = reduction::reductionBlockSize) {
+		return reduction::reduceBlocks<CompensatedMoments>(underlyings.size(), blockSize,
+			[&](std::size_t first, std::size_t size) {
+			CompensatedMoments moments;
+			for (std::size_t i = first; i < first + size; ++i)
+				moments.add(strategy.payoff(underlyings[i]));
+			return moments;
+		}, mergeMoments).moments();
+	}
+
+	// Same as above on the terminal values of paths
+	template<typename T>
+	PayoffMoments compensatedTerminalPayoff(PayoffStrategy<T> const &strategy,
+		std::vector<PathValuesType<T>> const &paths, std::size_t blockSize = reduction::reductionBlockSize) {
+		return reduction::reduceBlocks<CompensatedMoments>(paths.size(), blockSize,
+			[&](std::size_t first, std::size_t size) {
+			CompensatedMoments moments;
+			for (std::size_t i = first; i < first + size; ++i)
+				moments.add(strategy.payoff(paths[i].back()));
+			return moments;
+		}, mergeMoments).moments();
+	}
+
+
+	// Mixed-precision price against an all-double reference run on the same
+	// random numbers: the normals (and jumps) of every path are drawn once in
+	// double by the reference scheme and drive both the double path and, rounded
+	// to float, the float path. The pathwise difference then carries the error
+	// of the float arithmetic only: it passes when within confidence standard
+	// errors of itself plus tolerance times the standard error of the price,
+	// i.e. when the float error is negligible against the Monte Carlo error.
+	struct PrecisionReport {
+		double mixedPrice;
+		double mixedStandardError;
+		double referencePrice;
+		double referenceStandardError;
+		double difference;				// mixed - reference
+		double differenceStandardError;	// of the paired (pathwise) differences
+		double errorBound;				// confidence * differenceStandardError + tolerance * referenceStandardError
+		bool withinBound;
+	};
+
+	// Moments of the paired runs of one block
+	struct PairedMoments {
+		CompensatedMoments mixed;
+		CompensatedMoments reference;
+		CompensatedMoments difference;
+
+		inline void merge(PairedMoments const &other) {
+			mixed.merge(other.mixed);
+			reference.merge(other.reference);
+			difference.merge(other.difference);
+		}
+	};
+
+	inline void mergePaired(PairedMoments &into, PairedMoments const &from) { into.merge(from); }
+
+	// Prices on float paths (compensated double accumulation) and on double
+	// paths stepped from the same normals; both engines must share their time
+	// grid and be staged (no exact transitions, which draw while stepping).
+	// Path i takes the seed of path i of the reference engine.
+	template<std::size_t FactorCount>
+	PrecisionReport validate(Fdm<FactorCount, float> &mixed, Fdm<FactorCount, double> &reference,
+		PayoffStrategy<float> const &mixedPayoff, PayoffStrategy<double> const &referencePayoff,
+		std::size_t iterations, double discountFactor = 1.0, FDMScheme scheme = FDMScheme::EulerScheme,
+		double confidence = 3.0, double tolerance = 0.01) {
+		if (iterations < 2)
+			throw std::invalid_argument("Validation needs at least two paths.");
+		auto const mixedScheme = mixed.makeScheme(scheme);
+		auto const referenceScheme = reference.makeScheme(scheme);
+		if (!mixedScheme->isStaged() || !referenceScheme->isStaged())
+			throw std::invalid_argument("Paired validation needs models without exact transition.");
+		if (mixedScheme->normalsPerPath() != referenceScheme->normalsPerPath() ||
+			mixedScheme->storedLength() != referenceScheme->storedLength())
+			throw std::invalid_argument("Validated engines must share their time grid.");
+		std::vector<std::random_device::result_type> seeds(iterations);
+		for (std::size_t i = 0; i < iterations; ++i)
+			seeds[i] = reference.pathSeed(i);
+
+		auto const paired = reduction::reduceBlocks<PairedMoments>(iterations, reduction::reductionBlockSize,
+			[&](std::size_t first, std::size_t size) {
+			PathValuesType<double> normals(referenceScheme->normalsPerPath());
+			PathValuesType<float> mixedNormals(normals.size());
+			PathValuesType<double> referencePath(referenceScheme->storedLength());
+			PathValuesType<float> mixedPath(mixedScheme->storedLength());
+			JumpScheduleType<double> jumps;
+			JumpScheduleType<float> mixedJumps;
+			PairedMoments moments;
+			for (std::size_t i = first; i < first + size; ++i) {
+				referenceScheme->drawNormals(seeds[i], PathSpan<double>{ normals }, jumps);
+				std::transform(normals.begin(), normals.end(), mixedNormals.begin(),
+					[](double z) { return static_cast<float>(z); });
+				mixedJumps.clear();
+				for (auto const &jump : jumps)
+					mixedJumps.emplace_back(jump.first, static_cast<float>(jump.second));
+				referenceScheme->stepInto(PathSpan<double>{ normals }, jumps, PathSpan<double>{ referencePath });
+				mixedScheme->stepInto(PathSpan<float>{ mixedNormals }, mixedJumps, PathSpan<float>{ mixedPath });
+				double const mixedValue = static_cast<double>(mixedPayoff.payoff(mixedPath.back()));
+				double const referenceValue = referencePayoff.payoff(referencePath.back());
+				moments.mixed.add(mixedValue);
+				moments.reference.add(referenceValue);
+				moments.difference.add(mixedValue - referenceValue);
+			}
+			return moments;
+		}, mergePaired);
+
+		auto const mixedMoments = paired.mixed.moments();
+		auto const referenceMoments = paired.reference.moments();
+		auto const differenceMoments = paired.difference.moments();
+		PrecisionReport report;
+		report.mixedPrice = discountFactor * mixedMoments.mean();
+		report.mixedStandardError = discountFactor * mixedMoments.standardError();
+		report.referencePrice = discountFactor * referenceMoments.mean();
+		report.referenceStandardError = discountFactor * referenceMoments.standardError();
+		report.difference = report.mixedPrice - report.referencePrice;
+		report.differenceStandardError = discountFactor * differenceMoments.standardError();
+		report.errorBound = confidence * report.differenceStandardError + tolerance * report.referenceStandardError;
+		report.withinBound = (std::abs(report.difference) <= report.errorBound);
+		return report;
+	}
+
+}
+
+
+
+#endif ///_MIXED_PRECISION_H_
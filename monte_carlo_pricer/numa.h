@@ -0,0 +1,185 @@
+#pragma once
+#if !defined(_NUMA_H_)
+#define _NUMA_H_
+
+#include<vector>
+#include<string>
+#include<fstream>
+#include<sstream>
+#include<thread>
+#include<algorithm>
+#include<cstdint>
+
+#if defined(_WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include<windows.h>
+#else
+#include<pthread.h>
+#include<sched.h>
+#endif
+
+namespace numa {
+
+	// CPUs of one NUMA node usable by this process
+	struct NumaNode {
+		std::size_t index;			// operating system node number
+		std::vector<unsigned> cpus;	// logical CPU numbers
+	};
+
+	namespace detail {
+
+		// "0-3,8,10-11" -> 0 1 2 3 8 10 11
+		inline std::vector<unsigned> parseCpuList(std::string const &list) {
+			std::vector<unsigned> cpus;
+			std::stringstream stream(list);
+			std::string range;
+			while (std::getline(stream, range, ',')) {
+				if (range.empty() || range == "\n")
+					continue;
+				auto const dash = range.find('-');
+				try {
+					unsigned const first = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+					unsigned const last = (dash == std::string::npos ? first :
+						static_cast<unsigned>(std::stoul(range.substr(dash + 1))));
+					for (unsigned c = first; c <= last; ++c)
+						cpus.emplace_back(c);
+				}
+				catch (...) {}
+			}
+			return cpus;
+		}
+
+		inline std::string readLine(std::string const &fileName) {
+			std::ifstream file(fileName);
+			std::string line;
+			std::getline(file, line);
+			return line;
+		}
+	}
+
+
+	// NUMA nodes of the host restricted to the CPUs this process may run on.
+	// Hosts without NUMA information (or a single node) give one node holding
+	// all CPUs, on which pinning is skipped.
+	class NumaTopology {
+	private:
+		std::vector<NumaNode> nodes_;
+
+	public:
+		NumaTopology() = default;
+		explicit NumaTopology(std::vector<NumaNode> const &nodes) :nodes_{ nodes } {}
+
+		static NumaTopology flat(std::size_t cpuCount = std::max<std::size_t>(1, std::thread::hardware_concurrency())) {
+			NumaNode node{ 0,{} };
+			for (std::size_t c = 0; c < cpuCount; ++c)
+				node.cpus.emplace_back(static_cast<unsigned>(c));
+			return NumaTopology{ std::vector<NumaNode>{ node } };
+		}
+
+		static NumaTopology detect() {
+			std::vector<NumaNode> nodes;
+#if defined(_WIN32)
+			ULONG highest = 0;
+			if (GetNumaHighestNodeNumber(&highest)) {
+				for (ULONG n = 0; n <= highest; ++n) {
+					GROUP_AFFINITY affinity{};
+					if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(n), &affinity))
+						continue;
+					NumaNode node{ n,{} };
+					for (unsigned b = 0; b < 8 * sizeof(KAFFINITY); ++b) {
+						if (affinity.Mask & (KAFFINITY{ 1 } << b))
+							node.cpus.emplace_back(64u * affinity.Group + b);
+					}
+					if (!node.cpus.empty())
+						nodes.emplace_back(node);
+				}
+			}
+#else
+			cpu_set_t allowed;
+			CPU_ZERO(&allowed);
+			bool const restricted = (sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+			for (auto const n : detail::parseCpuList(detail::readLine("/sys/devices/system/node/online"))) {
+				NumaNode node{ n,{} };
+				for (auto const c : detail::parseCpuList(detail::readLine(
+					"/sys/devices/system/node/node" + std::to_string(n) + "/cpulist"))) {
+					if (!restricted || (c < CPU_SETSIZE && CPU_ISSET(c, &allowed)))
+						node.cpus.emplace_back(c);
+				}
+				if (!node.cpus.empty())
+					nodes.emplace_back(node);
+			}
+#endif
+			if (nodes.empty())
+				return flat();
+			return NumaTopology{ nodes };
+		}
+
+		inline std::size_t nodeCount()const { return nodes_.size(); }
+		inline NumaNode const &node(std::size_t i)const { return nodes_[i]; }
+		inline std::vector<NumaNode> const &nodes()const { return nodes_; }
+		inline bool isNuma()const { return (nodes_.size() > 1); }
+
+		inline std::size_t cpuCount()const {
+			std::size_t count{ 0 };
+			for (auto const &n : nodes_)
+				count += n.cpus.size();
+			return count;
+		}
+
+		// Position in nodes() of the node holding cpu (0 when unknown)
+		inline std::size_t nodeOfCpu(unsigned cpu)const {
+			for (std::size_t i = 0; i < nodes_.size(); ++i) {
+				if (std::find(nodes_[i].cpus.begin(), nodes_[i].cpus.end(), cpu) != nodes_[i].cpus.end())
+					return i;
+			}
+			return 0;
+		}
+
+		// Position in nodes() of the node the calling thread runs on now
+		inline std::size_t currentNode()const {
+			if (nodes_.size() < 2)
+				return 0;
+#if defined(_WIN32)
+			PROCESSOR_NUMBER number;
+			GetCurrentProcessorNumberEx(&number);
+			return nodeOfCpu(64u * number.Group + number.Number);
+#else
+			int const cpu = sched_getcpu();
+			return (cpu < 0 ? 0 : nodeOfCpu(static_cast<unsigned>(cpu)));
+#endif
+		}
+	};
+
+
+	// Restricts the calling thread to the CPUs of node, false if the system refused.
+	// Memory the thread touches first is then placed on that node by the
+	// operating system's first-touch policy.
+	inline bool pinCurrentThread(NumaNode const &node) {
+		if (node.cpus.empty())
+			return false;
+#if defined(_WIN32)
+		GROUP_AFFINITY affinity{};
+		affinity.Group = static_cast<WORD>(node.cpus.front() / 64);
+		for (auto const c : node.cpus) {
+			if (c / 64 == affinity.Group)
+				affinity.Mask |= (KAFFINITY{ 1 } << (c % 64));
+		}
+		return (SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0);
+#else
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (auto const c : node.cpus) {
+			if (c < CPU_SETSIZE)
+				CPU_SET(c, &set);
+		}
+		return (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+#endif
+	}
+
+}
+
+
+
+#endif ///_NUMA_H_
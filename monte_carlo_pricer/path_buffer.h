@@ -0,0 +1,273 @@
+#pragma once
+#if !defined(_PATH_BUFFER_H_)
+#define _PATH_BUFFER_H_
+
+#include"mc_types.h"
+#include"instrumentation.h"
+#include<vector>
+#include<cstdlib>
+#include<cstdint>
+#include<new>
+#include<utility>
+#include<algorithm>
+
+#if defined(_WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include<windows.h>
+#include<malloc.h>
+#else
+#include<sys/mman.h>
+#endif
+
+namespace path_buffer {
+
+	using mc_types::PathValuesType;
+	using mc_types::PageBacking;
+
+	// Alignment of every path in an arena (one cache line, full AVX-512 vector)
+	static constexpr std::size_t pathAlignment = 64;
+	// Buffers from this size on are backed by huge pages when asked for
+	static constexpr std::size_t hugePageSize = std::size_t{ 2 } << 20;
+
+
+	// Non-owning view of the values of one path
+	template<typename T>
+	class PathSpan {
+	private:
+		T *data_{ nullptr };
+		std::size_t size_{ 0 };
+
+	public:
+		PathSpan() = default;
+		PathSpan(T *data, std::size_t size) :data_{ data }, size_{ size } {}
+		explicit PathSpan(PathValuesType<T> &path) :data_{ path.data() }, size_{ path.size() } {}
+
+		inline T &operator[](std::size_t i)const { return data_[i]; }
+		inline T *data()const { return data_; }
+		inline std::size_t size()const { return size_; }
+		inline bool empty()const { return (size_ == 0); }
+		inline T *begin()const { return data_; }
+		inline T *end()const { return data_ + size_; }
+		inline T &back()const { return data_[size_ - 1]; }
+	};
+
+
+	// Raw memory aligned to pathAlignment, optionally on huge pages.
+	// Owns its memory and remembers how it was obtained.
+	class AlignedBuffer {
+	private:
+		enum class Source { None, Heap, Mapped };
+
+		void *data_{ nullptr };
+		std::size_t bytes_{ 0 };
+		Source source_{ Source::None };
+		PageBacking backing_{ PageBacking::Standard };	// backing actually obtained
+
+		static void *heapAllocate(std::size_t bytes, std::size_t alignment) {
+#if defined(_WIN32)
+			return _aligned_malloc(bytes, alignment);
+#else
+			void *p = nullptr;
+			return (posix_memalign(&p, alignment, bytes) == 0 ? p : nullptr);
+#endif
+		}
+
+		static void heapFree(void *p) {
+#if defined(_WIN32)
+			_aligned_free(p);
+#else
+			std::free(p);
+#endif
+		}
+
+		void release() {
+			if (source_ == Source::Heap)
+				heapFree(data_);
+#if defined(_WIN32)
+			else if (source_ == Source::Mapped)
+				VirtualFree(data_, 0, MEM_RELEASE);
+#else
+			else if (source_ == Source::Mapped)
+				munmap(data_, bytes_);
+#endif
+			data_ = nullptr;
+			bytes_ = 0;
+			source_ = Source::None;
+		}
+
+		// explicit huge pages, nullptr when the system has none to give
+		void *mapHugePages(std::size_t &bytes) {
+#if defined(_WIN32)
+			std::size_t const large = GetLargePageMinimum();
+			if (large == 0)
+				return nullptr;
+			bytes = ((bytes + large - 1) / large) * large;
+			return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+#elif defined(MAP_HUGETLB)
+			bytes = ((bytes + hugePageSize - 1) / hugePageSize) * hugePageSize;
+			void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			return (p == MAP_FAILED ? nullptr : p);
+#else
+			return nullptr;
+#endif
+		}
+
+		// fresh anonymous pages aligned to alignment, nullptr on failure: unlike
+		// recycled heap blocks they are untouched, so each page lands on the NUMA
+		// node of the thread writing it first
+		void *mapFresh(std::size_t bytes, std::size_t alignment) {
+#if defined(_WIN32)
+			return nullptr;
+#else
+			// mappings start on a page already, only larger alignments need slack
+			std::size_t const mapped = (alignment > 4096 ? bytes + alignment : bytes);
+			void *p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				return nullptr;
+			auto const base = reinterpret_cast<std::uintptr_t>(p);
+			auto const aligned = (base + alignment - 1) / alignment * alignment;
+			if (aligned > base)
+				munmap(p, aligned - base);
+			if (base + mapped > aligned + bytes)
+				munmap(reinterpret_cast<void*>(aligned + bytes), base + mapped - aligned - bytes);
+			return reinterpret_cast<void*>(aligned);
+#endif
+		}
+
+	public:
+		AlignedBuffer() = default;
+
+		AlignedBuffer(std::size_t bytes, PageBacking backing) {
+			if (bytes == 0)
+				return;
+			bool const huge = (backing != PageBacking::Standard) && (bytes >= hugePageSize);
+			if (huge && backing == PageBacking::HugePages) {
+				std::size_t mapped = bytes;
+				if ((data_ = mapHugePages(mapped)) != nullptr) {
+					bytes_ = mapped;
+					source_ = Source::Mapped;
+					backing_ = PageBacking::HugePages;
+					return;
+				}
+			}
+			// transparent huge pages need huge-page aligned ranges
+			std::size_t const alignment = (huge ? hugePageSize : pathAlignment);
+			bytes_ = ((bytes + alignment - 1) / alignment) * alignment;
+			if (bytes_ >= hugePageSize && (data_ = mapFresh(bytes_, alignment)) != nullptr)
+				source_ = Source::Mapped;
+			else if ((data_ = heapAllocate(bytes_, alignment)) != nullptr)
+				source_ = Source::Heap;
+			else
+				throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+			if (huge && madvise(data_, bytes_, MADV_HUGEPAGE) == 0)
+				backing_ = PageBacking::TransparentHugePages;
+#endif
+		}
+
+		~AlignedBuffer() { release(); }
+
+		AlignedBuffer(AlignedBuffer const &) = delete;
+		AlignedBuffer &operator=(AlignedBuffer const &) = delete;
+
+		AlignedBuffer(AlignedBuffer &&other) noexcept
+			:data_{ other.data_ }, bytes_{ other.bytes_ }, source_{ other.source_ }, backing_{ other.backing_ } {
+			other.data_ = nullptr;
+			other.bytes_ = 0;
+			other.source_ = Source::None;
+		}
+
+		AlignedBuffer &operator=(AlignedBuffer &&other) noexcept {
+			if (this != &other) {
+				release();
+				std::swap(data_, other.data_);
+				std::swap(bytes_, other.bytes_);
+				std::swap(source_, other.source_);
+				std::swap(backing_, other.backing_);
+			}
+			return *this;
+		}
+
+		inline void *data()const { return data_; }
+		inline std::size_t bytes()const { return bytes_; }
+		inline PageBacking backing()const { return backing_; }
+	};
+
+
+	// Contiguous storage for pathCount paths of pathLength values, path i starting
+	// at an aligned offset i * stride(). Memory only grows: refilling the arena on
+	// every run of the same Fdm allocates once and then reuses the same pages.
+	// An arena is filled by one run at a time.
+	template<typename T>
+	class PathArena {
+	private:
+		PageBacking backing_;
+		AlignedBuffer buffer_;
+		std::size_t pathCount_{ 0 };
+		std::size_t pathLength_{ 0 };
+		std::size_t stride_{ 0 };
+		std::size_t allocations_{ 0 };
+
+	public:
+		explicit PathArena(PageBacking backing = PageBacking::TransparentHugePages)
+			:backing_{ backing } {}
+
+		PathArena(PathArena const &) = delete;
+		PathArena &operator=(PathArena const &) = delete;
+		PathArena(PathArena &&) = default;
+		PathArena &operator=(PathArena &&) = default;
+
+		// Shapes the arena for pathCount paths of pathLength values,
+		// allocating only when the current buffer is too small
+		void reset(std::size_t pathCount, std::size_t pathLength) {
+			std::size_t const perAlignment = std::max<std::size_t>(1, pathAlignment / sizeof(T));
+			std::size_t const stride = ((pathLength + perAlignment - 1) / perAlignment) * perAlignment;
+			std::size_t const bytes = pathCount * stride * sizeof(T);
+			if (bytes > buffer_.bytes()) {
+				// grow by half again, so that slowly growing runs reallocate rarely
+				buffer_ = AlignedBuffer{ std::max(bytes, buffer_.bytes() + buffer_.bytes() / 2), backing_ };
+				++allocations_;
+				instrumentation::recordAllocation(buffer_.bytes());
+			}
+			pathCount_ = pathCount;
+			pathLength_ = pathLength;
+			stride_ = stride;
+		}
+
+		// Frees the memory, the next reset() allocates again
+		void release() {
+			buffer_ = AlignedBuffer{};
+			pathCount_ = pathLength_ = stride_ = 0;
+		}
+
+		inline PathSpan<T> path(std::size_t i)const {
+			return PathSpan<T>{ static_cast<T*>(buffer_.data()) + i * stride_, pathLength_ };
+		}
+
+		inline std::size_t pathCount()const { return pathCount_; }
+		inline std::size_t pathLength()const { return pathLength_; }
+		inline std::size_t stride()const { return stride_; }	// values between path starts
+		inline std::size_t capacityBytes()const { return buffer_.bytes(); }
+		inline std::size_t allocations()const { return allocations_; }
+		inline PageBacking requestedBacking()const { return backing_; }
+		inline PageBacking backing()const { return buffer_.backing(); }
+
+		// Copy in the nested vector form returned by Fdm::operator()
+		PathValuesType<PathValuesType<T>> paths()const {
+			PathValuesType<PathValuesType<T>> result;
+			result.reserve(pathCount_);
+			for (std::size_t i = 0; i < pathCount_; ++i) {
+				auto const p = path(i);
+				result.emplace_back(p.begin(), p.end());
+			}
+			return result;
+		}
+	};
+
+}
+
+
+
+#endif ///_PATH_BUFFER_H_
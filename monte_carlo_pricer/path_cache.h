@@ -0,0 +1,262 @@
+#pragma once
+#if !defined(_PATH_CACHE_H_)
+#define _PATH_CACHE_H_
+
+#include"mc_types.h"
+#include"mc_utilities.h"
+#include<string>
+#include<vector>
+#include<list>
+#include<unordered_map>
+#include<memory>
+#include<mutex>
+#include<functional>
+#include<cstdint>
+#include<cstring>
+#include<cmath>
+
+namespace path_cache {
+
+	using mc_types::PathValuesType;
+	using mc_types::FDMScheme;
+
+
+	// Identity of a seeded simulation
+	struct SimulationKey {
+		std::string model;
+		std::uint64_t fingerprint{ 0 };	// SdeBuilder::fingerprint() of the model
+		std::vector<double> engine;		// engine settings beyond the grid (correlation)
+		std::vector<double> timePoints;
+		FDMScheme scheme{ FDMScheme::EulerScheme };
+		std::size_t pathCount{ 0 };
+		std::size_t firstPath{ 0 };
+		std::uint64_t seed{ 0 };
+		bool terminalOnly{ false };
+
+		bool operator==(SimulationKey const &other)const {
+			return (model == other.model && fingerprint == other.fingerprint &&
+				engine == other.engine && timePoints == other.timePoints && scheme == other.scheme &&
+				pathCount == other.pathCount && firstPath == other.firstPath &&
+				seed == other.seed && terminalOnly == other.terminalOnly);
+		}
+
+		std::uint64_t hash()const {
+			mc_utilities::Fingerprint hash;
+			hash.mix(model);
+			hash.mix(fingerprint);
+			hash.mix(engine);
+			hash.mix(timePoints);
+			std::uint64_t const fields[] = { static_cast<std::uint64_t>(scheme),pathCount,firstPath,seed,
+				static_cast<std::uint64_t>(terminalOnly) };
+			hash.mix(fields, sizeof(fields));
+			return hash.value();
+		}
+	};
+
+	namespace detail {
+
+		// correlation of two-factor engines, nothing for one-factor engines
+		template<typename Engine>
+		auto engineSettings(Engine const &fdm, int) -> decltype(fdm.correlation(), std::vector<double>{}) {
+			return std::vector<double>{ static_cast<double>(fdm.correlation()) };
+		}
+
+		template<typename Engine>
+		std::vector<double> engineSettings(Engine const &, long) {
+			return std::vector<double>{};
+		}
+	}
+
+	// Key of a run of pathCount paths of model builder on seeded engine fdm
+	template<typename Builder, typename Engine>
+	SimulationKey makeKey(Builder const &builder, Engine const &fdm, std::size_t pathCount,
+		FDMScheme scheme, bool terminalOnly = false) {
+		SimulationKey key;
+		key.model = builder.name();
+		key.fingerprint = builder.fingerprint();
+		key.engine = detail::engineSettings(fdm, 0);
+		for (auto const &t : fdm.timeResolution())
+			key.timePoints.emplace_back(static_cast<double>(t));
+		key.scheme = scheme;
+		key.pathCount = pathCount;
+		key.firstPath = fdm.firstPath();
+		key.seed = fdm.seed();
+		key.terminalOnly = terminalOnly;
+		return key;
+	}
+
+	struct CacheStatistics {
+		std::size_t hits{ 0 };
+		std::size_t misses{ 0 };
+		std::size_t evictions{ 0 };
+		std::size_t entries{ 0 };
+		std::size_t bytes{ 0 };
+	};
+
+
+	// Least recently used cache of simulated paths and terminal distributions
+	// under a memory budget. Cached results are shared read-only, so eviction
+	// never invalidates results handed out before.
+	template<typename T = double>
+	class PathCache {
+	public:
+		typedef PathValuesType<PathValuesType<T>> PathsType;
+
+	private:
+		struct Entry {
+			SimulationKey key;
+			std::shared_ptr<PathsType const> paths;
+			std::shared_ptr<PathValuesType<T> const> terminal;
+			std::size_t bytes;
+		};
+
+		std::size_t budget_;
+		std::list<Entry> entries_;	// most recently used first
+		std::unordered_map<std::uint64_t, typename std::list<Entry>::iterator> index_;
+		CacheStatistics statistics_;
+		mutable std::mutex mutex_;
+
+		static std::size_t sizeOf(PathsType const &paths) {
+			std::size_t bytes = sizeof(PathsType) + paths.size() * sizeof(PathValuesType<T>);
+			for (auto const &path : paths)
+				bytes += path.size() * sizeof(T);
+			return bytes;
+		}
+
+		static std::size_t sizeOf(PathValuesType<T> const &values) {
+			return (sizeof(PathValuesType<T>) + values.size() * sizeof(T));
+		}
+
+		// entry of key moved to the front, nullptr on miss
+		Entry const *find(SimulationKey const &key, std::uint64_t hash) {
+			auto const it = index_.find(hash);
+			if (it == index_.end() || !(it->second->key == key)) {
+				++statistics_.misses;
+				return nullptr;
+			}
+			entries_.splice(entries_.begin(), entries_, it->second);
+			++statistics_.hits;
+			return &entries_.front();
+		}
+
+		void erase(typename std::list<Entry>::iterator it) {
+			statistics_.bytes -= it->bytes;
+			index_.erase(it->key.hash());
+			entries_.erase(it);
+		}
+
+		// key of unseeded runs, never stored
+		static SimulationKey uncachedKey() {
+			return SimulationKey{};
+		}
+
+		void insert(Entry &&entry, std::uint64_t hash) {
+			if (entry.bytes > budget_ || entry.key.model.empty())
+				return;
+			auto const existing = index_.find(hash);
+			if (existing != index_.end())
+				erase(existing->second);
+			while (statistics_.bytes + entry.bytes > budget_ && !entries_.empty()) {
+				erase(std::prev(entries_.end()));
+				++statistics_.evictions;
+			}
+			statistics_.bytes += entry.bytes;
+			entries_.emplace_front(std::move(entry));
+			index_[hash] = entries_.begin();
+		}
+
+	public:
+		explicit PathCache(std::size_t memoryBudget)
+			:budget_{ memoryBudget } {}
+
+		PathCache(PathCache const &) = delete;
+		PathCache &operator=(PathCache const &) = delete;
+
+		// Cached paths of key, simulate() is called on a miss. Simulation runs
+		// outside of the lock, concurrent misses on one key may simulate twice.
+		std::shared_ptr<PathsType const> paths(SimulationKey const &key, std::function<PathsType()> const &simulate) {
+			auto const hash = key.hash();
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto const entry = find(key, hash);
+				if (entry != nullptr && entry->paths)
+					return entry->paths;
+			}
+			auto result = std::make_shared<PathsType const>(simulate());
+			std::lock_guard<std::mutex> lock(mutex_);
+			insert(Entry{ key,result,nullptr,sizeOf(*result) }, hash);
+			return result;
+		}
+
+		// Cached terminal values of key, only these are kept from simulate()
+		std::shared_ptr<PathValuesType<T> const> terminalValues(SimulationKey key,
+			std::function<PathsType()> const &simulate) {
+			key.terminalOnly = true;
+			auto const hash = key.hash();
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto const entry = find(key, hash);
+				if (entry != nullptr && entry->terminal)
+					return entry->terminal;
+			}
+			auto const paths = simulate();
+			PathValuesType<T> values;
+			values.reserve(paths.size());
+			for (auto const &path : paths)
+				values.emplace_back(path.back());
+			auto result = std::make_shared<PathValuesType<T> const>(std::move(values));
+			std::lock_guard<std::mutex> lock(mutex_);
+			insert(Entry{ key,nullptr,result,sizeOf(*result) }, hash);
+			return result;
+		}
+
+		// Paths of a run on engine fdm, unseeded runs are never cached
+		template<typename Builder, typename Engine>
+		std::shared_ptr<PathsType const> paths(Builder const &builder, Engine &fdm, std::size_t pathCount,
+			FDMScheme scheme = FDMScheme::EulerScheme) {
+			auto const simulate = [&]() {return fdm(pathCount, scheme); };
+			if (!fdm.isSeeded())
+				return paths(uncachedKey(), simulate);
+			return paths(makeKey(builder, fdm, pathCount, scheme), simulate);
+		}
+
+		template<typename Builder, typename Engine>
+		std::shared_ptr<PathValuesType<T> const> terminalValues(Builder const &builder, Engine &fdm,
+			std::size_t pathCount, FDMScheme scheme = FDMScheme::EulerScheme) {
+			auto const simulate = [&]() {return fdm(pathCount, scheme); };
+			if (!fdm.isSeeded())
+				return terminalValues(uncachedKey(), simulate);
+			return terminalValues(makeKey(builder, fdm, pathCount, scheme, true), simulate);
+		}
+
+		void clear() {
+			std::lock_guard<std::mutex> lock(mutex_);
+			entries_.clear();
+			index_.clear();
+			statistics_.bytes = 0;
+		}
+
+		void setMemoryBudget(std::size_t memoryBudget) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			budget_ = memoryBudget;
+			while (statistics_.bytes > budget_ && !entries_.empty()) {
+				erase(std::prev(entries_.end()));
+				++statistics_.evictions;
+			}
+		}
+
+		inline std::size_t memoryBudget()const { return budget_; }
+
+		CacheStatistics statistics()const {
+			std::lock_guard<std::mutex> lock(mutex_);
+			CacheStatistics result = statistics_;
+			result.entries = entries_.size();
+			return result;
+		}
+	};
+
+}
+
+
+
+#endif ///_PATH_CACHE_H_
@@ -0,0 +1,426 @@
+#pragma once
+#if !defined(_PATH_STORE_H_)
+#define _PATH_STORE_H_
+
+#include"mc_types.h"
+#include"mc_utilities.h"
+#include"payoff_strategy.h"
+#include"fdm.h"
+#include<string>
+#include<vector>
+#include<fstream>
+#include<cstdint>
+#include<cstring>
+#include<stdexcept>
+#include<limits>
+#include<type_traits>
+
+#if defined(_WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include<windows.h>
+#else
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
+#endif
+
+namespace path_store {
+
+	using mc_types::PathValuesType;
+	using mc_types::TimePointsType;
+	using mc_types::PathLayout;
+	using mc_types::FDMScheme;
+	using payoff::PayoffStrategy;
+	using payoff::PayoffMoments;
+
+	// File layout (little endian, as written by the host):
+	// PathStoreHeader | model name | parameters (double) | time grid (double) |
+	// padding to bodyAlignment | body of pathCount x pathLength values of T
+	static constexpr std::uint64_t pathStoreMagic = 0x315348544150434DULL; // "MCPATHS1"
+	static constexpr std::uint64_t pathStoreVersion = 1;
+	static constexpr std::uint64_t bodyAlignment = 64;
+
+	struct PathStoreHeader {
+		std::uint64_t magic;
+		std::uint64_t version;
+		std::uint64_t precision;		// bytes per value
+		std::uint64_t layout;			// PathLayout
+		std::uint64_t pathCount;
+		std::uint64_t pathLength;
+		std::uint64_t seed;
+		std::uint64_t seeded;
+		std::uint64_t nameLength;
+		std::uint64_t parameterCount;
+		std::uint64_t gridCount;
+		std::uint64_t bodyOffset;
+	};
+
+	// Description of a stored simulation
+	struct PathStoreInfo {
+		std::string modelName;
+		std::vector<double> parameters;
+		std::vector<double> timePoints;
+		std::uint64_t seed{ 0 };
+		bool seeded{ false };
+		PathLayout layout{ PathLayout::PathMajor };
+		std::size_t pathCount{ 0 };
+		std::size_t pathLength{ 0 };
+	};
+
+	// Info of a simulation of model builder on engine fdm
+	template<typename Builder, typename Engine>
+	PathStoreInfo describe(Builder const &builder, Engine const &fdm, std::size_t pathCount,
+		PathLayout layout = PathLayout::PathMajor) {
+		PathStoreInfo info;
+		info.modelName = builder.name();
+		for (auto const &p : builder.parameters())
+			info.parameters.emplace_back(static_cast<double>(p));
+		for (auto const &t : fdm.timeResolution())
+			info.timePoints.emplace_back(static_cast<double>(t));
+		info.seed = fdm.seed();
+		info.seeded = fdm.isSeeded();
+		info.layout = layout;
+		info.pathCount = pathCount;
+		return info;
+	}
+
+
+	// Streams blocks of paths into a path file. Path length is taken from
+	// the first block written unless given in the info.
+	template<typename T = double>
+	class PathStoreWriter {
+	private:
+		std::fstream file_;
+		PathStoreHeader header_;
+		std::size_t written_{ 0 };
+
+		void writeHeader() {
+			file_.seekp(0);
+			file_.write(reinterpret_cast<char const *>(&header_), sizeof(header_));
+		}
+
+	public:
+		PathStoreWriter(std::string const &fileName, PathStoreInfo const &info)
+			:file_{ fileName, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc } {
+			if (!file_)
+				throw std::runtime_error("Cannot open path file " + fileName + ".");
+			if (info.pathCount == 0)
+				throw std::invalid_argument("Path file needs a positive path count.");
+			header_.magic = pathStoreMagic;
+			header_.version = pathStoreVersion;
+			header_.precision = sizeof(T);
+			header_.layout = static_cast<std::uint64_t>(info.layout);
+			header_.pathCount = info.pathCount;
+			header_.pathLength = info.pathLength;
+			header_.seed = info.seed;
+			header_.seeded = info.seeded ? 1 : 0;
+			header_.nameLength = info.modelName.size();
+			header_.parameterCount = info.parameters.size();
+			header_.gridCount = info.timePoints.size();
+			std::uint64_t const offset = sizeof(PathStoreHeader) + header_.nameLength +
+				sizeof(double) * (header_.parameterCount + header_.gridCount);
+			header_.bodyOffset = (offset + bodyAlignment - 1) / bodyAlignment * bodyAlignment;
+
+			writeHeader();
+			file_.write(info.modelName.data(), info.modelName.size());
+			file_.write(reinterpret_cast<char const *>(info.parameters.data()), sizeof(double) * info.parameters.size());
+			file_.write(reinterpret_cast<char const *>(info.timePoints.data()), sizeof(double) * info.timePoints.size());
+			std::vector<char> padding(static_cast<std::size_t>(header_.bodyOffset - offset), 0);
+			file_.write(padding.data(), padding.size());
+		}
+
+		inline std::size_t pathCount()const { return static_cast<std::size_t>(header_.pathCount); }
+		inline std::size_t pathLength()const { return static_cast<std::size_t>(header_.pathLength); }
+		inline std::size_t written()const { return written_; }
+
+		// Writes paths as paths [firstPath,firstPath+paths.size()) of the file
+		void write(PathValuesType<PathValuesType<T>> const &paths, std::size_t firstPath) {
+			if (paths.empty())
+				return;
+			if (header_.pathLength == 0) {
+				header_.pathLength = paths.front().size();
+				writeHeader();
+			}
+			std::size_t const length = pathLength();
+			if (firstPath + paths.size() > pathCount())
+				throw std::out_of_range("Paths lie beyond the path count of the file.");
+			for (auto const &path : paths) {
+				if (path.size() != length)
+					throw std::invalid_argument("Path length differs from the path file.");
+			}
+			std::uint64_t const body = header_.bodyOffset;
+			if (static_cast<PathLayout>(header_.layout) == PathLayout::PathMajor) {
+				file_.seekp(static_cast<std::streamoff>(body + sizeof(T) * firstPath * length));
+				for (auto const &path : paths)
+					file_.write(reinterpret_cast<char const *>(path.data()), sizeof(T) * length);
+			}
+			else {
+				std::vector<T> slice(paths.size());
+				for (std::size_t step = 0; step < length; ++step) {
+					for (std::size_t p = 0; p < paths.size(); ++p)
+						slice[p] = paths[p][step];
+					file_.seekp(static_cast<std::streamoff>(body + sizeof(T) * (step * pathCount() + firstPath)));
+					file_.write(reinterpret_cast<char const *>(slice.data()), sizeof(T) * slice.size());
+				}
+			}
+			if (!file_)
+				throw std::runtime_error("Writing of path file failed.");
+			written_ += paths.size();
+		}
+
+		// Simulates pathCount() paths block by block on the engine and streams them.
+		// Seeded engines give the same paths as a single run of the whole count.
+		template<typename Engine>
+		void simulate(Engine &fdm, std::size_t blockSize, FDMScheme scheme = FDMScheme::EulerScheme) {
+			blockSize = std::max<std::size_t>(1, blockSize);
+			auto const firstPath = fdm.firstPath();
+			for (std::size_t first = 0; first < pathCount(); first += blockSize) {
+				fdm.setFirstPath(firstPath + first);
+				write(fdm(std::min(blockSize, pathCount() - first), scheme), first);
+			}
+			fdm.setFirstPath(firstPath);
+		}
+
+		void close() {
+			file_.flush();
+			file_.close();
+		}
+	};
+
+
+	// Read-only memory mapping of a whole file
+	class MappedFile {
+	private:
+		void const *data_{ nullptr };
+		std::size_t size_{ 0 };
+#if defined(_WIN32)
+		HANDLE file_{ INVALID_HANDLE_VALUE };
+		HANDLE mapping_{ nullptr };
+#endif
+
+	public:
+		explicit MappedFile(std::string const &fileName) {
+#if defined(_WIN32)
+			file_ = ::CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file_ == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("Cannot open path file " + fileName + ".");
+			LARGE_INTEGER size;
+			::GetFileSizeEx(file_, &size);
+			size_ = static_cast<std::size_t>(size.QuadPart);
+			mapping_ = ::CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping_ != nullptr)
+				data_ = ::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+			if (data_ == nullptr) {
+				if (mapping_ != nullptr)
+					::CloseHandle(mapping_);
+				::CloseHandle(file_);
+				throw std::runtime_error("Cannot map path file " + fileName + ".");
+			}
+#else
+			int const fd = ::open(fileName.c_str(), O_RDONLY);
+			if (fd < 0)
+				throw std::runtime_error("Cannot open path file " + fileName + ".");
+			struct stat status;
+			if (::fstat(fd, &status) != 0 || status.st_size == 0) {
+				::close(fd);
+				throw std::runtime_error("Cannot read path file " + fileName + ".");
+			}
+			size_ = static_cast<std::size_t>(status.st_size);
+			void *data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (data == MAP_FAILED)
+				throw std::runtime_error("Cannot map path file " + fileName + ".");
+			data_ = data;
+#endif
+		}
+
+		~MappedFile() {
+#if defined(_WIN32)
+			::UnmapViewOfFile(data_);
+			::CloseHandle(mapping_);
+			::CloseHandle(file_);
+#else
+			::munmap(const_cast<void *>(data_), size_);
+#endif
+		}
+
+		MappedFile(MappedFile const &) = delete;
+		MappedFile &operator=(MappedFile const &) = delete;
+
+		inline char const *data()const { return static_cast<char const *>(data_); }
+		inline std::size_t size()const { return size_; }
+	};
+
+
+	// Zero-copy view of strided values inside a mapped path file
+	template<typename T>
+	class PathView {
+	private:
+		T const *data_;
+		std::size_t size_;
+		std::size_t stride_;
+
+	public:
+		PathView(T const *data, std::size_t size, std::size_t stride)
+			:data_{ data }, size_{ size }, stride_{ stride } {}
+
+		inline T operator[](std::size_t index)const { return data_[index * stride_]; }
+		inline std::size_t size()const { return size_; }
+		inline T front()const { return data_[0]; }
+		inline T back()const { return data_[(size_ - 1) * stride_]; }
+		inline bool isContiguous()const { return (stride_ == 1); }
+		// valid for contiguous views only
+		inline T const *data()const { return data_; }
+	};
+
+
+	// Maps a path file and exposes paths (and time slices) as views into it
+	template<typename T = double>
+	class PathStoreReader {
+	private:
+		MappedFile file_;
+		PathStoreHeader header_;
+		PathStoreInfo info_;
+		T const *body_;
+
+		// true when length bytes from offset lie inside the file, without overflow
+		inline bool fits(std::uint64_t offset, std::uint64_t length)const {
+			std::uint64_t const size = file_.size();
+			return (offset <= size && length <= size - offset);
+		}
+
+		// count values of size bytes each, false on overflow
+		static inline bool bytes(std::uint64_t count, std::uint64_t size, std::uint64_t &result) {
+			if (size != 0 && count > std::numeric_limits<std::uint64_t>::max() / size)
+				return false;
+			result = count * size;
+			return true;
+		}
+
+	public:
+		explicit PathStoreReader(std::string const &fileName)
+			:file_{ fileName } {
+			if (file_.size() < sizeof(PathStoreHeader))
+				throw std::runtime_error("Path file " + fileName + " is truncated.");
+			std::memcpy(&header_, file_.data(), sizeof(header_));
+			if (header_.magic != pathStoreMagic)
+				throw std::runtime_error("File " + fileName + " is not a path file.");
+			if (header_.version != pathStoreVersion)
+				throw std::runtime_error("Unsupported version of path file " + fileName + ".");
+			if (header_.precision != sizeof(T))
+				throw std::runtime_error("Precision of path file " + fileName + " differs from the reader.");
+			if (header_.layout != static_cast<std::uint64_t>(PathLayout::PathMajor) &&
+				header_.layout != static_cast<std::uint64_t>(PathLayout::StepMajor))
+				throw std::runtime_error("Unknown layout of path file " + fileName + ".");
+			// a writer closed before its first write() leaves pathLength 0
+			if (header_.pathCount == 0 || header_.pathLength == 0)
+				throw std::runtime_error("Path file " + fileName + " holds no paths.");
+
+			std::uint64_t cursor = sizeof(PathStoreHeader);
+			std::uint64_t parameterBytes{ 0 };
+			std::uint64_t gridBytes{ 0 };
+			std::uint64_t pathValues{ 0 };
+			std::uint64_t bodyBytes{ 0 };
+			if (!fits(cursor, header_.nameLength) ||
+				!bytes(header_.parameterCount, sizeof(double), parameterBytes) ||
+				!fits(cursor + header_.nameLength, parameterBytes) ||
+				!bytes(header_.gridCount, sizeof(double), gridBytes) ||
+				!fits(cursor + header_.nameLength + parameterBytes, gridBytes) ||
+				header_.bodyOffset < cursor + header_.nameLength + parameterBytes + gridBytes ||
+				header_.bodyOffset % alignof(T) != 0 ||
+				!bytes(header_.pathCount, header_.pathLength, pathValues) ||
+				!bytes(pathValues, sizeof(T), bodyBytes) ||
+				!fits(header_.bodyOffset, bodyBytes))
+				throw std::runtime_error("Path file " + fileName + " is truncated or corrupt.");
+
+			info_.modelName.assign(file_.data() + cursor, static_cast<std::size_t>(header_.nameLength));
+			cursor += header_.nameLength;
+			info_.parameters.resize(static_cast<std::size_t>(header_.parameterCount));
+			std::memcpy(info_.parameters.data(), file_.data() + cursor, static_cast<std::size_t>(parameterBytes));
+			cursor += parameterBytes;
+			info_.timePoints.resize(static_cast<std::size_t>(header_.gridCount));
+			std::memcpy(info_.timePoints.data(), file_.data() + cursor, static_cast<std::size_t>(gridBytes));
+			info_.seed = header_.seed;
+			info_.seeded = (header_.seeded != 0);
+			info_.layout = static_cast<PathLayout>(header_.layout);
+			info_.pathCount = static_cast<std::size_t>(header_.pathCount);
+			info_.pathLength = static_cast<std::size_t>(header_.pathLength);
+			body_ = reinterpret_cast<T const *>(file_.data() + header_.bodyOffset);
+		}
+
+		inline PathStoreInfo const &info()const { return info_; }
+		inline std::size_t pathCount()const { return info_.pathCount; }
+		inline std::size_t pathLength()const { return info_.pathLength; }
+		inline PathLayout layout()const { return info_.layout; }
+
+		PathView<T> path(std::size_t index)const {
+			if (info_.layout == PathLayout::PathMajor)
+				return PathView<T>{ body_ + index * info_.pathLength,info_.pathLength,1 };
+			return PathView<T>{ body_ + index,info_.pathLength,info_.pathCount };
+		}
+
+		// values of all paths at one step
+		PathView<T> slice(std::size_t step)const {
+			if (info_.layout == PathLayout::StepMajor)
+				return PathView<T>{ body_ + step * info_.pathCount,info_.pathCount,1 };
+			return PathView<T>{ body_ + step,info_.pathCount,info_.pathLength };
+		}
+	};
+
+
+	// Payoff moments of a strategy on the terminal values of stored paths,
+	// read in place when terminal values are contiguous (StepMajor)
+	template<typename T>
+	PayoffMoments batchTerminalPayoff(PayoffStrategy<T> const &strategy, PathStoreReader<T> const &reader,
+		std::size_t blockSize = 4096) {
+		auto const terminal = reader.slice(reader.pathLength() - 1);
+		return payoff::detail::parallelBlockMoments(reader.pathCount(), blockSize,
+			[&](std::size_t first, std::size_t size) {
+			if (terminal.isContiguous())
+				return strategy.moments(terminal.data() + first, size);
+			std::vector<T> values(size);
+			for (std::size_t i = 0; i < size; ++i)
+				values[i] = terminal[first + i];
+			return strategy.moments(values.data(), size);
+		});
+	}
+
+	// Payoff moments of payoff(PathView<T>) on stored paths, read in place
+	template<typename T, typename Payoff,
+		typename = typename std::enable_if<!std::is_base_of<PayoffStrategy<PathValuesType<T>>, Payoff>::value>::type>
+	PayoffMoments batchPayoff(Payoff const &pathPayoff, PathStoreReader<T> const &reader,
+		std::size_t blockSize = 1024) {
+		return payoff::detail::parallelBlockMoments(reader.pathCount(), blockSize,
+			[&](std::size_t first, std::size_t size) {
+			return payoff::detail::laneMoments(size, [&](std::size_t i) {
+				return static_cast<double>(pathPayoff(reader.path(first + i))); });
+		});
+	}
+
+	// Payoff moments of a path strategy on stored paths. The strategy takes
+	// vectors, so each path passes through one buffer reused within the block;
+	// payoffs on PathView above avoid even that copy.
+	template<typename T>
+	PayoffMoments batchPayoff(PayoffStrategy<PathValuesType<T>> const &strategy, PathStoreReader<T> const &reader,
+		std::size_t blockSize = 1024) {
+		return payoff::detail::parallelBlockMoments(reader.pathCount(), blockSize,
+			[&](std::size_t first, std::size_t size) {
+			PathValuesType<T> buffer(reader.pathLength());
+			return payoff::detail::laneMoments(size, [&](std::size_t i) {
+				auto const path = reader.path(first + i);
+				for (std::size_t k = 0; k < buffer.size(); ++k)
+					buffer[k] = path[k];
+				return strategy.payoff(buffer);
+			});
+		});
+	}
+
+}
+
+
+
+#endif ///_PATH_STORE_H_
@@ -0,0 +1,593 @@
+#pragma once
+#if !defined(_PAYOFF_EXPRESSION_H_)
+#define _PAYOFF_EXPRESSION_H_
+
+#include"mc_types.h"
+#include<algorithm>
+#include<array>
+#include<cctype>
+#include<cmath>
+#include<cstdlib>
+#include<map>
+#include<stdexcept>
+#include<string>
+#include<vector>
+
+namespace payoff {
+
+	using mc_types::PathValuesType;
+
+	// Payoff expression language, compiled at run time into a flat
+	// stack-machine program:
+	//
+	//   expression := term (('+'|'-') term)*
+	//   term       := unary (('*'|'/') unary)*
+	//   unary      := '-' unary | primary
+	//   primary    := number | parameter | '(' expression ')'
+	//               | 'S' '[' index ']'                 observation (negative counts from the end)
+	//               | max(e,...) | min(e,...)
+	//               | avg(from,to) | sum(from,to)        over observations, no arguments = whole path
+	//               | pathmax(from,to) | pathmin(from,to)
+	//               | exp(e) | log(e) | sqrt(e) | abs(e)
+	//               | discount(rate,time)                exp(-rate*time)
+	//
+	// Parameters (strike, rate, ...) are bound at compile time and folded
+	// into constants together with every constant subexpression, e.g.
+	//   "discount(r,T) * max(avg() - K, 0)"  with {{"r",0.05},{"T",1.0},{"K",100.0}}
+	//
+	// Blocks of paths are evaluated instruction by instruction over
+	// the whole block, so each instruction is one tight loop.
+	//
+	// Reversed windows (from > to) are rejected when compiled, and so is any
+	// index outside the path when the path length is given to the constructor.
+	// Windows mixing negative and non-negative indices are checked per path.
+
+	enum class PayoffOpCode {
+		Constant,
+		Observation,
+		Average,
+		Sum,
+		PathMax,
+		PathMin,
+		Add,
+		Subtract,
+		Multiply,
+		Divide,
+		Negate,
+		Max,
+		Min,
+		Exp,
+		Log,
+		Sqrt,
+		Abs,
+	};
+
+	struct PayoffInstruction {
+		PayoffOpCode code;
+		double value;		// Constant
+		long from;			// Observation index or first index of range
+		long to;			// last index of range (inclusive)
+	};
+
+	template<typename T = double>
+	class PayoffExpression {
+	public:
+		// deepest operand stack a program may need, single paths are
+		// evaluated on a fixed array of this size
+		static constexpr std::size_t maxStackDepth{ 64 };
+
+	private:
+		std::string source_;
+		std::map<std::string, double> parameters_;
+		std::size_t pathLength_{ 0 };
+		std::vector<PayoffInstruction> program_;
+		std::size_t stackDepth_{ 0 };
+		std::size_t blockSize_{ 256 };
+
+		// ---- compiler ----
+
+		enum class TokenType { Number, Identifier, Symbol, End };
+
+		struct Token {
+			TokenType type;
+			std::string text;
+			double number;
+			std::size_t position;
+		};
+
+		std::vector<Token> tokens_;
+		std::size_t current_{ 0 };
+
+		[[noreturn]] void fail(std::string const &message, std::size_t position)const {
+			throw std::invalid_argument("PayoffExpression: " + message + " at position " +
+				std::to_string(position) + " in \"" + source_ + "\"");
+		}
+
+		void tokenize() {
+			std::size_t i{ 0 };
+			while (i < source_.size()) {
+				char const c = source_[i];
+				if (std::isspace(static_cast<unsigned char>(c))) {
+					++i;
+				}
+				else if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+					char *end = nullptr;
+					double const number = std::strtod(source_.c_str() + i, &end);
+					std::size_t const length = static_cast<std::size_t>(end - (source_.c_str() + i));
+					if (length == 0)
+						fail("invalid number", i);
+					tokens_.push_back(Token{ TokenType::Number,source_.substr(i,length),number,i });
+					i += length;
+				}
+				else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+					std::size_t j = i;
+					while (j < source_.size() &&
+						(std::isalnum(static_cast<unsigned char>(source_[j])) || source_[j] == '_'))
+						++j;
+					tokens_.push_back(Token{ TokenType::Identifier,source_.substr(i,j - i),0.0,i });
+					i = j;
+				}
+				else if (std::string("+-*/()[],").find(c) != std::string::npos) {
+					tokens_.push_back(Token{ TokenType::Symbol,std::string(1,c),0.0,i });
+					++i;
+				}
+				else {
+					fail(std::string("unexpected character '") + c + "'", i);
+				}
+			}
+			tokens_.push_back(Token{ TokenType::End,"",0.0,source_.size() });
+		}
+
+		inline Token const &peek()const { return tokens_[current_]; }
+
+		inline bool accept(char symbol) {
+			if (peek().type == TokenType::Symbol && peek().text[0] == symbol) {
+				++current_;
+				return true;
+			}
+			return false;
+		}
+
+		inline void expect(char symbol) {
+			if (!accept(symbol))
+				fail(std::string("expected '") + symbol + "'", peek().position);
+		}
+
+		inline bool lastIsConstant(std::size_t count)const {
+			if (program_.size() < count)
+				return false;
+			for (std::size_t k = program_.size() - count; k < program_.size(); ++k) {
+				if (program_[k].code != PayoffOpCode::Constant)
+					return false;
+			}
+			return true;
+		}
+
+		inline void emitConstant(double value) {
+			program_.push_back(PayoffInstruction{ PayoffOpCode::Constant,value,0,0 });
+		}
+
+		// emits op, folding it when all operands are constants
+		void emit(PayoffOpCode code) {
+			bool const binary = (code == PayoffOpCode::Add || code == PayoffOpCode::Subtract ||
+				code == PayoffOpCode::Multiply || code == PayoffOpCode::Divide ||
+				code == PayoffOpCode::Max || code == PayoffOpCode::Min);
+			if (binary && lastIsConstant(2)) {
+				double const b = program_.back().value;
+				program_.pop_back();
+				double const a = program_.back().value;
+				program_.pop_back();
+				emitConstant(applyBinary(code, a, b));
+				return;
+			}
+			if (!binary && lastIsConstant(1)) {
+				double const a = program_.back().value;
+				program_.pop_back();
+				emitConstant(applyUnary(code, a));
+				return;
+			}
+			program_.push_back(PayoffInstruction{ code,0.0,0,0 });
+		}
+
+		// parses an expression that must fold into an integer constant
+		long constantIndex() {
+			std::size_t const position = peek().position;
+			parseExpression();
+			if (!lastIsConstant(1))
+				fail("index must be a constant", position);
+			double const value = program_.back().value;
+			program_.pop_back();
+			if (value != std::floor(value))
+				fail("index must be an integer", position);
+			return static_cast<long>(value);
+		}
+
+		// index checked against the path length when it is known
+		void checkIndex(long index, std::size_t position)const {
+			if (pathLength_ == 0)
+				return;
+			long const resolved = (index < 0) ? static_cast<long>(pathLength_) + index : index;
+			if (resolved < 0 || resolved >= static_cast<long>(pathLength_))
+				fail("observation index " + std::to_string(index) + " out of path range", position);
+		}
+
+		void parseRange(PayoffOpCode code) {
+			std::size_t const position = peek().position;
+			expect('(');
+			long from{ 0 };
+			long to{ -1 };
+			if (!accept(')')) {
+				from = constantIndex();
+				expect(',');
+				to = constantIndex();
+				expect(')');
+			}
+			checkIndex(from, position);
+			checkIndex(to, position);
+			bool const sameEnd = ((from < 0) == (to < 0));
+			bool const reversed = (pathLength_ == 0) ? (sameEnd && from > to) :
+				(resolve(from, pathLength_) > resolve(to, pathLength_));
+			if (reversed)
+				fail("reversed observation window (" + std::to_string(from) + "," + std::to_string(to) + ")", position);
+			program_.push_back(PayoffInstruction{ code,0.0,from,to });
+		}
+
+		void parsePrimary() {
+			Token const token = peek();
+			if (token.type == TokenType::Number) {
+				++current_;
+				emitConstant(token.number);
+				return;
+			}
+			if (accept('(')) {
+				parseExpression();
+				expect(')');
+				return;
+			}
+			if (token.type != TokenType::Identifier)
+				fail("unexpected token '" + token.text + "'", token.position);
+			++current_;
+			std::string const &name = token.text;
+			if (name == "S") {
+				expect('[');
+				long const index = constantIndex();
+				expect(']');
+				checkIndex(index, token.position);
+				program_.push_back(PayoffInstruction{ PayoffOpCode::Observation,0.0,index,index });
+			}
+			else if (name == "max" || name == "min") {
+				PayoffOpCode const code = (name == "max") ? PayoffOpCode::Max : PayoffOpCode::Min;
+				expect('(');
+				parseExpression();
+				std::size_t count{ 1 };
+				while (accept(',')) {
+					parseExpression();
+					emit(code);
+					++count;
+				}
+				expect(')');
+				if (count < 2)
+					fail(name + " needs at least two arguments", token.position);
+			}
+			else if (name == "avg") {
+				parseRange(PayoffOpCode::Average);
+			}
+			else if (name == "sum") {
+				parseRange(PayoffOpCode::Sum);
+			}
+			else if (name == "pathmax") {
+				parseRange(PayoffOpCode::PathMax);
+			}
+			else if (name == "pathmin") {
+				parseRange(PayoffOpCode::PathMin);
+			}
+			else if (name == "exp" || name == "log" || name == "sqrt" || name == "abs") {
+				expect('(');
+				parseExpression();
+				expect(')');
+				emit(name == "exp" ? PayoffOpCode::Exp : (name == "log" ? PayoffOpCode::Log :
+					(name == "sqrt" ? PayoffOpCode::Sqrt : PayoffOpCode::Abs)));
+			}
+			else if (name == "discount") {
+				expect('(');
+				parseExpression();
+				expect(',');
+				parseExpression();
+				expect(')');
+				emit(PayoffOpCode::Multiply);
+				emit(PayoffOpCode::Negate);
+				emit(PayoffOpCode::Exp);
+			}
+			else {
+				auto const parameter = parameters_.find(name);
+				if (parameter == parameters_.end())
+					fail("unknown name '" + name + "'", token.position);
+				emitConstant(parameter->second);
+			}
+		}
+
+		void parseUnary() {
+			if (accept('-')) {
+				parseUnary();
+				emit(PayoffOpCode::Negate);
+				return;
+			}
+			parsePrimary();
+		}
+
+		void parseTerm() {
+			parseUnary();
+			for (;;) {
+				if (accept('*')) {
+					parseUnary();
+					emit(PayoffOpCode::Multiply);
+				}
+				else if (accept('/')) {
+					parseUnary();
+					emit(PayoffOpCode::Divide);
+				}
+				else {
+					return;
+				}
+			}
+		}
+
+		void parseExpression() {
+			parseTerm();
+			for (;;) {
+				if (accept('+')) {
+					parseTerm();
+					emit(PayoffOpCode::Add);
+				}
+				else if (accept('-')) {
+					parseTerm();
+					emit(PayoffOpCode::Subtract);
+				}
+				else {
+					return;
+				}
+			}
+		}
+
+		void compile() {
+			tokenize();
+			parseExpression();
+			if (peek().type != TokenType::End)
+				fail("unexpected token '" + peek().text + "'", peek().position);
+			// stack depth needed by the program:
+			std::size_t depth{ 0 };
+			for (auto const &instruction : program_) {
+				if (arity(instruction.code) == 0)
+					++depth;
+				else if (arity(instruction.code) == 2)
+					--depth;
+				stackDepth_ = std::max(stackDepth_, depth);
+			}
+			if (stackDepth_ > maxStackDepth)
+				fail("expression needs more than " + std::to_string(maxStackDepth) + " operands at once", 0);
+			tokens_.clear();
+		}
+
+		// ---- evaluation ----
+
+		static inline std::size_t arity(PayoffOpCode code) {
+			switch (code) {
+			case PayoffOpCode::Constant:
+			case PayoffOpCode::Observation:
+			case PayoffOpCode::Average:
+			case PayoffOpCode::Sum:
+			case PayoffOpCode::PathMax:
+			case PayoffOpCode::PathMin:
+				return 0;
+			case PayoffOpCode::Negate:
+			case PayoffOpCode::Exp:
+			case PayoffOpCode::Log:
+			case PayoffOpCode::Sqrt:
+			case PayoffOpCode::Abs:
+				return 1;
+			default:
+				return 2;
+			}
+		}
+
+		static inline double applyBinary(PayoffOpCode code, double a, double b) {
+			switch (code) {
+			case PayoffOpCode::Add: return (a + b);
+			case PayoffOpCode::Subtract: return (a - b);
+			case PayoffOpCode::Multiply: return (a * b);
+			case PayoffOpCode::Divide: return (a / b);
+			case PayoffOpCode::Max: return std::max(a, b);
+			default: return std::min(a, b);
+			}
+		}
+
+		static inline double applyUnary(PayoffOpCode code, double a) {
+			switch (code) {
+			case PayoffOpCode::Negate: return -a;
+			case PayoffOpCode::Exp: return std::exp(a);
+			case PayoffOpCode::Log: return std::log(a);
+			case PayoffOpCode::Sqrt: return std::sqrt(a);
+			default: return std::abs(a);
+			}
+		}
+
+		static inline std::size_t resolve(long index, std::size_t size) {
+			long const resolved = (index < 0) ? static_cast<long>(size) + index : index;
+			if (resolved < 0 || resolved >= static_cast<long>(size))
+				throw std::out_of_range("PayoffExpression: observation index out of path range");
+			return static_cast<std::size_t>(resolved);
+		}
+
+		// aggregate over observations [from,to] of one path
+		static double aggregate(PayoffOpCode code, PathValuesType<T> const &path, long from, long to) {
+			std::size_t const first = resolve(from, path.size());
+			std::size_t const last = resolve(to, path.size());
+			if (first > last)
+				throw std::out_of_range("PayoffExpression: reversed observation window on path");
+			double result = static_cast<double>(path[first]);
+			switch (code) {
+			case PayoffOpCode::PathMax:
+				for (std::size_t k = first + 1; k <= last; ++k)
+					result = std::max(result, static_cast<double>(path[k]));
+				return result;
+			case PayoffOpCode::PathMin:
+				for (std::size_t k = first + 1; k <= last; ++k)
+					result = std::min(result, static_cast<double>(path[k]));
+				return result;
+			default:
+				for (std::size_t k = first + 1; k <= last; ++k)
+					result += static_cast<double>(path[k]);
+				if (code == PayoffOpCode::Average)
+					result /= static_cast<double>(last - first + 1);
+				return result;
+			}
+		}
+
+		// Evaluates paths [first,first+count) on stack, stackDepth_ rows of count
+		void evaluate(PathValuesType<PathValuesType<T>> const &paths, std::size_t first,
+			std::size_t count, double *result, double *stack)const {
+			std::size_t top{ 0 };
+			for (auto const &instruction : program_) {
+				double *out = nullptr;
+				double const *lhs = nullptr;
+				switch (arity(instruction.code)) {
+				case 0:
+					out = stack + (top++) * count;
+					break;
+				case 1:
+					out = stack + (top - 1) * count;
+					break;
+				default:
+					--top;
+					out = stack + (top - 1) * count;
+					lhs = stack + top * count;
+					break;
+				}
+				switch (instruction.code) {
+				case PayoffOpCode::Constant:
+					std::fill(out, out + count, instruction.value);
+					break;
+				case PayoffOpCode::Observation:
+					for (std::size_t p = 0; p < count; ++p) {
+						auto const &path = paths[first + p];
+						out[p] = static_cast<double>(path[resolve(instruction.from, path.size())]);
+					}
+					break;
+				case PayoffOpCode::Average:
+				case PayoffOpCode::Sum:
+				case PayoffOpCode::PathMax:
+				case PayoffOpCode::PathMin:
+					for (std::size_t p = 0; p < count; ++p)
+						out[p] = aggregate(instruction.code, paths[first + p], instruction.from, instruction.to);
+					break;
+				case PayoffOpCode::Add:
+					for (std::size_t p = 0; p < count; ++p) out[p] = out[p] + lhs[p];
+					break;
+				case PayoffOpCode::Subtract:
+					for (std::size_t p = 0; p < count; ++p) out[p] = out[p] - lhs[p];
+					break;
+				case PayoffOpCode::Multiply:
+					for (std::size_t p = 0; p < count; ++p) out[p] = out[p] * lhs[p];
+					break;
+				case PayoffOpCode::Divide:
+					for (std::size_t p = 0; p < count; ++p) out[p] = out[p] / lhs[p];
+					break;
+				case PayoffOpCode::Max:
+					for (std::size_t p = 0; p < count; ++p) out[p] = std::max(out[p], lhs[p]);
+					break;
+				case PayoffOpCode::Min:
+					for (std::size_t p = 0; p < count; ++p) out[p] = std::min(out[p], lhs[p]);
+					break;
+				case PayoffOpCode::Negate:
+					for (std::size_t p = 0; p < count; ++p) out[p] = -out[p];
+					break;
+				case PayoffOpCode::Exp:
+					for (std::size_t p = 0; p < count; ++p) out[p] = std::exp(out[p]);
+					break;
+				case PayoffOpCode::Log:
+					for (std::size_t p = 0; p < count; ++p) out[p] = std::log(out[p]);
+					break;
+				case PayoffOpCode::Sqrt:
+					for (std::size_t p = 0; p < count; ++p) out[p] = std::sqrt(out[p]);
+					break;
+				case PayoffOpCode::Abs:
+					for (std::size_t p = 0; p < count; ++p) out[p] = std::abs(out[p]);
+					break;
+				}
+			}
+			std::copy(stack, stack + count, result);
+		}
+
+	public:
+		// pathLength (if not 0) is the length of every path priced, so that
+		// observation indices are checked once here rather than per path
+		explicit PayoffExpression(std::string const &source,
+			std::map<std::string, double> const &parameters = std::map<std::string, double>{},
+			std::size_t pathLength = 0)
+			:source_{ source }, parameters_{ parameters }, pathLength_{ pathLength } {
+			compile();
+		}
+
+		inline std::string const &source()const { return source_; }
+		inline std::vector<PayoffInstruction> const &program()const { return program_; }
+		inline std::size_t stackDepth()const { return stackDepth_; }
+
+		inline void setBlockSize(std::size_t blockSize) { blockSize_ = std::max<std::size_t>(1, blockSize); }
+		inline std::size_t blockSize()const { return blockSize_; }
+
+		// Evaluates paths [first,first+count) into result[0,count).
+		// Every instruction runs over the whole block before the next one.
+		// stack is the caller's workspace, grown to stackDepth()*count once
+		// and reused block after block (one per thread).
+		void evaluate(PathValuesType<PathValuesType<T>> const &paths, std::size_t first,
+			std::size_t count, double *result, std::vector<double> &stack)const {
+			if (stack.size() < stackDepth_ * count)
+				stack.resize(stackDepth_ * count);
+			evaluate(paths, first, count, result, stack.data());
+		}
+
+		// payoffs of all paths, evaluated block by block
+		PathValuesType<double> evaluate(PathValuesType<PathValuesType<T>> const &paths)const {
+			PathValuesType<double> result(paths.size());
+			std::vector<double> stack(stackDepth_ * std::min(blockSize_, paths.size()));
+			for (std::size_t first = 0; first < paths.size(); first += blockSize_) {
+				std::size_t const count = std::min(blockSize_, paths.size() - first);
+				evaluate(paths, first, count, result.data() + first, stack.data());
+			}
+			return result;
+		}
+
+		// single path, so that the expression can be wrapped by Payoff<PathValuesType<T>>
+		// on a fixed array, no allocation per path
+		double operator()(PathValuesType<T> const &path)const {
+			std::array<double, maxStackDepth> stack;
+			std::size_t top{ 0 };
+			for (auto const &instruction : program_) {
+				switch (arity(instruction.code)) {
+				case 0:
+					if (instruction.code == PayoffOpCode::Constant)
+						stack[top++] = instruction.value;
+					else if (instruction.code == PayoffOpCode::Observation)
+						stack[top++] = static_cast<double>(path[resolve(instruction.from, path.size())]);
+					else
+						stack[top++] = aggregate(instruction.code, path, instruction.from, instruction.to);
+					break;
+				case 1:
+					stack[top - 1] = applyUnary(instruction.code, stack[top - 1]);
+					break;
+				default:
+					--top;
+					stack[top - 1] = applyBinary(instruction.code, stack[top - 1], stack[top]);
+					break;
+				}
+			}
+			return stack[0];
+		}
+	};
+
+
+}
+
+
+
+#endif ///_PAYOFF_EXPRESSION_H_
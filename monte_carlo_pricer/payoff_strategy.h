@@ -3,13 +3,96 @@
 #define _PAYOFF_STARTEGY_H_
 
 #include"mc_types.h"
+#include"mc_utilities.h"
+#include"instrumentation.h"
 #include<algorithm>
 #include<numeric>
+#include<array>
+#include<cmath>
 
 namespace payoff {
 
 	using mc_types::PathValuesType;
 
+	// Sum and sum of squares of payoffs over a number of paths
+	struct PayoffMoments {
+		double sum{ 0.0 };
+		double sumOfSquares{ 0.0 };
+		std::size_t count{ 0 };
+
+		void merge(PayoffMoments const &other) {
+			sum += other.sum;
+			sumOfSquares += other.sumOfSquares;
+			count += other.count;
+		}
+
+		double mean()const {
+			return (count == 0 ? 0.0 : sum / static_cast<double>(count));
+		}
+
+		double variance()const {
+			if (count < 2)
+				return 0.0;
+			double const m = mean();
+			return std::max(0.0, (sumOfSquares - static_cast<double>(count) * m * m) / static_cast<double>(count - 1));
+		}
+
+		double standardError()const {
+			return (count == 0 ? 0.0 : std::sqrt(variance() / static_cast<double>(count)));
+		}
+	};
+
+	namespace detail {
+
+		// Independent accumulator lanes, so that the reduction loops vectorise
+		// without reassociating floating point additions
+		static constexpr std::size_t momentLanes = 8;
+
+		template<typename Fun>
+		inline PayoffMoments laneMoments(std::size_t size, Fun &&value) {
+			std::array<double, momentLanes> sums{};
+			std::array<double, momentLanes> squares{};
+			std::size_t const bulk = size - size % momentLanes;
+			for (std::size_t i = 0; i < bulk; i += momentLanes) {
+				for (std::size_t l = 0; l < momentLanes; ++l) {
+					double const v = value(i + l);
+					sums[l] += v;
+					squares[l] += v * v;
+				}
+			}
+			for (std::size_t i = bulk; i < size; ++i) {
+				double const v = value(i);
+				sums[0] += v;
+				squares[0] += v * v;
+			}
+			PayoffMoments moments;
+			for (std::size_t l = 0; l < momentLanes; ++l) {
+				moments.sum += sums[l];
+				moments.sumOfSquares += squares[l];
+			}
+			moments.count = size;
+			return moments;
+		}
+
+		template<typename T>
+		inline double laneSum(T const *values, std::size_t size) {
+			std::array<double, momentLanes> sums{};
+			std::size_t const bulk = size - size % momentLanes;
+			for (std::size_t i = 0; i < bulk; i += momentLanes) {
+				for (std::size_t l = 0; l < momentLanes; ++l)
+					sums[l] += static_cast<double>(values[i + l]);
+			}
+			for (std::size_t i = bulk; i < size; ++i)
+				sums[0] += static_cast<double>(values[i]);
+			return std::accumulate(sums.begin(), sums.end(), 0.0);
+		}
+
+		template<typename T>
+		inline double average(PathValuesType<T> const &path) {
+			return (laneSum(path.data(), path.size()) / static_cast<double>(path.size()));
+		}
+	}
+
 
 	template<typename UnderlyingType,
 			typename = typename std::enable_if<std::is_scalar<UnderlyingType>::value||
@@ -18,6 +101,12 @@ namespace payoff {
 	public:
 		typedef UnderlyingType underlyingType;
 		virtual double payoff(UnderlyingType const &underlying)const = 0;
+
+		// Payoff moments over a block of underlyings, one virtual call per block.
+		// Strategies override it with a loop the compiler can vectorise
+		virtual PayoffMoments moments(UnderlyingType const *underlying, std::size_t size)const {
+			return detail::laneMoments(size, [&](std::size_t i) {return payoff(underlying[i]); });
+		}
 	};
 
 	template<typename T=double>
@@ -29,7 +118,13 @@ namespace payoff {
 			:strike_{ strike }{}
 
 		double payoff(T const &underlying)const override {
-			return static_cast<double>(std::max(0.0, underlying - strike_));
+			return std::max(0.0, static_cast<double>(underlying) - static_cast<double>(strike_));
+		}
+
+		PayoffMoments moments(T const *underlying, std::size_t size)const override {
+			double const strike = static_cast<double>(strike_);
+			return detail::laneMoments(size, [&](std::size_t i) {
+				return std::max(0.0, static_cast<double>(underlying[i]) - strike); });
 		}
 
 	};
@@ -43,7 +138,13 @@ namespace payoff {
 			:strike_{ strike } {}
 
 		double payoff(T const &underlying)const override {
-			return static_cast<double>(std::max(0.0, strike_ - underlying));
+			return std::max(0.0, static_cast<double>(strike_) - static_cast<double>(underlying));
+		}
+
+		PayoffMoments moments(T const *underlying, std::size_t size)const override {
+			double const strike = static_cast<double>(strike_);
+			return detail::laneMoments(size, [&](std::size_t i) {
+				return std::max(0.0, strike - static_cast<double>(underlying[i])); });
 		}
 	};
 
@@ -55,11 +156,18 @@ namespace payoff {
 		AsianAvgCallStrategy(T strike)
 			:strike_{strike}{}
 
-		double payoff(PathValuesType<T> const &underlying)const {
+		double payoff(PathValuesType<T> const &underlying)const override {
 			std::size_t N = underlying.size();
 			auto sum = std::accumulate(underlying.begin(), underlying.end(), 0.0);
 			auto avg = (sum / static_cast<double>(N));
-			return static_cast<double>(std::max(0.0, avg - strike_));
+			return std::max(0.0, avg - static_cast<double>(strike_));
+		}
+
+		PayoffMoments moments(PathValuesType<T> const *underlying, std::size_t size)const override {
+			double const strike = static_cast<double>(strike_);
+			return detail::laneMoments(size, [&](std::size_t i) {
+				double const avg = detail::average(underlying[i]);
+				return std::max(0.0, avg - strike); });
 		}
 	};
 
@@ -71,14 +179,60 @@ namespace payoff {
 		AsianAvgPutStrategy(T strike)
 			:strike_{ strike } {}
 
-		double payoff(PathValuesType<T> const &underlying)const {
+		double payoff(PathValuesType<T> const &underlying)const override {
 			std::size_t N = underlying.size();
 			auto sum = std::accumulate(underlying.begin(), underlying.end(), 0.0);
 			auto avg = (sum / static_cast<double>(N));
-			return static_cast<double>(std::max(0.0, strike_ - avg));
+			return std::max(0.0, static_cast<double>(strike_) - avg);
+		}
+
+		PayoffMoments moments(PathValuesType<T> const *underlying, std::size_t size)const override {
+			double const strike = static_cast<double>(strike_);
+			return detail::laneMoments(size, [&](std::size_t i) {
+				double const avg = detail::average(underlying[i]);
+				return std::max(0.0, strike - avg); });
 		}
 	};
 
+	namespace detail {
+
+		// Moments of blockFun(first,size) over consecutive blocks of count items,
+		// evaluated in parallel and merged in block order
+		template<typename BlockFun>
+		PayoffMoments parallelBlockMoments(std::size_t count, std::size_t blockSize, BlockFun &&blockFun) {
+			instrumentation::StageTimer timer{ instrumentation::Stage::Payoff };
+			auto const blockMoments = mc_utilities::parallelBlocks<PayoffMoments>(count, blockSize,
+				std::forward<BlockFun>(blockFun));
+			PayoffMoments result;
+			for (auto const &m : blockMoments)
+				result.merge(m);
+			return result;
+		}
+	}
+
+	// Payoff moments of a strategy over all underlyings (terminal values or whole paths)
+	template<typename UnderlyingType>
+	PayoffMoments batchPayoff(PayoffStrategy<UnderlyingType> const &strategy,
+		std::vector<UnderlyingType> const &underlyings, std::size_t blockSize = 4096) {
+		return detail::parallelBlockMoments(underlyings.size(), blockSize,
+			[&](std::size_t first, std::size_t size) {
+			return strategy.moments(underlyings.data() + first, size);
+		});
+	}
+
+	// Payoff moments of a strategy on the terminal values of paths,
+	// gathered block by block into contiguous storage
+	template<typename T>
+	PayoffMoments batchTerminalPayoff(PayoffStrategy<T> const &strategy,
+		std::vector<PathValuesType<T>> const &paths, std::size_t blockSize = 4096) {
+		return detail::parallelBlockMoments(paths.size(), blockSize,
+			[&](std::size_t first, std::size_t size) {
+			std::vector<T> terminal(size);
+			for (std::size_t i = 0; i < size; ++i)
+				terminal[i] = paths[first + i].back();
+			return strategy.moments(terminal.data(), size);
+		});
+	}
 
 }
 
@@ -3,6 +3,7 @@
 #define _PAYOFF_T_H_
 
 #include"payoff.h"
+#include"payoff_expression.h"
 #include<random>
 using namespace payoff;
 using namespace std::placeholders;
@@ -63,4 +64,38 @@ void payoff3() {
 
 }
 
+void payoff4() {
+	// Compile the payoff from text:
+	std::vector<double> prices(static_cast<std::size_t>(10));
+	std::random_device rd;
+	std::normal_distribution<double> normals;
+	double init{ 100.0 };
+	std::generate(prices.begin(), prices.end(), [&]() {return init * std::exp(0.1 * normals(rd)); });
+
+	std::map<std::string, double> parameters{ { "K",95.0 },{ "r",0.05 },{ "T",1.0 } };
+	PayoffExpression<> asian_expr{ "discount(r,T) * max(avg() - K, 0)",parameters };
+	std::cout << "Compiled '" << asian_expr.source() << "' into " << asian_expr.program().size() << " instructions\n";
+	std::cout << "Discounted average asian call payoff: " << asian_expr(prices) << "\n";
+
+	// Wrapped as any other payoff:
+	Payoff<PathValuesType<double>> lookback_pay{ PayoffExpression<>{ "pathmax() - S[-1]" } };
+	std::cout << "Floating strike lookback put payoff: " << lookback_pay.payoff(prices) << "\n";
+
+	// Whole block of paths at once:
+	PathValuesType<PathValuesType<double>> paths(1000, prices);
+	auto payoffs = asian_expr.evaluate(paths);
+	std::cout << "Block of " << payoffs.size() << " payoffs, first: " << payoffs.front() << "\n";
+
+	// Windows that can never be valid are rejected when compiled:
+	for (auto const &source : { "avg(5,2)","pathmax(-1,-3)","S[12]","sum(0,10)" }) {
+		try {
+			PayoffExpression<> rejected{ source,{},prices.size() };
+			std::cout << "Compiled '" << source << "'\n";
+		}
+		catch (std::invalid_argument const &e) {
+			std::cout << e.what() << "\n";
+		}
+	}
+}
+
 #endif //_PAYOFF_T_H_
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+#if !defined(_PIPELINE_H_)
+#define _PIPELINE_H_
+
+#include"mc_types.h"
+#include"payoff_strategy.h"
+#include"path_buffer.h"
+#include"mixed_precision.h"
+#include"fdm.h"
+#include"reduction.h"
+#include<vector>
+#include<algorithm>
+#include<type_traits>
+
+namespace pipeline {
+
+	using mc_types::FDMScheme;
+	using payoff::PayoffStrategy;
+	using payoff::PayoffMoments;
+	using path_buffer::PathSpan;
+	using path_buffer::PathArena;
+	using mixed_precision::CompensatedMoments;
+	using finite_difference_method::Fdm;
+
+	struct PipelineOptions {
+		std::size_t chunkPaths{ 0 };			// paths per chunk (0: as many as fit cacheBytes)
+		std::size_t cacheBytes{ 256 * 1024 };	// per worker working set aimed at, about one L2 cache
+		FDMScheme scheme{ FDMScheme::EulerScheme };
+	};
+
+	// Paths per chunk: the normals and values of a chunk together fit cacheBytes
+	template<std::size_t FactorCount, typename T>
+	std::size_t chunkPaths(Fdm<FactorCount, T> const &fdm, PipelineOptions const &options) {
+		if (options.chunkPaths > 0)
+			return options.chunkPaths;
+		auto const &grid = *(fdm.timeGrid());
+		std::size_t const bytesPerPath = (grid.size() + 1 + FactorCount * grid.steps()) * sizeof(T);
+		return std::max<std::size_t>(1, options.cacheBytes / bytesPerPath);
+	}
+
+
+	// Payoff moments of iterations paths of fdm priced in a pipeline: every
+	// chunk's random numbers are drawn, its paths stepped and payoff(path)
+	// accumulated (in double with compensated sums) while the chunk is still in
+	// cache. Paths are accumulated in order within fixed reduction blocks that
+	// are reduced by the tree of reduction.h, so a seeded engine gives the same
+	// bits for any chunk size and thread count.
+	template<std::size_t FactorCount, typename T, typename Payoff,
+		typename = typename std::enable_if<!std::is_base_of<PayoffStrategy<T>, Payoff>::value>::type>
+	PayoffMoments pipelinedPayoff(Fdm<FactorCount, T> &fdm, std::size_t iterations, Payoff const &payoff,
+		PipelineOptions const &options = PipelineOptions{}) {
+		auto blocks = fdm.template simulatePipelined<CompensatedMoments>(iterations, reduction::reductionBlockSize,
+			chunkPaths(fdm, options), [&](CompensatedMoments &moments, std::size_t, PathArena<T> const &chunk) {
+			for (std::size_t i = 0; i < chunk.pathCount(); ++i)
+				moments.add(static_cast<double>(payoff(chunk.path(i))));
+		}, options.scheme);
+		return reduction::treeReduce(std::move(blocks), mixed_precision::mergeMoments).moments();
+	}
+
+	// Terminal payoff strategy
+	template<std::size_t FactorCount, typename T>
+	PayoffMoments pipelinedPayoff(Fdm<FactorCount, T> &fdm, std::size_t iterations, PayoffStrategy<T> const &strategy,
+		PipelineOptions const &options = PipelineOptions{}) {
+		return pipelinedPayoff(fdm, iterations, [&strategy](PathSpan<T> const &path) {
+			return strategy.payoff(path.back()); }, options);
+	}
+
+}
+
+
+
+#endif ///_PIPELINE_H_
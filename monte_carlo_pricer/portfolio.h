@@ -0,0 +1,136 @@
+#pragma once
+#if !defined(_PORTFOLIO_H_)
+#define _PORTFOLIO_H_
+
+#include"mc_types.h"
+#include"mc_utilities.h"
+#include"payoff_strategy.h"
+#include"fdm.h"
+#include<string>
+#include<memory>
+#include<stdexcept>
+
+namespace portfolio {
+
+	using mc_types::PathValuesType;
+	using mc_types::FDMScheme;
+	using payoff::PayoffStrategy;
+	using payoff::PayoffMoments;
+	using finite_difference_method::Fdm;
+
+
+	// Trade of a portfolio: payoff on the terminal value or on the whole path
+	template<typename T = double>
+	struct Trade {
+		std::string name;
+		std::shared_ptr<PayoffStrategy<T>> terminalPayoff;
+		std::shared_ptr<PayoffStrategy<PathValuesType<T>>> pathPayoff;
+	};
+
+	// Discounted price of a trade with the standard error of the estimate
+	struct TradePrice {
+		std::string name;
+		double price;
+		double standardError;
+	};
+
+
+	// Trades written on the same model
+	template<typename T = double>
+	class Portfolio {
+	private:
+		std::vector<Trade<T>> trades_;
+
+	public:
+		Portfolio() {}
+
+		void add(std::string const &name, std::shared_ptr<PayoffStrategy<T>> const &payoff) {
+			trades_.emplace_back(Trade<T>{ name,payoff,nullptr });
+		}
+
+		void add(std::string const &name, std::shared_ptr<PayoffStrategy<PathValuesType<T>>> const &payoff) {
+			trades_.emplace_back(Trade<T>{ name,nullptr,payoff });
+		}
+
+		inline std::size_t size()const { return trades_.size(); }
+
+		inline Trade<T> const &trade(std::size_t index)const { return trades_.at(index); }
+
+		inline std::vector<Trade<T>> const &trades()const { return trades_; }
+
+		// Payoff moments of all trades over the paths [first,first+size).
+		// Terminal values are gathered once per block and shared by all terminal trades.
+		std::vector<PayoffMoments> moments(PathValuesType<PathValuesType<T>> const &paths,
+			std::size_t first, std::size_t size)const {
+			std::vector<PayoffMoments> result(trades_.size());
+			PathValuesType<T> terminal;
+			for (std::size_t t = 0; t < trades_.size(); ++t) {
+				if (trades_[t].pathPayoff) {
+					result[t] = trades_[t].pathPayoff->moments(paths.data() + first, size);
+					continue;
+				}
+				if (terminal.empty()) {
+					terminal.resize(size);
+					for (std::size_t i = 0; i < size; ++i)
+						terminal[i] = paths[first + i].back();
+				}
+				result[t] = trades_[t].terminalPayoff->moments(terminal.data(), size);
+			}
+			return result;
+		}
+	};
+
+
+	// Prices all trades of a portfolio from one simulation of the model.
+	// Constructor arguments are forwarded to the Fdm engine.
+	template<std::size_t FactorCount, typename T = double>
+	class PortfolioPricer {
+	private:
+		Fdm<FactorCount, T> fdm_;
+		std::size_t blockSize_{ 4096 };
+
+	public:
+		template<typename ...FdmArgs>
+		explicit PortfolioPricer(FdmArgs &&...fdmArgs)
+			:fdm_{ std::forward<FdmArgs>(fdmArgs)... } {}
+
+		inline Fdm<FactorCount, T> &fdm() { return fdm_; }
+
+		inline void setBlockSize(std::size_t blockSize) { blockSize_ = std::max<std::size_t>(1, blockSize); }
+		inline std::size_t blockSize()const { return blockSize_; }
+
+		// Simulates the paths once and pushes every block of paths through all trades.
+		// Blocks run in parallel and are merged in block order.
+		std::vector<TradePrice> price(Portfolio<T> const &portfolio, std::size_t iterations,
+			double discountFactor = 1.0, FDMScheme scheme = FDMScheme::EulerScheme) {
+			if (portfolio.size() == 0)
+				throw std::invalid_argument("Portfolio has no trades.");
+			auto const paths = fdm_(iterations, scheme);
+
+			instrumentation::StageTimer timer{ instrumentation::Stage::Payoff };
+			auto const blockMoments = mc_utilities::parallelBlocks<std::vector<PayoffMoments>>(paths.size(), blockSize_,
+				[&](std::size_t first, std::size_t size) {
+				return portfolio.moments(paths, first, size);
+			});
+
+			std::vector<PayoffMoments> total(portfolio.size());
+			for (auto const &block : blockMoments) {
+				for (std::size_t t = 0; t < total.size(); ++t)
+					total[t].merge(block[t]);
+			}
+			timer.stop();
+			std::vector<TradePrice> prices;
+			prices.reserve(total.size());
+			for (std::size_t t = 0; t < total.size(); ++t) {
+				prices.emplace_back(TradePrice{ portfolio.trade(t).name,
+					discountFactor * total[t].mean(),discountFactor * total[t].standardError() });
+			}
+			return prices;
+		}
+	};
+
+}
+
+
+
+#endif ///_PORTFOLIO_H_
@@ -0,0 +1,169 @@
+#pragma once
+#if !defined(_PRICE_SURFACE_H_)
+#define _PRICE_SURFACE_H_
+
+#include"mc_types.h"
+#include"payoff_strategy.h"
+#include"analytic_pricers.h"
+#include<algorithm>
+#include<future>
+#include<cmath>
+#include<stdexcept>
+
+namespace price_surface {
+
+	using mc_types::PathValuesType;
+	using mc_types::TimePointsType;
+	using payoff::PayoffMoments;
+
+
+	// Discounted call/put prices, rows are maturities and columns strikes
+	struct PriceSurface {
+		std::vector<double> maturities;
+		std::vector<double> strikes;
+		std::vector<std::vector<double>> calls;
+		std::vector<std::vector<double>> puts;
+		std::vector<std::vector<double>> callErrors;
+		std::vector<std::vector<double>> putErrors;
+		// filled on request, NaN where price lies outside of no-arbitrage bounds
+		std::vector<std::vector<double>> impliedVolatilities;
+	};
+
+
+	// Simulated values at one maturity, sorted once, with prefix sums of values
+	// and of their squares, so that payoff moments of any strike take one binary search
+	class MaturitySlice {
+	private:
+		std::vector<double> values_;
+		std::vector<double> prefix_;
+		std::vector<double> prefixSquares_;
+
+	public:
+		explicit MaturitySlice(std::vector<double> &&values)
+			:values_{ std::move(values) } {
+			std::sort(values_.begin(), values_.end());
+			prefix_.resize(values_.size() + 1);
+			prefixSquares_.resize(values_.size() + 1);
+			prefix_[0] = 0.0;
+			prefixSquares_[0] = 0.0;
+			for (std::size_t i = 0; i < values_.size(); ++i) {
+				prefix_[i + 1] = prefix_[i] + values_[i];
+				prefixSquares_[i + 1] = prefixSquares_[i] + values_[i] * values_[i];
+			}
+		}
+
+		inline std::size_t size()const { return values_.size(); }
+
+		PayoffMoments callMoments(double strike)const {
+			std::size_t const below = static_cast<std::size_t>(
+				std::upper_bound(values_.begin(), values_.end(), strike) - values_.begin());
+			double const count = static_cast<double>(values_.size() - below);
+			double const sum = prefix_.back() - prefix_[below];
+			double const squares = prefixSquares_.back() - prefixSquares_[below];
+			PayoffMoments moments;
+			moments.sum = sum - strike * count;
+			moments.sumOfSquares = squares - 2.0 * strike * sum + strike * strike * count;
+			moments.count = values_.size();
+			return moments;
+		}
+
+		PayoffMoments putMoments(double strike)const {
+			std::size_t const below = static_cast<std::size_t>(
+				std::upper_bound(values_.begin(), values_.end(), strike) - values_.begin());
+			double const count = static_cast<double>(below);
+			PayoffMoments moments;
+			moments.sum = strike * count - prefix_[below];
+			moments.sumOfSquares = strike * strike * count - 2.0 * strike * prefix_[below] + prefixSquares_[below];
+			moments.count = values_.size();
+			return moments;
+		}
+	};
+
+
+	// Prices a strike x maturity surface of vanillas from one set of simulated paths,
+	// path[i] is taken at timePoints[i]. Each maturity slice is gathered and sorted
+	// once (slices in parallel), every strike then costs O(log N).
+	template<typename T = double>
+	class SurfacePricer {
+	private:
+		TimePointsType<T> timePoints_;
+		T rate_;
+
+	public:
+		SurfacePricer(TimePointsType<T> const &timePoints, T rate)
+			:timePoints_{ timePoints }, rate_{ rate } {}
+
+		MaturitySlice slice(PathValuesType<PathValuesType<T>> const &paths, std::size_t index)const {
+			std::vector<double> values(paths.size());
+			for (std::size_t p = 0; p < paths.size(); ++p)
+				values[p] = static_cast<double>(paths[p][index]);
+			return MaturitySlice{ std::move(values) };
+		}
+
+		PriceSurface price(PathValuesType<PathValuesType<T>> const &paths,
+			std::vector<std::size_t> const &maturityIndices, std::vector<double> const &strikes)const {
+			if (paths.empty())
+				throw std::invalid_argument("No paths given.");
+			for (auto const &index : maturityIndices) {
+				if (index >= paths.front().size() || index >= timePoints_.size())
+					throw std::out_of_range("Maturity index lies beyond the end of the paths.");
+			}
+			std::vector<std::future<MaturitySlice>> futures;
+			futures.reserve(maturityIndices.size());
+			for (auto const &index : maturityIndices) {
+				futures.emplace_back(std::async(std::launch::async, [this, &paths, index]() {
+					return slice(paths, index);
+				}));
+			}
+
+			PriceSurface surface;
+			surface.strikes = strikes;
+			for (std::size_t m = 0; m < maturityIndices.size(); ++m) {
+				auto const slice = futures[m].get();
+				double const maturity = static_cast<double>(timePoints_[maturityIndices[m]]);
+				double const df = std::exp(-static_cast<double>(rate_) * maturity);
+				surface.maturities.emplace_back(maturity);
+				std::vector<double> calls, puts, callErrors, putErrors;
+				for (auto const &strike : strikes) {
+					auto const call = slice.callMoments(strike);
+					auto const put = slice.putMoments(strike);
+					calls.emplace_back(df * call.mean());
+					puts.emplace_back(df * put.mean());
+					callErrors.emplace_back(df * call.standardError());
+					putErrors.emplace_back(df * put.standardError());
+				}
+				surface.calls.emplace_back(std::move(calls));
+				surface.puts.emplace_back(std::move(puts));
+				surface.callErrors.emplace_back(std::move(callErrors));
+				surface.putErrors.emplace_back(std::move(putErrors));
+			}
+			return surface;
+		}
+
+		// Same as above and implied volatilities from out-of-the-money options
+		PriceSurface price(PathValuesType<PathValuesType<T>> const &paths,
+			std::vector<std::size_t> const &maturityIndices, std::vector<double> const &strikes,
+			double spot, double dividend)const {
+			auto surface = price(paths, maturityIndices, strikes);
+			double const rate = static_cast<double>(rate_);
+			for (std::size_t m = 0; m < surface.maturities.size(); ++m) {
+				double const maturity = surface.maturities[m];
+				double const forward = spot * std::exp((rate - dividend) * maturity);
+				std::vector<double> vols;
+				for (std::size_t k = 0; k < strikes.size(); ++k) {
+					bool const isCall = (strikes[k] >= forward);
+					double const price = isCall ? surface.calls[m][k] : surface.puts[m][k];
+					vols.emplace_back(analytic_pricers::impliedVolatility(price, spot, strikes[k], maturity,
+						rate, dividend, isCall));
+				}
+				surface.impliedVolatilities.emplace_back(std::move(vols));
+			}
+			return surface;
+		}
+	};
+
+}
+
+
+
+#endif ///_PRICE_SURFACE_H_
@@ -0,0 +1,673 @@
+#pragma once
+#if !defined(_PRICING_SERVICE_H_)
+#define _PRICING_SERVICE_H_
+
+#include"mc_types.h"
+#include"payoff_strategy.h"
+#include"portfolio.h"
+#include"fdm.h"
+#include"sde_builder.h"
+#include"path_cache.h"
+#include"thread_pool.h"
+#include<string>
+#include<vector>
+#include<map>
+#include<deque>
+#include<memory>
+#include<mutex>
+#include<condition_variable>
+#include<thread>
+#include<future>
+#include<atomic>
+#include<algorithm>
+#include<chrono>
+#include<functional>
+#include<sstream>
+#include<stdexcept>
+
+#if !defined(_WIN32)
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<unistd.h>
+#include<cerrno>
+#include<cstring>
+#endif
+
+namespace pricing_service {
+
+	using mc_types::PathValuesType;
+	using mc_types::FDMScheme;
+	using payoff::PayoffMoments;
+	using portfolio::Trade;
+	using portfolio::Portfolio;
+	using finite_difference_method::Fdm;
+	using sde_builder::SdeBuilder;
+	using thread_pool::ThreadPool;
+
+
+	// One trade to price. On the wire a request is one line of key=value fields
+	// after the request id, lists are comma separated, e.g.
+	//	7 model=gbm params=0.01,0.2,100 maturity=1 steps=360 scheme=euler seed=42 paths=20000 payoff=call args=100 rate=0.01
+	// seed=0 (default) runs unseeded.
+	struct PricingRequest {
+		std::uint64_t id{ 0 };
+		std::string model;
+		std::vector<double> modelParameters;
+		double maturity{ 1.0 };
+		std::size_t steps{ 360 };
+		FDMScheme scheme{ FDMScheme::EulerScheme };
+		std::uint64_t seed{ 0 };
+		std::size_t paths{ 10000 };
+		std::string payoff;
+		std::vector<double> payoffParameters;
+		double rate{ 0.0 };	// flat discount rate
+	};
+
+	// Answer to a request, times are in milliseconds. On the wire:
+	//	7 ok price=... error=... queue_ms=... compute_ms=... batch=...
+	//	7 failed message
+	struct PricingResponse {
+		std::uint64_t id{ 0 };
+		bool ok{ false };
+		std::string message;
+		double price{ 0.0 };
+		double standardError{ 0.0 };
+		double queueTime{ 0.0 };	// arrival until its batch started
+		double computeTime{ 0.0 };	// simulation and pricing of its batch
+		std::size_t batchSize{ 0 };
+	};
+
+	namespace detail {
+
+		inline std::vector<double> parseList(std::string const &text) {
+			std::vector<double> values;
+			std::istringstream stream{ text };
+			std::string item;
+			while (std::getline(stream, item, ',')) {
+				if (!item.empty())
+					values.emplace_back(std::stod(item));
+			}
+			return values;
+		}
+
+		inline double milliseconds(std::chrono::steady_clock::duration duration) {
+			return std::chrono::duration<double, std::milli>(duration).count();
+		}
+	}
+
+	inline PricingRequest parseRequest(std::string const &line) {
+		std::istringstream stream{ line };
+		PricingRequest request;
+		if (!(stream >> request.id))
+			throw std::invalid_argument("Request does not start with an id.");
+		std::string field;
+		try {
+			while (stream >> field) {
+				auto const eq = field.find('=');
+				if (eq == std::string::npos)
+					throw std::invalid_argument("Field " + field + " is not key=value.");
+				std::string const key = field.substr(0, eq);
+				std::string const value = field.substr(eq + 1);
+				if (key == "model") request.model = value;
+				else if (key == "params") request.modelParameters = detail::parseList(value);
+				else if (key == "maturity") request.maturity = std::stod(value);
+				else if (key == "steps") request.steps = static_cast<std::size_t>(std::stoull(value));
+				else if (key == "seed") request.seed = std::stoull(value);
+				else if (key == "paths") request.paths = static_cast<std::size_t>(std::stoull(value));
+				else if (key == "payoff") request.payoff = value;
+				else if (key == "args") request.payoffParameters = detail::parseList(value);
+				else if (key == "rate") request.rate = std::stod(value);
+				else if (key == "scheme") {
+					if (value == "euler") request.scheme = FDMScheme::EulerScheme;
+					else if (value == "milstein") request.scheme = FDMScheme::MilsteinScheme;
+					else throw std::invalid_argument("Unknown scheme " + value + ".");
+				}
+				else throw std::invalid_argument("Unknown field " + key + ".");
+			}
+		}
+		catch (std::logic_error const &e) {
+			throw std::invalid_argument(std::string{ "Malformed request: " } + e.what());
+		}
+		if (request.model.empty() || request.payoff.empty())
+			throw std::invalid_argument("Request needs a model and a payoff.");
+		if (request.steps == 0 || request.paths == 0)
+			throw std::invalid_argument("Request needs positive steps and paths.");
+		return request;
+	}
+
+	inline std::string formatResponse(PricingResponse const &response) {
+		std::ostringstream stream;
+		stream.precision(12);
+		stream << response.id;
+		if (!response.ok) {
+			stream << " failed " << response.message << "\n";
+			return stream.str();
+		}
+		stream << " ok price=" << response.price << " error=" << response.standardError
+			<< " queue_ms=" << response.queueTime << " compute_ms=" << response.computeTime
+			<< " batch=" << response.batchSize << "\n";
+		return stream.str();
+	}
+
+
+	template<typename T>
+	using ModelFactory = std::function<std::shared_ptr<SdeBuilder<1, T, T, T>>(std::vector<double> const &)>;
+
+	template<typename T>
+	using TradeFactory = std::function<Trade<T>(std::vector<double> const &)>;
+
+
+	// Long-lived pricer of one-factor trades. Requests sharing model, parameters,
+	// grid, scheme, seed and path count that arrive within the batching window are
+	// priced as one portfolio on one simulation. Simulations run on a warm thread
+	// pool, seeded simulations are kept in a path cache for repeated requests.
+	// Callbacks are called on pool threads.
+	template<typename T = double>
+	class PricingService {
+	public:
+		typedef std::function<void(PricingResponse const &)> Callback;
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Pending {
+			PricingRequest request;
+			Callback callback;
+			Clock::time_point arrival;
+		};
+
+		struct Batch {
+			Clock::time_point deadline;
+			std::vector<Pending> requests;
+		};
+
+		std::shared_ptr<ThreadPool> pool_;
+		Clock::duration window_;
+		std::size_t maxBatch_;
+		path_cache::PathCache<T> cache_;
+		std::map<std::string, ModelFactory<T>> models_;
+		std::map<std::string, TradeFactory<T>> trades_;
+		std::map<std::string, Batch> batches_;
+		std::mutex mutex_;
+		std::condition_variable changed_;
+		std::size_t inFlight_{ 0 };
+		bool stop_{ false };
+		std::thread dispatcher_;
+
+		static std::string batchKey(PricingRequest const &request) {
+			std::ostringstream key;
+			key << std::hexfloat << request.model << '|';
+			for (auto const &p : request.modelParameters)
+				key << p << ',';
+			key << '|' << request.maturity << '|' << request.steps << '|' << static_cast<int>(request.scheme)
+				<< '|' << request.seed << '|' << request.paths;
+			return key.str();
+		}
+
+		static void fail(Pending const &pending, std::string const &message) {
+			PricingResponse response;
+			response.id = pending.request.id;
+			response.message = message;
+			pending.callback(response);
+		}
+
+		void runBatch(std::vector<Pending> const &batch) {
+			auto const start = Clock::now();
+			PricingRequest const &first = batch.front().request;
+			std::vector<Pending const *> priced;
+			Portfolio<T> portfolio;
+			std::shared_ptr<SdeBuilder<1, T, T, T>> builder;
+			ModelFactory<T> model;
+			std::vector<TradeFactory<T>> trades;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto const it = models_.find(first.model);
+				if (it != models_.end())
+					model = it->second;
+				for (auto const &pending : batch) {
+					auto const trade = trades_.find(pending.request.payoff);
+					trades.emplace_back(trade == trades_.end() ? TradeFactory<T>{} : trade->second);
+				}
+			}
+			try {
+				if (!model)
+					throw std::invalid_argument("Unknown model " + first.model + ".");
+				builder = model(first.modelParameters);
+			}
+			catch (std::exception const &e) {
+				for (auto const &pending : batch)
+					fail(pending, e.what());
+				return;
+			}
+			for (std::size_t r = 0; r < batch.size(); ++r) {
+				if (!trades[r]) {
+					fail(batch[r], "Unknown payoff " + batch[r].request.payoff + ".");
+					continue;
+				}
+				try {
+					auto const trade = trades[r](batch[r].request.payoffParameters);
+					if (trade.pathPayoff)
+						portfolio.add(trade.name, trade.pathPayoff);
+					else
+						portfolio.add(trade.name, trade.terminalPayoff);
+					priced.emplace_back(&batch[r]);
+				}
+				catch (std::exception const &e) {
+					fail(batch[r], e.what());
+				}
+			}
+			if (priced.empty())
+				return;
+
+			try {
+				Fdm<1, T> fdm{ builder->model(),static_cast<T>(first.maturity),first.steps };
+				fdm.setThreadPool(pool_);
+				if (first.seed != 0)
+					fdm.setSeed(first.seed);
+				auto const paths = cache_.paths(*builder, fdm, first.paths, first.scheme);
+
+				std::size_t const blockSize = 4096;
+				std::size_t const blocks = (paths->size() + blockSize - 1) / blockSize;
+				std::vector<std::vector<PayoffMoments>> blockMoments(blocks);
+				pool_->parallelFor(blocks, [&](std::size_t b) {
+					std::size_t const offset = b * blockSize;
+					blockMoments[b] = portfolio.moments(*paths, offset, std::min(blockSize, paths->size() - offset));
+				});
+				std::vector<PayoffMoments> total(portfolio.size());
+				for (auto const &block : blockMoments) {
+					for (std::size_t t = 0; t < total.size(); ++t)
+						total[t].merge(block[t]);
+				}
+
+				auto const end = Clock::now();
+				for (std::size_t t = 0; t < priced.size(); ++t) {
+					double const df = std::exp(-priced[t]->request.rate * first.maturity);
+					PricingResponse response;
+					response.id = priced[t]->request.id;
+					response.ok = true;
+					response.price = df * total[t].mean();
+					response.standardError = df * total[t].standardError();
+					response.queueTime = detail::milliseconds(start - priced[t]->arrival);
+					response.computeTime = detail::milliseconds(end - start);
+					response.batchSize = priced.size();
+					priced[t]->callback(response);
+				}
+			}
+			catch (std::exception const &e) {
+				for (auto const pending : priced)
+					fail(*pending, e.what());
+			}
+		}
+
+		// hands batches over to the pool once their window closed or they are full
+		void dispatch() {
+			std::unique_lock<std::mutex> lock(mutex_);
+			for (;;) {
+				auto const now = Clock::now();
+				auto next = Clock::time_point::max();
+				for (auto it = batches_.begin(); it != batches_.end();) {
+					if (stop_ || it->second.deadline <= now || it->second.requests.size() >= maxBatch_) {
+						auto batch = std::make_shared<std::vector<Pending>>(std::move(it->second.requests));
+						it = batches_.erase(it);
+						++inFlight_;
+						pool_->submit([this, batch]() {
+							runBatch(*batch);
+							std::lock_guard<std::mutex> lock(mutex_);
+							--inFlight_;
+							changed_.notify_all();
+						});
+						continue;
+					}
+					next = std::min(next, it->second.deadline);
+					++it;
+				}
+				if (stop_)
+					return;
+				if (next == Clock::time_point::max())
+					changed_.wait(lock);
+				else
+					changed_.wait_until(lock, next);
+			}
+		}
+
+		void registerDefaults() {
+			models_["gbm"] = [](std::vector<double> const &p) {
+				if (p.size() != 3)
+					throw std::invalid_argument("gbm needs params=mu,sigma,spot.");
+				return std::shared_ptr<SdeBuilder<1, T, T, T>>{
+					new sde_builder::GeometricBrownianMotion<T>{ static_cast<T>(p[0]),static_cast<T>(p[1]),static_cast<T>(p[2]) } };
+			};
+			models_["abm"] = [](std::vector<double> const &p) {
+				if (p.size() != 3)
+					throw std::invalid_argument("abm needs params=mu,sigma,spot.");
+				return std::shared_ptr<SdeBuilder<1, T, T, T>>{
+					new sde_builder::ArithmeticBrownianMotion<T>{ static_cast<T>(p[0]),static_cast<T>(p[1]),static_cast<T>(p[2]) } };
+			};
+			models_["cev"] = [](std::vector<double> const &p) {
+				if (p.size() != 4)
+					throw std::invalid_argument("cev needs params=mu,sigma,beta,spot.");
+				return std::shared_ptr<SdeBuilder<1, T, T, T>>{
+					new sde_builder::ConstantElasticityVariance<T>{ static_cast<T>(p[0]),static_cast<T>(p[1]),
+					static_cast<T>(p[2]),static_cast<T>(p[3]) } };
+			};
+			trades_["call"] = [](std::vector<double> const &a) {
+				if (a.size() != 1)
+					throw std::invalid_argument("call needs args=strike.");
+				return Trade<T>{ "call",std::make_shared<payoff::PlainCallStrategy<T>>(static_cast<T>(a[0])),nullptr };
+			};
+			trades_["put"] = [](std::vector<double> const &a) {
+				if (a.size() != 1)
+					throw std::invalid_argument("put needs args=strike.");
+				return Trade<T>{ "put",std::make_shared<payoff::PlainPutStrategy<T>>(static_cast<T>(a[0])),nullptr };
+			};
+			trades_["asian_call"] = [](std::vector<double> const &a) {
+				if (a.size() != 1)
+					throw std::invalid_argument("asian_call needs args=strike.");
+				return Trade<T>{ "asian_call",nullptr,std::make_shared<payoff::AsianAvgCallStrategy<T>>(static_cast<T>(a[0])) };
+			};
+			trades_["asian_put"] = [](std::vector<double> const &a) {
+				if (a.size() != 1)
+					throw std::invalid_argument("asian_put needs args=strike.");
+				return Trade<T>{ "asian_put",nullptr,std::make_shared<payoff::AsianAvgPutStrategy<T>>(static_cast<T>(a[0])) };
+			};
+		}
+
+	public:
+		explicit PricingService(std::shared_ptr<ThreadPool> const &pool,
+			std::chrono::microseconds batchWindow = std::chrono::microseconds{ 2000 },
+			std::size_t maxBatch = 256, std::size_t cacheBudget = 256 * 1024 * 1024)
+			:pool_{ pool }, window_{ batchWindow }, maxBatch_{ std::max<std::size_t>(1, maxBatch) },
+			cache_{ cacheBudget } {
+			if (!pool_)
+				throw std::invalid_argument("Pricing service needs a thread pool.");
+			registerDefaults();
+			dispatcher_ = std::thread{ &PricingService::dispatch, this };
+		}
+
+		// Prices what is queued and waits for batches in flight
+		~PricingService() {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			changed_.notify_all();
+			dispatcher_.join();
+			std::unique_lock<std::mutex> lock(mutex_);
+			changed_.wait(lock, [this]() {return (inFlight_ == 0); });
+		}
+
+		PricingService(PricingService const &) = delete;
+		PricingService &operator=(PricingService const &) = delete;
+
+		void registerModel(std::string const &name, ModelFactory<T> const &factory) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			models_[name] = factory;
+		}
+
+		void registerTrade(std::string const &name, TradeFactory<T> const &factory) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			trades_[name] = factory;
+		}
+
+		inline path_cache::CacheStatistics cacheStatistics()const { return cache_.statistics(); }
+
+		void submit(PricingRequest const &request, Callback const &callback) {
+			Pending pending{ request,callback,Clock::now() };
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (stop_)
+					throw std::logic_error("Pricing service is stopping.");
+				auto const key = batchKey(request);
+				auto it = batches_.find(key);
+				if (it == batches_.end())
+					it = batches_.emplace(key, Batch{ pending.arrival + window_,std::vector<Pending>{} }).first;
+				it->second.requests.emplace_back(std::move(pending));
+			}
+			changed_.notify_all();
+		}
+
+		std::future<PricingResponse> submit(PricingRequest const &request) {
+			auto promise = std::make_shared<std::promise<PricingResponse>>();
+			auto future = promise->get_future();
+			submit(request, [promise](PricingResponse const &response) {promise->set_value(response); });
+			return future;
+		}
+	};
+
+
+#if !defined(_WIN32)
+
+#if defined(MSG_NOSIGNAL)
+	static constexpr int sendFlags = MSG_NOSIGNAL;
+#else
+	static constexpr int sendFlags = 0;
+#endif
+
+	namespace detail {
+
+		inline bool sendAll(int fd, std::string const &bytes) {
+			std::size_t sent{ 0 };
+			while (sent < bytes.size()) {
+				ssize_t const n = ::send(fd, bytes.data() + sent, bytes.size() - sent, sendFlags);
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n <= 0)
+					return false;
+				sent += static_cast<std::size_t>(n);
+			}
+			return true;
+		}
+
+		inline sockaddr_un socketAddress(std::string const &path) {
+			sockaddr_un address;
+			std::memset(&address, 0, sizeof(address));
+			address.sun_family = AF_UNIX;
+			if (path.size() >= sizeof(address.sun_path))
+				throw std::invalid_argument("Socket path " + path + " is too long.");
+			std::memcpy(address.sun_path, path.c_str(), path.size());
+			return address;
+		}
+	}
+
+
+	// Serves a pricing service on a Unix domain socket, one line per request and
+	// per response; responses come back in completion order, matched by id.
+	// The server must be stopped (or destroyed) before the service.
+	template<typename T = double>
+	class UnixSocketServer {
+	private:
+		struct Connection {
+			int fd;
+			std::mutex writeMutex;
+
+			explicit Connection(int fd) :fd{ fd } {}
+			~Connection() { ::close(fd); }
+
+			void write(std::string const &line) {
+				std::lock_guard<std::mutex> lock(writeMutex);
+				detail::sendAll(fd, line);
+			}
+		};
+
+		PricingService<T> &service_;
+		std::string path_;
+		int listener_{ -1 };
+		std::thread acceptor_;
+		std::vector<std::pair<std::thread, std::shared_ptr<std::atomic<bool>>>> readers_;
+		std::vector<std::weak_ptr<Connection>> connections_;
+		std::mutex mutex_;
+		bool running_{ false };
+
+		void serve(std::shared_ptr<Connection> connection, std::shared_ptr<std::atomic<bool>> done) {
+			read(connection);
+			*done = true;
+		}
+
+		void read(std::shared_ptr<Connection> const &connection) {
+			std::string buffer;
+			char chunk[4096];
+			for (;;) {
+				ssize_t const n = ::recv(connection->fd, chunk, sizeof(chunk), 0);
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n <= 0)
+					return;
+				buffer.append(chunk, static_cast<std::size_t>(n));
+				std::size_t end;
+				while ((end = buffer.find('\n')) != std::string::npos) {
+					std::string const line = buffer.substr(0, end);
+					buffer.erase(0, end + 1);
+					if (line.find_first_not_of(" \t\r") == std::string::npos)
+						continue;
+					try {
+						service_.submit(parseRequest(line), [connection](PricingResponse const &response) {
+							connection->write(formatResponse(response));
+						});
+					}
+					catch (std::exception const &e) {
+						PricingResponse response;
+						std::istringstream{ line } >> response.id;
+						response.message = e.what();
+						connection->write(formatResponse(response));
+					}
+				}
+			}
+		}
+
+		void accept() {
+			for (;;) {
+				int const fd = ::accept(listener_, nullptr, nullptr);
+				if (fd < 0) {
+					if (errno == EINTR)
+						continue;
+					return;
+				}
+				auto connection = std::make_shared<Connection>(fd);
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (!running_)
+					return;
+				// join readers of closed connections
+				for (auto it = readers_.begin(); it != readers_.end();) {
+					if (*(it->second)) {
+						it->first.join();
+						it = readers_.erase(it);
+					}
+					else
+						++it;
+				}
+				connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+					[](std::weak_ptr<Connection> const &weak) {return weak.expired(); }), connections_.end());
+				connections_.emplace_back(connection);
+				auto done = std::make_shared<std::atomic<bool>>(false);
+				readers_.emplace_back(std::thread{ &UnixSocketServer::serve, this, connection, done }, done);
+			}
+		}
+
+	public:
+		UnixSocketServer(PricingService<T> &service, std::string const &path)
+			:service_{ service }, path_{ path } {}
+
+		~UnixSocketServer() { stop(); }
+
+		UnixSocketServer(UnixSocketServer const &) = delete;
+		UnixSocketServer &operator=(UnixSocketServer const &) = delete;
+
+		inline std::string const &path()const { return path_; }
+
+		void start() {
+			auto const address = detail::socketAddress(path_);
+			::unlink(path_.c_str());
+			listener_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (listener_ < 0)
+				throw std::runtime_error("Cannot create socket.");
+			if (::bind(listener_, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) != 0 ||
+				::listen(listener_, 128) != 0) {
+				::close(listener_);
+				listener_ = -1;
+				throw std::runtime_error("Cannot listen on " + path_ + ".");
+			}
+			running_ = true;
+			acceptor_ = std::thread{ &UnixSocketServer::accept, this };
+		}
+
+		void stop() {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (!running_)
+					return;
+				running_ = false;
+				for (auto const &weak : connections_) {
+					if (auto connection = weak.lock())
+						::shutdown(connection->fd, SHUT_RDWR);
+				}
+			}
+			::shutdown(listener_, SHUT_RDWR);
+			::close(listener_);
+			acceptor_.join();
+			for (auto &reader : readers_)
+				reader.first.join();
+			readers_.clear();
+			connections_.clear();
+			::unlink(path_.c_str());
+		}
+	};
+
+
+	// Blocking client of UnixSocketServer
+	class UnixSocketClient {
+	private:
+		int fd_{ -1 };
+		std::string buffer_;
+
+	public:
+		explicit UnixSocketClient(std::string const &path) {
+			auto const address = detail::socketAddress(path);
+			fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) != 0) {
+				if (fd_ >= 0)
+					::close(fd_);
+				throw std::runtime_error("Cannot connect to " + path + ".");
+			}
+		}
+
+		~UnixSocketClient() { ::close(fd_); }
+
+		UnixSocketClient(UnixSocketClient const &) = delete;
+		UnixSocketClient &operator=(UnixSocketClient const &) = delete;
+
+		void send(std::string const &line) {
+			if (!detail::sendAll(fd_, line + "\n"))
+				throw std::runtime_error("Sending request failed.");
+		}
+
+		// next response line (without the newline)
+		std::string receive() {
+			std::size_t end;
+			while ((end = buffer_.find('\n')) == std::string::npos) {
+				char chunk[4096];
+				ssize_t const n = ::recv(fd_, chunk, sizeof(chunk), 0);
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n <= 0)
+					throw std::runtime_error("Connection closed.");
+				buffer_.append(chunk, static_cast<std::size_t>(n));
+			}
+			std::string const line = buffer_.substr(0, end);
+			buffer_.erase(0, end + 1);
+			return line;
+		}
+
+		inline std::string call(std::string const &line) {
+			send(line);
+			return receive();
+		}
+	};
+
+#endif
+
+}
+
+
+
+#endif ///_PRICING_SERVICE_H_
@@ -0,0 +1,79 @@
+#pragma once
+#if !defined(_RANDOM_VARIATES_H_)
+#define _RANDOM_VARIATES_H_
+
+#include<random>
+#include<cmath>
+#include<type_traits>
+
+namespace random_variates {
+
+	// Gamma(shape,1) variates by Marsaglia-Tsang squeeze method,
+	// shape < 1 is boosted by U^(1/shape)
+	template<typename T = double,
+		typename = typename std::enable_if<std::is_floating_point<T>::value>::type>
+	class GammaSampler {
+	private:
+		std::normal_distribution<T> normal_;
+		std::uniform_real_distribution<T> uniform_;
+
+	public:
+		template<typename Engine>
+		T operator()(T shape, Engine &engine) {
+			if (shape < static_cast<T>(1.0)) {
+				T const u = uniform_(engine);
+				return ((*this)(shape + static_cast<T>(1.0), engine) * std::pow(u, static_cast<T>(1.0) / shape));
+			}
+			T const d = shape - static_cast<T>(1.0 / 3.0);
+			T const c = static_cast<T>(1.0) / std::sqrt(static_cast<T>(9.0) * d);
+			for (;;) {
+				T x{};
+				T v{};
+				do {
+					x = normal_(engine);
+					v = static_cast<T>(1.0) + c * x;
+				} while (v <= static_cast<T>(0.0));
+				v = v * v * v;
+				T const u = uniform_(engine);
+				if (u < static_cast<T>(1.0) - static_cast<T>(0.0331) * x * x * x * x)
+					return (d * v);
+				if (std::log(u) < static_cast<T>(0.5) * x * x + d * (static_cast<T>(1.0) - v + std::log(v)))
+					return (d * v);
+			}
+		}
+	};
+
+	// Non-central chi-square variates with degrees of freedom df and
+	// non-centrality lambda.
+	// df > 1: (Z + sqrt(lambda))^2 + chi2(df-1), Z may be supplied by the caller
+	// df <= 1: Poisson mixture chi2(df + 2N), N ~ Poisson(lambda/2)
+	template<typename T = double,
+		typename = typename std::enable_if<std::is_floating_point<T>::value>::type>
+	class NonCentralChiSquared {
+	private:
+		GammaSampler<T> gamma_;
+		std::normal_distribution<T> normal_;
+
+	public:
+		template<typename Engine>
+		T operator()(T df, T lambda, T z, Engine &engine) {
+			if (df > static_cast<T>(1.0)) {
+				T const central = z + std::sqrt(lambda);
+				return (central * central + static_cast<T>(2.0) * gamma_(static_cast<T>(0.5) * (df - static_cast<T>(1.0)), engine));
+			}
+			std::poisson_distribution<long> poisson(static_cast<double>(0.5 * lambda));
+			auto const n = poisson(engine);
+			return (static_cast<T>(2.0) * gamma_(static_cast<T>(0.5) * df + static_cast<T>(n), engine));
+		}
+
+		template<typename Engine>
+		T operator()(T df, T lambda, Engine &engine) {
+			return (*this)(df, lambda, normal_(engine), engine);
+		}
+	};
+
+}
+
+
+
+#endif ///_RANDOM_VARIATES_H_
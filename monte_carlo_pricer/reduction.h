@@ -0,0 +1,182 @@
+#pragma once
+#if !defined(_REDUCTION_H_)
+#define _REDUCTION_H_
+
+#include"mc_utilities.h"
+#include<vector>
+#include<memory>
+#include<atomic>
+#include<utility>
+#include<algorithm>
+#include<type_traits>
+
+namespace reduction {
+
+	// Paths per leaf of a reduction tree. Fixed, so that a reduced result
+	// depends on the seed and the path count only, never on threads, nodes,
+	// scheduling or chunking.
+	static constexpr std::size_t reductionBlockSize = 4096;
+
+	// All reductions below share one tree shape over the leaves (block results
+	// in block order): neighbouring pairs are merged level by level, an odd
+	// last node moving up unmerged, and merge(into,from) always takes the left
+	// node as into. The shape depends on the number of leaves only, so the same
+	// leaves give bit-identical results on any host.
+
+
+	// Reduces leaves by the tree
+	template<typename Result, typename Merge>
+	Result treeReduce(std::vector<Result> leaves, Merge &&merge) {
+		if (leaves.empty())
+			return Result{};
+		while (leaves.size() > 1) {
+			std::size_t const pairs = leaves.size() / 2;
+			for (std::size_t p = 0; p < pairs; ++p) {
+				merge(leaves[2 * p], leaves[2 * p + 1]);
+				if (p > 0)
+					leaves[p] = std::move(leaves[2 * p]);
+			}
+			if (leaves.size() % 2 == 1)
+				leaves[pairs] = std::move(leaves.back());
+			leaves.resize((leaves.size() + 1) / 2);
+		}
+		return std::move(leaves.front());
+	}
+
+
+	// The tree filled concurrently: leaves are submitted in any order from any
+	// thread, and whichever child arrives second merges both into their parent,
+	// so the tree is built while blocks are still running and without a lock.
+	// result() is valid once every leaf has been submitted and the submitting
+	// threads have been joined.
+	template<typename Result, typename Merge>
+	class BlockTree {
+	private:
+		Merge merge_;
+		std::vector<std::vector<Result>> levels_;
+		// arrivals_[k][p]: children of node p of level k already in
+		std::vector<std::unique_ptr<std::atomic<unsigned char>[]>> arrivals_;
+
+	public:
+		BlockTree(std::size_t leaves, Merge merge) :merge_{ std::move(merge) } {
+			levels_.emplace_back(std::max<std::size_t>(1, leaves));
+			arrivals_.emplace_back(nullptr);
+			while (levels_.back().size() > 1) {
+				std::size_t const size = (levels_.back().size() + 1) / 2;
+				levels_.emplace_back(size);
+				arrivals_.emplace_back(new std::atomic<unsigned char>[size]);
+				for (std::size_t p = 0; p < size; ++p)
+					arrivals_.back()[p].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		BlockTree(BlockTree const &) = delete;
+		BlockTree &operator=(BlockTree const &) = delete;
+
+		inline std::size_t leafCount()const { return levels_.front().size(); }
+
+		void submit(std::size_t leaf, Result result) {
+			std::size_t p = leaf;
+			levels_[0][p] = std::move(result);
+			for (std::size_t k = 0; k + 1 < levels_.size(); ++k) {
+				std::size_t const parent = p / 2;
+				if ((p ^ 1) < levels_[k].size()) {
+					// the first child in leaves the merge to its sibling
+					if (arrivals_[k + 1][parent].fetch_add(1, std::memory_order_acq_rel) == 0)
+						return;
+					levels_[k + 1][parent] = std::move(levels_[k][2 * parent]);
+					merge_(levels_[k + 1][parent], levels_[k][2 * parent + 1]);
+				}
+				else {
+					levels_[k + 1][parent] = std::move(levels_[k][p]);
+				}
+				p = parent;
+			}
+		}
+
+		inline Result const &result()const { return levels_.back().front(); }
+	};
+
+
+	// The tree filled by a stream: leaves come in order and value() reduces
+	// those so far, equal to treeReduce() over them (a binary counter of
+	// complete subtrees, at most one per level).
+	template<typename Result, typename Merge>
+	class StreamingTree {
+	private:
+		Merge merge_;
+		std::vector<Result> subtrees_;		// subtrees_[k] covers 2^k leaves
+		std::vector<unsigned char> present_;
+		std::size_t leaves_{ 0 };
+
+	public:
+		explicit StreamingTree(Merge merge) :merge_{ std::move(merge) } {}
+
+		inline std::size_t leafCount()const { return leaves_; }
+
+		void add(Result leaf) {
+			std::size_t k = 0;
+			for (; k < present_.size() && present_[k]; ++k) {
+				merge_(subtrees_[k], leaf);
+				leaf = std::move(subtrees_[k]);
+				present_[k] = 0;
+			}
+			if (k == present_.size()) {
+				subtrees_.emplace_back();
+				present_.emplace_back(0);
+			}
+			subtrees_[k] = std::move(leaf);
+			present_[k] = 1;
+			++leaves_;
+		}
+
+		// Reduction of the leaves so far
+		Result value()const {
+			Result result{};
+			bool any{ false };
+			for (std::size_t k = 0; k < subtrees_.size(); ++k) {
+				if (!present_[k])
+					continue;
+				if (any) {
+					Result left = subtrees_[k];
+					merge_(left, result);
+					result = std::move(left);
+				}
+				else {
+					result = subtrees_[k];
+					any = true;
+				}
+			}
+			return result;
+		}
+
+		// Reduction of the leaves so far followed by one more, not kept
+		Result valueWith(Result const &last)const {
+			StreamingTree copy{ *this };
+			copy.add(last);
+			return copy.value();
+		}
+	};
+
+
+	// blockFun(first,size) over blocks of blockSize covering [0,count) on
+	// hardware threads, reduced by the tree as the blocks finish
+	template<typename Result, typename BlockFun, typename Merge>
+	Result reduceBlocks(std::size_t count, std::size_t blockSize, BlockFun &&blockFun, Merge &&merge) {
+		blockSize = std::max<std::size_t>(1, blockSize);
+		std::size_t const blocks = (count + blockSize - 1) / blockSize;
+		if (blocks == 0)
+			return Result{};
+		BlockTree<Result, typename std::decay<Merge>::type> tree(blocks, std::forward<Merge>(merge));
+		mc_utilities::parallelFor(blocks, [&](std::size_t b) {
+			std::size_t const first = b * blockSize;
+			tree.submit(b, blockFun(first, std::min(blockSize, count - first)));
+		});
+		return tree.result();
+	}
+
+}
+
+
+
+#endif ///_REDUCTION_H_
@@ -3,11 +3,49 @@
 #define _SDE_H_
 
 #include"mc_types.h"
+#include"term_structure.h"
+#include<memory>
+#include<cmath>
+#include<random>
 
 namespace sde {
 
 	using mc_types::ISde;
 	using mc_types::SdeComponent;
+	using term_structure::SeparableCoefficients;
+
+	// Compound Poisson jump component with log-normally distributed jump sizes.
+	// At every jump the factor is multiplied by exp(Y), Y ~ N(jumpMean,jumpStdev^2).
+	template<typename T>
+	class JumpProcess {
+	private:
+		T intensity_;
+		T jumpMean_;
+		T jumpStdev_;
+
+	public:
+		JumpProcess(T intensity, T jumpMean, T jumpStdev)
+			:intensity_{ intensity }, jumpMean_{ jumpMean }, jumpStdev_{ jumpStdev } {}
+
+		inline T intensity()const { return intensity_; }
+		inline T jumpMean()const { return jumpMean_; }
+		inline T jumpStdev()const { return jumpStdev_; }
+
+		// E[exp(Y)] - 1, used by the builders to compensate the drift
+		inline T compensator()const {
+			return std::exp(jumpMean_ + static_cast<T>(0.5) * jumpStdev_ * jumpStdev_) - static_cast<T>(1.0);
+		}
+	};
+
+	// Exact transition law of a one-dimensional factor over [time,time+dt].
+	// z is the (already correlated) standard normal of the step, Gaussian
+	// transitions use it directly so that correlation with other factors is kept.
+	template<typename T>
+	class ExactTransition {
+	public:
+		virtual ~ExactTransition() {}
+		virtual T sample(T time, T dt, T state, T z, std::mt19937 &engine)const = 0;
+	};
 
 	template<typename T,typename ...Ts>
 	class Sde {
@@ -15,18 +53,49 @@ namespace sde {
 		T initCond_;
 		SdeComponent<T,Ts...> drift_;
 		SdeComponent<T,Ts...> diffusion_;
+		std::shared_ptr<JumpProcess<T>> jumps_;
+		std::shared_ptr<SeparableCoefficients<T>> coefficients_;
+		std::shared_ptr<ExactTransition<T>> transition_;
 
 	public:
 		Sde(ISde<T,Ts...> const &sdeComponents,  T const &initialCondition = 0.0)
 			:drift_{ std::get<0>(sdeComponents) }, diffusion_{ std::get<1>(sdeComponents) },
 			initCond_{ initialCondition } {}
 
+		Sde(ISde<T, Ts...> const &sdeComponents, T const &initialCondition,
+			std::shared_ptr<JumpProcess<T>> const &jumps)
+			:initCond_{ initialCondition }, drift_{ std::get<0>(sdeComponents) },
+			diffusion_{ std::get<1>(sdeComponents) }, jumps_{ jumps } {}
+
+		Sde(ISde<T, Ts...> const &sdeComponents, T const &initialCondition,
+			std::shared_ptr<SeparableCoefficients<T>> const &coefficients)
+			:initCond_{ initialCondition }, drift_{ std::get<0>(sdeComponents) },
+			diffusion_{ std::get<1>(sdeComponents) }, coefficients_{ coefficients } {}
+
+		Sde(ISde<T, Ts...> const &sdeComponents, T const &initialCondition,
+			std::shared_ptr<ExactTransition<T>> const &transition)
+			:initCond_{ initialCondition }, drift_{ std::get<0>(sdeComponents) },
+			diffusion_{ std::get<1>(sdeComponents) }, transition_{ transition } {}
+
 		Sde(Sde<T,Ts...> const &copy)
 			:drift_{ copy.drift_ }, diffusion_{ copy.diffusion_ },
-			initCond_{ copy.initCond_ } {}
+			initCond_{ copy.initCond_ }, jumps_{ copy.jumps_ },
+			coefficients_{ copy.coefficients_ }, transition_{ copy.transition_ } {}
 
 		inline T initCondition()const { return initCond_; }
 
+		inline bool hasJumps()const { return (jumps_ != nullptr); }
+		inline std::shared_ptr<JumpProcess<T>> const &jumps()const { return jumps_; }
+
+		// time-dependent models expose separable coefficients so that the engine
+		// can integrate the time parts once per grid instead of once per step
+		inline bool hasStepCoefficients()const { return (coefficients_ != nullptr); }
+		inline std::shared_ptr<SeparableCoefficients<T>> const &coefficients()const { return coefficients_; }
+
+		// models with known transition law are stepped exactly by all schemes
+		inline bool hasExactTransition()const { return (transition_ != nullptr); }
+		inline std::shared_ptr<ExactTransition<T>> const &transition()const { return transition_; }
+
 		T drift(Ts...args)const {
 			return drift_(args...);
 		}
@@ -3,6 +3,9 @@
 #define _SDE_BUILDER_H_
 
 #include"sde.h"
+#include"random_variates.h"
+#include"fast_math.h"
+#include"mc_utilities.h"
 #include<memory>
 
 namespace sde_builder {
@@ -10,6 +13,11 @@ namespace sde_builder {
 	using mc_types::SdeComponent;
 	using mc_types::ISde;
 	using sde::Sde;
+	using sde::JumpProcess;
+	using sde::ExactTransition;
+	using mc_types::MathAccuracy;
+	using term_structure::ParameterCurve;
+	using term_structure::SeparableCoefficients;
 	using mc_types::SdeModelType;
 
 
@@ -23,6 +31,16 @@ namespace sde_builder {
 	public:
 		virtual ~SdeBuilder(){}
 		virtual inline  std::string name()const = 0;
+		// all parameters in constructor order, curves by ParameterCurve::appendTo
+		virtual std::vector<T> parameters()const = 0;
+		// hash of everything that shapes the paths of the model: name, parameters()
+		// and settings beyond them, which models holding such mix in
+		virtual std::uint64_t fingerprint()const {
+			mc_utilities::Fingerprint fingerprint;
+			fingerprint.mix(name());
+			fingerprint.mix(parameters());
+			return fingerprint.value();
+		}
 		virtual SdeComponent<T, Ts...> drift()const = 0;
 		virtual SdeComponent<T, Ts...> diffusion()const = 0;
 		virtual std::shared_ptr<Sde<T, Ts...>> model()const = 0;
@@ -36,6 +54,16 @@ namespace sde_builder {
 	public:
 		virtual ~SdeBuilder() {}
 		virtual  inline std::string name()const = 0;
+		// all parameters in constructor order, curves by ParameterCurve::appendTo
+		virtual std::vector<T> parameters()const = 0;
+		// hash of everything that shapes the paths of the model: name, parameters()
+		// and settings beyond them, which models holding such mix in
+		virtual std::uint64_t fingerprint()const {
+			mc_utilities::Fingerprint fingerprint;
+			fingerprint.mix(name());
+			fingerprint.mix(parameters());
+			return fingerprint.value();
+		}
 		virtual  SdeComponent<T, Ts...> drift1()const = 0;
 		virtual  SdeComponent<T, Ts...> diffusion1()const = 0;
 		virtual  SdeComponent<T, Ts...> drift2() const = 0;
@@ -48,6 +76,59 @@ namespace sde_builder {
 
 
 
+	// Exact Gaussian transition of Hull-White short rate
+	// dr = (theta(t) - kappa r) dt + sigma dW.
+	// theta is taken at the middle of the step, which is exact
+	// whenever the nodes of piecewise-constant theta lie on the time grid.
+	template<typename T>
+	class HullWhiteTransition :public ExactTransition<T> {
+	private:
+		T kappa_;
+		T sigma_;
+		std::shared_ptr<ParameterCurve<T>> theta_;
+
+	public:
+		HullWhiteTransition(T kappa, T sigma, std::shared_ptr<ParameterCurve<T>> const &theta)
+			:kappa_{ kappa }, sigma_{ sigma }, theta_{ theta } {}
+
+		T sample(T time, T dt, T state, T z, std::mt19937 &)const override {
+			T const theta = theta_->value(time + static_cast<T>(0.5) * dt);
+			if (std::abs(kappa_ * dt) < static_cast<T>(1.0e-8)) {
+				return (state + theta * dt + sigma_ * std::sqrt(dt) * z);
+			}
+			T const decay = std::exp(-kappa_ * dt);
+			T const mean = state * decay + theta * (static_cast<T>(1.0) - decay) / kappa_;
+			T const variance = sigma_ * sigma_ * (static_cast<T>(1.0) - decay * decay) / (static_cast<T>(2.0) * kappa_);
+			return (mean + std::sqrt(variance) * z);
+		}
+	};
+
+	// Exact non-central chi-square transition of Cox-Ingersoll-Ross short rate
+	// dr = kappa (theta - r) dt + sigma sqrt(r) dW
+	template<typename T>
+	class CoxIngersollRossTransition :public ExactTransition<T> {
+	private:
+		T kappa_;
+		T theta_;
+		T sigma_;
+
+	public:
+		CoxIngersollRossTransition(T kappa, T theta, T sigma)
+			:kappa_{ kappa }, theta_{ theta }, sigma_{ sigma } {}
+
+		T sample(T, T dt, T state, T z, std::mt19937 &engine)const override {
+			T const decay = std::exp(-kappa_ * dt);
+			// (1 - exp(-kappa dt))/kappa, tending to dt as kappa -> 0
+			T const horizon = (std::abs(kappa_ * dt) < static_cast<T>(1.0e-8)) ? dt : -std::expm1(-kappa_ * dt) / kappa_;
+			T const c = sigma_ * sigma_ * horizon / static_cast<T>(4.0);
+			T const df = static_cast<T>(4.0) * kappa_ * theta_ / (sigma_ * sigma_);
+			T const lambda = std::max(state, static_cast<T>(0.0)) * decay / c;
+			random_variates::NonCentralChiSquared<T> chiSquared;
+			return (c * chiSquared(df, lambda, z, engine));
+		}
+	};
+
+
 	template<typename T = double,
 				typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
 	class GeometricBrownianMotion: public SdeBuilder<1, T, T, T> {
@@ -55,21 +136,31 @@ namespace sde_builder {
 		T mu_;
 		T sigma_;
 		T init_;
+		// optional term structures of mu and sigma:
+		std::shared_ptr<ParameterCurve<T>> muCurve_;
+		std::shared_ptr<ParameterCurve<T>> sigmaCurve_;
 
 	public:
 		GeometricBrownianMotion(T mu,T sigma,T initialCondition)
 			:mu_{ mu }, sigma_{ sigma }, init_{initialCondition} {}
+		GeometricBrownianMotion(ParameterCurve<T> const &mu, ParameterCurve<T> const &sigma, T initialCondition)
+			:mu_{ mu.value(0.0) }, sigma_{ sigma.value(0.0) }, init_{ initialCondition },
+			muCurve_{ std::make_shared<ParameterCurve<T>>(mu) },
+			sigmaCurve_{ std::make_shared<ParameterCurve<T>>(sigma) } {}
 		GeometricBrownianMotion()
 			:GeometricBrownianMotion{ 0.0,1.0,1.0 } {}
 
 		GeometricBrownianMotion(GeometricBrownianMotion<T> const &copy)
-			:mu_{copy.mu_},sigma_{copy.sigma_},init_{copy.init_}{}
+			:mu_{copy.mu_},sigma_{copy.sigma_},init_{copy.init_},
+			muCurve_{copy.muCurve_},sigmaCurve_{copy.sigmaCurve_}{}
 
 		GeometricBrownianMotion& operator=(GeometricBrownianMotion<T> const &copy) {
 			if (this != &copy) {
 				mu_ = copy.mu_;
 				sigma_ = copy.sigma_;
 				init_ = copy.init_;
+				muCurve_ = copy.muCurve_;
+				sigmaCurve_ = copy.sigmaCurve_;
 			}
 			return *this;
 		}
@@ -77,16 +168,39 @@ namespace sde_builder {
 		inline T const &mu()const { return mu_; }
 		inline T const &sigma()const { return sigma_; }
 		inline T const &init()const { return init_; }
+		inline bool isTimeDependent()const { return (muCurve_ != nullptr); }
+		inline std::shared_ptr<ParameterCurve<T>> const &muCurve()const { return muCurve_; }
+		inline std::shared_ptr<ParameterCurve<T>> const &sigmaCurve()const { return sigmaCurve_; }
 
 		inline std::string name() const override { return std::string{ "Geometric Brownian Motion" }; }
+		inline std::vector<T> parameters() const override {
+			std::vector<T> parameters{ mu_, sigma_, init_ };
+			if (isTimeDependent()) {
+				muCurve_->appendTo(parameters);
+				sigmaCurve_->appendTo(parameters);
+			}
+			return parameters;
+		}
 		
 		SdeComponent<T,T,T> drift()const override{
+			if (isTimeDependent()) {
+				auto curve = muCurve_;
+				return [curve](T time, T underlyingPrice) {
+					return curve->value(time) * underlyingPrice;
+				};
+			}
 			return [this](T time,T underlyingPrice) {
 				return mu_ * underlyingPrice;
 			};
 		}
 
 		SdeComponent<T,T,T> diffusion()const override {
+			if (isTimeDependent()) {
+				auto curve = sigmaCurve_;
+				return [curve](T time, T underlyingPrice) {
+					return curve->value(time) * underlyingPrice;
+				};
+			}
 			return [this](T time,T underlyingPrice) {
 				return sigma_ * underlyingPrice;
 			};
@@ -96,6 +210,13 @@ namespace sde_builder {
 			auto drift = this->drift();
 			auto diff = this->diffusion();
 			ISde<T,T,T> modelPair = std::make_tuple(drift, diff);
+			if (isTimeDependent()) {
+				auto driftState = [](T underlyingPrice) { return underlyingPrice; };
+				auto diffusionState = [](T underlyingPrice) { return underlyingPrice; };
+				auto coefficients = std::make_shared<SeparableCoefficients<T>>(*muCurve_, driftState,
+					*sigmaCurve_, diffusionState);
+				return std::shared_ptr<Sde<T,T,T>>{ new Sde<T,T,T>{ modelPair,init_,coefficients } };
+			}
 			return std::shared_ptr<Sde<T,T,T>>{ new Sde<T,T,T>{ modelPair,init_} };
 		}
 
@@ -109,21 +230,31 @@ namespace sde_builder {
 		T mu_;
 		T sigma_;
 		T init_;
+		// optional term structures of mu and sigma:
+		std::shared_ptr<ParameterCurve<T>> muCurve_;
+		std::shared_ptr<ParameterCurve<T>> sigmaCurve_;
 
 	public:
 		ArithmeticBrownianMotion(T mu, T sigma, T initialCondition)
 			:mu_{ mu }, sigma_{ sigma }, init_{ initialCondition } {}
+		ArithmeticBrownianMotion(ParameterCurve<T> const &mu, ParameterCurve<T> const &sigma, T initialCondition)
+			:mu_{ mu.value(0.0) }, sigma_{ sigma.value(0.0) }, init_{ initialCondition },
+			muCurve_{ std::make_shared<ParameterCurve<T>>(mu) },
+			sigmaCurve_{ std::make_shared<ParameterCurve<T>>(sigma) } {}
 		ArithmeticBrownianMotion()
 			:ArithmeticBrownianMotion{ 0.0,1.0,1.0 } {}
 
 		ArithmeticBrownianMotion(ArithmeticBrownianMotion<T> const &copy)
-			:mu_{ copy.mu_ }, sigma_{ copy.sigma_ }, init_{ copy.init_ } {}
+			:mu_{ copy.mu_ }, sigma_{ copy.sigma_ }, init_{ copy.init_ },
+			muCurve_{ copy.muCurve_ }, sigmaCurve_{ copy.sigmaCurve_ } {}
 
 		ArithmeticBrownianMotion& operator=(ArithmeticBrownianMotion<T> const &copy) {
 			if (this != &copy) {
 				mu_ = copy.mu_;
 				sigma_ = copy.sigma_;
 				init_ = copy.init_;
+				muCurve_ = copy.muCurve_;
+				sigmaCurve_ = copy.sigmaCurve_;
 			}
 			return *this;
 		}
@@ -131,16 +262,39 @@ namespace sde_builder {
 		inline T const &mu()const { return mu_; }
 		inline T const &sigma()const { return sigma_; }
 		inline T const &init()const { return init_; }
+		inline bool isTimeDependent()const { return (muCurve_ != nullptr); }
+		inline std::shared_ptr<ParameterCurve<T>> const &muCurve()const { return muCurve_; }
+		inline std::shared_ptr<ParameterCurve<T>> const &sigmaCurve()const { return sigmaCurve_; }
 
 		inline std::string name() const override { return std::string{ "Arithmetic Brownian Motion" }; }
+		inline std::vector<T> parameters() const override {
+			std::vector<T> parameters{ mu_, sigma_, init_ };
+			if (isTimeDependent()) {
+				muCurve_->appendTo(parameters);
+				sigmaCurve_->appendTo(parameters);
+			}
+			return parameters;
+		}
 
 		SdeComponent<T,T,T> drift()const override {
+			if (isTimeDependent()) {
+				auto curve = muCurve_;
+				return [curve](T time, T underlyingPrice) {
+					return curve->value(time);
+				};
+			}
 			return [this](T time,T underlyingPrice) {
 				return mu_;
 			};
 		}
 
 		SdeComponent<T,T,T> diffusion()const override {
+			if (isTimeDependent()) {
+				auto curve = sigmaCurve_;
+				return [curve](T time, T underlyingPrice) {
+					return curve->value(time);
+				};
+			}
 			return [this](T time,T underlyingPrice) {
 				return sigma_;
 			};
@@ -150,6 +304,13 @@ namespace sde_builder {
 			auto drift = this->drift();
 			auto diff = this->diffusion();
 			ISde<T,T,T> modelPair = std::make_tuple(drift, diff);
+			if (isTimeDependent()) {
+				auto driftState = [](T underlyingPrice) { return static_cast<T>(1.0); };
+				auto diffusionState = [](T underlyingPrice) { return static_cast<T>(1.0); };
+				auto coefficients = std::make_shared<SeparableCoefficients<T>>(*muCurve_, driftState,
+					*sigmaCurve_, diffusionState);
+				return std::shared_ptr<Sde<T,T,T>>{ new Sde<T,T,T>{ modelPair,init_,coefficients } };
+			}
 			return std::shared_ptr<Sde<T,T,T>>{ new Sde<T,T,T>{ modelPair,init_ } };
 		}
 	};
@@ -162,18 +323,67 @@ namespace sde_builder {
 		T mu_;
 		T sigma_;
 		T init_;
+		// optional term structures of mu and sigma:
+		std::shared_ptr<ParameterCurve<T>> muCurve_;
+		std::shared_ptr<ParameterCurve<T>> sigmaCurve_;
+		MathAccuracy accuracy_{ MathAccuracy::Libm };
+
+		// x^beta evaluated as exp(beta*log(x)) by fast_math (std::pow for Libm)
+		template<MathAccuracy Accuracy>
+		static std::function<T(T)> power(T beta) {
+			return [beta](T underlyingPrice) {
+				return fast_math::pow<Accuracy>(underlyingPrice, beta);
+			};
+		}
+
+		std::function<T(T)> power()const {
+			switch (accuracy_) {
+			case MathAccuracy::Precise:
+				return power<MathAccuracy::Precise>(beta_);
+			case MathAccuracy::Fast:
+				return power<MathAccuracy::Fast>(beta_);
+			default:
+				return power<MathAccuracy::Libm>(beta_);
+			}
+		}
+
+		// x^beta over a block of states by the fast_math array kernel
+		template<MathAccuracy Accuracy>
+		static std::function<void(T const*, T*, std::size_t)> powers(T beta) {
+			return [beta](T const *underlyingPrices, T *result, std::size_t size) {
+				fast_math::pow<Accuracy>(underlyingPrices, beta, result, size);
+			};
+		}
+
+		std::function<void(T const*, T*, std::size_t)> powers()const {
+			switch (accuracy_) {
+			case MathAccuracy::Precise:
+				return powers<MathAccuracy::Precise>(beta_);
+			case MathAccuracy::Fast:
+				return powers<MathAccuracy::Fast>(beta_);
+			default:
+				return powers<MathAccuracy::Libm>(beta_);
+			}
+		}
 
 	public:
 		ConstantElasticityVariance(T mu, T sigma,T beta, T initialCondition)
 			:mu_{ mu }, sigma_{ sigma }, beta_{beta}, init_ {
 			initialCondition
 		} {}
+		ConstantElasticityVariance(ParameterCurve<T> const &mu, ParameterCurve<T> const &sigma,
+			T beta, T initialCondition)
+			:mu_{ mu.value(0.0) }, sigma_{ sigma.value(0.0) }, beta_{ beta }, init_{ initialCondition },
+			muCurve_{ std::make_shared<ParameterCurve<T>>(mu) },
+			sigmaCurve_{ std::make_shared<ParameterCurve<T>>(sigma) } {}
 		ConstantElasticityVariance()
 			:ConstantElasticityVariance{ 0.0,1.0,0.5,1.0 } {}
 
 		ConstantElasticityVariance(ConstantElasticityVariance<T> const &copy)
 			:mu_{ copy.mu_ }, sigma_{ copy.sigma_ }, beta_{copy.beta_}, 
-			init_ {copy.init_} {}
+			init_ {copy.init_},
+			muCurve_{ copy.muCurve_ }, sigmaCurve_{ copy.sigmaCurve_ },
+			accuracy_{ copy.accuracy_ } {}
 
 		ConstantElasticityVariance& operator=(ConstantElasticityVariance<T> const &copy) {
 			if (this != &copy) {
@@ -181,6 +391,9 @@ namespace sde_builder {
 				sigma_ = copy.sigma_;
 				beta_ = copy.beta_;
 				init_ = copy.init_;
+				muCurve_ = copy.muCurve_;
+				sigmaCurve_ = copy.sigmaCurve_;
+				accuracy_ = copy.accuracy_;
 			}
 			return *this;
 		}
@@ -188,27 +401,146 @@ namespace sde_builder {
 		inline T const &mu()const { return mu_; }
 		inline T const &sigma()const { return sigma_; }
 		inline T const &init()const { return init_; }
+		inline bool isTimeDependent()const { return (muCurve_ != nullptr); }
+		inline std::shared_ptr<ParameterCurve<T>> const &muCurve()const { return muCurve_; }
+		inline std::shared_ptr<ParameterCurve<T>> const &sigmaCurve()const { return sigmaCurve_; }
 		inline T const &beta()const { return beta_; }
 
+		// accuracy of the math layer used for x^beta
+		inline void setMathAccuracy(MathAccuracy accuracy) { accuracy_ = accuracy; }
+		inline MathAccuracy mathAccuracy()const { return accuracy_; }
+
+		std::uint64_t fingerprint()const override {
+			mc_utilities::Fingerprint fingerprint{ SdeBuilder<1, T, T, T>::fingerprint() };
+			fingerprint.mix(static_cast<std::uint64_t>(accuracy_));
+			return fingerprint.value();
+		}
+
 		inline std::string name() const override { return std::string{ "Constant Elasticity Variance" }; }
+		inline std::vector<T> parameters() const override {
+			std::vector<T> parameters{ mu_, sigma_, beta_, init_ };
+			if (isTimeDependent()) {
+				muCurve_->appendTo(parameters);
+				sigmaCurve_->appendTo(parameters);
+			}
+			return parameters;
+		}
 
 		SdeComponent<T,T,T> drift()const override {
+			if (isTimeDependent()) {
+				auto curve = muCurve_;
+				return [curve](T time, T underlyingPrice) {
+					return curve->value(time) * underlyingPrice;
+				};
+			}
 			return [this](T time,T underlyingPrice) {
 				return mu_* underlyingPrice;
 			};
 		}
 
 		SdeComponent<T,T,T> diffusion()const override {
-			return [this](T time,T underlyingPrice) {
-				return sigma_*std::pow(underlyingPrice,beta_);
+			auto power = this->power();
+			if (isTimeDependent()) {
+				auto curve = sigmaCurve_;
+				return [curve,power](T time, T underlyingPrice) {
+					return curve->value(time) * power(underlyingPrice);
+				};
+			}
+			T const sigma = sigma_;
+			return [sigma,power](T time,T underlyingPrice) {
+				return sigma * power(underlyingPrice);
 			};
 		}
 
+		// Always separable: the scheme then evaluates x^beta once per step
+		// (over whole chunks of paths when pipelined) and Milstein takes
+		// (x^beta)' = beta*x^beta/x from it.
 		std::shared_ptr<Sde<T,T,T>> model()const override {
 			auto drift = this->drift();
 			auto diff = this->diffusion();
 			ISde<T,T,T> modelPair = std::make_tuple(drift, diff);
-			return std::shared_ptr<Sde<T,T,T>>{ new Sde<T,T,T>{ modelPair,init_ } };
+			auto driftState = [](T underlyingPrice) { return underlyingPrice; };
+			T const beta = beta_;
+			auto diffusionStateDerivative = [beta](T underlyingPrice, T power) {
+				return (underlyingPrice > 0.0) ? beta * power / underlyingPrice : static_cast<T>(0.0);
+			};
+			auto coefficients = std::make_shared<SeparableCoefficients<T>>(
+				isTimeDependent() ? *muCurve_ : ParameterCurve<T>(mu_), driftState,
+				isTimeDependent() ? *sigmaCurve_ : ParameterCurve<T>(sigma_), this->power(),
+				diffusionStateDerivative);
+			coefficients->setDiffusionStates(this->powers());
+			return std::shared_ptr<Sde<T,T,T>>{ new Sde<T,T,T>{ modelPair,init_,coefficients } };
+		}
+	};
+
+	template<typename T = double,
+		typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+	class MertonJumpDiffusion :public SdeBuilder<1, T, T, T> {
+	private:
+		T mu_;
+		T sigma_;
+		T init_;
+		// jump component:
+		T lambda_;
+		T jumpMean_;
+		T jumpStdev_;
+
+	public:
+		MertonJumpDiffusion(T mu, T sigma, T lambda, T jumpMean, T jumpStdev, T initialCondition)
+			:mu_{ mu }, sigma_{ sigma }, init_{ initialCondition },
+			lambda_{ lambda }, jumpMean_{ jumpMean }, jumpStdev_{ jumpStdev } {}
+		MertonJumpDiffusion()
+			:MertonJumpDiffusion{ 0.0,1.0,0.0,0.0,0.0,1.0 } {}
+
+		MertonJumpDiffusion(MertonJumpDiffusion<T> const &copy)
+			:mu_{ copy.mu_ }, sigma_{ copy.sigma_ }, init_{ copy.init_ },
+			lambda_{ copy.lambda_ }, jumpMean_{ copy.jumpMean_ }, jumpStdev_{ copy.jumpStdev_ } {}
+
+		MertonJumpDiffusion& operator=(MertonJumpDiffusion<T> const &copy) {
+			if (this != &copy) {
+				mu_ = copy.mu_;
+				sigma_ = copy.sigma_;
+				lambda_ = copy.lambda_;
+				jumpMean_ = copy.jumpMean_;
+				jumpStdev_ = copy.jumpStdev_;
+				init_ = copy.init_;
+			}
+			return *this;
+		}
+
+		inline T const &mu()const { return mu_; }
+		inline T const &sigma()const { return sigma_; }
+		inline T const &init()const { return init_; }
+		inline T const &lambda()const { return lambda_; }
+		inline T const &jumpMean()const { return jumpMean_; }
+		inline T const &jumpStdev()const { return jumpStdev_; }
+
+		inline std::string name() const override { return std::string{ "Merton Jump Diffusion" }; }
+		inline std::vector<T> parameters() const override { return std::vector<T>{ mu_, sigma_, lambda_, jumpMean_, jumpStdev_, init_ }; }
+
+		// drift is compensated so that mu stays the expected growth rate of the underlying
+		SdeComponent<T, T, T> drift()const override {
+			T const compensated = mu_ - lambda_ * jumps()->compensator();
+			return [compensated](T time, T underlyingPrice) {
+				return compensated * underlyingPrice;
+			};
+		}
+
+		SdeComponent<T, T, T> diffusion()const override {
+			return [this](T time, T underlyingPrice) {
+				return sigma_ * underlyingPrice;
+			};
+		}
+
+		std::shared_ptr<JumpProcess<T>> jumps()const {
+			return std::make_shared<JumpProcess<T>>(lambda_, jumpMean_, jumpStdev_);
+		}
+
+		std::shared_ptr<Sde<T, T, T>> model()const override {
+			auto drift = this->drift();
+			auto diff = this->diffusion();
+			ISde<T, T, T> modelPair = std::make_tuple(drift, diff);
+			return std::shared_ptr<Sde<T, T, T>>{ new Sde<T, T, T>{ modelPair,init_,jumps() } };
 		}
 	};
 
@@ -267,6 +599,7 @@ namespace sde_builder {
 		inline T const &rho()const { return rho_; }
 
 		inline std::string name() const override { return std::string{ "Heston Model" }; }
+		inline std::vector<T> parameters() const override { return std::vector<T>{ mu_, sigma_, kappa_, theta_, etha_, init1_, init2_, rho_ }; }
 
 		SdeComponent<T,T,T,T> drift1()const override {
 			return [this](T time, T underlyingPrice, T varianceProcess) {
@@ -305,6 +638,350 @@ namespace sde_builder {
 	};
 
 
+	// Heston model with log-normal jumps in the first (underlying) factor
+	template<typename T = double,
+		typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+	class BatesModel :public SdeBuilder<2, T, T, T, T> {
+	private:
+		// for first underlying factor:
+		T init1_;
+		T mu_;
+		T sigma_;
+		// for second variance factor:
+		T init2_;
+		T kappa_;
+		T theta_;
+		T etha_;
+		// correlation between factors:
+		T rho_;
+		// jump component of first factor:
+		T lambda_;
+		T jumpMean_;
+		T jumpStdev_;
+
+	public:
+		BatesModel(T mu, T sigma, T kappa, T theta, T etha,
+			T lambda, T jumpMean, T jumpStdev,
+			T init1, T init2, T rho = 0.0)
+			:init1_{ init1 }, mu_{ mu }, sigma_{ sigma },
+			init2_{ init2 }, kappa_{ kappa }, theta_{ theta }, etha_{ etha }, rho_{ rho },
+			lambda_{ lambda }, jumpMean_{ jumpMean }, jumpStdev_{ jumpStdev } {}
+
+		BatesModel()
+			:BatesModel{ 0.5,0.05,0.05,0.05,0.05,0.0,0.0,0.0,1.0,0.01 } {}
+
+		BatesModel(BatesModel<T> const &copy)
+			:init1_{ copy.init1_ }, mu_{ copy.mu_ }, sigma_{ copy.sigma_ },
+			init2_{ copy.init2_ }, kappa_{ copy.kappa_ }, theta_{ copy.theta_ }, etha_{ copy.etha_ },
+			rho_{ copy.rho_ },
+			lambda_{ copy.lambda_ }, jumpMean_{ copy.jumpMean_ }, jumpStdev_{ copy.jumpStdev_ } {}
+
+		BatesModel& operator=(BatesModel<T> const &copy) {
+			if (this != &copy) {
+				mu_ = copy.mu_;
+				sigma_ = copy.sigma_;
+				kappa_ = copy.kappa_;
+				theta_ = copy.theta_;
+				etha_ = copy.etha_;
+				lambda_ = copy.lambda_;
+				jumpMean_ = copy.jumpMean_;
+				jumpStdev_ = copy.jumpStdev_;
+				init1_ = copy.init1_;
+				init2_ = copy.init2_;
+				rho_ = copy.rho_;
+			}
+			return *this;
+		}
+
+		inline T const &mu()const { return mu_; }
+		inline T const &sigma()const { return sigma_; }
+		inline T const &kappa()const { return kappa_; }
+		inline T const &theta()const { return theta_; }
+		inline T const &etha()const { return etha_; }
+		inline T const &lambda()const { return lambda_; }
+		inline T const &jumpMean()const { return jumpMean_; }
+		inline T const &jumpStdev()const { return jumpStdev_; }
+		inline T const &init1()const { return init1_; }
+		inline T const &init2()const { return init2_; }
+		inline T const &rho()const { return rho_; }
+
+		inline std::string name() const override { return std::string{ "Bates Model" }; }
+		inline std::vector<T> parameters() const override { return std::vector<T>{ mu_, sigma_, kappa_, theta_, etha_, lambda_, jumpMean_, jumpStdev_, init1_, init2_, rho_ }; }
+
+		SdeComponent<T, T, T, T> drift1()const override {
+			T const compensated = mu_ - lambda_ * jumps()->compensator();
+			return [compensated](T time, T underlyingPrice, T varianceProcess) {
+				return compensated * underlyingPrice;
+			};
+		}
+
+		SdeComponent<T, T, T, T> diffusion1()const override {
+			return [this](T time, T underlyingPrice, T varianceProcess) {
+				return sigma_ * underlyingPrice  *std::sqrt(varianceProcess);
+			};
+		}
+
+		SdeComponent<T, T, T, T> drift2() const override {
+			return [this](T time, T underlyingPrice, T varianceProcess) {
+				return kappa_ * (theta_ - varianceProcess);
+			};
+		}
+
+		SdeComponent<T, T, T, T> diffusion2()const override {
+			return [this](T time, T underlyingPrice, T varianceProcess) {
+				return etha_ * std::sqrt(varianceProcess);
+			};
+		}
+
+		std::shared_ptr<JumpProcess<T>> jumps()const {
+			return std::make_shared<JumpProcess<T>>(lambda_, jumpMean_, jumpStdev_);
+		}
+
+		std::tuple<std::shared_ptr<Sde<T, T, T, T>>, std::shared_ptr<Sde<T, T, T, T>>> model()const override {
+			auto drift1 = this->drift1();
+			auto diff1 = this->diffusion1();
+			auto drift2 = this->drift2();
+			auto diff2 = this->diffusion2();
+			ISde<T, T, T, T> modelPair1 = std::make_tuple(drift1, diff1);
+			ISde<T, T, T, T> modelPair2 = std::make_tuple(drift2, diff2);
+			return std::make_tuple(std::shared_ptr<Sde<T, T, T, T>>{ new Sde<T, T, T, T>{ modelPair1,init1_,jumps() } },
+				std::shared_ptr<Sde<T, T, T, T>>{new Sde<T, T, T, T>{ modelPair2,init2_ }});
+		}
+	};
+
+	// Hull-White short rate model dr = (theta(t) - kappa r) dt + sigma dW,
+	// stepped by its exact Gaussian transition
+	template<typename T = double,
+		typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+	class HullWhiteModel :public SdeBuilder<1, T, T, T> {
+	private:
+		T kappa_;
+		std::shared_ptr<ParameterCurve<T>> theta_;
+		T sigma_;
+		T init_;
+
+	public:
+		HullWhiteModel(T kappa, ParameterCurve<T> const &theta, T sigma, T initialCondition)
+			:kappa_{ kappa }, theta_{ std::make_shared<ParameterCurve<T>>(theta) },
+			sigma_{ sigma }, init_{ initialCondition } {}
+		HullWhiteModel()
+			:HullWhiteModel{ 0.1,ParameterCurve<T>(0.0),0.01,0.0 } {}
+
+		HullWhiteModel(HullWhiteModel<T> const &copy)
+			:kappa_{ copy.kappa_ }, theta_{ copy.theta_ }, sigma_{ copy.sigma_ },
+			init_{ copy.init_ } {}
+
+		HullWhiteModel& operator=(HullWhiteModel<T> const &copy) {
+			if (this != &copy) {
+				kappa_ = copy.kappa_;
+				theta_ = copy.theta_;
+				sigma_ = copy.sigma_;
+				init_ = copy.init_;
+			}
+			return *this;
+		}
+
+		inline T const &kappa()const { return kappa_; }
+		inline T const &sigma()const { return sigma_; }
+		inline T const &init()const { return init_; }
+		inline std::shared_ptr<ParameterCurve<T>> const &theta()const { return theta_; }
+
+		inline std::string name() const override { return std::string{ "Hull-White Model" }; }
+		inline std::vector<T> parameters() const override {
+			std::vector<T> parameters{ kappa_, sigma_, init_ };
+			theta_->appendTo(parameters);
+			return parameters;
+		}
+
+		SdeComponent<T, T, T> drift()const override {
+			auto theta = theta_;
+			T const kappa = kappa_;
+			return [theta, kappa](T time, T shortRate) {
+				return (theta->value(time) - kappa * shortRate);
+			};
+		}
+
+		SdeComponent<T, T, T> diffusion()const override {
+			return [this](T time, T shortRate) {
+				return sigma_;
+			};
+		}
+
+		std::shared_ptr<ExactTransition<T>> transition()const {
+			return std::make_shared<HullWhiteTransition<T>>(kappa_, sigma_, theta_);
+		}
+
+		std::shared_ptr<Sde<T, T, T>> model()const override {
+			auto drift = this->drift();
+			auto diff = this->diffusion();
+			ISde<T, T, T> modelPair = std::make_tuple(drift, diff);
+			return std::shared_ptr<Sde<T, T, T>>{ new Sde<T, T, T>{ modelPair,init_,transition() } };
+		}
+	};
+
+	// Cox-Ingersoll-Ross short rate model dr = kappa (theta - r) dt + sigma sqrt(r) dW,
+	// stepped by its exact non-central chi-square transition
+	template<typename T = double,
+		typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+	class CoxIngersollRossModel :public SdeBuilder<1, T, T, T> {
+	private:
+		T kappa_;
+		T theta_;
+		T sigma_;
+		T init_;
+
+	public:
+		CoxIngersollRossModel(T kappa, T theta, T sigma, T initialCondition)
+			:kappa_{ kappa }, theta_{ theta }, sigma_{ sigma }, init_{ initialCondition } {}
+		CoxIngersollRossModel()
+			:CoxIngersollRossModel{ 0.1,0.02,0.05,0.02 } {}
+
+		CoxIngersollRossModel(CoxIngersollRossModel<T> const &copy)
+			:kappa_{ copy.kappa_ }, theta_{ copy.theta_ }, sigma_{ copy.sigma_ },
+			init_{ copy.init_ } {}
+
+		CoxIngersollRossModel& operator=(CoxIngersollRossModel<T> const &copy) {
+			if (this != &copy) {
+				kappa_ = copy.kappa_;
+				theta_ = copy.theta_;
+				sigma_ = copy.sigma_;
+				init_ = copy.init_;
+			}
+			return *this;
+		}
+
+		inline T const &kappa()const { return kappa_; }
+		inline T const &theta()const { return theta_; }
+		inline T const &sigma()const { return sigma_; }
+		inline T const &init()const { return init_; }
+
+		inline std::string name() const override { return std::string{ "Cox-Ingersoll-Ross Model" }; }
+		inline std::vector<T> parameters() const override { return std::vector<T>{ kappa_, theta_, sigma_, init_ }; }
+
+		SdeComponent<T, T, T> drift()const override {
+			return [this](T time, T shortRate) {
+				return kappa_ * (theta_ - shortRate);
+			};
+		}
+
+		SdeComponent<T, T, T> diffusion()const override {
+			return [this](T time, T shortRate) {
+				return sigma_ * std::sqrt(std::max(shortRate, static_cast<T>(0.0)));
+			};
+		}
+
+		std::shared_ptr<ExactTransition<T>> transition()const {
+			return std::make_shared<CoxIngersollRossTransition<T>>(kappa_, theta_, sigma_);
+		}
+
+		std::shared_ptr<Sde<T, T, T>> model()const override {
+			auto drift = this->drift();
+			auto diff = this->diffusion();
+			ISde<T, T, T> modelPair = std::make_tuple(drift, diff);
+			return std::shared_ptr<Sde<T, T, T>>{ new Sde<T, T, T>{ modelPair,init_,transition() } };
+		}
+	};
+
+	// Equity with stochastic short rate: first factor dS = r S dt + sigma S dW1,
+	// second factor is the short rate r of a Hull-White or CIR model (exact transition).
+	// Meant for two-factor Fdm together with pathwise discount factors.
+	template<typename T = double,
+		typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+	class EquityShortRateModel :public SdeBuilder<2, T, T, T, T> {
+	private:
+		T sigma_;
+		T init1_;
+		std::shared_ptr<Sde<T, T, T>> shortRate_;
+		// identity of the short rate model:
+		std::string shortRateName_;
+		std::vector<T> shortRateParameters_;
+		std::uint64_t shortRateFingerprint_;
+
+	public:
+		EquityShortRateModel(T sigma, T init1, SdeBuilder<1, T, T, T> const &shortRateModel)
+			:sigma_{ sigma }, init1_{ init1 }, shortRate_{ shortRateModel.model() },
+			shortRateName_{ shortRateModel.name() }, shortRateParameters_{ shortRateModel.parameters() },
+			shortRateFingerprint_{ shortRateModel.fingerprint() } {}
+
+		EquityShortRateModel(EquityShortRateModel<T> const &copy)
+			:sigma_{ copy.sigma_ }, init1_{ copy.init1_ }, shortRate_{ copy.shortRate_ },
+			shortRateName_{ copy.shortRateName_ }, shortRateParameters_{ copy.shortRateParameters_ },
+			shortRateFingerprint_{ copy.shortRateFingerprint_ } {}
+
+		EquityShortRateModel& operator=(EquityShortRateModel<T> const &copy) {
+			if (this != &copy) {
+				sigma_ = copy.sigma_;
+				init1_ = copy.init1_;
+				shortRate_ = copy.shortRate_;
+				shortRateName_ = copy.shortRateName_;
+				shortRateParameters_ = copy.shortRateParameters_;
+				shortRateFingerprint_ = copy.shortRateFingerprint_;
+			}
+			return *this;
+		}
+
+		inline T const &sigma()const { return sigma_; }
+		inline T const &init1()const { return init1_; }
+		inline T init2()const { return shortRate_->initCondition(); }
+		inline std::string const &shortRateName()const { return shortRateName_; }
+
+		inline std::string name() const override { return std::string{ "Equity Short Rate Model (" } + shortRateName_ + ")"; }
+		// sigma, init1 followed by the parameters of the short rate model
+		inline std::vector<T> parameters() const override {
+			std::vector<T> parameters{ sigma_, init1_ };
+			parameters.insert(parameters.end(), shortRateParameters_.begin(), shortRateParameters_.end());
+			return parameters;
+		}
+
+		std::uint64_t fingerprint()const override {
+			mc_utilities::Fingerprint fingerprint{ SdeBuilder<2, T, T, T, T>::fingerprint() };
+			fingerprint.mix(shortRateFingerprint_);
+			return fingerprint.value();
+		}
+
+		SdeComponent<T, T, T, T> drift1()const override {
+			return [](T time, T underlyingPrice, T shortRate) {
+				return shortRate * underlyingPrice;
+			};
+		}
+
+		SdeComponent<T, T, T, T> diffusion1()const override {
+			return [this](T time, T underlyingPrice, T shortRate) {
+				return sigma_ * underlyingPrice;
+			};
+		}
+
+		SdeComponent<T, T, T, T> drift2() const override {
+			auto rate = shortRate_;
+			return [rate](T time, T underlyingPrice, T shortRate) {
+				return rate->drift(time, shortRate);
+			};
+		}
+
+		SdeComponent<T, T, T, T> diffusion2()const override {
+			auto rate = shortRate_;
+			return [rate](T time, T underlyingPrice, T shortRate) {
+				return rate->diffusion(time, shortRate);
+			};
+		}
+
+		std::tuple<std::shared_ptr<Sde<T, T, T, T>>, std::shared_ptr<Sde<T, T, T, T>>> model()const override {
+			auto drift1 = this->drift1();
+			auto diff1 = this->diffusion1();
+			auto drift2 = this->drift2();
+			auto diff2 = this->diffusion2();
+			ISde<T, T, T, T> modelPair1 = std::make_tuple(drift1, diff1);
+			ISde<T, T, T, T> modelPair2 = std::make_tuple(drift2, diff2);
+			if (shortRate_->hasExactTransition()) {
+				return std::make_tuple(std::shared_ptr<Sde<T, T, T, T>>{ new Sde<T, T, T, T>{ modelPair1,init1_ } },
+					std::shared_ptr<Sde<T, T, T, T>>{new Sde<T, T, T, T>{ modelPair2,init2(),shortRate_->transition() }});
+			}
+			return std::make_tuple(std::shared_ptr<Sde<T, T, T, T>>{ new Sde<T, T, T, T>{ modelPair1,init1_ } },
+				std::shared_ptr<Sde<T, T, T, T>>{new Sde<T, T, T, T>{ modelPair2,init2() }});
+		}
+	};
+
+
 
 }
 
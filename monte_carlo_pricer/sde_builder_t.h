@@ -47,6 +47,26 @@ void cev() {
 }
 
 
+void merton() {
+	double r{ 0.05 };
+	double sigma{ 0.01 };
+	double s{ 100.0 };
+	double lambda{ 0.5 };
+	double jumpMean{ -0.1 };
+	double jumpStdev{ 0.15 };
+
+	MertonJumpDiffusion<> merton{ r,sigma,lambda,jumpMean,jumpStdev,s };
+	std::cout << "Number of factors: " << MertonJumpDiffusion<>::FactorCount << "\n";
+	auto sde = merton.model();
+
+	std::cout << "has jumps: " << std::boolalpha << sde->hasJumps() << "\n";
+	std::cout << "jump compensator: " << sde->jumps()->compensator() << "\n";
+	std::cout << "====================================\n";
+	std::cout << "drift(101.1,0.1): " << sde->drift(0.1, 101.1) << "\n";
+	std::cout << "diffusion(101.1,0.1): " << sde->diffusion(0.1, 101.1) << "\n";
+}
+
+
 void heston() {
 	float r_d{ 0.05f };
 	float r_f{ 0.01f };
@@ -81,6 +101,36 @@ void heston() {
 }
 
 
+void shortRateTransitions() {
+	double theta{ 0.02 };
+	double sigma{ 0.05 };
+	double r{ 0.03 };
+	double dt{ 0.25 };
+	std::size_t const samples{ 200000 };
+
+	// kappa = 0 is the limit of both exact transitions: no NaN and E[r(dt)] = r
+	for (double kappa : { 0.0, 1.0e-12, 0.5 }) {
+		auto cir = CoxIngersollRossModel<>{ kappa,theta,sigma,r }.transition();
+		auto hw = HullWhiteModel<>{ kappa,ParameterCurve<double>(0.0),sigma,r }.transition();
+		std::mt19937 engine{ 42 };
+		std::normal_distribution<double> normal;
+		double cirMean{ 0.0 };
+		double hwMean{ 0.0 };
+		bool finite{ true };
+		for (std::size_t i = 0; i < samples; ++i) {
+			double const c = cir->sample(0.0, dt, r, normal(engine), engine);
+			double const h = hw->sample(0.0, dt, r, normal(engine), engine);
+			finite = finite && std::isfinite(c) && std::isfinite(h);
+			cirMean += c / samples;
+			hwMean += h / samples;
+		}
+		std::cout << "kappa: " << kappa << ", finite: " << std::boolalpha << finite
+			<< ", CIR mean: " << cirMean << " (exact " << theta + (r - theta) * std::exp(-kappa * dt) << ")"
+			<< ", HW mean: " << hwMean << " (exact " << r * std::exp(-kappa * dt) << ")\n";
+	}
+}
+
+
 
 
 
@@ -0,0 +1,482 @@
+#pragma once
+#if !defined(_SHARD_H_)
+#define _SHARD_H_
+
+#include"mc_types.h"
+#include"mc_utilities.h"
+#include"payoff_strategy.h"
+#include"thread_pool.h"
+#include<memory>
+#include<string>
+#include<vector>
+#include<cstdint>
+#include<cstring>
+#include<cmath>
+#include<algorithm>
+#include<stdexcept>
+
+#if !defined(_WIN32)
+#include<sys/types.h>
+#include<sys/wait.h>
+#include<unistd.h>
+#include<cerrno>
+#include<csignal>
+#endif
+
+namespace shard {
+
+	using mc_types::PathValuesType;
+	using mc_types::FDMScheme;
+	using payoff::PayoffMoments;
+	using thread_pool::ThreadPool;
+
+
+	// Running mean and second central moment (Welford), merged by Chan's rule
+	struct WelfordMoments {
+		std::size_t count{ 0 };
+		double mean{ 0.0 };
+		double m2{ 0.0 };
+
+		void add(double x) {
+			++count;
+			double const delta = x - mean;
+			mean += delta / static_cast<double>(count);
+			m2 += delta * (x - mean);
+		}
+
+		void merge(WelfordMoments const &other) {
+			if (other.count == 0)
+				return;
+			double const n = static_cast<double>(count + other.count);
+			double const delta = other.mean - mean;
+			mean += delta * static_cast<double>(other.count) / n;
+			m2 += other.m2 + delta * delta * static_cast<double>(count) * static_cast<double>(other.count) / n;
+			count += other.count;
+		}
+
+		double variance()const {
+			return (count < 2 ? 0.0 : m2 / static_cast<double>(count - 1));
+		}
+
+		double standardError()const {
+			return (count == 0 ? 0.0 : std::sqrt(variance() / static_cast<double>(count)));
+		}
+	};
+
+
+	// Normal equations X'X beta = X'y of a least-squares regression
+	// (X'X kept in full, row-major)
+	struct NormalEquations {
+		std::size_t dimension{ 0 };
+		std::vector<double> xtx;
+		std::vector<double> xty;
+
+		NormalEquations() {}
+		explicit NormalEquations(std::size_t dimension)
+			:dimension{ dimension }, xtx(dimension * dimension, 0.0), xty(dimension, 0.0) {}
+
+		// adds observation y with regressors basis[0],...,basis[dimension-1]
+		void add(double const *basis, double y) {
+			for (std::size_t r = 0; r < dimension; ++r) {
+				xty[r] += basis[r] * y;
+				for (std::size_t c = 0; c < dimension; ++c)
+					xtx[r * dimension + c] += basis[r] * basis[c];
+			}
+		}
+
+		void merge(NormalEquations const &other) {
+			if (dimension != other.dimension)
+				throw std::invalid_argument("Normal equations of different dimension.");
+			for (std::size_t k = 0; k < xtx.size(); ++k)
+				xtx[k] += other.xtx[k];
+			for (std::size_t k = 0; k < xty.size(); ++k)
+				xty[k] += other.xty[k];
+		}
+
+		inline bool solve(std::vector<double> &beta)const {
+			return mc_utilities::solveLinearSystem(xtx, xty, beta);
+		}
+	};
+
+
+	// Mergeable state of streaming estimators. The estimator of a run decides
+	// the shape (number of each kind), states of one run merge element-wise.
+	struct EstimatorState {
+		std::vector<PayoffMoments> moments;
+		std::vector<WelfordMoments> welford;
+		std::vector<NormalEquations> regressions;
+
+		void merge(EstimatorState const &other) {
+			if (moments.size() != other.moments.size() || welford.size() != other.welford.size() ||
+				regressions.size() != other.regressions.size())
+				throw std::invalid_argument("Estimator states of different shape.");
+			for (std::size_t k = 0; k < moments.size(); ++k)
+				moments[k].merge(other.moments[k]);
+			for (std::size_t k = 0; k < welford.size(); ++k)
+				welford[k].merge(other.welford[k]);
+			for (std::size_t k = 0; k < regressions.size(); ++k)
+				regressions[k].merge(other.regressions[k]);
+		}
+	};
+
+
+	// Contiguous range of paths [firstPath,firstPath+pathCount) of a run
+	struct ShardSpec {
+		std::size_t index;
+		std::size_t firstPath;
+		std::size_t pathCount;
+	};
+
+	// Splits pathCount paths into at most shardCount shards of whole blocks,
+	// shard boundaries fall on block boundaries of the single-process run
+	inline std::vector<ShardSpec> planShards(std::size_t pathCount, std::size_t shardCount, std::size_t blockSize) {
+		blockSize = std::max<std::size_t>(1, blockSize);
+		std::size_t const blocks = (pathCount + blockSize - 1) / blockSize;
+		shardCount = std::max<std::size_t>(1, std::min(shardCount, blocks));
+		std::vector<ShardSpec> shards;
+		std::size_t firstBlock{ 0 };
+		for (std::size_t s = 0; s < shardCount && blocks > 0; ++s) {
+			std::size_t const count = blocks / shardCount + (s < blocks % shardCount ? 1 : 0);
+			std::size_t const first = firstBlock * blockSize;
+			std::size_t const last = std::min(pathCount, (firstBlock + count) * blockSize);
+			shards.emplace_back(ShardSpec{ s,first,last - first });
+			firstBlock += count;
+		}
+		return shards;
+	}
+
+
+	// Wire format of block states (host byte order):
+	// magic | block count | per block: counts of each kind, then the values
+	static constexpr std::uint64_t shardMagic = 0x314452414853434DULL; // "MCSHARD1"
+
+	namespace detail {
+
+		inline void put(std::string &bytes, std::uint64_t value) {
+			bytes.append(reinterpret_cast<char const *>(&value), sizeof(value));
+		}
+
+		inline void put(std::string &bytes, double value) {
+			bytes.append(reinterpret_cast<char const *>(&value), sizeof(value));
+		}
+
+		class Reader {
+		private:
+			std::string const &bytes_;
+			std::size_t position_{ 0 };
+
+			void read(void *data, std::size_t size) {
+				if (position_ + size > bytes_.size())
+					throw std::runtime_error("Shard result is truncated.");
+				std::memcpy(data, bytes_.data() + position_, size);
+				position_ += size;
+			}
+
+		public:
+			explicit Reader(std::string const &bytes) :bytes_{ bytes } {}
+
+			std::uint64_t integer() { std::uint64_t value; read(&value, sizeof(value)); return value; }
+			double real() { double value; read(&value, sizeof(value)); return value; }
+			inline bool atEnd()const { return (position_ == bytes_.size()); }
+		};
+	}
+
+	inline std::string encode(std::vector<EstimatorState> const &blocks) {
+		std::string bytes;
+		detail::put(bytes, shardMagic);
+		detail::put(bytes, static_cast<std::uint64_t>(blocks.size()));
+		for (auto const &state : blocks) {
+			detail::put(bytes, static_cast<std::uint64_t>(state.moments.size()));
+			detail::put(bytes, static_cast<std::uint64_t>(state.welford.size()));
+			detail::put(bytes, static_cast<std::uint64_t>(state.regressions.size()));
+			for (auto const &m : state.moments) {
+				detail::put(bytes, m.sum);
+				detail::put(bytes, m.sumOfSquares);
+				detail::put(bytes, static_cast<std::uint64_t>(m.count));
+			}
+			for (auto const &w : state.welford) {
+				detail::put(bytes, static_cast<std::uint64_t>(w.count));
+				detail::put(bytes, w.mean);
+				detail::put(bytes, w.m2);
+			}
+			for (auto const &r : state.regressions) {
+				detail::put(bytes, static_cast<std::uint64_t>(r.dimension));
+				for (auto const &v : r.xtx)
+					detail::put(bytes, v);
+				for (auto const &v : r.xty)
+					detail::put(bytes, v);
+			}
+		}
+		return bytes;
+	}
+
+	inline std::vector<EstimatorState> decode(std::string const &bytes) {
+		detail::Reader reader{ bytes };
+		if (reader.integer() != shardMagic)
+			throw std::runtime_error("Not a shard result.");
+		std::vector<EstimatorState> blocks(static_cast<std::size_t>(reader.integer()));
+		for (auto &state : blocks) {
+			state.moments.resize(static_cast<std::size_t>(reader.integer()));
+			state.welford.resize(static_cast<std::size_t>(reader.integer()));
+			state.regressions.resize(static_cast<std::size_t>(reader.integer()));
+			for (auto &m : state.moments) {
+				m.sum = reader.real();
+				m.sumOfSquares = reader.real();
+				m.count = static_cast<std::size_t>(reader.integer());
+			}
+			for (auto &w : state.welford) {
+				w.count = static_cast<std::size_t>(reader.integer());
+				w.mean = reader.real();
+				w.m2 = reader.real();
+			}
+			for (auto &r : state.regressions) {
+				r = NormalEquations{ static_cast<std::size_t>(reader.integer()) };
+				for (auto &v : r.xtx)
+					v = reader.real();
+				for (auto &v : r.xty)
+					v = reader.real();
+			}
+		}
+		if (!reader.atEnd())
+			throw std::runtime_error("Shard result has trailing bytes.");
+		return blocks;
+	}
+
+
+	// Simulates the paths of shard block by block on a seeded engine. Each block
+	// starts from a copy of prototype and is filled by estimator(paths, state).
+	// Returns the state of every block.
+	template<typename Engine, typename Estimator>
+	std::vector<EstimatorState> simulateShard(Engine &fdm, ShardSpec const &shard, std::size_t blockSize,
+		EstimatorState const &prototype, Estimator &&estimator, FDMScheme scheme = FDMScheme::EulerScheme) {
+		blockSize = std::max<std::size_t>(1, blockSize);
+		std::size_t const base = fdm.firstPath();
+		std::vector<EstimatorState> blocks;
+		for (std::size_t done = 0; done < shard.pathCount; done += blockSize) {
+			std::size_t const size = std::min(blockSize, shard.pathCount - done);
+			fdm.setFirstPath(base + shard.firstPath + done);
+			auto const paths = fdm(size, scheme);
+			blocks.emplace_back(prototype);
+			estimator(paths, blocks.back());
+		}
+		fdm.setFirstPath(base);
+		return blocks;
+	}
+
+
+#if !defined(_WIN32)
+	namespace detail {
+
+		// Worker processes of a sharded run with the read ends of their pipes.
+		// Workers still running when it goes out of scope (a later pipe() or
+		// fork() failed, or collecting a result threw) are killed and reaped,
+		// and every pipe left open is closed.
+		class WorkerProcesses {
+		private:
+			std::vector<pid_t> workers_;
+			std::vector<int> pipes_;
+
+		public:
+			explicit WorkerProcesses(std::size_t capacity) {
+				// reserved up front so that add() cannot throw after a fork
+				workers_.reserve(capacity);
+				pipes_.reserve(capacity);
+			}
+			WorkerProcesses(WorkerProcesses const &) = delete;
+			WorkerProcesses &operator=(WorkerProcesses const &) = delete;
+
+			~WorkerProcesses() {
+				for (std::size_t s = 0; s < workers_.size(); ++s) {
+					closePipe(s);
+					if (workers_[s] > 0) {
+						::kill(workers_[s], SIGKILL);
+						reap(s);
+					}
+				}
+			}
+
+			inline void add(pid_t worker, int pipe) {
+				workers_.emplace_back(worker);
+				pipes_.emplace_back(pipe);
+			}
+
+			inline std::size_t size()const { return workers_.size(); }
+			inline int pipe(std::size_t s)const { return pipes_[s]; }
+			inline std::vector<int> const &pipes()const { return pipes_; }
+
+			void closePipe(std::size_t s) {
+				if (pipes_[s] >= 0)
+					::close(pipes_[s]);
+				pipes_[s] = -1;
+			}
+
+			// waits for worker s, returns its wait status
+			int reap(std::size_t s) {
+				int status{ 0 };
+				while (::waitpid(workers_[s], &status, 0) < 0 && errno == EINTR) {}
+				workers_[s] = -1;
+				return status;
+			}
+		};
+	}
+#endif
+
+
+	// Runs a seeded simulation split into shards, each shard in its own worker
+	// process (fork, result sent back over a pipe in the wire format above).
+	// Path i of the run is generated from pathSeed(seed,firstPath+i) whichever
+	// shard it lands in, and block states are merged in block order, so the
+	// result equals runInProcess() bit for bit for any number of shards.
+	// Workers inherit the engine and estimator of the parent; a cluster launcher
+	// can run simulateShard() remotely and return encode() of its result instead.
+	// Only the forking thread exists in a worker, so a thread pool of the engine
+	// is rebuilt there with the same number of threads (the inherited one is
+	// never touched). On Windows (no fork) the shards run in the calling process.
+	class ShardedRun {
+	private:
+		std::size_t shardCount_;
+		std::size_t blockSize_;
+
+		static EstimatorState fold(EstimatorState const &prototype, std::vector<EstimatorState> const &blocks) {
+			EstimatorState total = prototype;
+			for (auto const &block : blocks)
+				total.merge(block);
+			return total;
+		}
+
+#if !defined(_WIN32)
+		static std::string readAll(int fd) {
+			std::string bytes;
+			char buffer[65536];
+			for (;;) {
+				ssize_t const n = ::read(fd, buffer, sizeof(buffer));
+				if (n == 0)
+					break;
+				if (n < 0) {
+					if (errno == EINTR)
+						continue;
+					throw std::runtime_error("Reading shard result failed.");
+				}
+				bytes.append(buffer, static_cast<std::size_t>(n));
+			}
+			return bytes;
+		}
+
+		static bool writeAll(int fd, std::string const &bytes) {
+			std::size_t written{ 0 };
+			while (written < bytes.size()) {
+				ssize_t const n = ::write(fd, bytes.data() + written, bytes.size() - written);
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n <= 0)
+					return false;
+				written += static_cast<std::size_t>(n);
+			}
+			return true;
+		}
+#endif
+
+	public:
+		explicit ShardedRun(std::size_t shardCount, std::size_t blockSize = 5000)
+			:shardCount_{ std::max<std::size_t>(1, shardCount) }, blockSize_{ std::max<std::size_t>(1, blockSize) } {}
+
+		inline std::size_t shardCount()const { return shardCount_; }
+		inline std::size_t blockSize()const { return blockSize_; }
+
+		inline std::vector<ShardSpec> plan(std::size_t pathCount)const {
+			return planShards(pathCount, shardCount_, blockSize_);
+		}
+
+		template<typename Engine, typename Estimator>
+		EstimatorState runInProcess(Engine &fdm, std::size_t pathCount, EstimatorState const &prototype,
+			Estimator &&estimator, FDMScheme scheme = FDMScheme::EulerScheme)const {
+			if (!fdm.isSeeded())
+				throw std::invalid_argument("Sharded runs need a seeded engine.");
+			std::vector<EstimatorState> blocks;
+			for (auto const &shard : plan(pathCount)) {
+				auto result = simulateShard(fdm, shard, blockSize_, prototype, estimator, scheme);
+				blocks.insert(blocks.end(), result.begin(), result.end());
+			}
+			return fold(prototype, blocks);
+		}
+
+		template<typename Engine, typename Estimator>
+		EstimatorState run(Engine &fdm, std::size_t pathCount, EstimatorState const &prototype,
+			Estimator &&estimator, FDMScheme scheme = FDMScheme::EulerScheme)const {
+#if defined(_WIN32)
+			return runInProcess(fdm, pathCount, prototype, estimator, scheme);
+#else
+			if (!fdm.isSeeded())
+				throw std::invalid_argument("Sharded runs need a seeded engine.");
+			auto const shards = plan(pathCount);
+			detail::WorkerProcesses workers{ shards.size() };
+			for (auto const &shard : shards) {
+				int fds[2];
+				if (::pipe(fds) != 0)
+					throw std::runtime_error("Cannot create pipe for shard.");
+				pid_t const pid = ::fork();
+				if (pid < 0) {
+					::close(fds[0]);
+					::close(fds[1]);
+					throw std::runtime_error("Cannot start worker process for shard.");
+				}
+				if (pid == 0) {
+					// the worker leaves by _exit, no destructor of the parent's state runs
+					::close(fds[0]);
+					for (auto const fd : workers.pipes())
+						::close(fd);
+					// the inherited pool has no threads here and stays referenced up to _exit:
+					std::shared_ptr<ThreadPool> const inherited = fdm.threadPool();
+					int status{ 1 };
+					try {
+						if (inherited)
+							fdm.setThreadPool(std::make_shared<ThreadPool>(inherited->size()));
+						auto const bytes = encode(simulateShard(fdm, shard, blockSize_, prototype, estimator, scheme));
+						status = writeAll(fds[1], bytes) ? 0 : 1;
+					}
+					catch (...) {}
+					::close(fds[1]);
+					::_exit(status);
+				}
+				::close(fds[1]);
+				workers.add(pid, fds[0]);
+			}
+
+			std::vector<EstimatorState> blocks;
+			std::string failure;
+			for (std::size_t s = 0; s < shards.size(); ++s) {
+				std::string bytes;
+				try {
+					bytes = readAll(workers.pipe(s));
+				}
+				catch (std::exception const &e) {
+					failure = e.what();
+				}
+				workers.closePipe(s);
+				int const status = workers.reap(s);
+				if (!failure.empty())
+					continue;
+				if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+					failure = "Shard " + std::to_string(s) + " failed.";
+					continue;
+				}
+				try {
+					auto result = decode(bytes);
+					blocks.insert(blocks.end(), result.begin(), result.end());
+				}
+				catch (std::exception const &e) {
+					failure = e.what();
+				}
+			}
+			if (!failure.empty())
+				throw std::runtime_error(failure);
+			return fold(prototype, blocks);
+#endif
+		}
+	};
+
+}
+
+
+
+#endif ///_SHARD_H_
@@ -0,0 +1,204 @@
+#pragma once
+#if !defined(_TERM_STRUCTURE_H_)
+#define _TERM_STRUCTURE_H_
+
+#include"mc_types.h"
+#include<algorithm>
+#include<cassert>
+#include<cmath>
+#include<memory>
+
+namespace term_structure {
+
+	using mc_types::TimePointsType;
+	using mc_types::CurveInterpolation;
+
+	// Model parameter as a function of time.
+	// PiecewiseConstant: values[k] holds on [times[k],times[k+1])
+	// PiecewiseLinear: linear between the nodes
+	// Both are extrapolated flat outside of the nodes.
+	template<typename T>
+	class ParameterCurve {
+	private:
+		TimePointsType<T> times_;
+		std::vector<T> values_;
+		CurveInterpolation interpolation_;
+
+		// integral of f^power over [a,b], a and b within one segment starting at node k
+		T segmentIntegral(std::size_t k, T a, T b, int power)const {
+			T const fa = value(a);
+			T const fb = value(b);
+			if (interpolation_ == CurveInterpolation::PiecewiseConstant ||
+				k + 1 >= times_.size() || a < times_.front()) {
+				return (power == 1 ? fa : fa * fa) * (b - a);
+			}
+			// exact for linear function on [a,b]:
+			if (power == 1)
+				return static_cast<T>(0.5) * (fa + fb) * (b - a);
+			return (fa * fa + fa * fb + fb * fb) * (b - a) / static_cast<T>(3.0);
+		}
+
+		T integrate(T a, T b, int power)const {
+			if (b <= a)
+				return static_cast<T>(0.0);
+			T result{};
+			T left = a;
+			// first node strictly greater than a:
+			auto node = std::upper_bound(times_.begin(), times_.end(), a);
+			while (left < b) {
+				T right = (node == times_.end()) ? b : std::min(*node, b);
+				std::size_t k = (node == times_.begin()) ? 0 :
+					static_cast<std::size_t>(std::distance(times_.begin(), node) - 1);
+				result += segmentIntegral(k, left, right, power);
+				left = right;
+				if (node != times_.end())
+					++node;
+			}
+			return result;
+		}
+
+	public:
+		ParameterCurve(T constant = 0.0)
+			:times_{ static_cast<T>(0.0) }, values_{ constant },
+			interpolation_{ CurveInterpolation::PiecewiseConstant } {}
+
+		ParameterCurve(TimePointsType<T> const &times, std::vector<T> const &values,
+			CurveInterpolation interpolation = CurveInterpolation::PiecewiseConstant)
+			:times_{ times }, values_{ values }, interpolation_{ interpolation } {
+			assert(!times_.empty());
+			assert(times_.size() == values_.size());
+			assert(std::is_sorted(times_.begin(), times_.end()));
+		}
+
+		inline TimePointsType<T> const &times()const { return times_; }
+		inline std::vector<T> const &values()const { return values_; }
+		inline CurveInterpolation interpolation()const { return interpolation_; }
+		inline bool isConstant()const { return (values_.size() == 1); }
+
+		// interpolation, node count, nodes and values appended to parameters,
+		// so that a flat parameter list identifies the whole curve
+		void appendTo(std::vector<T> &parameters)const {
+			parameters.emplace_back(static_cast<T>(interpolation_));
+			parameters.emplace_back(static_cast<T>(times_.size()));
+			parameters.insert(parameters.end(), times_.begin(), times_.end());
+			parameters.insert(parameters.end(), values_.begin(), values_.end());
+		}
+
+		T value(T time)const {
+			if (time <= times_.front())
+				return values_.front();
+			if (time >= times_.back())
+				return values_.back();
+			auto node = std::upper_bound(times_.begin(), times_.end(), time);
+			std::size_t k = static_cast<std::size_t>(std::distance(times_.begin(), node) - 1);
+			if (interpolation_ == CurveInterpolation::PiecewiseConstant)
+				return values_[k];
+			T const w = (time - times_[k]) / (times_[k + 1] - times_[k]);
+			return (values_[k] + w * (values_[k + 1] - values_[k]));
+		}
+
+		// integral of the curve over [a,b]
+		inline T integral(T a, T b)const { return integrate(a, b, 1); }
+
+		// integral of the squared curve over [a,b]
+		inline T squareIntegral(T a, T b)const { return integrate(a, b, 2); }
+	};
+
+
+	// Flat per-step tables for one time grid. Entry i covers [t(i-1),t(i)],
+	// entry 0 is unused so that the schemes can index with their step counter.
+	// Built once per grid and shared read-only by all paths and threads.
+	template<typename T>
+	class StepCoefficientTable {
+	private:
+		std::vector<T> drift_;
+		std::vector<T> variance_;
+		std::vector<T> volatility_;
+
+	public:
+		StepCoefficientTable(ParameterCurve<T> const &driftCurve,
+			ParameterCurve<T> const &diffusionCurve,
+			TimePointsType<T> const &timePoints)
+			:drift_(timePoints.size()), variance_(timePoints.size()),
+			volatility_(timePoints.size()) {
+			for (std::size_t i = 1; i < timePoints.size(); ++i) {
+				drift_[i] = driftCurve.integral(timePoints[i - 1], timePoints[i]);
+				variance_[i] = diffusionCurve.squareIntegral(timePoints[i - 1], timePoints[i]);
+				volatility_[i] = std::sqrt(variance_[i]);
+			}
+		}
+
+		inline std::size_t size()const { return drift_.size(); }
+		// integrated drift coefficient over step i
+		inline T drift(std::size_t i)const { return drift_[i]; }
+		// integrated squared diffusion coefficient over step i
+		inline T variance(std::size_t i)const { return variance_[i]; }
+		// square root of variance(i)
+		inline T volatility(std::size_t i)const { return volatility_[i]; }
+	};
+
+
+	// Separable one-factor coefficients:
+	// drift(t,x) = a(t)*f(x), diffusion(t,x) = b(t)*g(x)
+	// The time parts are integrated per step into StepCoefficientTable,
+	// the state parts are evaluated by the scheme. Optional g'(x) is given
+	// the already evaluated g(x), so that Milstein reuses it.
+	template<typename T>
+	class SeparableCoefficients {
+	private:
+		ParameterCurve<T> driftCurve_;
+		std::function<T(T)> driftState_;
+		ParameterCurve<T> diffusionCurve_;
+		std::function<T(T)> diffusionState_;
+		std::function<T(T, T)> diffusionStateDerivative_;
+		std::function<void(T const*, T*, std::size_t)> diffusionStates_;
+
+	public:
+		SeparableCoefficients(ParameterCurve<T> const &driftCurve, std::function<T(T)> const &driftState,
+			ParameterCurve<T> const &diffusionCurve, std::function<T(T)> const &diffusionState)
+			:driftCurve_{ driftCurve }, driftState_{ driftState },
+			diffusionCurve_{ diffusionCurve }, diffusionState_{ diffusionState } {}
+
+		SeparableCoefficients(ParameterCurve<T> const &driftCurve, std::function<T(T)> const &driftState,
+			ParameterCurve<T> const &diffusionCurve, std::function<T(T)> const &diffusionState,
+			std::function<T(T, T)> const &diffusionStateDerivative)
+			:driftCurve_{ driftCurve }, driftState_{ driftState },
+			diffusionCurve_{ diffusionCurve }, diffusionState_{ diffusionState },
+			diffusionStateDerivative_{ diffusionStateDerivative } {}
+
+		inline ParameterCurve<T> const &driftCurve()const { return driftCurve_; }
+		inline ParameterCurve<T> const &diffusionCurve()const { return diffusionCurve_; }
+
+		inline T driftState(T state)const { return driftState_(state); }
+		inline T diffusionState(T state)const { return diffusionState_(state); }
+
+		// g over a block of states, giving the bits of diffusionState() for
+		// every state; a block function lets the model run a vector kernel
+		inline void setDiffusionStates(std::function<void(T const*, T*, std::size_t)> const &diffusionStates) {
+			diffusionStates_ = diffusionStates;
+		}
+		void diffusionStates(T const *states, T *result, std::size_t size)const {
+			if (diffusionStates_ != nullptr) {
+				diffusionStates_(states, result, size);
+				return;
+			}
+			for (std::size_t i = 0; i < size; ++i)
+				result[i] = diffusionState_(states[i]);
+		}
+
+		inline bool hasDiffusionStateDerivative()const { return (diffusionStateDerivative_ != nullptr); }
+		// g'(state) given g(state) = diffusionStateValue
+		inline T diffusionStateDerivative(T state, T diffusionStateValue)const {
+			return diffusionStateDerivative_(state, diffusionStateValue);
+		}
+
+		std::shared_ptr<StepCoefficientTable<T> const> table(TimePointsType<T> const &timePoints)const {
+			return std::make_shared<StepCoefficientTable<T> const>(driftCurve_, diffusionCurve_, timePoints);
+		}
+	};
+
+}
+
+
+
+#endif ///_TERM_STRUCTURE_H_
@@ -0,0 +1,343 @@
+#pragma once
+#if !defined(_THREAD_POOL_H_)
+#define _THREAD_POOL_H_
+
+#include"instrumentation.h"
+#include"numa.h"
+#include"reduction.h"
+#include<vector>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<functional>
+#include<future>
+#include<memory>
+#include<atomic>
+#include<exception>
+#include<algorithm>
+#include<type_traits>
+#include<utility>
+#include<chrono>
+
+namespace thread_pool {
+
+	using numa::NumaTopology;
+
+	// Fixed set of worker threads kept alive between simulations,
+	// so that a run does not pay thread creation per path.
+	// Built from a NumaTopology the workers are grouped by node and pinned to
+	// their node's CPUs: parallelFor hands every node a contiguous share of the
+	// index range, so what a node's workers write (paths of an arena, per path
+	// buffers, generator state) is first touched, and so placed, on that node.
+	class ThreadPool {
+	private:
+		struct NodeQueue {
+			std::deque<std::function<void()>> tasks;
+			std::condition_variable ready;
+			std::size_t workers{ 0 };
+			std::size_t firstWorker{ 0 };	// workers before this node
+		};
+
+		struct WorkerSlot {
+			ThreadPool const *pool{ nullptr };
+			std::size_t node{ 0 };
+		};
+
+		NumaTopology topology_;
+		std::vector<std::thread> workers_;
+		std::vector<std::unique_ptr<NodeQueue>> nodes_;
+		std::mutex mutex_;
+		std::size_t nextNode_{ 0 };
+		std::atomic<std::size_t> pinned_{ 0 };
+		bool stop_{ false };
+
+		static WorkerSlot &currentWorker() {
+			static thread_local WorkerSlot slot;
+			return slot;
+		}
+
+		void work(std::size_t node, bool pin) {
+			if (pin && numa::pinCurrentThread(topology_.node(node)))
+				++pinned_;
+			currentWorker() = WorkerSlot{ this, node };
+			instrumentation::registerPoolWorker();
+			auto &queue = *nodes_[node];
+			for (;;) {
+				std::function<void()> task;
+				{
+					instrumentation::ThreadTimer idle{ false };
+					std::unique_lock<std::mutex> lock(mutex_);
+					queue.ready.wait(lock, [this, &queue]() {return (stop_ || !queue.tasks.empty()); });
+					if (stop_ && queue.tasks.empty())
+						return;
+					task = std::move(queue.tasks.front());
+					queue.tasks.pop_front();
+				}
+				instrumentation::ThreadTimer busy{ true };
+				task();
+			}
+		}
+
+		void enqueue(std::size_t node, std::function<void()> &&task) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				nodes_[node]->tasks.emplace_back(std::move(task));
+			}
+			nodes_[node]->ready.notify_one();
+		}
+
+		void start(std::vector<std::size_t> const &nodeWorkers, bool pin) {
+			std::size_t total{ 0 };
+			for (auto const w : nodeWorkers) {
+				nodes_.emplace_back(new NodeQueue{});
+				nodes_.back()->workers = w;
+				nodes_.back()->firstWorker = total;
+				total += w;
+			}
+			workers_.reserve(total);
+			for (std::size_t n = 0; n < nodeWorkers.size(); ++n) {
+				for (std::size_t t = 0; t < nodeWorkers[n]; ++t)
+					workers_.emplace_back(&ThreadPool::work, this, n, pin);
+			}
+		}
+
+		// Node the calling thread takes parallelFor chunks from first
+		inline std::size_t homeNode()const {
+			auto const &slot = currentWorker();
+			if (slot.pool == this)
+				return slot.node;
+			return std::min(topology_.currentNode(), nodes_.size() - 1);
+		}
+
+	public:
+		explicit ThreadPool(std::size_t threads = std::max<std::size_t>(1, std::thread::hardware_concurrency()))
+			:topology_{ NumaTopology::flat() } {
+			start({ std::max<std::size_t>(1, threads) }, false);
+		}
+
+		// threadsPerNode workers on every node of topology (0: one per CPU of the node)
+		explicit ThreadPool(NumaTopology const &topology, std::size_t threadsPerNode = 0)
+			:topology_{ topology } {
+			if (topology_.nodeCount() == 0)
+				topology_ = NumaTopology::flat();
+			std::vector<std::size_t> nodeWorkers;
+			for (auto const &node : topology_.nodes())
+				nodeWorkers.emplace_back(threadsPerNode == 0 ?
+					std::max<std::size_t>(1, node.cpus.size()) : threadsPerNode);
+			start(nodeWorkers, true);
+		}
+
+		// Finishes queued tasks before joining
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			for (auto &node : nodes_)
+				node->ready.notify_all();
+			for (auto &worker : workers_)
+				worker.join();
+		}
+
+		ThreadPool(ThreadPool const &) = delete;
+		ThreadPool &operator=(ThreadPool const &) = delete;
+
+		inline std::size_t size()const { return workers_.size(); }
+		inline std::size_t nodeCount()const { return nodes_.size(); }
+		inline std::size_t nodeSize(std::size_t node)const { return nodes_[node]->workers; }
+		inline NumaTopology const &topology()const { return topology_; }
+		// workers the system let pin to their node so far
+		inline std::size_t pinnedWorkers()const { return pinned_.load(); }
+
+		// Share [first,last) of [0,count) of node, in proportion to its workers
+		inline std::pair<std::size_t, std::size_t> nodeRange(std::size_t count, std::size_t node)const {
+			std::size_t const total = workers_.size();
+			std::size_t const before = nodes_[node]->firstWorker;
+			std::size_t const upTo = before + nodes_[node]->workers;
+			return std::make_pair(count / total * before + count % total * before / total,
+				count / total * upTo + count % total * upTo / total);
+		}
+
+		// Tasks go to the nodes in turn
+		template<typename Fun>
+		std::future<typename std::result_of<Fun()>::type> submit(Fun &&fun) {
+			std::size_t node;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				node = nextNode_++ % nodes_.size();
+			}
+			return submitTo(node, std::forward<Fun>(fun));
+		}
+
+		template<typename Fun>
+		std::future<typename std::result_of<Fun()>::type> submitTo(std::size_t node, Fun &&fun) {
+			typedef typename std::result_of<Fun()>::type Result;
+			auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Fun>(fun));
+			auto future = task->get_future();
+			enqueue(node, [task]() {(*task)(); });
+			return future;
+		}
+
+		// Calls fun(i) for i in [0,count) in chunks over the workers and the
+		// calling thread. The caller takes chunks itself and only waits for chunks
+		// already taken, so it is safe to call from inside a pool task.
+		// Chunks of nodeRange(count,n) go to the workers of node n; a thread out
+		// of chunks on its own node helps the other nodes.
+		// The first exception thrown by fun is rethrown to the caller.
+		template<typename Fun>
+		void parallelFor(std::size_t count, Fun &&fun) {
+			if (count == 0)
+				return;
+			struct Part {
+				std::size_t first;
+				std::size_t last;
+				std::size_t chunks;
+				std::atomic<std::size_t> next{ 0 };
+			};
+			struct Shared {
+				std::size_t chunk;
+				std::size_t chunks{ 0 };
+				std::vector<std::unique_ptr<Part>> parts;
+				std::size_t done{ 0 };
+				std::mutex mutex;
+				std::condition_variable finished;
+				std::exception_ptr error;
+				std::function<void(std::size_t)> fun;
+			};
+			auto shared = std::make_shared<Shared>();
+			shared->chunk = std::max<std::size_t>(1, count / (4 * (size() + 1)));
+			for (std::size_t n = 0; n < nodes_.size(); ++n) {
+				auto const range = nodeRange(count, n);
+				shared->parts.emplace_back(new Part{});
+				auto &part = *shared->parts.back();
+				part.first = range.first;
+				part.last = range.second;
+				part.chunks = (range.second - range.first + shared->chunk - 1) / shared->chunk;
+				shared->chunks += part.chunks;
+			}
+			shared->fun = std::forward<Fun>(fun);
+			auto const drain = [](std::shared_ptr<Shared> const &s, std::size_t home) {
+				for (std::size_t k = 0; k < s->parts.size(); ++k) {
+					auto &part = *s->parts[(home + k) % s->parts.size()];
+					for (;;) {
+						std::size_t const c = part.next++;
+						if (c >= part.chunks)
+							break;
+						std::size_t const first = part.first + c * s->chunk;
+						std::size_t const last = std::min(part.last, first + s->chunk);
+						std::exception_ptr error;
+						try {
+							for (std::size_t i = first; i < last; ++i)
+								s->fun(i);
+						}
+						catch (...) {
+							error = std::current_exception();
+						}
+						std::lock_guard<std::mutex> lock(s->mutex);
+						if (error && !s->error)
+							s->error = error;
+						if (++s->done == s->chunks)
+							s->finished.notify_all();
+					}
+				}
+			};
+			std::size_t const home = homeNode();
+			for (std::size_t n = 0; n < nodes_.size(); ++n) {
+				std::size_t const chunks = shared->parts[n]->chunks;
+				std::size_t const helpers = std::min(nodes_[n]->workers,
+					(n == home && chunks > 0 ? chunks - 1 : chunks));
+				for (std::size_t h = 0; h < helpers; ++h)
+					enqueue(n, [shared, drain, n]() {drain(shared, n); });
+			}
+			drain(shared, home);
+			std::unique_lock<std::mutex> lock(shared->mutex);
+			shared->finished.wait(lock, [&shared]() {return (shared->done == shared->chunks); });
+			if (shared->error)
+				std::rethrow_exception(shared->error);
+		}
+
+		// blockFun(first,size) over blocks of blockSize covering [0,count) with
+		// results in block order, same block layout as mc_utilities::parallelBlocks
+		template<typename Result, typename BlockFun>
+		std::vector<Result> parallelBlocks(std::size_t count, std::size_t blockSize, BlockFun &&blockFun) {
+			blockSize = std::max<std::size_t>(1, blockSize);
+			std::size_t const blocks = (count + blockSize - 1) / blockSize;
+			std::vector<Result> results(blocks);
+			parallelFor(blocks, [&](std::size_t b) {
+				std::size_t const first = b * blockSize;
+				results[b] = blockFun(first, std::min(blockSize, count - first));
+			});
+			return results;
+		}
+
+		// Reduction of blockFun(first,size) over blocks of blockSize by the fixed
+		// tree of reduction.h, built as the blocks finish: subtrees over a node's
+		// blocks are merged on that node and the result is bit-identical for any
+		// pool size, topology or scheduling (and to reduction::reduceBlocks)
+		template<typename Result, typename BlockFun, typename Merge>
+		Result parallelReduce(std::size_t count, std::size_t blockSize, BlockFun &&blockFun, Merge &&merge) {
+			blockSize = std::max<std::size_t>(1, blockSize);
+			std::size_t const blocks = (count + blockSize - 1) / blockSize;
+			if (blocks == 0)
+				return Result{};
+			reduction::BlockTree<Result, typename std::decay<Merge>::type> tree(blocks, std::forward<Merge>(merge));
+			parallelFor(blocks, [&](std::size_t b) {
+				std::size_t const first = b * blockSize;
+				tree.submit(b, blockFun(first, std::min(blockSize, count - first)));
+			});
+			return tree.result();
+		}
+	};
+
+
+	// Wall time of a workload on a growing number of workers
+	struct ScalingPoint {
+		std::size_t nodes;
+		std::size_t threads;
+		double seconds;
+		double speedup;		// against the single thread run
+		double efficiency;	// speedup per thread, 1 is linear scaling
+	};
+
+	// Runs workload(pool) on one pinned thread, then on all workers of the
+	// first node, the first two nodes and so on up to the whole topology.
+	// The workload is started from a pool worker so the timed threads are
+	// exactly the pool's; the best of repetitions runs is kept.
+	template<typename Workload>
+	std::vector<ScalingPoint> measureScaling(NumaTopology const &topology, Workload &&workload,
+		std::size_t repetitions = 3) {
+		std::vector<ScalingPoint> points;
+		auto const time = [&](ThreadPool &pool) {
+			double best{ 0.0 };
+			for (std::size_t r = 0; r < std::max<std::size_t>(1, repetitions); ++r) {
+				auto const start = std::chrono::steady_clock::now();
+				pool.submitTo(0, [&]() {workload(pool); }).get();
+				double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				best = (r == 0 ? seconds : std::min(best, seconds));
+			}
+			return best;
+		};
+		auto const add = [&](ThreadPool &pool, std::size_t nodes) {
+			double const seconds = time(pool);
+			double const speedup = (points.empty() ? 1.0 : points.front().seconds / seconds);
+			points.emplace_back(ScalingPoint{ nodes, pool.size(), seconds, speedup,
+				speedup / static_cast<double>(pool.size()) });
+		};
+		{
+			ThreadPool single(NumaTopology{ std::vector<numa::NumaNode>{ topology.node(0) } }, 1);
+			add(single, 1);
+		}
+		for (std::size_t n = 1; n <= topology.nodeCount(); ++n) {
+			std::vector<numa::NumaNode> nodes(topology.nodes().begin(), topology.nodes().begin() + n);
+			ThreadPool pool(NumaTopology{ nodes });
+			add(pool, n);
+		}
+		return points;
+	}
+
+}
+
+
+
+#endif ///_THREAD_POOL_H_
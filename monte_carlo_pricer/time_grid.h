@@ -0,0 +1,153 @@
+#pragma once
+#if !defined(_TIME_GRID_H_)
+#define _TIME_GRID_H_
+
+#include"mc_types.h"
+#include<vector>
+#include<memory>
+#include<cmath>
+#include<cstdint>
+#include<algorithm>
+#include<stdexcept>
+
+namespace time_grid {
+
+	using mc_types::TimePointsType;
+	using mc_types::PathValuesType;
+
+
+	// Immutable simulation time grid with per-step tables, built once per
+	// engine and shared read-only by all path workers:
+	// time(i)   time of grid point i, i in [0,size())
+	// dt(i)     length of step i ending at point i, i in [1,size())
+	// sqrtDt(i) square root of dt(i)
+	// Observation points are the points a path is reported at (all points unless
+	// the grid was refined between them); coarseIndex(i) is the observation at or
+	// before fine point i and observationIndex(k) the fine point of observation k.
+	template<typename T>
+	class TimeGrid {
+	private:
+		TimePointsType<T> times_;
+		std::vector<T> dt_;
+		std::vector<T> sqrtDt_;
+		std::vector<std::uint8_t> observed_;
+		std::vector<std::size_t> observations_;
+		std::vector<std::size_t> coarseIndex_;
+		bool uniform_{ false };
+		T delta_{};
+
+		TimeGrid() = default;
+
+		void build() {
+			if (times_.size() < 2)
+				throw std::invalid_argument("Time grid needs at least two points.");
+			dt_.assign(times_.size(), T{});
+			sqrtDt_.assign(times_.size(), T{});
+			for (std::size_t i = 1; i < times_.size(); ++i) {
+				if (!(times_[i] > times_[i - 1]))
+					throw std::invalid_argument("Time grid points must be strictly increasing.");
+				// uniform steps are kept exactly delta, as the schemes always took them
+				dt_[i] = (uniform_ ? delta_ : times_[i] - times_[i - 1]);
+				sqrtDt_[i] = std::sqrt(dt_[i]);
+			}
+			if (observed_.empty())
+				observed_.assign(times_.size(), 1);
+			observations_.clear();
+			coarseIndex_.assign(times_.size(), 0);
+			for (std::size_t i = 0; i < times_.size(); ++i) {
+				if (observed_[i])
+					observations_.emplace_back(i);
+				coarseIndex_[i] = observations_.size() - 1;
+			}
+		}
+
+	public:
+		// numberSteps steps of terminationTime/numberSteps from 0 to terminationTime
+		static std::shared_ptr<TimeGrid const> uniform(T terminationTime, std::size_t numberSteps) {
+			if (numberSteps == 0)
+				throw std::invalid_argument("Time grid needs at least one step.");
+			std::shared_ptr<TimeGrid> grid{ new TimeGrid{} };
+			grid->uniform_ = true;
+			grid->delta_ = terminationTime / static_cast<T>(numberSteps);
+			grid->times_.resize(numberSteps + 1);
+			for (std::size_t i = 0; i <= numberSteps; ++i)
+				grid->times_[i] = grid->delta_ * static_cast<T>(i);
+			grid->build();
+			return grid;
+		}
+
+		// Given increasing points, all of them observed
+		static std::shared_ptr<TimeGrid const> fromPoints(TimePointsType<T> const &points) {
+			std::shared_ptr<TimeGrid> grid{ new TimeGrid{} };
+			grid->times_ = points;
+			grid->build();
+			return grid;
+		}
+
+		// Given observation points with every step split into equal substeps no
+		// longer than maxStep; only the original points are observed
+		static std::shared_ptr<TimeGrid const> refined(TimePointsType<T> const &observations, T maxStep) {
+			if (!(maxStep > T{}))
+				throw std::invalid_argument("Time grid refinement needs a positive maximal step.");
+			if (observations.size() < 2)
+				throw std::invalid_argument("Time grid needs at least two points.");
+			std::shared_ptr<TimeGrid> grid{ new TimeGrid{} };
+			grid->times_.emplace_back(observations.front());
+			grid->observed_.emplace_back(1);
+			for (std::size_t k = 1; k < observations.size(); ++k) {
+				T const length = observations[k] - observations[k - 1];
+				auto const substeps = std::max<std::size_t>(1,
+					static_cast<std::size_t>(std::ceil(static_cast<double>(length / maxStep))));
+				for (std::size_t j = 1; j < substeps; ++j) {
+					grid->times_.emplace_back(observations[k - 1] + length * static_cast<T>(j) / static_cast<T>(substeps));
+					grid->observed_.emplace_back(0);
+				}
+				grid->times_.emplace_back(observations[k]);
+				grid->observed_.emplace_back(1);
+			}
+			grid->build();
+			return grid;
+		}
+
+		inline std::size_t size()const { return times_.size(); }
+		inline std::size_t steps()const { return (times_.size() - 1); }
+		inline T time(std::size_t i)const { return times_[i]; }
+		inline T dt(std::size_t i)const { return dt_[i]; }
+		inline T sqrtDt(std::size_t i)const { return sqrtDt_[i]; }
+		inline T terminationTime()const { return times_.back(); }
+		inline TimePointsType<T> const &times()const { return times_; }
+
+		// equal steps of delta() (dt(i) == delta() for all steps)
+		inline bool isUniform()const { return uniform_; }
+		inline T delta()const { return delta_; }
+
+		inline bool isObservation(std::size_t i)const { return (observed_[i] != 0); }
+		inline std::size_t observationCount()const { return observations_.size(); }
+		inline std::size_t observationIndex(std::size_t k)const { return observations_[k]; }
+		inline std::size_t coarseIndex(std::size_t i)const { return coarseIndex_[i]; }
+		inline bool isRefined()const { return (observations_.size() != times_.size()); }
+
+		TimePointsType<T> observationTimes()const {
+			TimePointsType<T> result;
+			result.reserve(observations_.size());
+			for (auto const i : observations_)
+				result.emplace_back(times_[i]);
+			return result;
+		}
+
+		// Values of a path on this grid at the observation points
+		template<typename Path>
+		PathValuesType<T> observe(Path const &path)const {
+			PathValuesType<T> result;
+			result.reserve(observations_.size());
+			for (auto const i : observations_)
+				result.emplace_back(path[i]);
+			return result;
+		}
+	};
+
+}
+
+
+
+#endif ///_TIME_GRID_H_